@@ -50,6 +50,8 @@ option(LIMA_ENABLE_TESTS "compile test directories ?" OFF)
 # Compile with trace (debug information)
 #--------------------------------------------------------------------------------
 option(LIMA_ENABLE_DEBUG "compile with trace ?" ON)
+set(LIMA_DEBUG_MAX_TYPE "Return" CACHE STRING
+    "highest trace type compiled in (Warning, Trace, Funct, Param or Return)")
 
 #--------------------------------------------------------------------------------
 # libconfig
@@ -100,6 +102,15 @@ else()
     option(LIMA_ENABLE_EDFGZ "compile EDF.GZ saving code?" OFF)
 endif()
 
+if(UNIX)
+  # Asynchronous (io_uring) file writes for the RAW/EDF saving
+  if(DEFINED ENV{LIMA_ENABLE_IO_URING})
+    set(LIMA_ENABLE_IO_URING "$ENV{LIMA_ENABLE_IO_URING}" CACHE BOOL "compile io_uring saving backend?" FORCE)
+  else()
+    option(LIMA_ENABLE_IO_URING "compile io_uring saving backend?" OFF)
+  endif()
+endif()
+
 if(DEFINED ENV{LIMA_ENABLE_HDF5})
     set(LIMA_ENABLE_HDF5 "$ENV{LIMA_ENABLE_HDF5}" CACHE BOOL "compile HDF5 saving code?" FORCE)
 else()
@@ -55,6 +55,19 @@ if(LIMA_ENABLE_CBF)
     list(APPEND saving_definitions -DWITH_CBF_SAVING)
     list(APPEND saving_definitions -DPROTOTYPES)
     list(APPEND control_srcs control/src/CtSaving_Cbf.cpp)
+    # byte-offset kernels, the x86 vector extensions are selected at runtime
+    set(cbf_kernel_srcs control/src/CtSaving_Cbf_Kernels.cpp)
+    if(NOT MSVC AND CMAKE_SYSTEM_PROCESSOR MATCHES "^(x86_64|AMD64|amd64)$")
+      list(APPEND cbf_kernel_srcs control/src/CtSaving_Cbf_Kernels_avx2.cpp)
+      set_source_files_properties(${cbf_kernel_srcs}
+        PROPERTIES COMPILE_DEFINITIONS LIMA_CBF_X86_KERNELS)
+      set_source_files_properties(control/src/CtSaving_Cbf_Kernels_avx2.cpp
+        PROPERTIES COMPILE_OPTIONS "-mavx2")
+    endif()
+    if(NOT MSVC)
+      set_property(SOURCE ${cbf_kernel_srcs} APPEND PROPERTY COMPILE_OPTIONS "-O3")
+    endif()
+    list(APPEND control_srcs ${cbf_kernel_srcs})
     list(APPEND saving_libs ${CBF_LIBRARIES} crypto)
     list(APPEND saving_includes ${CBF_INCLUDE_DIRS})
   else()
@@ -0,0 +1,7 @@
+find_library(LIBURING_LIBRARIES NAMES uring liburing)
+find_path(LIBURING_INCLUDE_DIRS liburing.h)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(LibUring DEFAULT_MSG LIBURING_LIBRARIES LIBURING_INCLUDE_DIRS)
+
+mark_as_advanced(LIBURING_INCLUDE_DIRS LIBURING_LIBRARIES)
@@ -57,6 +57,8 @@ class LIMACORE_API BufferHelper
 		DurationPolicy durationPolicy;
 		PersistentSizePolicy sizePolicy;
 		double reqMemSizePercent;
+		// SoftBufferAllocMgr: all the buffers in a single allocation
+		bool slabAlloc;
 
 		Parameters();
 
@@ -94,7 +96,8 @@ bool operator ==(const BufferHelper::Parameters& lhs,
 		(lhs.initMem == rhs.initMem) &&
 		(lhs.durationPolicy == rhs.durationPolicy) &&
 		(lhs.sizePolicy == rhs.sizePolicy) &&
-		(lhs.reqMemSizePercent == rhs.reqMemSizePercent));
+		(lhs.reqMemSizePercent == rhs.reqMemSizePercent) &&
+		(lhs.slabAlloc == rhs.slabAlloc));
 }
 
 inline
@@ -228,8 +231,11 @@ std::ostream& operator<<(std::ostream& os,
 	   << "durationPolicy=" << duration_pol << ", "
 	   << "sizePolicy=" << size_pol << ", "
 	   << "initMem=" << params.initMem << ", "
-	   << "reqMemSizePercent=" << params.reqMemSizePercent
-	   << ">";
+	   << "reqMemSizePercent=" << params.reqMemSizePercent << ", "
+	   << "slabAlloc=" << params.slabAlloc;
+	if (params.allocator)
+		os << ", allocator=" << params.allocator->toString();
+	os << ">";
 	return os;
 }
 
@@ -29,6 +29,7 @@
 #include "lima/StreamUtils.h"
 #include "lima/ThreadUtils.h"
 
+#include <atomic>
 #include <string>
 #include <map>
 #ifndef __unix
@@ -80,6 +81,39 @@ enum DebModule {
 
 typedef const char *ConstStr;
 
+/*------------------------------------------------------------------
+ *  compile-time trace selection
+ *
+ *  LIMA_DEBUG_MAX_TYPE is the highest trace type compiled in
+ *  (DebTypeWarning drops Trace/Funct/Param/Return), LIMA_DEBUG_MODULES
+ *  the mask of modules whose traces are compiled in. Fatal, Error,
+ *  Warning and Always messages are always compiled.
+ *------------------------------------------------------------------*/
+
+#ifndef LIMA_DEBUG_MAX_TYPE
+#define LIMA_DEBUG_MAX_TYPE	lima::DebTypeReturn
+#endif
+
+#ifndef LIMA_DEBUG_MODULES
+#define LIMA_DEBUG_MODULES	0xffffffff
+#endif
+
+namespace detail {
+
+enum {
+	DebTraceTypes = (DebTypeTrace | DebTypeFunct | DebTypeParam |
+			 DebTypeReturn),
+};
+
+inline constexpr bool debCompiled(DebModule mod, DebType type)
+{
+	return !(type & DebTraceTypes) ||
+		((type <= (LIMA_DEBUG_MAX_TYPE)) &&
+		 ((LIMA_DEBUG_MODULES) & mod));
+}
+
+} // namespace detail
+
 /*------------------------------------------------------------------
  *  class DebStream
  *------------------------------------------------------------------*/
@@ -195,12 +229,17 @@ class LIMACORE_API DebParams
 
 	static void checkInit();
 
+	// fast path: one relaxed load, false if the trace type is
+	// disabled or if all the modules are disabled
+	static bool checkTraceType(DebType type);
+
 private:
 	template <bool active>
 	friend class TDebProxy;
 	friend class DebObj;
 
 	static void doInit();
+	static void updateTraceTypes();
 
 	template <class T>
 	static void setFlagsNameList(Flags& flags, 
@@ -214,6 +253,7 @@ private:
 	static Flags s_type_flags;
 	static Flags s_fmt_flags;
 	static Flags s_mod_flags;
+	static std::atomic<int> s_trace_types;
 
 	static DebStream *s_deb_stream;
 
@@ -277,7 +317,8 @@ class LIMACORE_API DebObj
 
 	DebObj(DebParams& deb_params, bool destructor = false,
 	       ConstStr funct_name = NULL, ConstStr obj_name = NULL, 
-	       ConstStr file_name = NULL, int line_nr = 0);
+	       ConstStr file_name = NULL, int line_nr = 0,
+	       bool funct_compiled = true);
 	~DebObj();
 
 	bool checkOut(DebType type);
@@ -311,6 +352,22 @@ class LIMACORE_API DebObj
 	ConstStr m_obj_name;
 	ConstStr m_file_name;
 	int m_line_nr;
+	bool m_funct_traced;
+};
+
+/*------------------------------------------------------------------
+ *  class DebVoidify
+ *
+ *  turns "deb_proxy << a << b" into a void expression, so that the
+ *  trace macros can skip the stream arguments with the ?: operator
+ *------------------------------------------------------------------*/
+
+class DebVoidify
+{
+ public:
+	template <bool active>
+	void operator &(const TDebProxy<active>&) const
+	{}
 };
 
 
@@ -400,6 +457,11 @@ inline bool DebParams::checkType(DebType type) const
 	return DebHasFlag(s_type_flags, type); 
 }
 
+inline bool DebParams::checkTraceType(DebType type)
+{
+	return DebHasFlag(s_trace_types.load(std::memory_order_relaxed), type);
+}
+
 /*------------------------------------------------------------------
  *  class TDebProxy inline functions
  *------------------------------------------------------------------*/
@@ -456,17 +518,24 @@ inline TDebProxy<false>::~TDebProxy()
 
 inline DebObj::DebObj(DebParams& deb_params, bool destructor, 
 		      ConstStr funct_name, ConstStr obj_name, 
-		      ConstStr file_name, int line_nr)
+		      ConstStr file_name, int line_nr, bool funct_compiled)
 	: m_deb_params(&deb_params), m_destructor(destructor), 
 	  m_funct_name(funct_name), m_obj_name(obj_name), 
-	  m_file_name(file_name), m_line_nr(line_nr)
+	  m_file_name(file_name), m_line_nr(line_nr),
+	  m_funct_traced(funct_compiled && 
+			 DebParams::checkTraceType(DebTypeFunct) &&
+			 deb_params.checkModule())
 {
+	if (!m_funct_traced)
+		return;
 	getThreadData()->indent++;
 	write(DebTypeFunct, m_file_name, m_line_nr) << "Enter";
 }
 
 inline DebObj::~DebObj()
 {
+	if (!m_funct_traced)
+		return;
 	write(DebTypeFunct, m_file_name, m_line_nr) << "Exit";
 	getThreadData()->indent--;
 }
@@ -523,11 +592,15 @@ inline constexpr size_t file_name_offset()
  *------------------------------------------------------------------*/
 
 #define DEB_GLOBAL_NAMESPC(mod, name_space)				\
+	inline constexpr lima::DebModule getDebModule()			\
+	{								\
+		return lima::mod;					\
+	}								\
+									\
 	inline lima::DebParams& getDebParams()				\
 	{								\
-		static lima::DebParams *deb_params = NULL;		\
-		EXEC_ONCE(deb_params = new lima::DebParams(lima::mod, NULL,\
-							   name_space)); \
+		static lima::DebParams *deb_params =			\
+			new lima::DebParams(lima::mod, NULL, name_space); \
 		return *deb_params;					\
 	}
 
@@ -535,12 +608,16 @@ inline constexpr size_t file_name_offset()
 	DEB_GLOBAL_NAMESPC(mod, NULL)
 
 #define DEB_STRUCT_NAMESPC(mod, struct_name, name_space)		\
+	static constexpr lima::DebModule getDebModule()			\
+	{								\
+		return lima::mod;					\
+	}								\
+									\
 	static lima::DebParams& getDebParams()				\
 	{								\
-		static lima::DebParams *deb_params = NULL;		\
-		EXEC_ONCE(deb_params = new lima::DebParams(lima::mod,	\
-							   struct_name, \
-							   name_space)); \
+		static lima::DebParams *deb_params =			\
+			new lima::DebParams(lima::mod, struct_name,	\
+					    name_space);		\
 		return *deb_params;					\
 	}								\
 									\
@@ -567,20 +644,26 @@ inline constexpr size_t file_name_offset()
 
 #ifndef LIMA_NO_DEBUG
 
+#define DEB_FUNCT_COMPILED()						\
+	lima::detail::debCompiled(getDebModule(), lima::DebTypeFunct)
+
 #define DEB_GLOBAL_FUNCT()						\
 	lima::DebObj deb(getDebParams(), false, __FUNCTION__,		\
-		   NULL, &__FILE__[::lima::detail::file_name_offset()], __LINE__)
+		   NULL, &__FILE__[::lima::detail::file_name_offset()], __LINE__, \
+		   DEB_FUNCT_COMPILED())
 
 #define DEB_CONSTRUCTOR()						\
 	DEB_MEMBER_FUNCT()
 
 #define DEB_DESTRUCTOR()						\
 	lima::DebObj deb(getDebParams(), true, __FUNCTION__,		\
-		   getDebObjName(), &__FILE__[::lima::detail::file_name_offset()], __LINE__)
+		   getDebObjName(), &__FILE__[::lima::detail::file_name_offset()], __LINE__, \
+		   DEB_FUNCT_COMPILED())
 
 #define DEB_MEMBER_FUNCT()						\
 	lima::DebObj deb(getDebParams(), false, __FUNCTION__,		\
-		   getDebObjName(), &__FILE__[::lima::detail::file_name_offset()], __LINE__)
+		   getDebObjName(), &__FILE__[::lima::detail::file_name_offset()], __LINE__, \
+		   DEB_FUNCT_COMPILED())
 
 #define DEB_PTR()							\
 	(&deb)
@@ -600,11 +683,18 @@ inline constexpr size_t file_name_offset()
 #define DEB_FATAL()		DEB_MSG(lima::DebTypeFatal)
 #define DEB_ERROR()		DEB_MSG(lima::DebTypeError)
 #define DEB_WARNING()		DEB_MSG(lima::DebTypeWarning)
-#define DEB_TRACE()		DEB_MSG(lima::DebTypeTrace)
-#define DEB_PARAM()		DEB_MSG(lima::DebTypeParam)
-#define DEB_RETURN()		DEB_MSG(lima::DebTypeReturn)
+#define DEB_TRACE()		DEB_TRACE_MSG(lima::DebTypeTrace)
+#define DEB_PARAM()		DEB_TRACE_MSG(lima::DebTypeParam)
+#define DEB_RETURN()		DEB_TRACE_MSG(lima::DebTypeReturn)
 #define DEB_ALWAYS()		DEB_MSG(lima::DebTypeAlways)
 
+// the stream arguments are not evaluated if the type is not compiled in
+// or disabled: DEB_TRACE() << x must be used as a statement
+#define DEB_TRACE_MSG(type)						\
+	!(lima::detail::debCompiled(getDebModule(), type) &&		\
+	  lima::DebParams::checkTraceType(type) && deb.checkAny(type)) ? \
+		(void) 0 : lima::DebVoidify() & DEB_MSG(type)
+
 #define DEB_OBJ_NAME(o)							\
 	((o)->getDebObjName())
 
@@ -627,7 +717,7 @@ inline constexpr size_t file_name_offset()
 #define DEB_MSG(type)						\
 	DebProxy(NULL, type, __FUNCTION__, __FILE__, __LINE__)
 #define DEB_NO_MSG()							\
-	DebSink()
+	true ? (void) 0 : lima::DebVoidify() & lima::DebSink()
 
 #define DEB_FATAL()		DEB_MSG(lima::DebTypeFatal)
 #define DEB_ERROR()		DEB_MSG(lima::DebTypeError)
@@ -50,6 +50,10 @@ int LIMACORE_API GetDefMaxNbBuffers(const FrameDim& frame_dim);
 
 void LIMACORE_API ClearBuffer(void *ptr, int nb_concat_frames, const FrameDim& frame_dim);
 
+// Zero a large memory area with nb_threads threads (0: one per CPU, up to 16),
+// which also spreads its first-touch page faults
+void LIMACORE_API ParallelClearBuffer(void *ptr, size_t size, int nb_threads = 0);
+
 
 //--------------------------------------------------------------------
 //  Allocator
@@ -203,6 +207,7 @@ public:
 
 	// Returns the size of a page aligned buffer (multiple of page size)
 	static int getPageAlignedSize(int size);
+	static size_t getPageAlignedSize(size_t size);
 
 	// string representation for serialization
 	std::string toString() const override;
@@ -213,6 +218,61 @@ protected:
 	void *allocMmap(size_t& size);
 };
 
+
+//--------------------------------------------------------------------
+//  HugePageAllocator
+//--------------------------------------------------------------------
+
+// Allocator mapping the buffers on huge pages, which avoids most of the
+// page faults and TLB misses on large frame buffers. Explicit hugetlbfs
+// pages (2M or 1G, reserved in /proc/sys/vm/nr_hugepages or
+// /sys/kernel/mm/hugepages) are used if available, otherwise the buffer
+// is 2M-aligned and advised for transparent huge pages.
+// Optionally the pages are pre-faulted (MAP_POPULATE) and locked in RAM.
+class LIMACORE_API HugePageAllocator : public MMapAllocator
+{
+	DEB_CLASS_NAMESPC(DebModCommon, "HugePageAllocator", "MemUtils");
+
+public:
+	enum PageSize {
+		THP = 0,		// transparent huge pages only
+		Huge2M = 2 << 20,
+		Huge1G = 1 << 30,
+	};
+
+	HugePageAllocator(PageSize page_size = Huge2M, bool populate = false,
+			  bool lock = false)
+		: m_page_size(page_size), m_populate(populate), m_lock(lock)
+	{}
+
+	PageSize getPageSize() const { return m_page_size; }
+	bool getPopulate() const { return m_populate; }
+	bool getLock() const { return m_lock; }
+
+	// Allocate a buffer of a given size, rounded to the huge page size
+	virtual DataPtr alloc(void* &ptr, size_t& size, size_t alignment = 16)
+								override;
+
+	// Free a buffer
+	virtual void release(void* ptr, size_t size, DataPtr alloc_data)
+								override;
+
+	// string representation for serialization
+	std::string toString() const override;
+
+	static const char *getPageSizeName(PageSize page_size);
+
+private:
+	struct MapData;
+
+	void *mapHugeTLB(size_t& size);
+	void *mapTHP(size_t& size);
+
+	PageSize m_page_size;
+	bool m_populate;
+	bool m_lock;
+};
+
 #endif //__unix
 
 
@@ -0,0 +1,216 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2019
+// European Synchrotron Radiation Facility
+// CS40220 38043 Grenoble Cedex 9 
+// FRANCE
+//
+// Contact: lima@esrf.fr
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef OBJECTPOOL_H
+#define OBJECTPOOL_H
+
+#include "lima/LimaCompatibility.h"
+#include "lima/ThreadUtils.h"
+
+#include <atomic>
+#include <vector>
+#include <ostream>
+#include <new>
+
+namespace lima
+{
+
+//--------------------------------------------------------------------
+//  ObjectPoolStats
+//--------------------------------------------------------------------
+
+struct LIMACORE_API ObjectPoolStats
+{
+	long hits;	//!< Allocations served from the pool
+	long misses;	//!< Allocations falling back on the heap
+	long cached;	//!< Blocks currently waiting in the pool
+
+	ObjectPoolStats() : hits(0), misses(0), cached(0)
+	{}
+
+	ObjectPoolStats& operator +=(const ObjectPoolStats& o)
+	{
+		hits += o.hits;
+		misses += o.misses;
+		cached += o.cached;
+		return *this;
+	}
+};
+
+inline std::ostream& operator <<(std::ostream& os, const ObjectPoolStats& s)
+{
+	return os << "<"
+		  << "hits=" << s.hits << ", "
+		  << "misses=" << s.misses << ", "
+		  << "cached=" << s.cached
+		  << ">";
+}
+
+//--------------------------------------------------------------------
+//  ObjectPool
+//--------------------------------------------------------------------
+
+/// Recycles the memory blocks of short-lived per-frame objects.
+///
+/// One pool exists per Tag type. Released blocks are kept (up to the
+/// reserved number) and given back on the next allocation of the same
+/// size, so a steady-state acquisition does not call malloc/free.
+/// The first block size requested defines the pool block size, other
+/// sizes are always served by the heap.
+///
+/// The pool is typically used through class-specific operator new/delete
+/// or through ObjectPoolAllocator (std::allocate_shared).
+template <class Tag>
+class ObjectPool
+{
+public:
+	/// The pool is never destroyed: objects released at exit
+	/// must still find it
+	static ObjectPool& get()
+	{
+		static ObjectPool *pool = new ObjectPool();
+		return *pool;
+	}
+
+	void *alloc(size_t size)
+	{
+		{
+			AutoMutex l(m_mutex);
+			if ((size == m_block_size) && !m_free.empty()) {
+				void *ptr = m_free.back();
+				m_free.pop_back();
+				++m_hits;
+				return ptr;
+			} else if (m_block_size == 0) {
+				m_block_size = size;
+			}
+		}
+		++m_misses;
+		return ::operator new(size);
+	}
+
+	void release(void *ptr, size_t size)
+	{
+		if (!ptr)
+			return;
+		{
+			AutoMutex l(m_mutex);
+			// m_free capacity is reserved: no allocation here
+			if ((size == m_block_size) &&
+			    (m_free.size() < m_free.capacity())) {
+				m_free.push_back(ptr);
+				return;
+			}
+		}
+		::operator delete(ptr);
+	}
+
+	/// Set the maximum number of cached blocks, never shrinks
+	void reserve(int nb_objects)
+	{
+		AutoMutex l(m_mutex);
+		if (size_t(nb_objects) > m_free.capacity())
+			m_free.reserve(nb_objects);
+	}
+
+	/// Release all the cached blocks to the heap
+	void clear()
+	{
+		std::vector<void *> free_list;
+		{
+			AutoMutex l(m_mutex);
+			free_list.reserve(m_free.capacity());
+			free_list.swap(m_free);
+		}
+		for (void *ptr : free_list)
+			::operator delete(ptr);
+	}
+
+	void getStats(ObjectPoolStats& stats) const
+	{
+		stats.hits = m_hits;
+		stats.misses = m_misses;
+		AutoMutex l(m_mutex);
+		stats.cached = m_free.size();
+	}
+
+	void resetStats()
+	{
+		m_hits = m_misses = 0;
+	}
+
+private:
+	ObjectPool() : m_block_size(0), m_hits(0), m_misses(0)
+	{}
+
+	mutable Mutex m_mutex;
+	size_t m_block_size;
+	std::vector<void *> m_free;
+	std::atomic<long> m_hits;
+	std::atomic<long> m_misses;
+};
+
+/// Standard allocator drawing single objects from ObjectPool<Tag>,
+/// it can be re-bound (std::allocate_shared) while keeping the Tag
+template <class T, class Tag = T>
+struct ObjectPoolAllocator
+{
+	typedef T value_type;
+
+	template <class U>
+	struct rebind { typedef ObjectPoolAllocator<U, Tag> other; };
+
+	ObjectPoolAllocator() = default;
+	template <class U>
+	ObjectPoolAllocator(const ObjectPoolAllocator<U, Tag>&)
+	{}
+
+	T *allocate(size_t n)
+	{
+		if (n != 1)
+			return static_cast<T *>(::operator new(n * sizeof(T)));
+		return static_cast<T *>(ObjectPool<Tag>::get().alloc(sizeof(T)));
+	}
+
+	void deallocate(T *ptr, size_t n)
+	{
+		if (n != 1)
+			::operator delete(ptr);
+		else
+			ObjectPool<Tag>::get().release(ptr, sizeof(T));
+	}
+};
+
+template <class T, class U, class Tag>
+inline bool operator ==(const ObjectPoolAllocator<T, Tag>&,
+			const ObjectPoolAllocator<U, Tag>&)
+{ return true; }
+
+template <class T, class U, class Tag>
+inline bool operator !=(const ObjectPoolAllocator<T, Tag>&,
+			const ObjectPoolAllocator<U, Tag>&)
+{ return false; }
+
+} // namespace lima
+
+#endif // OBJECTPOOL_H
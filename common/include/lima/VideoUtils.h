@@ -6,6 +6,7 @@
 
 #include "lima/Constants.h"
 #include "lima/Exceptions.h"
+#include "lima/SizeUtils.h"
 
 #include "processlib/Data.h"
 
@@ -19,7 +20,8 @@ namespace lima
       width(-1),
       inused(0),
       mode(Y8),
-      buffer(NULL)
+      buffer(NULL),
+      capacity(0)
     {}
     ~VideoImage()
     {
@@ -32,32 +34,31 @@ namespace lima
     int		inused;
     VideoMode 	mode;
     char*	buffer;
+    int		capacity;	///< allocated size of buffer
 
+    /// the buffer only grows, a smaller image reuses it
     inline void alloc(int size)
     {
-      if(!buffer || double(size) > this->size())
+      if(!buffer || size > capacity)
       {
         char* tmp = (char*)realloc(buffer,size);
         if (tmp == NULL)
           throw LIMA_COM_EXC(Error, "Error in realloc: ")
             << "NULL pointer returned";
         else
+          {
             buffer = tmp;
+            capacity = size;
+          }
       }
     }
     inline void setParams(int fNumber,int w,int h,VideoMode m)
     {
-      double oldSize = size();
       frameNumber = fNumber;
       width = w;
       height = h;
       mode = m;
-      double newSize = height * width * depth();
-     if(!buffer || newSize > oldSize)
-	{
-	  int size = int(newSize + 0.5);
-	  buffer = (char*)realloc(buffer,size);
-	}
+      alloc(int(height * width * depth() + 0.5));
     }
     inline double size() const {return buffer ? height * width * depth() : 0;}
     static inline double mode_depth(VideoMode m)
@@ -103,8 +104,24 @@ namespace lima
   };
 
   void data2Image(Data &aData,VideoImage &anImage);
+  /** @brief binning, roi and copy into the image in a single pass.
+   *  The roi is in binned coordinates, binned pixels are summed and
+   *  saturate at the pixel type limits. The image buffer only grows.
+   */
+  void data2Image(Data &aData,VideoImage &anImage,
+		  const Bin &aBin,const Roi &aRoi);
+  /** @brief luma of a colour image (Y8, Y16 for the 16-bit Bayer modes).
+   *  The rows are split in nb_threads bands on large images, run with
+   *  the help of the processing pool threads.
+   */
   void image2YUV(const unsigned char *srcPt,int width,int height,VideoMode mode,
-		 unsigned char *dst);
+		 unsigned char *dst,int nb_threads = 1);
+  /** @brief bilinear demosaic of a Bayer image into interleaved R,G,B of
+   *  the source pixel type (RGB24 for 8-bit, 3 x 16-bit for 16-bit modes).
+   *  The first and last rows and columns are black.
+   */
+  void bayer2RGB(const unsigned char *srcPt,int width,int height,VideoMode mode,
+		 unsigned char *dst,int nb_threads = 1);
 
   inline std::ostream& operator<<(std::ostream &os,
 				  const VideoImage &anImage)
@@ -31,7 +31,8 @@ BufferHelper::Parameters::Parameters()
 	: initMem(false),
 	  durationPolicy(Ephemeral),
 	  sizePolicy(Automatic),
-	  reqMemSizePercent(0.0)
+	  reqMemSizePercent(0.0),
+	  slabAlloc(false)
 {
 	DEB_CONSTRUCTOR();
 }
@@ -108,6 +109,18 @@ std::istream& lima::operator>>(std::istream& is,
 			s.erase(0, 1);
 			stage = Value;
 		} else if (stage == Value) {
+			if (name == "allocator") {
+				// the allocator params are also comma-separated
+				size_t pos = s.find(')');
+				if (pos == std::string::npos)
+					throw LIMA_COM_EXC(InvalidValue, "Invalid BufferHelper allocator");
+				std::string alloc_str = s.substr(0, pos + 1);
+				s.erase(0, pos + 1);
+				AllocatorFactory& factory = AllocatorFactory::get();
+				params.allocator = factory.fromString(alloc_str);
+				stage = Sep;
+				continue;
+			}
 			long pos = s.find(',');
 			std::istringstream val(s.substr(0, pos));
 			s.erase(0, pos);
@@ -119,6 +132,8 @@ std::istream& lima::operator>>(std::istream& is,
 				val >> params.sizePolicy;
 			else if (name == "reqMemSizePercent")
 				val >> params.reqMemSizePercent;
+			else if (name == "slabAlloc")
+				val >> params.slabAlloc;
 			else
 				throw LIMA_COM_EXC(InvalidValue, "Invalid BufferHelper params");
 			stage = Sep;
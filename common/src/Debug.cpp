@@ -122,6 +122,7 @@ const DebParams::Flags DebParams::AllFlags = 0xffffffff;
 DebParams::Flags DebParams::s_type_flags;
 DebParams::Flags DebParams::s_fmt_flags;
 DebParams::Flags DebParams::s_mod_flags;
+atomic<int> DebParams::s_trace_types(0);
 
 DebStream *DebParams::s_deb_stream = NULL;
 
@@ -136,12 +137,20 @@ void DebParams::checkInit()
 	EXEC_ONCE(doInit());
 }
 
+void DebParams::updateTraceTypes()
+{
+	int trace_types = int(s_type_flags & detail::DebTraceTypes);
+	s_trace_types.store(s_mod_flags ? trace_types : 0,
+			    memory_order_relaxed);
+}
+
 
 void DebParams::setTypeFlags(Flags type_flags)
 { 
 	checkInit();
 	checkTypeFlags(type_flags);
-	s_type_flags = type_flags; 
+	s_type_flags = type_flags;
+	updateTraceTypes();
 }
 
 DebParams::Flags DebParams::getTypeFlags()
@@ -155,12 +164,14 @@ void DebParams::enableTypeFlags(Flags type_flags)
 	checkInit();
 	checkTypeFlags(type_flags);
 	s_type_flags |= type_flags;
+	updateTraceTypes();
 }
 
 void DebParams::disableTypeFlags(Flags type_flags)
 {
 	checkInit();
 	s_type_flags &= ~type_flags;
+	updateTraceTypes();
 }
 
 void DebParams::setFormatFlags(Flags fmt_flags)
@@ -190,7 +201,8 @@ void DebParams::disableFormatFlags(Flags fmt_flags)
 void DebParams::setModuleFlags(Flags mod_flags)
 {
 	checkInit();
-	s_mod_flags = mod_flags; 
+	s_mod_flags = mod_flags;
+	updateTraceTypes();
 }
 
 DebParams::Flags DebParams::getModuleFlags()
@@ -203,12 +215,14 @@ void DebParams::enableModuleFlags(Flags mod_flags)
 {
 	checkInit();
 	s_mod_flags |= mod_flags;
+	updateTraceTypes();
 }
 
 void DebParams::disableModuleFlags(Flags mod_flags)
 {
 	checkInit();
 	s_mod_flags &= ~mod_flags;
+	updateTraceTypes();
 }
 
 template <class T>
@@ -253,6 +267,7 @@ void DebParams::setTypeFlagsNameList(const NameList& type_name_list)
 	setFlagsNameList(type_flags, *s_type_name_map, type_name_list);
 	checkTypeFlags(type_flags);
 	s_type_flags = type_flags;
+	updateTraceTypes();
 }
 
 DebParams::NameList DebParams::getTypeFlagsNameList()
@@ -281,6 +296,7 @@ void DebParams::setModuleFlagsNameList(const NameList& mod_name_list)
 {
 	checkInit();
 	setFlagsNameList(s_mod_flags, *s_mod_name_map, mod_name_list);
+	updateTraceTypes();
 }
 
 DebParams::NameList DebParams::getModuleFlagsNameList()
@@ -338,6 +354,7 @@ void DebParams::doInit()
 	s_fmt_flags = s_mod_flags = AllFlags;
 	s_type_flags  = DebTypeFatal | DebTypeError | DebTypeWarning;
 	s_type_flags |= DebTypeAlways;
+	updateTraceTypes();
 
 	s_deb_stream = new DebStream();
 
@@ -23,10 +23,13 @@
 #include "lima/MemUtils.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <sstream>
 #include <iomanip>
 #include <limits>
+#include <thread>
+#include <vector>
 #ifdef __unix
 #include <sys/sysinfo.h>
 #ifdef LIMA_USE_NUMA
@@ -152,6 +155,35 @@ void lima::ClearBuffer(void *ptr, int nb_concat_frames,
 	memset(ptr, 0, nb_concat_frames * size_t(frame_dim.getMemSize()));
 }
 
+void lima::ParallelClearBuffer(void *ptr, size_t size, int nb_threads)
+{
+	// below this size per thread, the thread start-up dominates
+	const size_t MinThreadSize = 64 << 20;
+	const size_t ChunkAlign = 4096;
+
+	if (nb_threads <= 0)
+		nb_threads = std::min(int(std::thread::hardware_concurrency()),
+				      16);
+	size_t max_threads = std::max<size_t>(size / MinThreadSize, 1);
+	nb_threads = int(std::min<size_t>(std::max(nb_threads, 1),
+					  max_threads));
+
+	char *base = static_cast<char *>(ptr);
+	auto clear = [=](int i) {
+		size_t first = (size * i / nb_threads) & ~(ChunkAlign - 1);
+		size_t end = (i == nb_threads - 1) ? size :
+			(size * (i + 1) / nb_threads) & ~(ChunkAlign - 1);
+		memset(base + first, 0, end - first);
+	};
+
+	std::vector<std::thread> helpers;
+	for (int i = 1; i < nb_threads; ++i)
+		helpers.emplace_back(clear, i);
+	clear(0);
+	for (auto& t : helpers)
+		t.join();
+}
+
 
 //--------------------------------------------------------------------
 //  Allocator
@@ -414,6 +446,16 @@ int MMapAllocator::getPageAlignedSize(int size)
 	return size;
 }
 
+size_t MMapAllocator::getPageAlignedSize(size_t size)
+{
+	int page_size;
+	GetPageSize(page_size);
+	size_t misaligned = size & (page_size - 1);
+	if (misaligned)
+		size += page_size - misaligned;
+	return size;
+}
+
 // Allocate a buffer of a given size 
 Allocator::DataPtr MMapAllocator::alloc(void* &ptr, size_t& size,
 					size_t /*alignment = 16*/)
@@ -434,7 +476,7 @@ void *MMapAllocator::allocMmap(size_t& size)
 	size = getPageAlignedSize(size);
 	void *ptr = (char *) mmap(0, size, PROT_READ | PROT_WRITE,
 				  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-	if (!ptr)
+	if (ptr == MAP_FAILED)
 		throw LIMA_COM_EXC(Error, "Error in mmap: ")
 			<< strerror(errno);
 	return ptr;
@@ -478,6 +520,223 @@ public:
 	}
 } mmap_allocator_factory;
 
+
+//--------------------------------------------------------------------
+//  HugePageAllocator
+//--------------------------------------------------------------------
+
+// The real mapping, needed by release
+struct HugePageAllocator::MapData : Allocator::Data
+{
+	size_t len;
+	bool hugetlb;
+};
+
+template <typename T>
+static T round_up(T x, T align)
+{
+	return (x + align - 1) / align * align;
+}
+
+const char *HugePageAllocator::getPageSizeName(PageSize page_size)
+{
+	switch (page_size) {
+	case THP:	return "THP";
+	case Huge2M:	return "2M";
+	case Huge1G:	return "1G";
+	}
+	return "Unknown";
+}
+
+// Allocate explicit huge pages, NULL if none available
+void *HugePageAllocator::mapHugeTLB(size_t& size)
+{
+	DEB_MEMBER_FUNCT();
+#ifdef MAP_HUGETLB
+	size_t len = round_up<size_t>(size, m_page_size);
+	int page_shift = (m_page_size == Huge1G) ? 30 : 21;
+	int flags = (MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+		     (page_shift << MAP_HUGE_SHIFT));
+	if (m_populate)
+		flags |= MAP_POPULATE;
+	void *ptr = mmap(0, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (ptr == MAP_FAILED) {
+		// not worth a warning for every buffer
+		static std::atomic<bool> warned(false);
+		if (!warned.exchange(true))
+			DEB_WARNING() << "No " << getPageSizeName(m_page_size)
+				      << " hugetlbfs pages available ("
+				      << strerror(errno) << "), "
+				      << "falling back to transparent huge pages";
+		return NULL;
+	}
+	size = len;
+	return ptr;
+#else
+	return NULL;
+#endif
+}
+
+// Allocate 2M-aligned memory advised for transparent huge pages
+void *HugePageAllocator::mapTHP(size_t& size)
+{
+	DEB_MEMBER_FUNCT();
+
+	const size_t thp_size = Huge2M;
+	size_t len = getPageAlignedSize(size);
+	bool align = (len >= thp_size);
+	size_t map_len = align ? (round_up(len, thp_size) + thp_size) : len;
+	char *base = (char *) mmap(0, map_len, PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+		THROW_COM_ERROR(Error) << "Error in mmap: " << strerror(errno);
+
+	char *ptr = base;
+	if (align) {
+		// unmap the misaligned head and the tail
+		len = round_up(len, thp_size);
+		ptr = (char *) round_up<uintptr_t>(uintptr_t(base), thp_size);
+		if (ptr != base)
+			munmap(base, ptr - base);
+		char *end = ptr + len;
+		size_t tail = base + map_len - end;
+		if (tail)
+			munmap(end, tail);
+	}
+#ifdef MADV_HUGEPAGE
+	if (madvise(ptr, len, MADV_HUGEPAGE) != 0)
+		DEB_TRACE() << "madvise(MADV_HUGEPAGE) failed: "
+			    << strerror(errno);
+#endif
+	if (m_populate) {
+		// touch every base page: where a huge page was granted only
+		// its first write faults, the others hit the mapped huge page,
+		// and the memory is still fully populated if the kernel falls
+		// back to 4K pages. MAP_POPULATE would always use 4K pages
+		int page_size;
+		GetPageSize(page_size);
+		for (size_t offset = 0; offset < len; offset += page_size)
+			ptr[offset] = 0;
+	}
+	size = len;
+	return ptr;
+}
+
+Allocator::DataPtr HugePageAllocator::alloc(void* &ptr, size_t& size,
+					    size_t /*alignment = 16*/)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(size);
+
+	std::shared_ptr<MapData> data = std::make_shared<MapData>();
+	size_t len = size;
+	void *p = (m_page_size != THP) ? mapHugeTLB(len) : NULL;
+	data->hugetlb = (p != NULL);
+	if (!p)
+		p = mapTHP(len);
+	data->len = len;
+
+	if (m_lock && (mlock(p, len) != 0)) {
+		int error = errno;
+		munmap(p, len);
+		THROW_COM_ERROR(Error) << "Error in mlock (check RLIMIT_MEMLOCK): "
+				       << strerror(error);
+	}
+
+	ptr = p;
+	size = len;
+	DEB_RETURN() << DEB_VAR3(ptr, size, data->hugetlb);
+	return data;
+}
+
+void HugePageAllocator::release(void* ptr, size_t size, DataPtr alloc_data)
+{
+	MapData *data = static_cast<MapData *>(alloc_data.get());
+	munmap(ptr, data ? data->len : getPageAlignedSize(size));
+}
+
+std::string HugePageAllocator::toString() const
+{
+	std::ostringstream os;
+	os << "HugePageAllocator(page_size=" << getPageSizeName(m_page_size)
+	   << ",populate=" << m_populate << ",lock=" << m_lock << ")";
+	return os.str();
+}
+
+//--------------------------------------------------------------------
+//  HugePageAllocatorFactory
+//--------------------------------------------------------------------
+
+class HugePageAllocatorFactory
+{
+	struct Impl : AllocatorFactory::Impl
+	{
+		DEB_STRUCT_NAMESPC(DebModCommon,
+				   "HugePageAllocatorFactory::Impl",
+				   "MemUtils");
+
+		typedef HugePageAllocator::PageSize PageSize;
+
+		std::string getName() const override
+		{
+			return "HugePageAllocator";
+		}
+
+		static bool decodeBool(const Param& par)
+		{
+			DEB_STATIC_FUNCT();
+			if ((par.value == "1") || (par.value == "true"))
+				return true;
+			else if ((par.value == "0") || (par.value == "false"))
+				return false;
+			THROW_COM_ERROR(InvalidValue)
+				<< "Invalid HugePageAllocator " << par.key
+				<< ": " << par.value;
+		}
+
+		Allocator::Ref createFromParams(const ParamList& pars) override
+		{
+			DEB_MEMBER_FUNCT();
+
+			PageSize page_size = HugePageAllocator::Huge2M;
+			bool populate = false;
+			bool lock = false;
+			for (auto& par: pars) {
+				if (par.key == "page_size") {
+					if (par.value == "THP")
+						page_size = HugePageAllocator::THP;
+					else if (par.value == "2M")
+						page_size = HugePageAllocator::Huge2M;
+					else if (par.value == "1G")
+						page_size = HugePageAllocator::Huge1G;
+					else
+						THROW_COM_ERROR(InvalidValue)
+							<< "Invalid HugePageAllocator "
+							<< "page_size, must be: "
+							<< "THP, 2M or 1G";
+				} else if (par.key == "populate") {
+					populate = decodeBool(par);
+				} else if (par.key == "lock") {
+					lock = decodeBool(par);
+				} else {
+					THROW_COM_ERROR(InvalidValue)
+						<< "Invalid HugePageAllocator param: "
+						<< par.key;
+				}
+			}
+			return std::make_shared<HugePageAllocator>(page_size,
+								   populate,
+								   lock);
+		}
+	} m_impl;
+
+public:
+	HugePageAllocatorFactory()
+	{
+		AllocatorFactory::get().registerImplementation(&m_impl);
+	}
+} huge_page_allocator_factory;
+
 #endif //__unix
 
 
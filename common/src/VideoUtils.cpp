@@ -1,197 +1,291 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+
 #include "lima/Exceptions.h"
+#include "lima/ThreadUtils.h"
 
 #include "lima/VideoUtils.h"
+#include "VideoUtils_Kernels.h"
+
+#include "processlib/PoolThreadMgr.h"
+#include "processlib/SinkTask.h"
+#include "processlib/TaskMgr.h"
 using namespace lima;
 
-/** func tool to convert from color to Y only (luma) for greyscale image
+// below this number of rows per band, no row splitting
+static const int MIN_ROWS_PER_THREAD = 64;
+
+/** @brief row bands of an image conversion, shared by the caller and
+ *  the helper tasks: each band is taken by the first one to ask
  */
-inline void _rgb555_2_yuv(const unsigned char *data,unsigned char *luma,
-			   int column,int row)
+class _RowBandJob
 {
-  for(int aSize = column * row;aSize;--aSize,data += 2,++luma)
+public:
+  typedef std::function<void(int band)> BandFunc;
+
+  _RowBandJob(const BandFunc& func,int nb_bands) :
+    m_func(func),m_nb_bands(nb_bands),m_next_band(0),m_nb_done(0)
+  {}
+
+  bool processNextBand()
+  {
+    int band = m_next_band++;
+    if(band >= m_nb_bands)
+      return false;
+    m_func(band);
+    AutoMutex aLock(m_cond.mutex());
+    if(++m_nb_done == m_nb_bands)
+      m_cond.broadcast();
+    return true;
+  }
+
+  void waitAllBands()
+  {
+    AutoMutex aLock(m_cond.mutex());
+    while(m_nb_done < m_nb_bands)
+      m_cond.wait();
+  }
+
+private:
+  BandFunc		m_func;
+  int			m_nb_bands;
+  std::atomic<int>	m_next_band;
+  Cond			m_cond;
+  int			m_nb_done;
+};
+
+class _RowBandTask : public SinkTaskBase
+{
+public:
+  _RowBandTask(std::shared_ptr<_RowBandJob> job) : m_job(job) {}
+
+  virtual void process(Data&)
+  {
+    while(m_job->processNextBand())
+      continue;
+  }
+
+private:
+  std::shared_ptr<_RowBandJob> m_job;
+};
+
+/** @brief run the kernel on nb_threads bands of rows, with the help of
+ *  the processing threads
+ */
+static void _convert_rows(VideoKernels::RowFunc func,
+			  const unsigned char *src,unsigned char *dst,
+			  int width,int height,int nb_threads)
+{
+  int nb_bands = std::max(1,std::min(nb_threads,height / MIN_ROWS_PER_THREAD));
+  if(nb_bands == 1)
     {
-      unsigned char red = (data[0] & 0x7c) >> 2;
-      unsigned char green = ((data[0] & 0x03) << 3)  + ((data[1] & 0xe0) >> 5);
-      unsigned char blue = data[1] & 0x1f;
-      *luma = ((66 * red + 129 * green + 25 * blue) + 128) >> 8;
+      func(src,dst,width,height,0,height);
+      return;
     }
-}
 
-inline void _rgb565_2_yuv(const unsigned char *data,unsigned char *luma,
-			   int column,int row)
-{
-  for(int aSize = column * row;aSize;--aSize,data += 2,++luma)
+  auto band_func = [&](int band) {
+    int first_row = long(height) * band / nb_bands;
+    int end_row = long(height) * (band + 1) / nb_bands;
+    func(src,dst,width,height,first_row,end_row);
+  };
+  std::shared_ptr<_RowBandJob> job(new _RowBandJob(band_func,nb_bands));
+  PoolThreadMgr& pool = PoolThreadMgr::get();
+  int nb_helpers = std::min(nb_bands,pool.getNumberOfThread()) - 1;
+  Data no_data;
+  for(int i = 0;i < nb_helpers;++i)
     {
-      unsigned char red = (data[0] & 0xf8) >> 3;
-      unsigned char green = ((data[0] & 0x07) << 3)  + ((data[1] & 0xe0) >> 5);
-      unsigned char blue = data[1] & 0x1f;
-      *luma = ((66 * red + 129 * green + 25 * blue) + 128) >> 8;
+      _RowBandTask *task = new _RowBandTask(job);
+      TaskMgr *mgr = new TaskMgr();
+      mgr->addSinkTask(0,task);
+      task->unref();
+      mgr->setInputData(no_data);
+      pool.addProcess(mgr);
     }
+
+  // the helpers arriving late find nothing left to do
+  while(job->processNextBand())
+    continue;
+  job->waitAllBands();
 }
 
-inline void _rgb_2_yuv(const unsigned char *data,unsigned char *luma,
-			int column,int row,int bandes)
+// the accumulator is wider than the pixels, except for 64 bit
+template<class accClass>
+inline void _bin_add(accClass& sum,accClass v)
 {
-  for(int aSize = column * row;aSize;--aSize,data += bandes,++luma)
-    *luma = ((66 * data[0] + 129 * data[1] + 25 * data[2]) + 128) >> 8;
+  sum += v;
 }
 
-inline void _bgr_2_yuv(const unsigned char *data,unsigned char *luma,
-			int column,int row,int bandes)
+template<>
+inline void _bin_add(unsigned long long& sum,unsigned long long v)
 {
-  for(int aSize = column * row;aSize;--aSize,data += bandes,++luma)
-    *luma = ((25 * data[0] + 129 * data[1] + 66 * data[2]) + 128) >> 8;
+  const unsigned long long max_val =
+    std::numeric_limits<unsigned long long>::max();
+  sum = (v > max_val - sum) ? max_val : sum + v;
 }
 
-template<class xClass>
-inline void _bayer_2_yuv(const xClass* bayer0,xClass* luma,
-			 int column,int row,int blue,int start_with_green)
+template<>
+inline void _bin_add(long long& sum,long long v)
 {
-  int luma_step = column * sizeof(xClass);
-  int bayer_step = column;
-  xClass *luma0 = (xClass*)luma;
-  memset( luma0, 0, luma_step);
-  memset( luma0 + (row - 1)*bayer_step, 0, luma_step);
-  luma0 += column + 1;
-  row -= 2;
-  column -= 2;
+  const long long max_val = std::numeric_limits<long long>::max();
+  const long long min_val = std::numeric_limits<long long>::min();
+  if(v > 0 && sum > max_val - v)
+    sum = max_val;
+  else if(v < 0 && sum < min_val - v)
+    sum = min_val;
+  else
+    sum += v;
+}
 
-  for( ; row > 0;--row,bayer0 += bayer_step, luma0 += bayer_step )
+template<class xClass,class accClass>
+static void _bin_roi_copy(const xClass *src,int src_width,xClass *dst,
+			  int x0,int y0,int width,int height,
+			  int bin_x,int bin_y)
+{
+  if(bin_x == 1 && bin_y == 1)
     {
-      int t0, t1;
-      const xClass* bayer = bayer0;
-      xClass* dst = luma0;
-      const xClass* bayer_end = bayer + column;
-
-      dst[-1] = 0;
-
-      if(column <= 0 )
-	continue;
-
-      if( start_with_green )
-        {
-	  t0 = (bayer[1] + bayer[bayer_step*2+1] + 1) >> 1;
-	  t1 = (bayer[bayer_step] + bayer[bayer_step+2] + 1) >> 1;
-	  if(blue < -1)
-	    *dst = (bayer[bayer_step+1] * 150 + t0 * 29 + t1 * 76) >> 8;
-	  else
-	    *dst = (bayer[bayer_step+1] * 150 + t1 * 29 + t0 * 76) >> 8;
-	  ++bayer;
-	  ++dst;
-        }
-
-      if( blue > 0 )
-        {
-	  for( ; bayer <= bayer_end - 2; bayer += 2)
-            {
-	      t0 = (bayer[0] + bayer[2] + bayer[bayer_step*2] +
-		    bayer[bayer_step*2+2] + 2) >> 2;
-	      t1 = (bayer[1] + bayer[bayer_step] +
-		    bayer[bayer_step+2] + bayer[bayer_step*2+1]+2) >> 2;
-	      *dst = (t0 * 76 + t1 * 150 + bayer[bayer_step+1] * 29) >> 8;
-	      ++dst;
-
-	      t0 = (bayer[2] + bayer[bayer_step*2+2] + 1) >> 1;
-	      t1 = (bayer[bayer_step+1] + bayer[bayer_step+3] + 1) >> 1;
-	      *dst = (t0 * 76 + bayer[bayer_step+2] * 150 + t1 * 29) >> 8;
-	      ++dst;
-            }
-        }
-      else
-        {
-	  for( ; bayer <= bayer_end - 2; bayer += 2)
-            {
-	      t0 = (bayer[0] + bayer[2] + bayer[bayer_step*2] +
-		    bayer[bayer_step*2+2] + 2) >> 2;
-	      t1 = (bayer[1] + bayer[bayer_step] +
-		    bayer[bayer_step+2] + bayer[bayer_step*2+1]+2) >> 2;
-	      *dst = (t0 * 29 + t1 * 150 + bayer[bayer_step+1] * 76) >> 8;
-	      ++dst;
-
-	      t0 = (bayer[2] + bayer[bayer_step*2+2] + 1) >> 1;
-	      t1 = (bayer[bayer_step+1] + bayer[bayer_step+3] + 1) >> 1;
-	      *dst = (t0 * 29 + bayer[bayer_step+2] * 150 + t1 * 76) >> 8;
-	      ++dst;
-            }
-        }
-
-      if( bayer < bayer_end )
-        {
-	  t0 = (bayer[0] + bayer[2] + bayer[bayer_step*2] +
-		bayer[bayer_step*2+2] + 2) >> 2;
-	  t1 = (bayer[1] + bayer[bayer_step] +
-		bayer[bayer_step+2] + bayer[bayer_step*2+1]+2) >> 2;
-	  if(blue > 0)
-	    *dst = (t0 * 76 + t1 * 150 +  bayer[bayer_step+1] * 29) >> 8;
-	  else
-	    *dst = (t0 * 29 + t1 * 150 +  bayer[bayer_step+1] * 76) >> 8;
-	  ++bayer;
-	  ++dst;
-        }
+      for(int y = 0;y < height;++y,dst += width)
+	memcpy(dst,src + long(y0 + y) * src_width + x0,
+	       width * sizeof(xClass));
+      return;
+    }
 
-      blue = -blue;
-      start_with_green = !start_with_green;
+  const accClass max_val = std::numeric_limits<xClass>::max();
+  const accClass min_val = std::numeric_limits<xClass>::min();
+  for(int y = 0;y < height;++y,dst += width)
+    {
+      const xClass *src_row = src + long(y0 + y) * bin_y * src_width +
+			      long(x0) * bin_x;
+      for(int x = 0;x < width;++x,src_row += bin_x)
+	{
+	  accClass sum = 0;
+	  const xClass *s = src_row;
+	  for(int j = 0;j < bin_y;++j,s += src_width)
+	    for(int i = 0;i < bin_x;++i)
+	      _bin_add<accClass>(sum,s[i]);
+	  dst[x] = xClass(std::min(std::max(sum,min_val),max_val));
+	}
     }
 }
 
-template<class xClass>
-inline void _bayer_rg_2_yuv(const xClass* bayer0,xClass* luma,
-			    int column,int row)
+void lima::data2Image(Data &aData,VideoImage &anImage)
 {
-  _bayer_2_yuv<xClass>(bayer0,luma,column,row,1,0);
+  data2Image(aData,anImage,Bin(),Roi());
 }
 
-template<class xClass>
-inline void _bayer_bg_2_yuv(const xClass* bayer0,xClass* luma,
-			    int column,int row)
+void lima::data2Image(Data &aData,VideoImage &anImage,
+		      const Bin &aBin,const Roi &aRoi)
 {
-  _bayer_2_yuv<xClass>(bayer0,luma,column,row,-1,0);
-}
+  if(aData.empty())
+    return;
 
-inline void _yuv422packed_2_yuv(const unsigned char *data,unsigned char *luma,
-			int column,int row)
-{
-  // Format is 4 bytes for 2 pixels U and V common for 2 pixels: |U|Y0|V|Y1|  |U|Y2|V|Y3|
-  // so Y (luma) is every 2 bytes
-  long nbIter = column * row /2;
-  --nbIter;
-  for(; nbIter; --nbIter, data += 4, luma+=2)
+  VideoMode new_mode;
+  switch(aData.type)
+    {
+    case Data::UINT8:
+    case Data::INT8:
+      new_mode = Y8;break;
+    case Data::UINT16:
+    case Data::INT16:
+      new_mode = Y16;break;
+    case Data::UINT32:
+    case Data::INT32:
+      new_mode = Y32;break;
+    case Data::UINT64:
+    case Data::INT64:
+      new_mode = Y64;break;
+    case Data::FLOAT:
+    case Data::DOUBLE:
+    default:
+      throw LIMA_COM_EXC(Error, "Data type is not yet used for VideoImage");
+    }
+
+  int src_width = aData.dimensions[0];
+  int bin_x = aBin.getX(),bin_y = aBin.getY();
+  int x0 = 0,y0 = 0;
+  int width = src_width / bin_x;
+  int height = aData.dimensions[1] / bin_y;
+  if(aRoi.isActive())
+    {
+      const Point& topl = aRoi.getTopLeft();
+      const Size& size = aRoi.getSize();
+      if(topl.x + size.getWidth() > width ||
+	 topl.y + size.getHeight() > height)
+	throw LIMA_COM_EXC(InvalidValue, "Roi is outside the binned image");
+      x0 = topl.x,y0 = topl.y;
+      width = size.getWidth(),height = size.getHeight();
+    }
+
+  int depth = aData.depth();
+  anImage.alloc(width * height * depth);
+  const void *src = aData.data();
+  void *dst = anImage.buffer;
+  switch(depth)
     {
-      luma[0] = data[1];
-      luma[1] = data[3];
+    case 1:
+      if(aData.type == Data::UINT8)
+	_bin_roi_copy<unsigned char,int>((const unsigned char*)src,src_width,
+					 (unsigned char*)dst,x0,y0,
+					 width,height,bin_x,bin_y);
+      else
+	_bin_roi_copy<char,int>((const char*)src,src_width,(char*)dst,
+				x0,y0,width,height,bin_x,bin_y);
+      break;
+    case 2:
+      if(aData.type == Data::UINT16)
+	_bin_roi_copy<unsigned short,int>((const unsigned short*)src,src_width,
+					  (unsigned short*)dst,x0,y0,
+					  width,height,bin_x,bin_y);
+      else
+	_bin_roi_copy<short,int>((const short*)src,src_width,(short*)dst,
+				 x0,y0,width,height,bin_x,bin_y);
+      break;
+    case 4:
+      if(aData.type == Data::UINT32)
+	_bin_roi_copy<unsigned int,long long>((const unsigned int*)src,
+					      src_width,(unsigned int*)dst,
+					      x0,y0,width,height,bin_x,bin_y);
+      else
+	_bin_roi_copy<int,long long>((const int*)src,src_width,(int*)dst,
+				     x0,y0,width,height,bin_x,bin_y);
+      break;
+    default:
+      // no wider accumulator: 64 bit sums saturate in _bin_add
+      if(aData.type == Data::UINT64)
+	_bin_roi_copy<unsigned long long,unsigned long long>(
+			(const unsigned long long*)src,src_width,
+			(unsigned long long*)dst,x0,y0,width,height,bin_x,bin_y);
+      else
+	_bin_roi_copy<long long,long long>((const long long*)src,src_width,
+					   (long long*)dst,x0,y0,
+					   width,height,bin_x,bin_y);
+      break;
     }
+  anImage.mode = new_mode;
+  anImage.width = width;
+  anImage.height = height;
+  anImage.frameNumber = aData.frameNumber;
 }
 
-void lima::data2Image(Data &aData,VideoImage &anImage)
+static VideoKernels::Kernel _get_kernel(VideoMode mode)
 {
-  if(!aData.empty())
+  switch(mode)
     {
-      VideoMode new_mode;
-      switch(aData.type)
-	{
-	case Data::UINT8:
-	case Data::INT8:
-	  new_mode = Y8;break;
-	case Data::UINT16:
-	case Data::INT16:
-	  new_mode = Y16;break;
-	case Data::UINT32:
-	case Data::INT32:
-	  new_mode = Y32;break;
-	case Data::UINT64:
-	case Data::INT64:
-	  new_mode = Y64;break;
-	case Data::FLOAT:
-	case Data::DOUBLE:
-	default:
-	  throw LIMA_COM_EXC(Error, "Data type is not yet used for VideoImage");
-	}
-      anImage.alloc(aData.size());
-      memcpy(anImage.buffer,aData.data(),aData.size());
-      anImage.mode = new_mode;
-      anImage.width = aData.dimensions[0];
-      anImage.height = aData.dimensions[1];
-      anImage.frameNumber = aData.frameNumber;
+    case RGB24:		return VideoKernels::KernelRGB24;
+    case BGR24:		return VideoKernels::KernelBGR24;
+    case RGB32:		return VideoKernels::KernelRGB32;
+    case BGR32:		return VideoKernels::KernelBGR32;
+    case RGB555:	return VideoKernels::KernelRGB555;
+    case RGB565:	return VideoKernels::KernelRGB565;
+    case YUV422PACKED:	return VideoKernels::KernelYUV422Packed;
+    case BAYER_RG8:	return VideoKernels::KernelBayerRG8;
+    case BAYER_BG8:	return VideoKernels::KernelBayerBG8;
+    case BAYER_RG16:	return VideoKernels::KernelBayerRG16;
+    case BAYER_BG16:	return VideoKernels::KernelBayerBG16;
+    default:		return VideoKernels::NbKernels;
     }
 }
 
@@ -199,9 +293,8 @@ void lima::data2Image(Data &aData,VideoImage &anImage)
  * convert the video color image to Y (luma only) greyscale image
  */
 void lima::image2YUV(const unsigned char *srcPt,int width,int height,VideoMode mode,
-		     unsigned char *dst)
+		     unsigned char *dst,int nb_threads)
 {
-
   switch(mode)
     {
     case Y8:
@@ -219,40 +312,37 @@ void lima::image2YUV(const unsigned char *srcPt,int width,int height,VideoMode m
     case YUV444:
       memcpy(dst,srcPt,width * height);
       break;
-    case YUV422PACKED:
-      _yuv422packed_2_yuv(srcPt,dst,width,height);
-      break;
-    case RGB555:
-      _rgb555_2_yuv(srcPt,dst,width,height);
-      break;
-    case RGB565:
-      _rgb565_2_yuv(srcPt,dst,width,height);
-      break;
+    default:
+      {
+	VideoKernels::Kernel kernel = _get_kernel(mode);
+	if(kernel == VideoKernels::NbKernels)
+	  throw LIMA_COM_EXC(Error,"Video mode not yet managed!");
+	VideoKernels::RowFunc func =
+	  VideoKernels::getRowFunc(kernel,VideoKernels::OutputLuma);
+	_convert_rows(func,srcPt,dst,width,height,nb_threads);
+      }
+    }
+}
+
+/*
+ * full colour demosaic of a Bayer image
+ */
+void lima::bayer2RGB(const unsigned char *srcPt,int width,int height,VideoMode mode,
+		     unsigned char *dst,int nb_threads)
+{
+  switch(mode)
+    {
     case BAYER_RG8:
-      _bayer_rg_2_yuv(srcPt,dst,width,height);
-      break;
-    case BAYER_RG16:
-      _bayer_rg_2_yuv((unsigned short*)srcPt,(unsigned short*)dst,width,height);
-      break;
     case BAYER_BG8:
-      _bayer_bg_2_yuv(srcPt,dst,width,height);
-      break;
+    case BAYER_RG16:
     case BAYER_BG16:
-      _bayer_bg_2_yuv((unsigned short*)srcPt,(unsigned short*)dst,width,height);
-      break;
-    case RGB32:
-      _rgb_2_yuv(srcPt,dst,width,height,4);
-      break;
-    case BGR32:
-      _bgr_2_yuv(srcPt,dst,width,height,4);
-      break;
-    case RGB24:
-      _rgb_2_yuv(srcPt,dst,width,height,3);
-      break;
-    case BGR24:
-      _bgr_2_yuv(srcPt,dst,width,height,3);
-      break;
+      {
+	VideoKernels::RowFunc func =
+	  VideoKernels::getRowFunc(_get_kernel(mode),VideoKernels::OutputRGB);
+	_convert_rows(func,srcPt,dst,width,height,nb_threads);
+	break;
+      }
     default:
-      throw LIMA_COM_EXC(Error,"Video mode not yet managed!");
+      throw LIMA_COM_EXC(InvalidValue,"Not a Bayer video mode");
     }
 }
@@ -0,0 +1,87 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <cstddef>
+
+#include "VideoUtils_Kernels.h"
+
+namespace
+{
+#include "VideoUtils_KernelsImpl.h"
+
+Isa detect_isa()
+{
+#ifdef LIMA_VIDEO_X86_KERNELS
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))
+    return IsaAVX2;
+  if(__builtin_cpu_supports("sse4.1"))
+    return IsaSSE4;
+#endif
+  return IsaScalar;
+}
+}
+
+using namespace lima;
+
+VideoKernels::RowFunc VideoKernels::lookupScalar(Kernel kernel,Output output)
+{
+  return lookup(kernel,output);
+}
+
+VideoKernels::Isa VideoKernels::getBestIsa()
+{
+  static const Isa best_isa = detect_isa();
+  return best_isa;
+}
+
+const char *VideoKernels::getIsaName(Isa isa)
+{
+  switch(isa)
+    {
+    case IsaScalar:	return "scalar";
+    case IsaSSE4:	return "sse4";
+    case IsaAVX2:	return "avx2";
+    default:		return "unknown";
+    }
+}
+
+VideoKernels::RowFunc VideoKernels::getRowFunc(Kernel kernel,Output output,
+					       Isa isa)
+{
+  if(isa > getBestIsa())
+    return NULL;
+
+  switch(isa)
+    {
+#ifdef LIMA_VIDEO_X86_KERNELS
+    case IsaAVX2:	return lookupAVX2(kernel,output);
+    case IsaSSE4:	return lookupSSE4(kernel,output);
+#endif
+    case IsaScalar:	return lookupScalar(kernel,output);
+    default:		return NULL;
+    }
+}
+
+VideoKernels::RowFunc VideoKernels::getRowFunc(Kernel kernel,Output output)
+{
+  return getRowFunc(kernel,output,getBestIsa());
+}
@@ -0,0 +1,75 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef VIDEOUTILS_KERNELS_H
+#define VIDEOUTILS_KERNELS_H
+
+// Colour to luma and Bayer demosaic kernels of VideoUtils. Each kernel
+// converts a band of rows, so a frame can be split between threads. The
+// same code is compiled for several instruction sets
+// (VideoUtils_Kernels_<isa>.cpp), the best one is chosen at runtime.
+//
+// Only plain types here: the ISA specific translation units must not
+// instantiate any inline code shared with the rest of the library.
+
+namespace lima {
+namespace VideoKernels {
+
+enum Kernel {
+  KernelRGB24, KernelBGR24, KernelRGB32, KernelBGR32,
+  KernelRGB555, KernelRGB565, KernelYUV422Packed,
+  KernelBayerRG8, KernelBayerBG8, KernelBayerRG16, KernelBayerBG16,
+  NbKernels
+};
+enum Output {
+  OutputLuma,		// Y8, or Y16 for the 16-bit Bayer modes
+  OutputRGB,		// Bayer only: R,G,B of the source pixel type
+};
+enum Isa { IsaScalar, IsaSSE4, IsaAVX2, NbIsas };
+
+/** @brief convert the rows [first_row,end_row) of a width x height image,
+ *  src and dst point to the first row of the image.
+ */
+typedef void (*RowFunc)(const unsigned char *src,unsigned char *dst,
+			int width,int height,int first_row,int end_row);
+
+/** @brief best function for the kernel, NULL if not supported
+ */
+RowFunc getRowFunc(Kernel kernel,Output output);
+/** @brief function for a given instruction set, NULL if not available
+ */
+RowFunc getRowFunc(Kernel kernel,Output output,Isa isa);
+/** @brief best instruction set supported by this CPU and build
+ */
+Isa getBestIsa();
+const char *getIsaName(Isa isa);
+
+// per instruction set entry points
+RowFunc lookupScalar(Kernel kernel,Output output);
+#ifdef LIMA_VIDEO_X86_KERNELS
+RowFunc lookupSSE4(Kernel kernel,Output output);
+RowFunc lookupAVX2(Kernel kernel,Output output);
+#endif
+
+} // namespace VideoKernels
+} // namespace lima
+
+#endif // VIDEOUTILS_KERNELS_H
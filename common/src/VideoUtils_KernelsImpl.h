@@ -0,0 +1,210 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+// Kernel templates, included inside an anonymous namespace by each
+// VideoUtils_Kernels*.cpp: every instruction set gets its own
+// (internal linkage) instantiations. No include guard on purpose.
+//
+// The loops are written branch-free, in the narrowest arithmetic type
+// that cannot overflow, so that the compiler vectorizes them.
+
+using namespace lima::VideoKernels;
+
+/** @brief Y = (66 R + 129 G + 25 B + 128) >> 8, 8-bit interleaved RGB
+ */
+template <int R,int G,int B,int Stride>
+void rgb_2_luma(const unsigned char *src,unsigned char *dst,
+		int width,int,int first_row,int end_row)
+{
+  long end = long(end_row) * width;
+  for(long i = long(first_row) * width;i < end;++i)
+    {
+      const unsigned char *p = src + i * Stride;
+      unsigned short y = 66 * p[R] + 129 * p[G] + 25 * p[B] + 128;
+      dst[i] = y >> 8;
+    }
+}
+
+/** @brief same weights on 5-bit red and blue, 5 or 6-bit green
+ */
+template <bool Is565>
+void rgb16_2_luma(const unsigned char *src,unsigned char *dst,
+		  int width,int,int first_row,int end_row)
+{
+  long end = long(end_row) * width;
+  for(long i = long(first_row) * width;i < end;++i)
+    {
+      unsigned short d0 = src[2 * i],d1 = src[2 * i + 1];
+      unsigned short red,green;
+      if(Is565)
+	{
+	  red = (d0 & 0xf8) >> 3;
+	  green = ((d0 & 0x07) << 3) + ((d1 & 0xe0) >> 5);
+	}
+      else
+	{
+	  red = (d0 & 0x7c) >> 2;
+	  green = ((d0 & 0x03) << 3) + ((d1 & 0xe0) >> 5);
+	}
+      unsigned short blue = d1 & 0x1f;
+      dst[i] = (66 * red + 129 * green + 25 * blue + 128) >> 8;
+    }
+}
+
+/** @brief |U|Y0|V|Y1|: Y is every other byte
+ */
+void yuv422packed_2_luma(const unsigned char *src,unsigned char *dst,
+			 int width,int,int first_row,int end_row)
+{
+  long end = long(end_row) * width;
+  for(long i = long(first_row) * width;i < end;++i)
+    dst[i] = src[2 * i + 1];
+}
+
+template <class T,class Acc,bool RedRow,bool Rgb>
+inline void bayer_store(T *out,int x,Acc own,Acc green,Acc other)
+{
+  Acc red = RedRow ? own : other;
+  Acc blue = RedRow ? other : own;
+  if(Rgb)
+    {
+      out[3 * x] = T(red);
+      out[3 * x + 1] = T(green);
+      out[3 * x + 2] = T(blue);
+    }
+  else
+    out[x] = T((red * 76 + green * 150 + blue * 29) >> 8);
+}
+
+/** @brief red or blue pixel: the opposite colour is the mean of the 4
+ *  diagonal pixels, green the mean of the 4 closest
+ */
+template <class T,class Acc,bool RedRow,bool Rgb>
+inline void bayer_color_pixel(const T *up,const T *mid,const T *down,
+			      T *out,int x)
+{
+  Acc cross = (Acc(mid[x - 1]) + mid[x + 1] + up[x] + down[x] + 2) >> 2;
+  Acc diag = (Acc(up[x - 1]) + up[x + 1] + down[x - 1] + down[x + 1] + 2) >> 2;
+  bayer_store<T,Acc,RedRow,Rgb>(out,x,mid[x],cross,diag);
+}
+
+/** @brief green pixel: the colour of the row is the mean of the 2
+ *  horizontal neighbours, the other one the mean of the 2 vertical ones
+ */
+template <class T,class Acc,bool RedRow,bool Rgb>
+inline void bayer_green_pixel(const T *up,const T *mid,const T *down,
+			      T *out,int x)
+{
+  Acc horz = (Acc(mid[x - 1]) + mid[x + 1] + 1) >> 1;
+  Acc vert = (Acc(up[x]) + down[x] + 1) >> 1;
+  bayer_store<T,Acc,RedRow,Rgb>(out,x,horz,mid[x],vert);
+}
+
+/** @brief bilinear demosaic of one row, the borders excepted.
+ *  The red/blue pixels are at x % 2 == color_parity. Acc is large enough
+ *  for 4 pixels and for the luma weights (Y = (76 R + 150 G + 29 B) >> 8).
+ */
+template <class T,class Acc,bool RedRow,bool Rgb>
+inline void bayer_row(const T *up,const T *mid,const T *down,T *out,
+		      int width,int color_parity)
+{
+  int x = 1;
+  if(color_parity == 0)
+    bayer_green_pixel<T,Acc,RedRow,Rgb>(up,mid,down,out,x++);
+  // (colour, green) pairs
+  for(;x + 1 < width - 1;x += 2)
+    {
+      bayer_color_pixel<T,Acc,RedRow,Rgb>(up,mid,down,out,x);
+      bayer_green_pixel<T,Acc,RedRow,Rgb>(up,mid,down,out,x + 1);
+    }
+  if(x < width - 1)
+    bayer_color_pixel<T,Acc,RedRow,Rgb>(up,mid,down,out,x);
+}
+
+/** @brief Bayer to luma or RGB, the first and last rows and columns are 0.
+ *  RedEven: red pixels are on the even rows (RG pattern), else on the odd
+ *  ones (BG pattern). Red or blue pixels are at (even,even) and (odd,odd).
+ */
+template <class T,class Acc,bool RedEven,bool Rgb>
+void bayer_convert(const unsigned char *src,unsigned char *dst,
+		   int width,int height,int first_row,int end_row)
+{
+  const int nb_chan = Rgb ? 3 : 1;
+  const T *in = (const T *) src;
+  for(int y = first_row;y < end_row;++y)
+    {
+      T *out = (T *) dst + long(y) * width * nb_chan;
+      if(y == 0 || y == height - 1 || width < 3)
+	{
+	  for(int i = 0;i < width * nb_chan;++i)
+	    out[i] = 0;
+	  continue;
+	}
+      for(int c = 0;c < nb_chan;++c)
+	out[c] = out[(width - 1) * nb_chan + c] = 0;
+
+      const T *mid = in + long(y) * width;
+      bool red_row = ((y & 1) == 0) == RedEven;
+      if(red_row)
+	bayer_row<T,Acc,true,Rgb>(mid - width,mid,mid + width,out,
+				  width,y & 1);
+      else
+	bayer_row<T,Acc,false,Rgb>(mid - width,mid,mid + width,out,
+				   width,y & 1);
+    }
+}
+
+template <bool Rgb>
+RowFunc lookup_bayer(Kernel kernel)
+{
+  switch(kernel)
+    {
+    case KernelBayerRG8:
+      return bayer_convert<unsigned char,unsigned short,true,Rgb>;
+    case KernelBayerBG8:
+      return bayer_convert<unsigned char,unsigned short,false,Rgb>;
+    case KernelBayerRG16:
+      return bayer_convert<unsigned short,unsigned int,true,Rgb>;
+    case KernelBayerBG16:
+      return bayer_convert<unsigned short,unsigned int,false,Rgb>;
+    default:
+      return NULL;
+    }
+}
+
+RowFunc lookup(Kernel kernel,Output output)
+{
+  if(output == OutputRGB)
+    return lookup_bayer<true>(kernel);
+
+  switch(kernel)
+    {
+    case KernelRGB24:		return rgb_2_luma<0,1,2,3>;
+    case KernelBGR24:		return rgb_2_luma<2,1,0,3>;
+    case KernelRGB32:		return rgb_2_luma<0,1,2,4>;
+    case KernelBGR32:		return rgb_2_luma<2,1,0,4>;
+    case KernelRGB555:		return rgb16_2_luma<false>;
+    case KernelRGB565:		return rgb16_2_luma<true>;
+    case KernelYUV422Packed:	return yuv422packed_2_luma;
+    default:			return lookup_bayer<false>(kernel);
+    }
+}
@@ -0,0 +1,137 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+// Per-call overhead of the debug macros in a hot member function
+// (DEB_MEMBER_FUNCT + DEB_PARAM + DEB_RETURN) compared to the same
+// function without macros, with the tracing disabled and with the trace
+// types enabled but the module disabled, plus a check that the stream
+// arguments of a disabled trace are not evaluated.
+//
+// usage: test_debug_overhead [nb_calls]
+
+#include <cassert>
+#include <cstdlib>
+
+#include <iostream>
+
+#include "lima/Debug.h"
+#include "lima/Timestamp.h"
+
+using namespace lima;
+using namespace std;
+
+static int nb_evals = 0;
+
+static int countEval(int x)
+{
+	++nb_evals;
+	return x;
+}
+
+class HotPath
+{
+	DEB_CLASS(DebModTest, "HotPath");
+
+public:
+	__attribute__((noinline)) int frameReady(int frame_nb, int size)
+	{
+		DEB_MEMBER_FUNCT();
+		DEB_PARAM() << DEB_VAR2(frame_nb, size);
+		int ret = frame_nb + size;
+		DEB_RETURN() << DEB_VAR1(ret);
+		return ret;
+	}
+
+	__attribute__((noinline)) int plainFrameReady(int frame_nb, int size)
+	{
+		return frame_nb + size;
+	}
+
+	__attribute__((noinline)) void traceEval(int x)
+	{
+		DEB_MEMBER_FUNCT();
+		DEB_TRACE() << DEB_VAR1(countEval(x));
+	}
+};
+
+// ns per call above the same function without debug macros
+double benchmark(HotPath& hot, int nb_calls)
+{
+	volatile int sink = 0;
+	Timestamp t0 = Timestamp::now();
+	for (int i = 0; i < nb_calls; ++i)
+		sink = sink + hot.plainFrameReady(i, 1024);
+	double plain = Timestamp::now() - t0;
+
+	t0 = Timestamp::now();
+	for (int i = 0; i < nb_calls; ++i)
+		sink = sink + hot.frameReady(i, 1024);
+	double elapsed = Timestamp::now() - t0;
+	return (elapsed - plain) / nb_calls * 1e9;
+}
+
+void test_no_eval(HotPath& hot)
+{
+	DebParams::Flags type_flags = DebParams::getTypeFlags();
+	DebParams::Flags mod_flags = DebParams::getModuleFlags();
+
+	nb_evals = 0;
+	hot.traceEval(1);
+	assert(nb_evals == 0);
+
+	DebParams::enableTypeFlags(DebTypeTrace);
+	DebParams::setModuleFlags(DebModControl);
+	hot.traceEval(2);
+	assert(nb_evals == 0);
+
+	DebParams::enableModuleFlags(DebModTest);
+	hot.traceEval(3);
+	assert(nb_evals == 1);
+
+	DebParams::setTypeFlags(type_flags);
+	DebParams::setModuleFlags(mod_flags);
+	hot.traceEval(4);
+	assert(nb_evals == 1);
+}
+
+int main(int argc, char *argv[])
+{
+	int nb_calls = (argc > 1) ? atoi(argv[1]) : 10000000;
+
+	HotPath hot;
+	test_no_eval(hot);
+
+	DebParams::Flags type_flags = DebParams::getTypeFlags();
+	DebParams::Flags mod_flags = DebParams::getModuleFlags();
+
+	cout << "tracing disabled: " << benchmark(hot, nb_calls)
+	     << " ns/call" << endl;
+
+	DebParams::enableTypeFlags(DebTypeFunct | DebTypeParam | 
+				   DebTypeReturn);
+	DebParams::disableModuleFlags(DebModTest);
+	cout << "module disabled:  " << benchmark(hot, nb_calls)
+	     << " ns/call" << endl;
+
+	DebParams::setTypeFlags(type_flags);
+	DebParams::setModuleFlags(mod_flags);
+	return 0;
+}
@@ -0,0 +1,161 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+// HugePageAllocator string round-trip, plus a startup-time and
+// first-frame-latency benchmark of the buffer allocators: the time to
+// allocate a ring of frame buffers, then the time the "detector" takes to
+// write the first frame into each of them.
+//
+// usage: test_hugepage_alloc [frame_size_mb [nb_buffers]]
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+#include <iostream>
+#include <vector>
+
+#include "lima/MemUtils.h"
+#include "lima/BufferHelper.h"
+#include "lima/Timestamp.h"
+
+using namespace lima;
+using namespace std;
+
+
+void test_from_string()
+{
+	AllocatorFactory& factory = AllocatorFactory::get();
+
+	const char *alloc_str = "HugePageAllocator(page_size=1G,populate=1,lock=0)";
+	Allocator::Ref alloc = factory.fromString(alloc_str);
+	assert(alloc->toString() == alloc_str);
+
+	HugePageAllocator *huge = dynamic_cast<HugePageAllocator *>(alloc.get());
+	assert(huge);
+	assert(huge->getPageSize() == HugePageAllocator::Huge1G);
+	assert(huge->getPopulate() && !huge->getLock());
+
+	alloc = factory.fromString("HugePageAllocator()");
+	assert(alloc->toString() ==
+	       "HugePageAllocator(page_size=2M,populate=0,lock=0)");
+
+	bool failed = false;
+	try {
+		factory.fromString("HugePageAllocator(page_size=4K)");
+	} catch (Exception&) {
+		failed = true;
+	}
+	assert(failed);
+
+	BufferHelper::Parameters params;
+	params.initMem = true;
+	params.slabAlloc = true;
+	params.allocator = factory.fromString("HugePageAllocator(page_size=THP)");
+	std::string params_str = params.toString();
+	BufferHelper::Parameters decoded;
+	decoded = BufferHelper::Parameters::fromString(params_str);
+	assert(decoded.initMem);
+	assert(decoded.slabAlloc);
+	assert(decoded.allocator);
+	assert(decoded.allocator->toString() == params.allocator->toString());
+	assert(decoded.toString() == params_str);
+}
+
+void test_alloc()
+{
+	const size_t size = 3 * HugePageAllocator::Huge2M + 123;
+	const char *configs[] = {
+		"HugePageAllocator(page_size=THP)",
+		"HugePageAllocator(page_size=THP,populate=1)",
+		"HugePageAllocator(page_size=2M)",
+	};
+	for (auto alloc_str : configs) {
+		Allocator::Ref alloc = AllocatorFactory::get().fromString(alloc_str);
+		MemBuffer b(size, alloc);
+		assert(b.getSize() == size);
+		char *ptr = (char *) b.getPtr();
+		assert((uintptr_t(ptr) % HugePageAllocator::Huge2M) == 0);
+		assert(ptr[0] == 0 && ptr[size - 1] == 0);
+		memset(ptr, 0xa5, size);
+	}
+}
+
+void benchmark(size_t frame_size, int nb_buffers)
+{
+	const char *configs[] = {
+		"Allocator()",
+		"MMapAllocator()",
+		"HugePageAllocator(page_size=THP)",
+		"HugePageAllocator(page_size=THP,populate=1)",
+		"HugePageAllocator(page_size=2M)",
+		"HugePageAllocator(page_size=2M,populate=1)",
+		"HugePageAllocator(page_size=1G,populate=1)",
+	};
+
+	vector<char> frame(frame_size, 0x5a);
+	for (auto alloc_str : configs) {
+		Allocator::Ref alloc = AllocatorFactory::get().fromString(alloc_str);
+		vector<MemBuffer> buffers;
+		buffers.reserve(nb_buffers);
+
+		// no memset: the first frame pays the page faults
+		Timestamp t0 = Timestamp::now();
+		for (int i = 0; i < nb_buffers; ++i)
+			buffers.emplace_back(frame_size, alloc, false);
+		double startup = Timestamp::now() - t0;
+
+		// first write into each buffer: the page faults are paid here
+		double max_latency = 0;
+		t0 = Timestamp::now();
+		for (auto& b : buffers) {
+			Timestamp t = Timestamp::now();
+			memcpy(b.getPtr(), frame.data(), frame_size);
+			max_latency = max<double>(max_latency, Timestamp::now() - t);
+		}
+		double first_pass = Timestamp::now() - t0;
+
+		// steady state, all pages mapped
+		t0 = Timestamp::now();
+		for (auto& b : buffers)
+			memcpy(b.getPtr(), frame.data(), frame_size);
+		double second_pass = Timestamp::now() - t0;
+
+		cout << alloc_str << ": "
+		     << "startup=" << startup * 1e3 << " ms, "
+		     << "first-frame=" << first_pass / nb_buffers * 1e3 << " ms "
+		     << "(max " << max_latency * 1e3 << " ms), "
+		     << "steady=" << second_pass / nb_buffers * 1e3 << " ms"
+		     << endl;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	size_t frame_size = ((argc > 1) ? atoi(argv[1]) : 8) * (1 << 20);
+	int nb_buffers = (argc > 2) ? atoi(argv[2]) : 16;
+
+	test_from_string();
+	test_alloc();
+	benchmark(frame_size, nb_buffers);
+
+	return 0;
+}
@@ -161,6 +161,21 @@ void test_custom_allocator()
 }
 
 
+void test_parallel_clear()
+{
+	// odd size, several threads
+	const size_t size = (256 << 20) + 123;
+	MemBuffer b(size, MockAllocator::getAllocator(), false);
+	char *ptr = (char *) b.getPtr();
+	memset(ptr, 0x5a, size);
+	ParallelClearBuffer(ptr + 1, size - 2, 4);
+	assert(ptr[0] == 0x5a && ptr[size - 1] == 0x5a);
+	for (size_t i = 1; i < size - 1; i += 4093)
+		assert(ptr[i] == 0);
+	assert(ptr[size - 2] == 0);
+}
+
+
 int main(int /*argc*/, char * /*argv*/ [])
 {
 	try {
@@ -170,6 +185,8 @@ int main(int /*argc*/, char * /*argv*/ [])
 
 		test_custom_allocator();
 
+		test_parallel_clear();
+
 	} catch (Exception e) {
 		std::cerr << "LIMA Exception: " << e << std::endl;
 	}
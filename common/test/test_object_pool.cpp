@@ -0,0 +1,117 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+#include "lima/ObjectPool.h"
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <cassert>
+
+using namespace std;
+using namespace lima;
+
+struct Frame
+{
+	static void *operator new(size_t size)
+	{ return ObjectPool<Frame>::get().alloc(size); }
+	static void operator delete(void *p, size_t size)
+	{ ObjectPool<Frame>::get().release(p, size); }
+
+	long nb;
+	char data[64];
+};
+
+struct SharedTag {};
+
+void test_class_pool()
+{
+	cout << "Testing class-specific ObjectPool" << endl;
+
+	const int nb_objects = 16;
+	ObjectPool<Frame>& pool = ObjectPool<Frame>::get();
+	pool.reserve(nb_objects);
+
+	// first round: all allocations miss, all blocks are cached on release
+	vector<Frame *> frames;
+	for (int i = 0; i < nb_objects; ++i)
+		frames.push_back(new Frame());
+	for (Frame *f : frames)
+		delete f;
+	frames.clear();
+
+	ObjectPoolStats stats;
+	pool.getStats(stats);
+	cout << "round 1: " << stats << endl;
+	assert((stats.hits == 0) && (stats.misses == nb_objects));
+	assert(stats.cached == nb_objects);
+
+	// steady state: no more heap allocation
+	for (int round = 0; round < 10; ++round) {
+		for (int i = 0; i < nb_objects; ++i)
+			frames.push_back(new Frame());
+		for (Frame *f : frames)
+			delete f;
+		frames.clear();
+	}
+	pool.getStats(stats);
+	cout << "round 11: " << stats << endl;
+	assert((stats.hits == 10 * nb_objects) && (stats.misses == nb_objects));
+
+	// beyond the reserved size blocks go back to the heap
+	for (int i = 0; i < 2 * nb_objects; ++i)
+		frames.push_back(new Frame());
+	for (Frame *f : frames)
+		delete f;
+	pool.getStats(stats);
+	cout << "overflow: " << stats << endl;
+	assert(stats.cached == nb_objects);
+
+	pool.clear();
+	pool.getStats(stats);
+	assert(stats.cached == 0);
+}
+
+void test_shared_pool()
+{
+	cout << "Testing ObjectPoolAllocator" << endl;
+
+	typedef ObjectPoolAllocator<Frame, SharedTag> Allocator;
+	ObjectPool<SharedTag>& pool = ObjectPool<SharedTag>::get();
+	pool.reserve(4);
+
+	for (int i = 0; i < 8; ++i) {
+		shared_ptr<Frame> f = allocate_shared<Frame>(Allocator());
+		f->nb = i;
+	}
+
+	ObjectPoolStats stats;
+	pool.getStats(stats);
+	cout << "shared: " << stats << endl;
+	assert((stats.misses == 1) && (stats.hits == 7));
+}
+
+int main(int /*argc*/, char * /*argv*/ [])
+{
+	test_class_pool();
+	test_shared_pool();
+	return 0;
+}
@@ -0,0 +1,373 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+// Video colour kernels: every instruction set must give the same result
+// as a plain per-pixel reference, then a Mpixel/s benchmark of each
+// VideoMode for each instruction set and with row splitting.
+// The live-video binning of 64 bit frames must saturate, the binning and
+// ROI crop must match a per-pixel reference.
+//
+// usage: test_video_kernels [width [height [nb_threads]]]
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+#include <iostream>
+#include <limits>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../src/VideoUtils_Kernels.h"
+#include "lima/VideoUtils.h"
+#include "lima/Timestamp.h"
+#include "processlib/PoolThreadMgr.h"
+
+using namespace lima;
+using namespace std;
+
+struct ModeKernel
+{
+	VideoMode mode;
+	VideoKernels::Kernel kernel;
+	int src_depth;		// bytes per source pixel
+	int luma_depth;		// bytes per luma pixel
+};
+
+const ModeKernel mode_kernels[] = {
+	{RGB24, VideoKernels::KernelRGB24, 3, 1},
+	{BGR24, VideoKernels::KernelBGR24, 3, 1},
+	{RGB32, VideoKernels::KernelRGB32, 4, 1},
+	{BGR32, VideoKernels::KernelBGR32, 4, 1},
+	{RGB555, VideoKernels::KernelRGB555, 2, 1},
+	{RGB565, VideoKernels::KernelRGB565, 2, 1},
+	{YUV422PACKED, VideoKernels::KernelYUV422Packed, 2, 1},
+	{BAYER_RG8, VideoKernels::KernelBayerRG8, 1, 1},
+	{BAYER_BG8, VideoKernels::KernelBayerBG8, 1, 1},
+	{BAYER_RG16, VideoKernels::KernelBayerRG16, 2, 2},
+	{BAYER_BG16, VideoKernels::KernelBayerBG16, 2, 2},
+};
+
+bool is_bayer(VideoMode mode)
+{
+	return (mode == BAYER_RG8) || (mode == BAYER_BG8) ||
+	       (mode == BAYER_RG16) || (mode == BAYER_BG16);
+}
+
+template <class T>
+void ref_bayer(const T *src, int width, int height, bool red_even,
+	       unsigned *rgb, int x, int y)
+{
+	auto p = [&](int dx, int dy) -> unsigned {
+		return src[(y + dy) * width + x + dx];
+	};
+	unsigned c = p(0, 0);
+	unsigned cross = (p(-1, 0) + p(1, 0) + p(0, -1) + p(0, 1) + 2) >> 2;
+	unsigned diag = (p(-1, -1) + p(1, -1) + p(-1, 1) + p(1, 1) + 2) >> 2;
+	unsigned horz = (p(-1, 0) + p(1, 0) + 1) >> 1;
+	unsigned vert = (p(0, -1) + p(0, 1) + 1) >> 1;
+	bool red_row = ((y % 2) == 0) == red_even;
+	if ((x % 2) == (y % 2)) {	// red or blue pixel
+		rgb[red_row ? 0 : 2] = c;
+		rgb[red_row ? 2 : 0] = diag;
+		rgb[1] = cross;
+	} else {			// green pixel
+		rgb[red_row ? 0 : 2] = horz;
+		rgb[red_row ? 2 : 0] = vert;
+		rgb[1] = c;
+	}
+}
+
+/** @brief per-pixel reference: luma, or RGB for Bayer if rgb
+ */
+template <class T>
+void reference_bayer(const ModeKernel& mk, const unsigned char *src,
+		     int width, int height, bool rgb, vector<unsigned>& out)
+{
+	int nb_chan = rgb ? 3 : 1;
+	out.assign(size_t(width) * height * nb_chan, 0);
+	bool red_even = (mk.mode == BAYER_RG8) || (mk.mode == BAYER_RG16);
+	for (int y = 1; y < height - 1; ++y)
+		for (int x = 1; x < width - 1; ++x) {
+			unsigned v[3];
+			ref_bayer((const T *) src, width, height, red_even,
+				  v, x, y);
+			unsigned *o = &out[(size_t(y) * width + x) * nb_chan];
+			if (rgb)
+				o[0] = v[0], o[1] = v[1], o[2] = v[2];
+			else
+				o[0] = (v[0] * 76 + v[1] * 150 + v[2] * 29) >> 8;
+		}
+}
+
+void reference(const ModeKernel& mk, const unsigned char *src,
+	       int width, int height, bool rgb, vector<unsigned>& out)
+{
+	if (mk.src_depth == 2 && is_bayer(mk.mode)) {
+		reference_bayer<unsigned short>(mk, src, width, height, rgb, out);
+		return;
+	} else if (is_bayer(mk.mode)) {
+		reference_bayer<unsigned char>(mk, src, width, height, rgb, out);
+		return;
+	}
+
+	out.resize(size_t(width) * height);
+	for (size_t i = 0; i < out.size(); ++i) {
+		const unsigned char *p = src + i * mk.src_depth;
+		unsigned r, g, b;
+		switch (mk.mode) {
+		case RGB24: case RGB32:
+			r = p[0], g = p[1], b = p[2]; break;
+		case BGR24: case BGR32:
+			r = p[2], g = p[1], b = p[0]; break;
+		case RGB555:
+			r = (p[0] & 0x7c) >> 2;
+			g = ((p[0] & 0x03) << 3) + ((p[1] & 0xe0) >> 5);
+			b = p[1] & 0x1f;
+			break;
+		case RGB565:
+			r = (p[0] & 0xf8) >> 3;
+			g = ((p[0] & 0x07) << 3) + ((p[1] & 0xe0) >> 5);
+			b = p[1] & 0x1f;
+			break;
+		default:	// YUV422PACKED
+			out[i] = p[1];
+			continue;
+		}
+		out[i] = (66 * r + 129 * g + 25 * b + 128) >> 8;
+	}
+}
+
+void check(const ModeKernel& mk, const vector<unsigned char>& dst,
+	   const vector<unsigned>& ref)
+{
+	for (size_t i = 0; i < ref.size(); ++i) {
+		unsigned v = (mk.luma_depth == 2) ?
+			((const unsigned short *) dst.data())[i] : dst[i];
+		if (v != ref[i]) {
+			cerr << mk.mode << ": pixel " << i << " is " << v
+			     << " instead of " << ref[i] << endl;
+			exit(1);
+		}
+	}
+}
+
+// 2x2 binning of a 4x2 frame: [max, 1, ...] saturates, [1, 2, ...] does not
+template <class T>
+void test_bin_saturation(Data::TYPE type)
+{
+	const T max_val = numeric_limits<T>::max();
+	const T min_val = numeric_limits<T>::min();
+	const T pixels[] = {max_val, 1, 1, 2,
+			    max_val, 1, 3, 4};
+
+	Data data;
+	data.type = type;
+	data.dimensions.push_back(4);
+	data.dimensions.push_back(2);
+	data.frameNumber = 0;
+	Buffer *buffer = new Buffer(sizeof(pixels));
+	data.setBuffer(buffer);
+	buffer->unref();
+	memcpy(data.data(), pixels, sizeof(pixels));
+
+	VideoImage image;
+	data2Image(data, image, Bin(2, 2), Roi());
+	assert((image.width == 2) && (image.height == 1));
+	const T *binned = (const T *) image.buffer;
+	assert(binned[0] == max_val);
+	assert(binned[1] == 10);
+
+	if (min_val < 0) {
+		T *p = (T *) data.data();
+		p[0] = p[4] = min_val;
+		p[1] = p[5] = -1;
+		data2Image(data, image, Bin(2, 2), Roi());
+		binned = (const T *) image.buffer;
+		assert(binned[0] == min_val);
+	}
+}
+
+// bin and crop a random 16 bit frame, compare with the per-pixel sums
+void test_bin_roi(int width, int height, const Bin& bin, const Roi& roi)
+{
+	mt19937 gen(4321);
+	uniform_int_distribution<int> dist(0, 1000);
+
+	Data data;
+	data.type = Data::UINT16;
+	data.dimensions.push_back(width);
+	data.dimensions.push_back(height);
+	data.frameNumber = 0;
+	Buffer *buffer = new Buffer(data.size());
+	data.setBuffer(buffer);
+	buffer->unref();
+	unsigned short *src = (unsigned short *) data.data();
+	for (int i = 0; i < width * height; ++i)
+		src[i] = dist(gen);
+
+	VideoImage image;
+	data2Image(data, image, bin, roi);
+	int x0 = 0, y0 = 0;
+	int roi_width = width / bin.getX(), roi_height = height / bin.getY();
+	if (roi.isActive()) {
+		x0 = roi.getTopLeft().x, y0 = roi.getTopLeft().y;
+		roi_width = roi.getSize().getWidth();
+		roi_height = roi.getSize().getHeight();
+	}
+	assert((image.width == roi_width) && (image.height == roi_height));
+	assert(image.mode == Y16);
+
+	const unsigned short *dst = (const unsigned short *) image.buffer;
+	for (int y = 0; y < roi_height; ++y)
+		for (int x = 0; x < roi_width; ++x) {
+			unsigned sum = 0;
+			for (int by = 0; by < bin.getY(); ++by)
+				for (int bx = 0; bx < bin.getX(); ++bx) {
+					int sx = (x0 + x) * bin.getX() + bx;
+					int sy = (y0 + y) * bin.getY() + by;
+					sum += src[sy * width + sx];
+				}
+			unsigned v = dst[y * roi_width + x];
+			if (v != sum) {
+				cerr << "bin " << bin << ", roi " << roi
+				     << ": pixel " << x << "," << y << " is "
+				     << v << " instead of " << sum << endl;
+				exit(1);
+			}
+		}
+
+	// the ROI must be inside the binned frame
+	Roi outside(width / bin.getX() - 1, 0, 2, 1);
+	bool thrown = false;
+	try {
+		data2Image(data, image, bin, outside);
+	} catch (Exception&) {
+		thrown = true;
+	}
+	assert(thrown);
+}
+
+void test_kernels(int width, int height)
+{
+	mt19937 gen(1234);
+	uniform_int_distribution<int> dist(0, 255);
+	for (auto& mk : mode_kernels) {
+		vector<unsigned char> src(size_t(width) * height * mk.src_depth);
+		for (auto& c : src)
+			c = dist(gen);
+
+		for (int rgb = 0; rgb < (is_bayer(mk.mode) ? 2 : 1); ++rgb) {
+			vector<unsigned> ref;
+			reference(mk, src.data(), width, height, rgb, ref);
+			VideoKernels::Output output = rgb ?
+				VideoKernels::OutputRGB : VideoKernels::OutputLuma;
+			for (int i = 0; i < VideoKernels::NbIsas; ++i) {
+				VideoKernels::Isa isa = VideoKernels::Isa(i);
+				VideoKernels::RowFunc func =
+				    VideoKernels::getRowFunc(mk.kernel, output, isa);
+				if (!func)
+					continue;
+				vector<unsigned char> dst(ref.size() * mk.luma_depth, 0xa5);
+				// two bands, to check the band limits
+				func(src.data(), dst.data(), width, height, 0, height / 3);
+				func(src.data(), dst.data(), width, height, height / 3, height);
+				check(mk, dst, ref);
+			}
+
+			// row splitting
+			vector<unsigned char> dst(ref.size() * mk.luma_depth);
+			if (rgb)
+				bayer2RGB(src.data(), width, height, mk.mode, dst.data(), 4);
+			else
+				image2YUV(src.data(), width, height, mk.mode, dst.data(), 4);
+			check(mk, dst, ref);
+		}
+	}
+}
+
+void benchmark(int width, int height, int nb_threads)
+{
+	const int nb_loops = 20;
+	double mpixels = double(width) * height * nb_loops / 1e6;
+	cout << "best isa: "
+	     << VideoKernels::getIsaName(VideoKernels::getBestIsa()) << endl;
+	for (auto& mk : mode_kernels) {
+		vector<unsigned char> src(size_t(width) * height * mk.src_depth, 0x5a);
+		vector<unsigned char> dst(size_t(width) * height * 3 * mk.luma_depth);
+		for (int rgb = 0; rgb < (is_bayer(mk.mode) ? 2 : 1); ++rgb) {
+			VideoKernels::Output output = rgb ?
+				VideoKernels::OutputRGB : VideoKernels::OutputLuma;
+			cout << mk.mode << (rgb ? " -> RGB" : " -> Y") << ":";
+			for (int i = 0; i < VideoKernels::NbIsas; ++i) {
+				VideoKernels::Isa isa = VideoKernels::Isa(i);
+				VideoKernels::RowFunc func =
+				    VideoKernels::getRowFunc(mk.kernel, output, isa);
+				if (!func)
+					continue;
+				Timestamp t0 = Timestamp::now();
+				for (int l = 0; l < nb_loops; ++l)
+					func(src.data(), dst.data(), width, height,
+					     0, height);
+				double elapsed = Timestamp::now() - t0;
+				cout << " " << VideoKernels::getIsaName(isa) << "="
+				     << int(mpixels / elapsed) << "";
+			}
+			Timestamp t0 = Timestamp::now();
+			for (int l = 0; l < nb_loops; ++l)
+				if (rgb)
+					bayer2RGB(src.data(), width, height, mk.mode,
+						  dst.data(), nb_threads);
+				else
+					image2YUV(src.data(), width, height, mk.mode,
+						  dst.data(), nb_threads);
+			double elapsed = Timestamp::now() - t0;
+			cout << " " << nb_threads << "-threads="
+			     << int(mpixels / elapsed) << " Mpixel/s" << endl;
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int width = (argc > 1) ? atoi(argv[1]) : 2048;
+	int height = (argc > 2) ? atoi(argv[2]) : 2048;
+	int nb_threads = (argc > 3) ? atoi(argv[3]) :
+		max(1, int(thread::hardware_concurrency()) / 2);
+	// the row bands are run by the processing threads
+	PoolThreadMgr::get().setNumberOfThread(nb_threads);
+
+	test_bin_saturation<unsigned long long>(Data::UINT64);
+	test_bin_saturation<long long>(Data::INT64);
+	test_bin_saturation<unsigned int>(Data::UINT32);
+
+	test_bin_roi(37, 23, Bin(1, 1), Roi());
+	test_bin_roi(37, 23, Bin(1, 1), Roi(5, 3, 17, 11));
+	test_bin_roi(37, 23, Bin(2, 3), Roi(1, 2, 12, 5));
+	test_bin_roi(37, 23, Bin(4, 1), Roi(0, 0, 9, 23));
+
+	test_kernels(131, 257);
+	test_kernels(2, 2);
+	benchmark(width, height, nb_threads);
+
+	return 0;
+}
@@ -25,6 +25,9 @@
 #include "lima/LimaCompatibility.h"
 #include <list>
 #include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
 
 #include "lima/BufferHelper.h"
 #include "lima/CtControl.h"
@@ -33,6 +36,7 @@
 
 namespace lima
 {
+  class AccMedianStack;
   
   /// Control image accumulation settings
   class LIMACORE_API CtAccumulation
@@ -131,6 +135,11 @@ namespace lima
 
     void setHwNbBuffers(int hw_nb_buffers);
     void getHwNbBuffers(int& hw_nb_buffers) const;
+
+    // --- tiled accumulation: frames split in row bands processed in
+    // parallel, 0 means sequential, -1 the number of processing threads
+    void setNbTiles(int nb_tiles);
+    void getNbTiles(int& nb_tiles) const;
     
     // --- variable and data result of Concatenation or Accumulation
 
@@ -168,6 +177,9 @@ namespace lima
 
     class _ProcAccTask;
     friend class _ProcAccTask;
+    typedef std::function<long long(long first_pixel,int nb_pixels)> TileFunc;
+    class _TileJob;
+    class _TileTask;
     class _CalcSaturatedTask;
     friend class _CalcSaturatedTask;
     class _CalcEndCBK;
@@ -219,8 +231,13 @@ namespace lima
       int				frame_nb;
       int				acc_frames{0};
       std::map<int,Data>		new_pending_data;
-      // Temporary data where frames are stored to compute the median
-      // std::vector<Data>		tmp_datas;
+      // Tiled mode: frames received, images allocated, one lock per band
+      int				nb_started{0};
+      bool				ready{false};
+      bool				failed{false};
+      std::shared_ptr<std::vector<Mutex> >	tile_locks;
+      // Samples of all the frames to compute the median
+      std::shared_ptr<AccMedianStack>	median;
       Data				data[NbImgTypes];
 
       _ProcAccInfo(int frame) : frame_nb(frame) {}
@@ -245,6 +262,8 @@ namespace lima
     bool 				m_last_continue_flag;
     int					m_hw_img_depth;
     int					m_hw_nb_buffers;
+    int					m_nb_tiles;
+    int					m_acc_nb_tiles;
     FrameDim				m_frame_dim[NbImgTypes];
     BufferHelper::Parameters		m_buffer_params;
     BufferHelper			m_buffer_helper[NbImgTypes];
@@ -255,6 +274,8 @@ namespace lima
     bool _newFrameReady(Data&);
     void _newBaseFrameReady(Data&);
     void _processBaseFrame(_ProcAccInfo&,Data&,AutoMutex&);
+    bool _processTiledFrame(_ProcAccInfo&,Data&,AutoMutex&);
+    void _prepareAccImages(_ProcAccInfo&,Data&,AutoMutex&);
     void stop();
 
     void _calcImgFrameDims();
@@ -263,7 +284,16 @@ namespace lima
     void getFrame(Data &,int frameNumber);
     BufferBase *_getDataBuffer(ImgType type, int size);
 
-    void _accFrame(Data& src, Data& dst) const;
+    struct _AccKernel;
+    bool _getAccKernel(Data& src, Data& dst, Data *sat_data, _AccKernel& kernel);
+    bool _accFrame(Data& src, Data& dst, Data *sat_data = NULL);
+    bool _accTiledFrame(Data& src, Data& dst, Data *sat_data,
+                        std::vector<Mutex>& tile_locks, int first_tile);
+    void _setSaturatedCounter(Data& src, long long nb_saturated);
+    long long _runTiles(const Data& frame, const TileFunc& func,
+                        std::vector<Mutex>& tile_locks, int first_tile);
+    void _medianAddFrame(_ProcAccInfo& info, Data& src, int frame_idx);
+    void _medianReduce(_ProcAccInfo& info, Data& dst);
 
     void _calcSaturatedImageNCounters(Data &src,Data &dst);
 
@@ -28,6 +28,7 @@
 #include "lima/CtImage.h"
 #include "lima/HwInterface.h"
 #include "lima/HwFrameCallback.h"
+#include "lima/ObjectPool.h"
 
 #include "processlib/Data.h"
 
@@ -95,6 +96,8 @@ namespace lima {
 
     bool waitBuffersReleased(double timeout=-1);
 
+    void getPoolStats(ObjectPoolStats& stats) const;
+
 #ifdef __unix
     void setMallocTrimPad(unsigned long  pad);
     void getMallocTrimPad(unsigned long& pad) const;
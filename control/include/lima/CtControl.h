@@ -23,11 +23,15 @@
 #define CTCONTROL_H
 
 #include <set>
+#include <vector>
+#include <atomic>
 
 #include <lima/project_version.h>
 
 #include "lima/LimaCompatibility.h"
 #include "lima/ThreadUtils.h"
+#include "lima/ObjectPool.h"
+#include "lima/CtSpillTier.h"
 
 #include "lima/HwInterface.h"
 
@@ -51,6 +55,7 @@ namespace lima
   class CtAccumulation;
   class CtVideo;
   class CtEvent;
+  class CtFrameTrace;
 #ifdef WITH_CONFIG
   class CtConfig;
 #endif
@@ -89,6 +94,36 @@ namespace lima
       long	LastCounterReady;
     };
 
+    /** @brief frames of a block, read without copy.
+     *  Each segment is the Data of a buffer (3D for consecutive frames of
+     *  a concatenated HW buffer), the acquisition buffers stay pinned
+     *  against overwrite while the block or a Data taken from it lives.
+     */
+    class LIMACORE_API DataBlock
+    {
+      DEB_CLASS_NAMESPC(DebModControl,"Control::DataBlock","Control");
+    public:
+      DataBlock();
+
+      int getNbFrames() const;
+      int getNbSegments() const;
+      Data getSegment(int segment) const;
+      /// @brief view of one frame of the block, no copy
+      Data getFrame(int frame) const;
+      /// @brief the frames in a single buffer, copied if needed
+      Data getContiguous() const;
+
+    private:
+      friend class CtControl;
+      void _addSegment(Data& data,int nb_frames,int frame_mem_size);
+      void _findFrame(int frame,int& segment,int& offset) const;
+
+      std::vector<Data>	m_segments;
+      std::vector<int>	m_first_frames;	///< first block frame of segments
+      int		m_nb_frames;
+      int		m_frame_mem_size;
+    };
+
 
     class LIMACORE_API ImageStatusCallback
     {
@@ -138,6 +173,13 @@ namespace lima
       ImageStatus	ImageCounters;
     };
 
+    /// Hits/misses of the per-frame object pools
+    struct LIMACORE_API PoolStats
+    {
+      ObjectPoolStats	DataBuffers;	//!< CtBuffer frame descriptors
+      ObjectPoolStats	SavingData;	//!< CtSaving per-frame data and tasks
+    };
+
     CtControl(HwInterface *hw);
     ~CtControl();
 
@@ -165,6 +207,8 @@ namespace lima
     CtVideo*		video();
     CtShutter* 		shutter();
     CtEvent*		event();
+    CtFrameTrace*	frameTrace();
+    CtSpillTier*	spillTier();
 #ifdef WITH_CONFIG
     CtConfig*		config();
 #endif
@@ -193,6 +237,10 @@ namespace lima
     CtShutter* 		shutter() 		{ return m_ct_shutter; }
     /// Returns a pointer to the event control
     CtEvent* 		event() 		{ return m_ct_event; }
+    /// Returns a pointer to the per-frame stage latency tracing
+    CtFrameTrace*	frameTrace()		{ return m_ct_frame_trace; }
+    /// Returns a pointer to the saving overflow tier
+    CtSpillTier*	spillTier()		{ return m_ct_spill_tier; }
 #ifdef WITH_CONFIG
     /// Returns a pointer to the config control
     CtConfig*		config()		{ return m_ct_config; }
@@ -208,9 +256,15 @@ namespace lima
 
     void getStatus(Status& status) const; // from HW
     void getImageStatus(ImageStatus& status) const;
+    void getPoolStats(PoolStats& stats) const;
+    void getSpillStats(CtSpillTier::Stats& stats) const;
 
     void ReadImage(Data&,long frameNumber = -1, long readBlockLen = 1);
     void ReadBaseImage(Data&,long frameNumber = -1, long readBlockLen = 1);
+    void ReadImageBlock(DataBlock&,long frameNumber = -1,
+			long readBlockLen = 1);
+    void ReadBaseImageBlock(DataBlock&,long frameNumber = -1,
+			    long readBlockLen = 1);
 
     void reset();
     void resetStatus(bool only_acq_status);
@@ -255,6 +309,9 @@ namespace lima
     class _AbortAcqCallback;
     friend class _AbortAcqCallback;
 
+    class _ImageCounters;
+    friend class _ImageCounters;
+
     class ImageStatusThread;
     typedef std::list<ImageStatusThread*>  ImageStatusThreadList;
     typedef std::set<Data,ltData> SortedDataType;
@@ -274,6 +331,8 @@ namespace lima
     CtAccumulation	*m_ct_accumulation;
     CtVideo		*m_ct_video;
     CtEvent		*m_ct_event;
+    CtFrameTrace	*m_ct_frame_trace;
+    CtSpillTier		*m_ct_spill_tier;
 #ifdef WITH_CONFIG
     CtConfig		*m_ct_config;
 #endif
@@ -285,18 +344,15 @@ namespace lima
     bool		m_op_ext_link_task_active;
     bool		m_op_ext_sink_task_active;
 
-    long		m_last_image_compressed;
     long		m_saving_nb_zbuffers;
     long		m_nb_buffers;
 
-    SortedDataType      m_images_acquired;
-    SortedDataType      m_base_images_ready;
-    SortedDataType      m_images_ready;
-    SortedDataType	m_images_compressed;
-    SortedDataType	m_images_saved;
+    _ImageCounters	*m_img_counters;
+    std::atomic<bool>	m_acq_fault;
 
     std::map<int,Data>    m_images_buffer;
     int			  m_images_buffer_size;
+    Mutex		  m_images_buffer_lock;
 
     FrameDim m_last_frame_dim;  //!< Dimension of the actual acquired image
     FrameDim m_last_hw_frame_dim;  //!< Dimension of the actual acquired HW image
@@ -305,27 +361,36 @@ namespace lima
     bool		m_ready;
     bool		m_autosave;
     bool		m_saving_compression;
-    bool		m_running;
+    std::atomic<bool>	m_running;
 #ifdef WITH_SPS_IMAGE
     bool		m_display_active_flag;
 #endif
     ImageStatusThreadList m_img_status_thread_list;
     ReadWriteLock	m_img_status_thread_list_lock;
+    std::atomic<int>	m_img_status_thread_nb;
     SoftOpErrorHandler* m_soft_op_error_handler;
     _ReconstructionChangeCallback* m_reconstruction_cbk;
 
     double		m_prepare_timeout;
 
-    inline bool _checkOverrun(Data&, AutoMutex&);
+    inline bool _checkOverrun(Data&);
     inline void _calcAcqStatus();
     inline void _updateImageStatusThreads(bool force);
+    // must be called with m_cond locked
+    void _setAcqStatus(AcqStatus acq_status)
+    {
+      m_status.AcquisitionStatus = acq_status;
+      m_acq_fault = (acq_status == AcqFault);
+    }
 
-    inline bool _mustSkipProcessing(Data&, AutoMutex&);
+    inline bool _mustSkipProcessing(Data&);
 
     void _stopAcq(bool faulty_acq);
 
     void readBlock(Data&, long frameNumber, long readBlockLen,
 		   bool baseImage);
+    void readBlock(DataBlock&, long frameNumber, long readBlockLen,
+		   bool baseImage);
     void readOneImageBuffer(Data&, long frameNumber, long readBlockLen,
 			    bool baseImage);
     static inline long _increment_image_cnt(Data& aData,
@@ -380,6 +445,16 @@ namespace lima
     return os;
   }
 
+  inline std::ostream& operator<<(std::ostream &os,
+				  const CtControl::PoolStats &stats)
+  {
+    os << "<"
+       << "DataBuffers=" << stats.DataBuffers << ", "
+       << "SavingData=" << stats.SavingData
+       << ">";
+    return os;
+  }
+
   inline bool operator <(const CtControl::ImageStatus& a,
 			 const CtControl::ImageStatus& b)
   {
@@ -0,0 +1,145 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef CTFRAMETRACE_H
+#define CTFRAMETRACE_H
+
+#include "lima/LimaCompatibility.h"
+#include "lima/Debug.h"
+#include "lima/ThreadUtils.h"
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace lima
+{
+  /** @brief per-frame latency of the control stages.
+   *
+   *  When active, each frame is stamped at every stage of the control
+   *  layer. The latency since the first stamp of the frame (HwFrameReady,
+   *  or Acquired with accumulation) is added to a per-stage log-linear
+   *  histogram, and the stamps are kept in a per-thread ring buffer which
+   *  can be exported as a Chrome trace-event JSON (chrome://tracing,
+   *  Perfetto). The ring buffers hold the stamps of the current (or
+   *  last) acquisition, the histograms accumulate until reset().
+   *
+   *  stamp() is lock-free: a relaxed load when inactive, a few relaxed
+   *  atomic increments and a ring buffer entry when active.
+   */
+  class LIMACORE_API CtFrameTrace
+  {
+    DEB_CLASS_NAMESPC(DebModControl,"FrameTrace","Control");
+  public:
+    enum Stage {
+      HwFrameReady,		///< CtBufferFrameCB::newFrameReady
+      Acquired,			///< accepted by CtControl::newFrameReady
+      BaseImageReady,		///< end of the internal soft-op chain
+      ImageReady,		///< end of the external link tasks
+      CounterReady,		///< end of the external sink tasks
+      ImageCompressed,		///< saving compression task done
+      ImageSaved,		///< written by the saving
+      Overrun,			///< processing or saving overrun detected
+      NbStages,
+    };
+
+    /// latency histogram of a stage, in seconds
+    struct LIMACORE_API Histogram
+    {
+      Histogram();
+      void reset();
+
+      /// latency below which percent % of the frames are
+      double getPercentile(double percent) const;
+      /// buckets: 32 per power of 2 (3% resolution) from 1 ns
+      static double getBucketLowerBound(int bucket);
+
+      long long			Count;
+      double			Min;
+      double			Max;
+      double			Mean;
+      std::vector<long>		Buckets;
+    };
+
+    CtFrameTrace();
+    ~CtFrameTrace();
+
+    void setActive(bool active);
+    void getActive(bool& active) const;
+
+    /// @brief stamps kept per thread for the trace export
+    void setRingSize(int nb_stamps);
+    void getRingSize(int& nb_stamps) const;
+
+    /// @brief clear the histograms and the ring buffers
+    void reset();
+
+    void getHistogram(Stage stage,Histogram& histogram) const;
+    void getChromeTrace(std::string& json) const;
+    void dumpChromeTrace(const std::string& filename) const;
+
+    static const char* getStageName(Stage stage);
+
+    void stamp(Stage stage,long frame)
+    {
+      if(m_active.load(std::memory_order_relaxed))
+	_stamp(stage,frame);
+    }
+
+  private:
+    friend class CtControl;
+    class _Tables;
+    class _Ring;
+    struct _Stamp;
+
+    void _prepareAcq();
+    void _stamp(Stage stage,long frame);
+    _Ring* _getRing();
+
+    std::atomic<bool>		m_active;
+    _Tables*			m_tables;
+    mutable Mutex		m_lock;
+    int				m_ring_size;
+    // unique among instances and ring sizes, for the thread caches
+    std::atomic<unsigned long long> m_ring_key;
+    std::vector<_Ring*>		m_rings;
+    std::vector<_Ring*>		m_old_rings;	///< still used by threads
+  };
+
+  inline std::ostream& operator<<(std::ostream& os,CtFrameTrace::Stage stage)
+  {
+    return os << CtFrameTrace::getStageName(stage);
+  }
+
+  inline std::ostream& operator<<(std::ostream& os,
+				  const CtFrameTrace::Histogram& h)
+  {
+    return os << "<"
+	      << "Count=" << h.Count << ", "
+	      << "Min=" << h.Min << ", "
+	      << "Mean=" << h.Mean << ", "
+	      << "P99=" << h.getPercentile(99) << ", "
+	      << "Max=" << h.Max
+	      << ">";
+  }
+}
+
+#endif // CTFRAMETRACE_H
@@ -26,7 +26,9 @@
 
 #include <map>
 #include <list>
+#include <set>
 #include <string>
+#include <vector>
 #include <fstream>
 #include <ios>
 #include <algorithm>
@@ -37,10 +39,12 @@
 #include "lima/CtConfig.h"
 #include "lima/HwSavingCtrlObj.h"
 #include "lima/OrderedMap.h"
+#include "lima/ObjectPool.h"
 
 #include "lima/SidebandData.h"
 #include "lima/BufferHelper.h"
 #include "lima/CtSaving_ZBuffer.h"
+#include "lima/CtSaving_Header.h"
 
 struct Data;
 class TaskEventCallback;
@@ -102,6 +106,12 @@ public:
 		MultiSet,		///< Like append but doesn't use file counter
 	};
 
+	enum StripePolicy
+	{
+		RoundRobin,		///< file N goes to stripe directory N % nb_directories
+		LeastQueue,		///< new file goes to the directory with less running writes
+	};
+
 	struct LIMACORE_API Parameters
 	{
 		DEB_CLASS_NAMESPC(DebModControl, "Saving::Parameters", "Control");
@@ -120,9 +130,16 @@ public:
 		long framesPerFile;	///< the number of images save in one files
 		long everyNFrames; ///< save every N frames (skip the others)
 		long nbframes;
+		/// if not empty, the files are distributed over these directories
+		/// and directory only holds the stripe index file
+		std::vector<std::string> stripeDirectories;
+		StripePolicy stripePolicy;	///< how the files are distributed
+		long stripeMaxWritingTasks;	///< parallel writes per stripe directory, 0 means no limit
 
 		Parameters();
 		void checkValid() const;
+		bool isStriped() const
+		{ return !stripeDirectories.empty(); }
 	};
 
 	typedef std::pair<std::string, std::string> HeaderValue;
@@ -138,6 +155,17 @@ public:
 	void setDirectory(const std::string& directory, int stream_idx = 0);
 	void getDirectory(std::string& directory, int stream_idx = 0) const;
 
+	void setStripeDirectories(const std::vector<std::string>& directories,
+				  int stream_idx = 0);
+	void getStripeDirectories(std::vector<std::string>& directories,
+				  int stream_idx = 0) const;
+
+	void setStripePolicy(StripePolicy policy, int stream_idx = 0);
+	void getStripePolicy(StripePolicy& policy, int stream_idx = 0) const;
+
+	void setStripeMaxWritingTasks(long nb_tasks, int stream_idx = 0);
+	void getStripeMaxWritingTasks(long& nb_tasks, int stream_idx = 0) const;
+
 	void setPrefix(const std::string& prefix, int stream_idx = 0);
 	void getPrefix(std::string& prefix, int stream_idx = 0) const;
 
@@ -211,6 +239,11 @@ public:
 	// --- frame headers
 
 	void updateFrameHeader(long frame_nr, const HeaderMap& header);
+	/// values[i * keys.size() + k] is the value of keys[k] for frame
+	/// first_frame_nr + i
+	void updateFrameHeaders(long first_frame_nr, long nb_frames,
+				const std::vector<std::string>& keys,
+				const std::vector<std::string>& values);
 	void addToFrameHeader(long frame_nr, const HeaderValue& value);
 	void validateFrameHeader(long frame_nr);
 	void getFrameHeader(long frame_nr, HeaderMap& header) const;
@@ -242,6 +275,8 @@ public:
 
 	void setEnableLogStat(bool enable, int stream_idx = 0);
 	void getEnableLogStat(bool& enable, int stream_idx = 0) const;
+
+	void getPoolStats(ObjectPoolStats& stats) const;
 	// --- misc
 
 	void clear();
@@ -273,12 +308,14 @@ public:
 		{
 			FrameParameters() :
 				m_valid(false),
-				m_threadable(false)
+				m_threadable(false),
+				m_stripe(-1)
 			{}
 			FrameParameters(const CtSaving::Parameters& pars) :
 				m_pars(pars),
 				m_valid(true),
-				m_threadable(false)
+				m_threadable(false),
+				m_stripe(-1)
 			{}
 
 			void setParameters(const CtSaving::Parameters& pars)
@@ -293,6 +330,7 @@ public:
 			CtSaving::Parameters	m_pars;
 			bool			m_valid;
 			bool			m_threadable;
+			int			m_stripe; ///< index in stripeDirectories
 		};
 		typedef std::map<long, FrameParameters> Frame2Params;
 		struct Handler
@@ -402,6 +440,13 @@ public:
 		BufferHelper& getZBufferHelper() { return m_zbuffer_helper; }
 		int getNbZBuffers() { return m_nb_zbuffers; }
 
+		/** @brief true if _writeFile only submits the writes:
+		 *  the frame is finished by the last asyncWriteCompleted
+		 */
+		bool isAsyncWrite() const { return m_async_write; }
+		void asyncWriteStart(Data&);
+		void asyncWriteCompleted(Data&);
+
 	protected:
 		virtual void* _open(const std::string& filename,
 			std::ios_base::openmode flags,
@@ -416,6 +461,20 @@ public:
 		virtual bool _hasBuffers(Data& data);
 		virtual void _setBuffers(Data& data, ZBufferList&& buffer);
 		virtual ZBufferList _takeBuffers(Data& data);
+		// @brief true if option is in the '|' separated pars.options
+		static bool _hasOption(const Parameters& pars,
+				       const std::string& option);
+		// @brief VALUE of an OPTION=VALUE pars.options field, or ""
+		static std::string _getOptionValue(const Parameters& pars,
+						   const std::string& option);
+		// @brief full path of the file described by pars
+		static std::string _getFilename(const Parameters& pars);
+		// @brief COMPRESSION_BLOCK_SIZE=<size>[K|M] option, 0 if not set
+		static int _getCompressionBlockSize(const Parameters& pars);
+		// @brief from _writeFile: can the frame writes be asynchronous
+		bool _isAsyncWrite(Data&);
+		// @brief one more pending write, see asyncWriteCompleted
+		void _asyncWriteSubmitted(Data&);
 
 		mutable Cond		m_cond; // wait if opening same handler
 		Mutex&			m_lock;
@@ -424,6 +483,7 @@ public:
 		long			m_frames_to_write;
 		long			m_files_to_write;
 		long			m_written_frames;
+		bool			m_async_write; ///< set by _prepare
 
 	private:
 		friend struct _SavingSidebandData;
@@ -434,6 +494,15 @@ public:
 		typedef std::set<Parameters *> OpeningPars;
 
 		int _getNbRunningTasks() const { return m_running_tasks.size(); }
+		void _writeFinished(Data&);
+		void _runningTaskFinished(long frameId);
+		int _getStripeNbRunningTasks(int stripe) const;
+		int _getStripe(const Parameters& pars) const;
+		bool _isStripeReady(const Parameters& pars) const;
+		void _addStripeIndex(const std::string& index_directory,
+				     const Parameters& pars, int stripe,
+				     long first_frame, long nb_frames);
+		void _truncateStripeIndex(long nb_acquired_frames);
 
 		void _prepareCompressionBuffers(CtControl&);
 
@@ -451,6 +520,9 @@ public:
 		WritingTasks		m_waiting_tasks; ///< waiting tasks
 		WritingTasks		m_running_tasks; ///< running tasks
 		bool			m_last_task_closes_all;
+		std::map<long, int>	m_file_stripes; ///< file number -> stripe
+		Mutex			m_stripe_index_lock;
+		bool			m_stripe_index_started; ///< in this acquisition
 
 		BufferHelper		m_zbuffer_helper;
 		int			m_nb_zbuffers;
@@ -532,7 +604,8 @@ public:
 		}
 		void setActive(bool active);
 
-		void writeFile(Data& data, HeaderMap& header);
+		void writeFile(Data& data, HeaderMap& header,
+			       bool async = false);
 
 		bool hasAutoSaveMode()
 		{
@@ -611,8 +684,10 @@ public:
 		class _SaveCBK;
 		class _SaveTask;
 		class _CompressionCBK;
+		friend class CtSaving;	// _SaveTask pool
 
 		void _prepare();
+		void _checkWriteAccess(const std::string& directory);
 
 		enum ContainerStatus {
 		      Init, Preparing, Prepared, Open,
@@ -643,8 +718,19 @@ private:
 	friend class _NewFrameSaveCBK;
 	class	_SavingErrorHandler;
 	friend class _SavingErrorHandler;
+	class	_SpillThread;
 	typedef std::vector<SinkTaskBase*> TaskList;
-	typedef std::map<long, HeaderMap>	FrameHeaderMap;
+	typedef std::map<long, SavingFrameHeader>	FrameHeaderMap;
+	typedef std::shared_ptr<const HeaderMap>	CommonHeaderRef;
+
+	/// a frame header out of m_frame_headers, HeaderMap built unlocked
+	struct _TakenHeader
+	{
+		CommonHeaderRef		common;
+		SavingFrameHeader	frame;
+
+		void get(HeaderMap& header) const;
+	};
 
 	void _validateFrameHeader(long frame_nr);
 	void _resetReadyFlag();
@@ -658,7 +744,9 @@ private:
 
 	HeaderMap		m_common_header;
 	HeaderMap		m_internal_common_header;
+	CommonHeaderRef		m_common_header_cache;	///< internal + common
 	FrameHeaderMap		m_frame_headers;
+	SavingFrameHeader::KeysRef m_header_keys;	///< per acquisition
 	FrameMap		m_frame_datas;
 	std::pair<long, long>	m_frames_to_save;
 
@@ -672,6 +760,12 @@ private:
 	bool			m_saving_stop;
 	_SavingErrorHandler* m_saving_error_handler;
 
+	// frames still in a HW buffer, when the spill tier is active
+	bool			m_spill_active;	///< set by _prepare
+	std::set<long>		m_pinned_frames;
+	std::atomic<long>	m_oldest_pinned;	///< -1 if none
+	_SpillThread*		m_spill_thread;
+
 	Stream& getStream(int stream_idx)
 	{
 		bool stream_ok = (stream_idx >= 0) && (stream_idx < m_nb_stream);
@@ -708,10 +802,11 @@ private:
 	void _prepare();
 	void _stop();
 	void _close();
-	void _getCommonHeader(HeaderMap&);
+	CommonHeaderRef _getCommonHeader();
+	SavingFrameHeader& _getFrameHeader(long frame_nr);
 	bool _needParallelCompression();
 	bool _needCompression(Data&);
-	void _takeHeader(FrameHeaderMap::iterator&, HeaderMap& header,
+	void _takeHeader(FrameHeaderMap::iterator&, _TakenHeader& header,
 		bool keep_in_map);
 	void _getTaskList(TaskType type, Data& data, const HeaderMap& header,
 		TaskList& task_list, int& priority);
@@ -734,6 +829,14 @@ private:
 	void _eraseFrameData(FrameMap::iterator it);
 	void _clearFrameDatas();
 
+	// --- spill tier
+	bool _isSpillActive() const { return m_spill_active; }
+	long _getLastUnpinnedFrame(long last_image_ready) const;
+	void _pinFrame(long frame_nr);
+	void _unpinFrame(long frame_nr);
+	void _requestSpill();
+	void _spillFrames();
+
 	static const std::string m_saving_data_key;
 	static bool _hasSavingData(Data& data);
 	void _createSavingData(Data& data);
@@ -919,6 +1022,48 @@ inline std::istream& operator >>(std::istream& is,
 	return is;
 }
 
+inline const char* convert_2_string(CtSaving::StripePolicy stripePolicy)
+{
+	const char* aStripePolicyHumanPt;
+	switch (stripePolicy)
+	{
+	case CtSaving::LeastQueue:
+		aStripePolicyHumanPt = "LeastQueue"; break;
+	default:		// RoundRobin
+		aStripePolicyHumanPt = "RoundRobin"; break;
+	}
+	return aStripePolicyHumanPt;
+}
+inline void convert_from_string(const std::string& val,
+	CtSaving::StripePolicy& stripePolicy)
+{
+	std::string buffer = val;
+	std::transform(buffer.begin(), buffer.end(),
+		buffer.begin(), ::tolower);
+
+	if (buffer == "roundrobin") 	stripePolicy = CtSaving::RoundRobin;
+	else if (buffer == "leastqueue")	stripePolicy = CtSaving::LeastQueue;
+	else
+	{
+		std::ostringstream msg;
+		msg << "StripePolicy can't be:" << DEB_VAR1(val);
+		throw LIMA_EXC(Control, InvalidValue, msg.str());
+	}
+}
+inline std::ostream& operator <<(std::ostream& os,
+				 CtSaving::StripePolicy stripePolicy)
+{
+	return os << convert_2_string(stripePolicy);
+}
+inline std::istream& operator >>(std::istream& is,
+				 CtSaving::StripePolicy& stripePolicy)
+{
+	std::string s;
+	is >> s;
+	convert_from_string(s, stripePolicy);
+	return is;
+}
+
 inline const char* convert_2_string(CtSaving::ManagedMode manageMode)
 {
 	const char* aManagedModeHumanPt;
@@ -979,8 +1124,16 @@ inline std::ostream& operator<<(std::ostream& os, const CtSaving::Parameters& pa
 		<< "useHwComp=" << params.useHwComp << ","
 		<< "framesPerFile=" << params.framesPerFile << ", "
 		<< "everyNFrames=" << params.everyNFrames << ", "
-		<< "nbframes=" << params.nbframes
-		<< ">";
+		<< "nbframes=" << params.nbframes;
+	if (params.isStriped()) {
+		os << ", stripeDirectories=[";
+		for (size_t i = 0; i < params.stripeDirectories.size(); ++i)
+			os << (i ? ", " : "") << params.stripeDirectories[i];
+		os << "], "
+			<< "stripePolicy=" << params.stripePolicy << ", "
+			<< "stripeMaxWritingTasks=" << params.stripeMaxWritingTasks;
+	}
+	os << ">";
 	return os;
 }
 
@@ -999,7 +1152,10 @@ inline bool operator ==(const CtSaving::Parameters& a,
 		(a.indexFormat == b.indexFormat) &&
 		(a.framesPerFile == b.framesPerFile) &&
 		(a.everyNFrames == b.everyNFrames) &&
-		(a.nbframes == b.nbframes));
+		(a.nbframes == b.nbframes) &&
+		(a.stripeDirectories == b.stripeDirectories) &&
+		(a.stripePolicy == b.stripePolicy) &&
+		(a.stripeMaxWritingTasks == b.stripeMaxWritingTasks));
 }
 
 inline std::ostream& operator<<(std::ostream& os, const CtSaving::HeaderMap& header)
@@ -32,6 +32,21 @@ namespace lima {
 
   class SaveContainerEdf;
 
+  /** @brief intra-frame parallel compression
+   *
+   *  With a COMPRESSION_BLOCK_SIZE saving option, the frames larger than
+   *  the block size are split in blocks compressed independently by the
+   *  processing threads, then joined in one standard stream: a gzip/zlib
+   *  stream made of flushed deflate blocks, concatenated LZ4 frames or
+   *  bitshuffle blocks. The output does not depend on the number of threads.
+   */
+  namespace BlockCompression
+  {
+    /// @brief number of blocks of data_size, 1 if block_size is 0
+    inline int getNbBlocks(int data_size, int block_size)
+    { return block_size ? (data_size + block_size - 1) / block_size : 1; }
+  }
+
 #ifdef WITH_Z_COMPRESSION 
 #include <zlib.h>
 
@@ -43,9 +58,11 @@ namespace lima {
     CtSaving::HeaderMap 	m_header;
     
     z_stream_s		m_compression_struct;
+    int			m_block_size;
   public:
     FileZCompression(SaveContainerEdf &save_cnt,
-		     const CtSaving::HeaderMap &header);
+		     const CtSaving::HeaderMap &header,
+		     int block_size = 0);
      ~FileZCompression();
 
     ZBufferList compress_header(Data &aData);
@@ -59,6 +76,7 @@ namespace lima {
     void _update_used_size(ZBufferList& return_buffers);
     void _compression(const char *buffer,int size,ZBufferList& return_buffers);
     void _end_compression(ZBufferList& return_buffers);
+    void _block_compression(Data &aData);
   };
 #endif // WITH_Z_COMPRESSION
 
@@ -91,15 +109,18 @@ static const LZ4F_preferences_t lz4_preferences = {
    SaveContainerEdf&		m_container;
    CtSaving::HeaderMap		m_header;
    LZ4F_compressionContext_t	m_ctx;
+   int				m_block_size;
  public:
    FileLz4Compression(SaveContainerEdf &save_cnt,
-		      const CtSaving::HeaderMap &header);
+		      const CtSaving::HeaderMap &header,
+		      int block_size = 0);
    ~FileLz4Compression();
 
    ZBufferList compress_header(Data &aData);
    virtual void process(Data &aData);
 
    void _compression(const char *src,size_t size,ZBufferList& return_buffers);
+   void _block_compression(Data &aData,ZBufferList& return_buffers);
  };
 #endif // WITH_LZ4_COMPRESSION
 
@@ -110,13 +131,14 @@ class ImageBsCompression: public SinkTaskBase
   DEB_CLASS_NAMESPC(DebModControl, "Image BS/LZ4 Compression Task", "Control");
 
   CtSaving::SaveContainer&	m_container;
+  int				m_block_size;
 
  public:
-  ImageBsCompression(CtSaving::SaveContainer &save_cnt);
+  ImageBsCompression(CtSaving::SaveContainer &save_cnt, int block_size = 0);
   ~ImageBsCompression();
   static int calcBufferSize(int data_size, int data_depth);
   virtual void process(Data &aData);
-  void _compression(const char *buffer,int size,int depth,ZBufferList& return_buffers);
+  void _compression(Data &aData,ZBufferList& return_buffers);
 };
 #endif // WITH_BS_COMPRESSION 
 
@@ -129,13 +151,15 @@ class ImageZCompression: public SinkTaskBase
   
   CtSaving::SaveContainer& 	m_container;
   int                              m_compression_level;
+  int                              m_block_size;
  public:
   ImageZCompression(CtSaving::SaveContainer &save_cnt,
-	       int level);
+	       int level, int block_size = 0);
   ~ImageZCompression();
-  static int calcBufferSize(int data_size, int data_depth);
+  static int calcBufferSize(int data_size, int data_depth,
+			    int block_size = 0);
   virtual void process(Data &aData);
-  void _compression(const char *buffer,int size,ZBufferList& return_buffers);
+  void _compression(Data &aData,ZBufferList& return_buffers);
 };
 #endif // WITH_Z_COMPRESSION
 
@@ -0,0 +1,97 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+#ifndef CTSAVING_HEADER_H
+#define CTSAVING_HEADER_H
+
+#include "lima/LimaCompatibility.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace lima {
+
+/// Keys of the frame headers, interned once per acquisition:
+/// the frame headers only keep the key id and a pointer to its name
+class LIMACORE_API SavingHeaderKeys
+{
+public:
+  struct Key
+  {
+    const std::string *name;
+    unsigned id;
+  };
+
+  Key intern(const std::string& name);
+  int size() const { return int(m_ids.size()); }
+
+private:
+  // node-based: the names never move, they can be read without lock
+  std::unordered_map<std::string, unsigned> m_ids;
+};
+
+/// Frame header with interned keys, all the values of the frame are
+/// packed in a single string
+class LIMACORE_API SavingFrameHeader
+{
+public:
+  typedef std::map<std::string, std::string> HeaderMap;
+  typedef std::shared_ptr<SavingHeaderKeys> KeysRef;
+
+  SavingFrameHeader(KeysRef keys = KeysRef()) : m_dead_size(0), m_keys(keys) {}
+
+  bool empty() const { return m_entries.empty(); }
+  int size() const { return int(m_entries.size()); }
+
+  /// an existing value is only overwritten if replace is true
+  void set(const SavingHeaderKeys::Key& key, const std::string& value,
+	   bool replace = true);
+  void set(const std::string& name, const std::string& value,
+	   bool replace = true);
+  void update(const HeaderMap& header, bool replace = true);
+
+  /// add the values to header, overwriting the existing ones if replace
+  void get(HeaderMap& header, bool replace = true) const;
+
+private:
+  struct Entry
+  {
+    unsigned id;
+    unsigned offset;
+    unsigned len;
+    const std::string *name;
+  };
+
+  void _compact();
+
+  std::vector<Entry> m_entries;	///< sorted by key id
+  std::string m_values;
+  size_t m_dead_size;		///< overwritten values in m_values
+  KeysRef m_keys;		///< keeps the key names alive
+};
+
+} // namespace lima
+
+#endif // CTSAVING_HEADER_H
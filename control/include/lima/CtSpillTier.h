@@ -0,0 +1,132 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef CTSPILLTIER_H
+#define CTSPILLTIER_H
+
+#include "lima/LimaCompatibility.h"
+#include "lima/Debug.h"
+#include "lima/ThreadUtils.h"
+#include "lima/Timestamp.h"
+
+#include "processlib/Data.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+namespace lima
+{
+  /** @brief overflow tier for the frames waiting to be saved.
+   *
+   *  When the unsaved frames hold more than the high-water mark of the
+   *  hardware buffer ring, the frames queued in CtSaving are copied into
+   *  a memory-mapped scratch file (ideally on a local NVMe) and their
+   *  hardware buffer is released. The saving streams then read the
+   *  frames from the scratch file, and the SaveOverun fault is only
+   *  raised when the tier is full too.
+   *
+   *  The scratch file is created (and immediately unlinked) in the
+   *  directory at prepareAcq, with the blocks allocated up-front so that
+   *  a full disk is reported there and not while spilling. The tier is
+   *  disabled with an empty directory or a null size (default).
+   */
+  class LIMACORE_API CtSpillTier
+  {
+    DEB_CLASS_NAMESPC(DebModControl,"SpillTier","Control");
+  public:
+    /// tier activity since the last prepareAcq
+    struct LIMACORE_API Stats
+    {
+      Stats();
+
+      bool		Enabled;
+      long		NbSlots;	///< frames the scratch file can hold
+      long		Occupancy;	///< spilled frames not saved yet
+      long		PeakOccupancy;
+      long		NbSpilled;
+      long		NbRefused;	///< frames not spilled: tier full, frame too large
+      double		SpillRate;	///< spilled frames per second
+      double		PeakRingUsage;	///< max % of the HW ring not saved
+    };
+
+    CtSpillTier();
+    ~CtSpillTier();
+
+    /// @brief scratch file directory, empty to disable the tier
+    void setDirectory(const std::string& directory);
+    void getDirectory(std::string& directory) const;
+
+    /// @brief scratch file size in MB, 0 to disable the tier
+    void setMaxSize(long size_mb);
+    void getMaxSize(long& size_mb) const;
+
+    /// @brief % of the HW ring held by unsaved frames starting the spill
+    void setHighWaterMark(double percent);
+    void getHighWaterMark(double& percent) const;
+
+    bool isEnabled() const;
+    void getStats(Stats& stats) const;
+
+    // --- from control
+    /// @brief (re)create the scratch file and reset the statistics
+    void prepare(long frame_mem_size,long nb_buffers);
+    /// @brief copy the frame into the tier and release its buffer
+    bool spill(Data& data);
+    /// @brief record the unsaved frames, true if above the high-water mark
+    bool checkRingUsage(long nb_frames);
+
+  private:
+    class _Scratch;
+
+    mutable Mutex		m_lock;
+    std::string			m_directory;
+    long			m_max_size;
+    double			m_high_water_mark;
+
+    std::shared_ptr<_Scratch>	m_scratch;	///< kept by spilled buffers
+    bool			m_active;	///< set by prepare
+    long			m_nb_buffers;
+    long			m_high_water_frames;
+    Timestamp			m_start;
+    std::atomic<long>		m_peak_occupancy;
+    std::atomic<long>		m_nb_spilled;
+    std::atomic<long>		m_nb_refused;
+    std::atomic<long>		m_peak_ring_frames;
+  };
+
+  inline std::ostream& operator<<(std::ostream& os,
+				  const CtSpillTier::Stats& s)
+  {
+    return os << "<"
+	      << "Enabled=" << s.Enabled << ", "
+	      << "NbSlots=" << s.NbSlots << ", "
+	      << "Occupancy=" << s.Occupancy << ", "
+	      << "PeakOccupancy=" << s.PeakOccupancy << ", "
+	      << "NbSpilled=" << s.NbSpilled << ", "
+	      << "NbRefused=" << s.NbRefused << ", "
+	      << "SpillRate=" << s.SpillRate << ", "
+	      << "PeakRingUsage=" << s.PeakRingUsage
+	      << ">";
+  }
+}
+
+#endif // CTSPILLTIER_H
@@ -124,6 +124,10 @@ namespace lima
     void setBin(const Bin &aBin);
     void getBin(Bin &aBin) const;
 
+    /// @brief limit the conversion rate of the acquired frames (0: no limit)
+    void setMaxImageRate(double rate);
+    void getMaxImageRate(double &rate) const;
+
     // --- images
     void getLastImage(Image &anImage) const;
     void getLastImageCounter(long long &anImageCounter) const;
@@ -142,13 +146,16 @@ namespace lima
     void frameReady(Data&);	// callback from CtControl
 
     void _setLive(bool);
-    void _data_2_image(Data &aData,Bin &aBin,Roi &aRoi);
+    void _data_2_image(Data &aData,AutoMutex &aLock);
     void _data2image_finnished(Data&);
+    VideoImage* _get_write_image(bool wait_for_image = true);
+    bool _publish_image(VideoImage *anImage);
     void _apply_params(AutoMutex &,bool = false);
     void _read_hw_params();
     void _check_video_mode(VideoMode);
     void _prepareAcq();
     void _startAcqTime();
+    void _acqFinished();
 #ifdef WITH_CONFIG
     class _ConfigHandler;
     CtConfig::ModuleTypeCallback* _getConfigHandler();
@@ -158,7 +165,10 @@ namespace lima
     int			m_pars_modify_mask;
     bool 		m_has_video;
     bool		m_ready_flag;
+    double		m_max_image_rate;
+    Timestamp		m_last_image_time;
     Data		m_last_data;
+    Data		m_skipped_data;	///< latest frame dropped by the rate
     _Data2ImageTask*	m_data_2_image_task;
     _Data2ImageCBK*	m_data_2_image_cb;
     HwVideoCtrlObj* 	m_video;
@@ -167,6 +177,7 @@ namespace lima
     long long		m_image_counter;
     mutable VideoImage*	m_read_image;
     mutable VideoImage*	m_write_image;
+    VideoImage*		m_spare_image;	///< reused when read is busy
     ImageCallback*	m_image_callback;
     _InternalImageCBK*	m_internal_image_callback;
     CtControl&		m_ct;
@@ -40,6 +40,8 @@
 
 namespace lima
 {
+  class RoiCounterEngine;
+
   class LIMACORE_API SoftOpBaseClass
   {
     friend class SoftOpExternalMgr;
@@ -338,10 +340,15 @@ namespace lima
     {
       for (NameMapIterator i = begin(); i != end(); ++i)
 	aMgr.addSinkTask(stage, i->second.second);
-      ++m_counter_status;
+      incCounterStatus();
       return !m_manager_tasks.empty();
     }
 
+    void incCounterStatus()
+    {
+      ++m_counter_status;
+    }
+
     int getCounterStatus() const
     {
       return m_counter_status;
@@ -411,6 +418,12 @@ namespace lima
 
     void getOverflowThreshold(unsigned long long& threshold);
     void setOverflowThreshold(unsigned long long threshold);
+
+    /** @brief compute all the ROIs in a single task, reading each frame
+     *  once. Not used when an overflow threshold is set.
+     */
+    void setFusedEngine(bool fused);
+    void getFusedEngine(bool& fused) const;
     
   protected:
     virtual bool addTo(TaskMgr&,int stage);
@@ -435,6 +448,8 @@ namespace lima
     Data			m_mask;
     mutable Cond		m_cond;
     unsigned long long 		m_overflow_threshold;
+    RoiCounterEngine*		m_engine;
+    bool			m_fused;
   };
 
   template <SoftOpRoiCounter::SoftTask::type type, class R>
@@ -55,6 +55,7 @@ namespace lima
 
     void addTo(TaskMgr&,int&,bool registerCallback = true,
 	       bool skipReconstruction = false) const;
+    bool hasTasks(bool skipReconstruction = false) const;
 
     void setEndCallback(TaskEventCallback *aCbk)
     {
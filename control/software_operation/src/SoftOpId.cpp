@@ -20,6 +20,7 @@
 // along with this program; if not, see <http://www.gnu.org/licenses/>.
 //###########################################################################
 #include "lima/SoftOpId.h"
+#include "SoftOpRoiCounterEngine.h"
 using namespace lima;
 #include "processlib/BackgroundSubstraction.h"
 
@@ -237,13 +238,16 @@ bool SoftOpMask::addTo(TaskMgr &aMgr,int stage)
 SoftOpRoiCounter::SoftOpRoiCounter() : 
   SoftOpBaseClass(),
   m_history_size(DEFAULT_HISTORY_SIZE),
-  m_overflow_threshold(0)
+  m_overflow_threshold(0),
+  m_engine(new RoiCounterEngine()),
+  m_fused(false)
 {
   m_task_manager.setCompatFormat("roi_%d");
 }
 
 SoftOpRoiCounter::~SoftOpRoiCounter()
 {
+  delete m_engine;
 }
 
 void SoftOpRoiCounter::updateRois(const std::list<RoiNameAndRoi> &named_rois)
@@ -260,6 +264,7 @@ void SoftOpRoiCounter::updateRois(const std::list<RoiNameAndRoi> &named_rois)
       const Size &aSize = i->second.getSize();
       aCounterTaskPt->setRoi(aOri.x,aOri.y,aSize.getWidth(),aSize.getHeight());
       aCounterTaskPt->setMask(m_mask);
+      m_engine->setRoi(i->first,aCounterMgrPt,i->second);
     }
 }
 void SoftOpRoiCounter::updateArcRois(const std::list<RoiNameAndArcRoi>& named_arc)
@@ -283,6 +288,7 @@ void SoftOpRoiCounter::updateArcRois(const std::list<RoiNameAndArcRoi>& named_ar
 				 rayon1,rayon2,
 				 start,end);
       aCounterTaskPt->setMask(m_mask);
+      m_engine->setArcRoi(i->first,aCounterMgrPt,i->second);
     }
 }
 void SoftOpRoiCounter::setLut(const std::string& name,
@@ -294,6 +300,7 @@ void SoftOpRoiCounter::setLut(const std::string& name,
   _get_or_create(name,aCounterMgrPt,aCounterTaskPt);
   aCounterTaskPt->setLut(origin.x,origin.y,lut);
   aCounterTaskPt->setMask(m_mask);
+  m_engine->setLut(name,aCounterMgrPt,origin,lut);
 }
 void SoftOpRoiCounter::setLutMask(const std::string& name,
 				  const Point& origin,Data& mask)
@@ -304,6 +311,7 @@ void SoftOpRoiCounter::setLutMask(const std::string& name,
   _get_or_create(name,aCounterMgrPt,aCounterTaskPt);
   aCounterTaskPt->setLutMask(origin.x,origin.y,mask);
   aCounterTaskPt->setMask(m_mask);
+  m_engine->setLutMask(name,aCounterMgrPt,origin,mask);
 }
 void SoftOpRoiCounter::getRois(std::list<RoiNameAndRoi>& names_rois) const
 {
@@ -339,6 +347,7 @@ void SoftOpRoiCounter::getNames(std::list<std::string>& roi_names) const
 void SoftOpRoiCounter::removeRois(const std::list<std::string>& names)
 {
   AutoMutex aLock(m_cond.mutex());
+  m_engine->remove(names);
   m_task_manager.remove(names);
 }
 
@@ -347,6 +356,7 @@ void SoftOpRoiCounter::removeRois(const std::list<std::string>& names)
 void SoftOpRoiCounter::clearAllRois()
 {
   AutoMutex aLock(m_cond.mutex());
+  m_engine->clearAll();
   m_task_manager.clearAll();
 }
 
@@ -373,6 +383,7 @@ void SoftOpRoiCounter::setMask(Data& aMask)
   for(NameMapIterator i = m_task_manager.begin();
        i != m_task_manager.end();++i)
       i->second.second->setMask(aMask);
+  m_engine->setMask(aMask);
   m_mask = aMask;
 }
 
@@ -407,6 +418,12 @@ void SoftOpRoiCounter::readCounters(int from,
 bool SoftOpRoiCounter::addTo(TaskMgr &aMgr,int stage)
 {
   AutoMutex aLock(m_cond.mutex());
+  // the fused engine does not check the overflow threshold
+  if(m_fused && !m_overflow_threshold && !m_task_manager.empty()) {
+    m_engine->addTo(aMgr, stage);
+    m_task_manager.incCounterStatus();
+    return true;
+  }
   return m_task_manager.addTo(aMgr, stage);
 }
 
@@ -448,6 +465,18 @@ void SoftOpRoiCounter::setOverflowThreshold(unsigned long long threshold)
 
   m_overflow_threshold = threshold;
 }
+
+void SoftOpRoiCounter::setFusedEngine(bool fused)
+{
+  AutoMutex aLock(m_cond.mutex());
+  m_fused = fused;
+}
+
+void SoftOpRoiCounter::getFusedEngine(bool& fused) const
+{
+  AutoMutex aLock(m_cond.mutex());
+  fused = m_fused;
+}
 //-------------------- ROI TO SPECTRUM --------------------
 
 SoftOpRoi2Spectrum::SoftOpRoi2Spectrum() : 
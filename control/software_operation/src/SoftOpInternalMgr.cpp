@@ -109,6 +109,17 @@ bool SoftOpInternalMgr::hasReconstructionTask()
   return (m_reconstruction_task!=NULL);
 }
 
+/** @brief true if addTo would add at least one task
+ */
+bool SoftOpInternalMgr::hasTasks(bool skipReconstruction) const
+{
+  return ((m_reconstruction_task && !skipReconstruction) ||
+	  m_bin.getX() > 1 || m_bin.getY() > 1 ||
+	  m_flip.x || m_flip.y ||
+	  m_rotation != Rotation_0 ||
+	  m_roi.isActive());
+}
+
 void SoftOpInternalMgr::addTo(TaskMgr &aTaskMgr,
 			      int &aLastStage,
 			      bool registerCallback,
@@ -0,0 +1,637 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include "SoftOpRoiCounterEngine.h"
+
+#include "processlib/PoolThreadMgr.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <vector>
+
+using namespace lima;
+
+namespace
+{
+  // below this number of pixels in the ROIs, no band splitting
+  const long MIN_BAND_PIXELS = 1 << 19;
+
+  struct Span
+  {
+    int		roi;
+    int		x;
+    int		len;
+    long	weights;	// index in the weight table, -1 if none
+  };
+
+  struct Acc
+  {
+    double	sum;
+    double	sum2;
+    double	min;
+    double	max;
+    long long	nb;
+
+    Acc() : sum(0), sum2(0),
+	    min(std::numeric_limits<double>::infinity()),
+	    max(-std::numeric_limits<double>::infinity()),
+	    nb(0) {}
+
+    void merge(const Acc& o)
+    {
+      sum += o.sum;
+      sum2 += o.sum2;
+      min = std::min(min, o.min);
+      max = std::max(max, o.max);
+      nb += o.nb;
+    }
+  };
+  typedef std::vector<Acc> AccList;
+
+  // exact integer sums for the small types, the loops then vectorize
+  template <class T> struct acc_traits
+  { typedef double sum; typedef double sum2; };
+#define ROI_ACC_INT_TRAITS(T, Q)				\
+  template <> struct acc_traits<T>				\
+  { typedef long long sum; typedef Q sum2; }
+  ROI_ACC_INT_TRAITS(unsigned char, unsigned long long);
+  ROI_ACC_INT_TRAITS(char, unsigned long long);
+  ROI_ACC_INT_TRAITS(unsigned short, unsigned long long);
+  ROI_ACC_INT_TRAITS(short, unsigned long long);
+  ROI_ACC_INT_TRAITS(unsigned int, double);
+  ROI_ACC_INT_TRAITS(int, double);
+#undef ROI_ACC_INT_TRAITS
+
+  template <class T>
+  inline void acc_span(const T *p, int len, Acc& a)
+  {
+    typedef typename acc_traits<T>::sum S;
+    typedef typename acc_traits<T>::sum2 Q;
+    S sum = 0;
+    Q sum2 = 0;
+    T vmin = p[0], vmax = p[0];
+    for(int i = 0; i < len; ++i) {
+      T v = p[i];
+      sum += v;
+      sum2 += Q(v) * Q(v);
+      vmin = std::min(vmin, v);
+      vmax = std::max(vmax, v);
+    }
+    a.sum += double(sum);
+    a.sum2 += double(sum2);
+    a.min = std::min(a.min, double(vmin));
+    a.max = std::max(a.max, double(vmax));
+    a.nb += len;
+  }
+
+  template <class T>
+  inline void acc_weighted_span(const T *p, const double *w, int len, Acc& a)
+  {
+    double sum = 0, sum2 = 0;
+    double vmin = a.min, vmax = a.max;
+    for(int i = 0; i < len; ++i) {
+      double v = p[i] * w[i];
+      sum += v;
+      sum2 += v * v;
+      vmin = std::min(vmin, v);
+      vmax = std::max(vmax, v);
+    }
+    a.sum += sum;
+    a.sum2 += sum2;
+    a.min = vmin;
+    a.max = vmax;
+    a.nb += len;
+  }
+
+  // value of a LUT or mask pixel
+  inline double get_pixel(const Data& d, long i)
+  {
+    const void *p = d.data();
+    switch(d.type) {
+    case Data::UINT8:  return ((const unsigned char *) p)[i];
+    case Data::INT8:   return ((const char *) p)[i];
+    case Data::UINT16: return ((const unsigned short *) p)[i];
+    case Data::INT16:  return ((const short *) p)[i];
+    case Data::UINT32: return ((const unsigned int *) p)[i];
+    case Data::INT32:  return ((const int *) p)[i];
+    case Data::UINT64: return double(((const unsigned long long *) p)[i]);
+    case Data::INT64:  return double(((const long long *) p)[i]);
+    case Data::FLOAT:  return ((const float *) p)[i];
+    case Data::DOUBLE: return ((const double *) p)[i];
+    default:           return 0;
+    }
+  }
+}
+
+/*******************************************************************
+ * \brief the row bands of a frame, shared with the helper threads
+ *******************************************************************/
+class _RoiBandJob
+{
+public:
+  typedef std::function<void(int band)> BandFunc;
+
+  _RoiBandJob(const BandFunc& func, int nb_bands) :
+    m_func(func), m_nb_bands(nb_bands), m_next_band(0), m_nb_done(0)
+  {}
+
+  bool processNextBand()
+  {
+    int band = m_next_band++;
+    if(band >= m_nb_bands)
+      return false;
+    m_func(band);
+    AutoMutex aLock(m_cond.mutex());
+    if(++m_nb_done == m_nb_bands)
+      m_cond.broadcast();
+    return true;
+  }
+
+  void waitAllBands()
+  {
+    AutoMutex aLock(m_cond.mutex());
+    while(m_nb_done < m_nb_bands)
+      m_cond.wait();
+  }
+
+private:
+  BandFunc		m_func;
+  int			m_nb_bands;
+  std::atomic<int>	m_next_band;
+  Cond			m_cond;
+  int			m_nb_done;
+};
+
+class _RoiBandTask : public SinkTaskBase
+{
+public:
+  _RoiBandTask(std::shared_ptr<_RoiBandJob> job) : m_job(job) {}
+
+  virtual void process(Data&)
+  {
+    while(m_job->processNextBand())
+      continue;
+  }
+
+private:
+  std::shared_ptr<_RoiBandJob> m_job;
+};
+
+/*******************************************************************
+ * \brief immutable copy of the ROIs, used by the sink tasks
+ *******************************************************************/
+class RoiCounterEngine::Snapshot
+{
+  DEB_CLASS_NAMESPC(DebModControl,"RoiCounterEngine::Snapshot",
+		    "SoftOpRoiCounter");
+public:
+  Snapshot(const std::map<std::string,RoiDef>& rois,const Data& mask);
+  ~Snapshot();
+
+  void process(Data& frame);
+
+private:
+  struct SpanTable
+  {
+    int			width;
+    int			height;
+    std::vector<Span>	spans;
+    std::vector<long>	row_first;	// height + 1 entries
+    std::vector<double>	weights;
+    long		nb_pixels;
+  };
+  typedef std::shared_ptr<const SpanTable> SpanTablePtr;
+
+  SpanTablePtr _getSpans(int width,int height);
+  void _compile(SpanTable& table);
+
+  template <class T>
+  void _accRows(const T *frame,const SpanTable& table,
+		int first_row,int end_row,AccList& accs);
+  void _accRows(Data& frame,const SpanTable& table,
+		int first_row,int end_row,AccList& accs);
+
+  std::vector<RoiDef>	m_rois;
+  Data			m_mask;
+  Mutex			m_mutex;
+  SpanTablePtr		m_spans;
+};
+
+RoiCounterEngine::Snapshot::Snapshot(const std::map<std::string,RoiDef>& rois,
+				     const Data& mask) :
+  m_mask(mask)
+{
+  DEB_CONSTRUCTOR();
+  std::map<std::string,RoiDef>::const_iterator i;
+  for(i = rois.begin(); i != rois.end(); ++i) {
+    m_rois.push_back(i->second);
+    m_rois.back().mgr->ref();
+  }
+  DEB_TRACE() << "nb_rois=" << m_rois.size();
+}
+
+RoiCounterEngine::Snapshot::~Snapshot()
+{
+  DEB_DESTRUCTOR();
+  for(std::vector<RoiDef>::iterator i = m_rois.begin(); i != m_rois.end(); ++i)
+    i->mgr->unref();
+}
+
+RoiCounterEngine::Snapshot::SpanTablePtr
+RoiCounterEngine::Snapshot::_getSpans(int width,int height)
+{
+  DEB_MEMBER_FUNCT();
+
+  AutoMutex aLock(m_mutex);
+  if(!m_spans || (m_spans->width != width) || (m_spans->height != height)) {
+    std::shared_ptr<SpanTable> table = std::make_shared<SpanTable>();
+    table->width = width;
+    table->height = height;
+    _compile(*table);
+    m_spans = table;
+  }
+  return m_spans;
+}
+
+/** @brief convert all the ROIs into row-ordered runs of selected pixels
+ */
+void RoiCounterEngine::Snapshot::_compile(SpanTable& table)
+{
+  DEB_MEMBER_FUNCT();
+
+  int width = table.width, height = table.height;
+  const unsigned char *mask = NULL;
+  std::vector<unsigned char> mask_bits;
+  if(m_mask.data()) {
+    if((m_mask.dimensions.size() != 2) || (m_mask.dimensions[0] != width) ||
+       (m_mask.dimensions[1] != height))
+      DEB_WARNING() << "Mask size does not match the frame: ignored";
+    else {
+      mask_bits.resize(long(width) * height);
+      for(long i = 0; i < long(mask_bits.size()); ++i)
+	mask_bits[i] = (get_pixel(m_mask, i) != 0);
+      mask = mask_bits.data();
+    }
+  }
+
+  std::vector<std::vector<Span> > rows(height);
+  std::vector<unsigned char> sel;
+  std::vector<double> row_weights;
+  table.nb_pixels = 0;
+
+  // emit the runs of selected pixels in [x0,x1) of row y
+  auto add_runs = [&](int roi, int y, int x0, int x1, const double *w) {
+    for(int x = x0; x < x1;) {
+      while((x < x1) && (!sel[x - x0] || (mask && !mask[long(y) * width + x])))
+	++x;
+      int start = x;
+      while((x < x1) && sel[x - x0] && (!mask || mask[long(y) * width + x]))
+	++x;
+      if(x == start)
+	continue;
+      Span span = {roi, start, x - start, -1};
+      if(w) {
+	span.weights = table.weights.size();
+	table.weights.insert(table.weights.end(), w + (start - x0), w + (x - x0));
+      }
+      rows[y].push_back(span);
+      table.nb_pixels += span.len;
+    }
+  };
+
+  for(int roi = 0; roi < int(m_rois.size()); ++roi) {
+    const RoiDef& def = m_rois[roi];
+    int x0, y0, x1, y1;	// ROI area, before clipping
+    switch(def.type) {
+    case SQUARE: {
+      x0 = def.roi.getTopLeft().x;
+      y0 = def.roi.getTopLeft().y;
+      x1 = x0 + def.roi.getSize().getWidth();
+      y1 = y0 + def.roi.getSize().getHeight();
+    } break;
+    case ARC: {
+      double cx, cy, r1, r2;
+      def.arc.getCenter(cx, cy);
+      def.arc.getRayons(r1, r2);
+      double r = std::max(r1, r2);
+      x0 = int(std::floor(cx - r));
+      y0 = int(std::floor(cy - r));
+      x1 = int(std::ceil(cx + r)) + 1;
+      y1 = int(std::ceil(cy + r)) + 1;
+    } break;
+    default: {
+      x0 = def.origin.x;
+      y0 = def.origin.y;
+      x1 = x0 + def.lut.dimensions[0];
+      y1 = y0 + def.lut.dimensions[1];
+    } break;
+    }
+    int cx0 = std::max(x0, 0), cx1 = std::min(x1, width);
+    int cy0 = std::max(y0, 0), cy1 = std::min(y1, height);
+    if((cx0 >= cx1) || (cy0 >= cy1))
+      continue;
+
+    sel.assign(cx1 - cx0, 1);
+    for(int y = cy0; y < cy1; ++y) {
+      const double *w = NULL;
+      if(def.type == ARC) {
+	double cx, cy, r1, r2, start, end;
+	def.arc.getCenter(cx, cy);
+	def.arc.getRayons(r1, r2);
+	def.arc.getAngles(start, end);
+	double rmin = std::min(r1, r2), rmax = std::max(r1, r2);
+	bool full = (end - start >= 360.);
+	double dy = y - cy;
+	for(int x = cx0; x < cx1; ++x) {
+	  double dx = x - cx;
+	  double r = std::sqrt(dx * dx + dy * dy);
+	  bool in = (r >= rmin) && (r <= rmax);
+	  if(in && !full) {
+	    double angle = std::atan2(dy, dx) * 180. / M_PI;
+	    angle = start + std::fmod(std::fmod(angle - start, 360.) + 360., 360.);
+	    in = (angle <= end);
+	  }
+	  sel[x - cx0] = in;
+	}
+      } else if((def.type == LUT) || (def.type == LUT_MASK)) {
+	long lut_row = long(y - y0) * (x1 - x0) - x0;
+	if(def.type == LUT) {
+	  row_weights.resize(cx1 - cx0);
+	  for(int x = cx0; x < cx1; ++x)
+	    row_weights[x - cx0] = get_pixel(def.lut, lut_row + x);
+	  w = row_weights.data();
+	} else {
+	  for(int x = cx0; x < cx1; ++x)
+	    sel[x - cx0] = (get_pixel(def.lut, lut_row + x) != 0);
+	}
+      }
+      add_runs(roi, y, cx0, cx1, w);
+    }
+  }
+
+  // flatten, each row sorted by x for a sequential read of the frame
+  table.row_first.resize(height + 1);
+  for(int y = 0; y < height; ++y) {
+    std::vector<Span>& row = rows[y];
+    std::stable_sort(row.begin(), row.end(),
+		     [](const Span& a, const Span& b) { return a.x < b.x; });
+    table.row_first[y] = table.spans.size();
+    table.spans.insert(table.spans.end(), row.begin(), row.end());
+  }
+  table.row_first[height] = table.spans.size();
+
+  DEB_TRACE() << "nb_spans=" << table.spans.size() << ", "
+	      << "nb_pixels=" << table.nb_pixels;
+}
+
+template <class T>
+void RoiCounterEngine::Snapshot::_accRows(const T *frame,
+					  const SpanTable& table,
+					  int first_row,int end_row,
+					  AccList& accs)
+{
+  const Span *spans = table.spans.data();
+  const double *weights = table.weights.data();
+  for(int y = first_row; y < end_row; ++y) {
+    const T *row = frame + long(y) * table.width;
+    for(long s = table.row_first[y]; s < table.row_first[y + 1]; ++s) {
+      const Span& span = spans[s];
+      if(span.weights < 0)
+	acc_span(row + span.x, span.len, accs[span.roi]);
+      else
+	acc_weighted_span(row + span.x, weights + span.weights, span.len,
+			  accs[span.roi]);
+    }
+  }
+}
+
+void RoiCounterEngine::Snapshot::_accRows(Data& frame,const SpanTable& table,
+					  int first_row,int end_row,
+					  AccList& accs)
+{
+  void *p = frame.data();
+  switch(frame.type) {
+  case Data::UINT8:
+    _accRows((const unsigned char *) p, table, first_row, end_row, accs); break;
+  case Data::INT8:
+    _accRows((const char *) p, table, first_row, end_row, accs); break;
+  case Data::UINT16:
+    _accRows((const unsigned short *) p, table, first_row, end_row, accs); break;
+  case Data::INT16:
+    _accRows((const short *) p, table, first_row, end_row, accs); break;
+  case Data::UINT32:
+    _accRows((const unsigned int *) p, table, first_row, end_row, accs); break;
+  case Data::INT32:
+    _accRows((const int *) p, table, first_row, end_row, accs); break;
+  case Data::UINT64:
+    _accRows((const unsigned long long *) p, table, first_row, end_row, accs);
+    break;
+  case Data::INT64:
+    _accRows((const long long *) p, table, first_row, end_row, accs); break;
+  case Data::FLOAT:
+    _accRows((const float *) p, table, first_row, end_row, accs); break;
+  case Data::DOUBLE:
+    _accRows((const double *) p, table, first_row, end_row, accs); break;
+  default:
+    break;
+  }
+}
+
+void RoiCounterEngine::Snapshot::process(Data& frame)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(frame.frameNumber);
+
+  if((frame.dimensions.size() != 2) || (frame.type == Data::UNDEF)) {
+    DEB_ERROR() << "Invalid frame " << frame.frameNumber;
+    return;
+  }
+  int width = frame.dimensions[0], height = frame.dimensions[1];
+  SpanTablePtr table = _getSpans(width, height);
+  int nb_rois = m_rois.size();
+
+  PoolThreadMgr& pool = PoolThreadMgr::get();
+  int nb_bands = 1;
+  if(table->nb_pixels >= MIN_BAND_PIXELS)
+    nb_bands = std::max(1, std::min(pool.getNumberOfThread(), height));
+
+  std::vector<AccList> band_accs(nb_bands, AccList(nb_rois));
+  if(nb_bands == 1) {
+    _accRows(frame, *table, 0, height, band_accs[0]);
+  } else {
+    const SpanTable& t = *table;
+    auto band_func = [&](int band) {
+      int first_row = height * band / nb_bands;
+      int end_row = height * (band + 1) / nb_bands;
+      _accRows(frame, t, first_row, end_row, band_accs[band]);
+    };
+    std::shared_ptr<_RoiBandJob> job(new _RoiBandJob(band_func, nb_bands));
+    for(int i = 0; i < nb_bands - 1; ++i) {
+      _RoiBandTask *task = new _RoiBandTask(job);
+      TaskMgr *mgr = new TaskMgr();
+      mgr->addSinkTask(0, task);
+      task->unref();
+      mgr->setInputData(frame);
+      pool.addProcess(mgr);
+    }
+    // the helpers arriving late find nothing left to do
+    while(job->processNextBand())
+      continue;
+    job->waitAllBands();
+  }
+
+  for(int roi = 0; roi < nb_rois; ++roi) {
+    Acc acc;
+    for(int band = 0; band < nb_bands; ++band)
+      acc.merge(band_accs[band][roi]);
+
+    Tasks::RoiCounterResult result;
+    result.frameNumber = frame.frameNumber;
+    if(acc.nb) {
+      result.sum = acc.sum;
+      result.average = acc.sum / acc.nb;
+      double var = acc.sum2 / acc.nb - result.average * result.average;
+      result.std = std::sqrt(std::max(var, 0.));
+      result.minValue = acc.min;
+      result.maxValue = acc.max;
+    }
+    m_rois[roi].mgr->setResult(result);
+  }
+}
+
+/*******************************************************************
+ * \brief sink task of a frame
+ *******************************************************************/
+class RoiCounterEngine::_Task : public SinkTaskBase
+{
+public:
+  _Task(std::shared_ptr<Snapshot> snapshot) : m_snapshot(snapshot) {}
+
+  virtual void process(Data& frame)
+  {
+    m_snapshot->process(frame);
+  }
+
+private:
+  std::shared_ptr<Snapshot> m_snapshot;
+};
+
+/*******************************************************************
+ * \brief RoiCounterEngine
+ *******************************************************************/
+RoiCounterEngine::RoiCounterEngine()
+{
+  DEB_CONSTRUCTOR();
+}
+
+RoiCounterEngine::~RoiCounterEngine()
+{
+  DEB_DESTRUCTOR();
+}
+
+void RoiCounterEngine::_set(const std::string& name,const RoiDef& def)
+{
+  m_rois[name] = def;
+  m_snapshot.reset();
+}
+
+void RoiCounterEngine::setRoi(const std::string& name,Manager *mgr,
+			      const Roi& roi)
+{
+  RoiDef def;
+  def.type = SQUARE;
+  def.mgr = mgr;
+  def.roi = roi;
+  _set(name, def);
+}
+
+void RoiCounterEngine::setArcRoi(const std::string& name,Manager *mgr,
+				 const ArcRoi& arc)
+{
+  RoiDef def;
+  def.type = ARC;
+  def.mgr = mgr;
+  def.arc = arc;
+  _set(name, def);
+}
+
+void RoiCounterEngine::setLut(const std::string& name,Manager *mgr,
+			      const Point& origin,Data& lut)
+{
+  DEB_MEMBER_FUNCT();
+  if(lut.dimensions.size() != 2)
+    THROW_CTL_ERROR(InvalidValue) << "Invalid LUT for " << name;
+  RoiDef def;
+  def.type = LUT;
+  def.mgr = mgr;
+  def.origin = origin;
+  def.lut = lut;
+  _set(name, def);
+}
+
+void RoiCounterEngine::setLutMask(const std::string& name,Manager *mgr,
+				  const Point& origin,Data& mask)
+{
+  DEB_MEMBER_FUNCT();
+  if(mask.dimensions.size() != 2)
+    THROW_CTL_ERROR(InvalidValue) << "Invalid LUT mask for " << name;
+  RoiDef def;
+  def.type = LUT_MASK;
+  def.mgr = mgr;
+  def.origin = origin;
+  def.lut = mask;
+  _set(name, def);
+}
+
+void RoiCounterEngine::remove(const std::list<std::string>& names)
+{
+  for(std::list<std::string>::const_iterator i = names.begin();
+      i != names.end(); ++i)
+    m_rois.erase(*i);
+  m_snapshot.reset();
+}
+
+void RoiCounterEngine::clearAll()
+{
+  m_rois.clear();
+  m_snapshot.reset();
+}
+
+void RoiCounterEngine::setMask(Data& mask)
+{
+  m_mask = mask;
+  m_snapshot.reset();
+}
+
+void RoiCounterEngine::addTo(TaskMgr& aMgr,int stage)
+{
+  DEB_MEMBER_FUNCT();
+  if(m_rois.empty())
+    return;
+  if(!m_snapshot)
+    m_snapshot = std::make_shared<Snapshot>(m_rois, m_mask);
+  _Task *task = new _Task(m_snapshot);
+  aMgr.addSinkTask(stage, task);
+  task->unref();
+}
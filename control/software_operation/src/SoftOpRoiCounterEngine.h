@@ -0,0 +1,105 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef SOFTOPROICOUNTERENGINE_H
+#define SOFTOPROICOUNTERENGINE_H
+
+#include "lima/SizeUtils.h"
+#include "lima/Debug.h"
+#include "lima/ThreadUtils.h"
+
+#include "processlib/TaskMgr.h"
+#include "processlib/RoiCounter.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+
+namespace lima
+{
+  /** @brief fused ROI counters: one sink task for all the ROIs.
+   *
+   *  The ROIs (rectangles, arcs, LUT and LUT masks) and the global mask
+   *  are compiled into a row-ordered table of pixel spans, so each frame
+   *  is read once whatever the number of ROIs. Large frames are split
+   *  in row bands processed by the pool threads.
+   *  The results are stored in the RoiCounterManager of each ROI, as the
+   *  per-ROI RoiCounterTask would do.
+   *
+   *  Counter definitions:
+   *  - the pixels with a 0 in the global mask are excluded;
+   *  - LUT: every pixel of the LUT area is weighted by its LUT value;
+   *  - LUT mask: the pixels with a non-zero LUT mask value;
+   *  - arc: the pixels whose (x,y) index is between the two radii of
+   *    the center and inside [start,end] angles, in degrees.
+   *  average and std (population) are over the selected pixels.
+   */
+  class RoiCounterEngine
+  {
+    DEB_CLASS_NAMESPC(DebModControl,"RoiCounterEngine","SoftOpRoiCounter");
+  public:
+    typedef Tasks::RoiCounterManager Manager;
+
+    RoiCounterEngine();
+    ~RoiCounterEngine();
+
+    void setRoi(const std::string& name,Manager *mgr,const Roi& roi);
+    void setArcRoi(const std::string& name,Manager *mgr,const ArcRoi& arc);
+    void setLut(const std::string& name,Manager *mgr,
+		const Point& origin,Data& lut);
+    void setLutMask(const std::string& name,Manager *mgr,
+		    const Point& origin,Data& mask);
+    void remove(const std::list<std::string>& names);
+    void clearAll();
+
+    void setMask(Data& mask);
+
+    /// @brief add the fused sink task (on the current ROIs) to aMgr
+    void addTo(TaskMgr& aMgr,int stage);
+
+    class Snapshot;
+
+  private:
+    enum RoiType { SQUARE, ARC, LUT, LUT_MASK };
+
+    struct RoiDef
+    {
+      RoiType		type;
+      Manager*		mgr;
+      Roi		roi;
+      ArcRoi		arc;
+      Point		origin;
+      Data		lut;
+    };
+    friend class Snapshot;
+    class _Task;
+
+    void _set(const std::string& name,const RoiDef& def);
+
+    std::map<std::string,RoiDef>	m_rois;
+    Data				m_mask;
+    // the ROIs seen by the tasks, rebuilt after any change
+    std::shared_ptr<Snapshot>		m_snapshot;
+  };
+}
+
+#endif // SOFTOPROICOUNTERENGINE_H
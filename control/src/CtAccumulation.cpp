@@ -22,9 +22,12 @@
 #include "lima/CtAccumulation.h"
 #include "lima/CtAcquisition.h"
 #include "lima/CtBuffer.h"
+#include "CtAccumulation_Kernels.h"
+#include "CtAccumulation_Median.h"
 #include "processlib/SinkTask.h"
 #include "processlib/SinkTaskMgr.h"
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <memory>
 #include <type_traits>
@@ -318,6 +321,102 @@ private:
   Data            m_dst;
 };
 
+/*********************************************************************************
+			   tiled accumulation
+*********************************************************************************/
+struct CtAccumulation::_AccKernel
+{
+  AccKernels::AccFunc	func;
+  AccKernels::Params	pars;
+  Data			mask;
+};
+
+/** @brief the row bands of a frame, shared by the thread which received
+    it and the helper tasks
+ */
+class CtAccumulation::_TileJob
+{
+  DEB_CLASS_NAMESPC(DebModControl,"Accumulation::_TileJob","Control");
+public:
+  _TileJob(const Data& frame, const TileFunc& func,
+           std::vector<Mutex>& tile_locks, int first_tile) :
+    m_func(func),
+    m_tile_locks(tile_locks),
+    m_width(frame.dimensions[0]),
+    m_height(frame.dimensions[1]),
+    m_nb_tiles(std::min(int(tile_locks.size()), m_height)),
+    m_first_tile(first_tile),
+    m_next_tile(0),
+    m_nb_done(0),
+    m_result(0)
+  {}
+
+  int getNbTiles() const { return m_nb_tiles; }
+
+  // @brief process the next free band, false if none left
+  bool processNextTile()
+  {
+    int i = m_next_tile++;
+    if(i >= m_nb_tiles)
+      return false;
+
+    int tile = (m_first_tile + i) % m_nb_tiles;
+    int first_row = m_height * tile / m_nb_tiles;
+    int end_row = m_height * (tile + 1) / m_nb_tiles;
+    long first_pixel = long(first_row) * m_width;
+    int nb_pixels = (end_row - first_row) * m_width;
+
+    long long result;
+    {
+      AutoMutex aLock(m_tile_locks[tile]);
+      result = m_func(first_pixel, nb_pixels);
+    }
+
+    AutoMutex aLock(m_cond.mutex());
+    m_result += result;
+    if(++m_nb_done == m_nb_tiles)
+      m_cond.broadcast();
+    return true;
+  }
+
+  // @brief wait for the bands taken by the other threads
+  long long waitAllTiles()
+  {
+    AutoMutex aLock(m_cond.mutex());
+    while(m_nb_done < m_nb_tiles)
+      m_cond.wait();
+    return m_result;
+  }
+
+private:
+  TileFunc		m_func;
+  std::vector<Mutex>&	m_tile_locks;
+  int			m_width;
+  int			m_height;
+  int			m_nb_tiles;
+  int			m_first_tile;
+  std::atomic<int>	m_next_tile;
+  Cond			m_cond;
+  int			m_nb_done;
+  long long		m_result;
+};
+
+class CtAccumulation::_TileTask : public SinkTaskBase
+{
+public:
+  _TileTask(std::shared_ptr<_TileJob> job) : m_job(job)
+  {}
+
+  virtual void process(Data&)
+  {
+    while(m_job->processNextTile())
+      continue;
+  }
+
+private:
+  std::shared_ptr<_TileJob> m_job;
+};
+
 class CtAccumulation::_CalcEndCBK : public TaskEventCallback
 {
   DEB_CLASS_NAMESPC(DebModControl,"_CalcEndCBK","Control");
@@ -511,7 +610,9 @@ CtAccumulation::CtAccumulation(CtControl &ct) :
   m_acc_nb_frames(0),
   m_threshold_cb(NULL),
   m_last_continue_flag(true),
-  m_hw_nb_buffers(ACC_DEF_HW_BUFFERS)
+  m_hw_nb_buffers(ACC_DEF_HW_BUFFERS),
+  m_nb_tiles(0),
+  m_acc_nb_tiles(0)
 {
   m_calc_end = new _CalcEndCBK(*this);
   m_calc_mgr = new _CalcSaturatedTaskMgr();
@@ -735,9 +836,6 @@ void CtAccumulation::setOperation(Operation operation)
   DEB_MEMBER_FUNCT();
   DEB_PARAM() << DEB_VAR1(operation);
 
-  if (operation == ACC_MEDIAN)
-    THROW_CTL_ERROR(Error) << "Median accumulator not implemented";
-
   AutoMutex aLock(m_cond.mutex());
   m_pars.operation = operation;
 }
@@ -1006,6 +1104,32 @@ void CtAccumulation::getHwNbBuffers(int& hw_nb_buffers) const
   DEB_RETURN() << DEB_VAR1(hw_nb_buffers);
 }
 
+/** @brief split the frames in nb_tiles row bands accumulated in parallel
+    @param nb_tiles 0 (default) for the sequential accumulation,
+    -1 for the number of processing threads
+ */
+void CtAccumulation::setNbTiles(int nb_tiles)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(nb_tiles);
+
+  if(nb_tiles < -1)
+    THROW_CTL_ERROR(InvalidValue) << "Invalid nb_tiles: " << nb_tiles;
+
+  AutoMutex aLock(m_cond.mutex());
+  m_nb_tiles = nb_tiles;
+}
+
+void CtAccumulation::getNbTiles(int& nb_tiles) const
+{
+  DEB_MEMBER_FUNCT();
+
+  AutoMutex aLock(m_cond.mutex());
+  nb_tiles = m_nb_tiles;
+
+  DEB_RETURN() << DEB_VAR1(nb_tiles);
+}
+
 /** @brief get dimensions of the different buffer types
  */
 inline void CtAccumulation::_calcImgFrameDims()
@@ -1159,18 +1283,6 @@ void CtAccumulation::prepare()
   m_datas.setMaxSize(m_buffers_size);
   m_saturated_images.setMaxSize(m_buffers_size);
 
-  // Check preconditions (if needed)
-  switch (m_pars.operation) {
-  case ACC_SUM:
-    break;
-
-  case ACC_MEAN:
-    break;
-
-  case ACC_MEDIAN:
-    THROW_CTL_ERROR(NotSupported) << "ACC_MEDIAN mode is not supported yet";
-  }
-
   // Allocate the main data (if needed)
   bool do_acc = m_frame_dim[AccImg].isValid();
   if(do_acc) {
@@ -1187,6 +1299,11 @@ void CtAccumulation::prepare()
     }
   }
 
+  m_acc_nb_tiles = m_nb_tiles;
+  if(m_acc_nb_tiles < 0)
+    m_acc_nb_tiles = PoolThreadMgr::get().getNumberOfThread();
+  DEB_TRACE() << DEB_VAR1(m_acc_nb_tiles);
+
   m_calc_mgr->resizeHistory(m_buffers_size * acc_nframes);
   m_last_continue_flag = true;
 }
@@ -1262,6 +1379,14 @@ void CtAccumulation::_newBaseFrameReady(Data &aData)
                                            _ProcAccInfo(abs_frame))).first;
   }
   _ProcAccInfo& info = proc_it->second;
+
+  // the tiled accumulation does not need the frames in order
+  if(m_acc_nb_tiles > 1) {
+    if(_processTiledFrame(info, aData, aLock))
+      procs.erase(proc_it);
+    return;
+  }
+
   std::map<int,Data>& pending = info.new_pending_data;
   
   if(rel_frame < info.acc_frames) {
@@ -1285,82 +1410,147 @@ void CtAccumulation::_newBaseFrameReady(Data &aData)
     procs.erase(proc_it);
 }
 
-void CtAccumulation::_processBaseFrame(_ProcAccInfo &info, Data &aData,
+static bool get_acc_pixel_type(Data::TYPE type,AccKernels::PixelType& pixel_type)
+{
+  switch(type)
+  {
+  case Data::UINT8:  pixel_type = AccKernels::U8;  return true;
+  case Data::INT8:   pixel_type = AccKernels::S8;  return true;
+  case Data::UINT16: pixel_type = AccKernels::U16; return true;
+  case Data::INT16:  pixel_type = AccKernels::S16; return true;
+  case Data::UINT32: pixel_type = AccKernels::U32; return true;
+  case Data::INT32:  pixel_type = AccKernels::S32; return true;
+  default:           return false;
+  }
+}
+
+static void get_filter_params(const CtAccumulation::Parameters& acc_pars,
+                              AccKernels::Params& pars)
+{
+  pars.threshold = acc_pars.thresholdB4Acc;
+  pars.offset = acc_pars.offsetB4Acc;
+  switch (acc_pars.filter)
+  {
+  case CtAccumulation::FILTER_NONE:
+    pars.filter = AccKernels::FilterNone; break;
+  case CtAccumulation::FILTER_THRESHOLD_MIN:
+    pars.filter = AccKernels::FilterThreshold; break;
+  case CtAccumulation::FILTER_OFFSET_THEN_THRESHOLD_MIN:
+    pars.filter = AccKernels::FilterOffsetThreshold; break;
+  }
+}
+
+/** @brief allocate the images of a new accumulated frame
+ */
+void CtAccumulation::_prepareAccImages(_ProcAccInfo &info, Data &aData,
                                        AutoMutex &aLock)
 {
+  DEB_MEMBER_FUNCT();
+
   bool do_sat = m_pars.active;
-  int nb_acc_frame = m_acc_nb_frames;
   Operation op = m_pars.operation;
   Data& acc_data = info.data[AccImg];
   Data& sat_data = info.data[SatImg];
   Data& tmp_data = info.data[TmpImg];
 
-  if(info.acc_frames == 0) // new Data has to be created
-  {
-    int nextFrameNumber = info.frame_nb;
+  int nextFrameNumber = info.frame_nb;
 
-    // Release old data(s) before crossing the size limit
-    m_datas.removeOldestIfFull();
-    if(do_sat)
-      m_saturated_images.removeOldestIfFull();
+  // Release old data(s) before crossing the size limit
+  m_datas.removeOldestIfFull();
+  if(do_sat)
+    m_saturated_images.removeOldestIfFull();
 
-    ImageType pixel_type[NbImgTypes];
-    for (int i = 0; i < NbImgTypes; ++i)
-      pixel_type[i] = m_frame_dim[i].getImageType();
+  ImageType pixel_type[NbImgTypes];
+  for (int i = 0; i < NbImgTypes; ++i)
+    pixel_type[i] = m_frame_dim[i].getImageType();
+  {
+    AutoMutexUnlock u(aLock);
+    acc_data.type = convert_imagetype_to_datatype(pixel_type[AccImg]);
+    acc_data.dimensions = aData.dimensions;
+    acc_data.frameNumber = nextFrameNumber;
+    acc_data.timestamp = aData.timestamp;
+    acc_data.buffer = _getDataBuffer(AccImg, acc_data.size());
+    memset(acc_data.data(),0,acc_data.size());
+
+    // create also the new image for saturated counters
+    if(do_sat)
     {
-      AutoMutexUnlock u(aLock);
-      acc_data.type = convert_imagetype_to_datatype(pixel_type[AccImg]);
-      acc_data.dimensions = aData.dimensions;
-      acc_data.frameNumber = nextFrameNumber;
-      acc_data.timestamp = aData.timestamp;
-      acc_data.buffer = _getDataBuffer(AccImg, acc_data.size());
-      memset(acc_data.data(),0,acc_data.size());
-
-      // create also the new image for saturated counters
-      if(do_sat)
-      {
-        sat_data.type = convert_imagetype_to_datatype(pixel_type[SatImg]);
-        sat_data.dimensions = aData.dimensions;
-        sat_data.frameNumber = nextFrameNumber;
-        sat_data.timestamp = aData.timestamp;
-        sat_data.buffer = _getDataBuffer(SatImg, sat_data.size());
-        memset(sat_data.data(),0,sat_data.size());
-      }
+      sat_data.type = convert_imagetype_to_datatype(pixel_type[SatImg]);
+      sat_data.dimensions = aData.dimensions;
+      sat_data.frameNumber = nextFrameNumber;
+      sat_data.timestamp = aData.timestamp;
+      sat_data.buffer = _getDataBuffer(SatImg, sat_data.size());
+      memset(sat_data.data(),0,sat_data.size());
+    }
 
-      if(op == ACC_MEAN) {
-        tmp_data.type = convert_imagetype_to_datatype(pixel_type[TmpImg]);
-        tmp_data.dimensions = aData.dimensions;
-        tmp_data.buffer = _getDataBuffer(TmpImg, tmp_data.size());
-        memset(tmp_data.data(), 0, tmp_data.size());
-      }
+    if(op == ACC_MEAN) {
+      tmp_data.type = convert_imagetype_to_datatype(pixel_type[TmpImg]);
+      tmp_data.dimensions = aData.dimensions;
+      tmp_data.buffer = _getDataBuffer(TmpImg, tmp_data.size());
+      memset(tmp_data.data(), 0, tmp_data.size());
     }
-    m_datas.insert(acc_data);
-    if(do_sat)
-      m_saturated_images.insert(sat_data);
+  }
+  m_datas.insert(acc_data);
+  if(do_sat)
+    m_saturated_images.insert(sat_data);
+
+  // the median samples of all the frames
+  if(op == ACC_MEDIAN) {
+    AccKernels::PixelType src_type;
+    if(!get_acc_pixel_type(aData.type, src_type))
+      THROW_CTL_ERROR(NotSupported) << "Invalid median input: " << aData;
+    long nb_pixels = long(aData.dimensions[0]) * aData.dimensions[1];
+    int nb_frames = m_acc_nb_frames;
+    AutoMutexUnlock u(aLock);
+    info.median = std::make_shared<AccMedianStack>(src_type, nb_pixels,
+                                                   nb_frames);
   }
 
+  // the median is always computed in bands
+  int nb_tiles = m_acc_nb_tiles;
+  if((nb_tiles <= 1) && (op == ACC_MEDIAN))
+    nb_tiles = PoolThreadMgr::get().getNumberOfThread();
+  if((nb_tiles > 1) || (op == ACC_MEDIAN))
+    info.tile_locks = std::make_shared<std::vector<Mutex> >(std::max(nb_tiles, 1));
+}
+
+void CtAccumulation::_processBaseFrame(_ProcAccInfo &info, Data &aData,
+                                       AutoMutex &aLock)
+{
+  bool do_sat = m_pars.active;
+  int nb_acc_frame = m_acc_nb_frames;
+  Operation op = m_pars.operation;
+  Data& acc_data = info.data[AccImg];
+  Data& sat_data = info.data[SatImg];
+  Data& tmp_data = info.data[TmpImg];
+
+  if(info.acc_frames == 0) // new Data has to be created
+    _prepareAccImages(info, aData, aLock);
+
   bool last = ((info.acc_frames + 1) == nb_acc_frame);
   {
     AutoMutexUnlock u(aLock);
 
-    if(do_sat)
-      _calcSaturatedImageNCounters(aData,sat_data);
-
-    // Accumulate
+    // Accumulate, counting the saturated pixels in the same pass if possible
+    Data *fused_sat_data = do_sat ? &sat_data : NULL;
+    bool sat_done = false;
     switch (op) {
     case ACC_SUM:
-      _accFrame(aData, acc_data);
+      sat_done = _accFrame(aData, acc_data, fused_sat_data);
       break;
 
     case ACC_MEAN:
-      _accFrame(aData, tmp_data);
+      sat_done = _accFrame(aData, tmp_data, fused_sat_data);
       break;
 
     case ACC_MEDIAN:
-      // TODO push data into tmp_datas;
+      _medianAddFrame(info, aData, info.acc_frames);
       break;
     }
 
+    if(do_sat && !sat_done)
+      _calcSaturatedImageNCounters(aData,sat_data);
+
     // If accumulated frame is cleared for takeoff
     if(last)
     {
@@ -1374,7 +1564,7 @@ void CtAccumulation::_processBaseFrame(_ProcAccInfo &info, Data &aData,
         break;
 
       case ACC_MEDIAN:
-        // TODO compute the median from tmp_datas
+        _medianReduce(info, acc_data);
         break;
       }
     }
@@ -1392,6 +1582,82 @@ void CtAccumulation::_processBaseFrame(_ProcAccInfo &info, Data &aData,
 
   m_last_continue_flag &= cont_flag;
 }
+
+/** @brief accumulate a frame in tiled mode.
+    The frame is split in row bands accumulated in parallel, each band of
+    the accumulated image has its own lock. As the accumulation is
+    commutative, the frames can be processed in any order: acc_frames
+    counts the completed ones.
+    @return true if the accumulated frame is finished
+ */
+bool CtAccumulation::_processTiledFrame(_ProcAccInfo &info, Data &aData,
+                                        AutoMutex &aLock)
+{
+  DEB_MEMBER_FUNCT();
+
+  // the first frame received allocates the images
+  if(info.nb_started++ == 0)
+  {
+    try
+    {
+      _prepareAccImages(info, aData, aLock);
+    }
+    catch(...)
+    {
+      info.failed = true;
+      m_cond.broadcast();
+      throw;
+    }
+    info.ready = true;
+    m_cond.broadcast();
+  }
+  while(!info.ready)
+  {
+    if(info.failed)
+      THROW_CTL_ERROR(Error) << "Accumulation images not allocated";
+    m_cond.wait();
+  }
+
+  bool do_sat = m_pars.active;
+  int nb_acc_frame = m_acc_nb_frames;
+  Operation op = m_pars.operation;
+  Data& acc_data = info.data[AccImg];
+  Data& sat_data = info.data[SatImg];
+  Data& tmp_data = info.data[TmpImg];
+  // start with different bands to limit the lock contention
+  int first_tile = aData.frameNumber % nb_acc_frame;
+
+  {
+    AutoMutexUnlock u(aLock);
+
+    bool sat_done = false;
+    if(op == ACC_MEDIAN) {
+      _medianAddFrame(info, aData, aData.frameNumber % nb_acc_frame);
+    } else {
+      Data& dst = (op == ACC_MEAN) ? tmp_data : acc_data;
+      sat_done = _accTiledFrame(aData, dst, do_sat ? &sat_data : NULL,
+                                *info.tile_locks, first_tile);
+    }
+    if(do_sat && !sat_done)
+      _calcSaturatedImageNCounters(aData,sat_data);
+  }
+
+  if(++info.acc_frames < nb_acc_frame)
+    return false;
+
+  bool cont_flag;
+  {
+    AutoMutexUnlock u(aLock);
+    if(op == ACC_MEAN)
+      transform_pixel(tmp_data, acc_data, pixel_divide(nb_acc_frame));
+    else if(op == ACC_MEDIAN)
+      _medianReduce(info, acc_data);
+    cont_flag = m_ct.newFrameReady(acc_data);
+  }
+
+  m_last_continue_flag &= cont_flag;
+  return true;
+}
 /** @brief stops the current integration
  */
 void CtAccumulation::stop()
@@ -1443,7 +1709,66 @@ inline void acc_frame_with_offset_then_threshold(Data &src,Data &dst,long long o
   transform_pixel(src, dst, fn);
 }
 
-void CtAccumulation::_accFrame(Data& src, Data& dst) const
+/** @brief get the vectorized kernel (see CtAccumulation_Kernels.h) for
+    src and dst. If sat_data is given, the saturated pixels are counted
+    in the same pass when possible.
+    @return false if the generic path must be used
+ */
+bool CtAccumulation::_getAccKernel(Data& src, Data& dst, Data *sat_data,
+                                   _AccKernel& kernel)
+{
+  DEB_MEMBER_FUNCT();
+
+  AccKernels::Params& pars = kernel.pars;
+  pars = AccKernels::Params();
+  get_filter_params(m_pars, pars);
+
+  // not while calculation tasks are pending on the saturated images
+  Data& mask = kernel.mask;
+  if(sat_data)
+  {
+    AutoMutex aLock(m_cond.mutex());
+    if(m_calc_ready)
+    {
+      mask = m_calc_mask;
+      pars.sat_threshold = m_pars.pixelThresholdValue;
+      pars.sat_image = (unsigned short*)sat_data->data();
+    }
+  }
+  // the calculation task reports the errors
+  if(pars.sat_image && ((sat_data->type != Data::UINT16) ||
+                        (sat_data->dimensions != src.dimensions) ||
+                        (!mask.empty() && ((mask.depth() != 1) ||
+                                           (mask.dimensions != src.dimensions)))))
+    pars.sat_image = NULL;
+  if(pars.sat_image)
+    pars.mask = (const char*)mask.data();
+
+  AccKernels::PixelType src_type, dst_type;
+  kernel.func = NULL;
+  if(get_acc_pixel_type(src.type, src_type) &&
+     get_acc_pixel_type(dst.type, dst_type))
+    kernel.func = AccKernels::getAccFunc(src_type, dst_type, pars);
+
+  bool has_kernel = (kernel.func != NULL);
+  DEB_RETURN() << DEB_VAR1(has_kernel);
+  return has_kernel;
+}
+
+void CtAccumulation::_setSaturatedCounter(Data& src, long long nb_saturated)
+{
+  _CounterResult result(src.frameNumber);
+  result.value = nb_saturated;
+  m_calc_mgr->setResult(result);
+  _callIfNeedThresholdCallback(src, nb_saturated);
+}
+
+/** @brief accumulate src into dst.
+    If sat_data is given, the saturated pixels are counted in the same pass
+    when a vectorized kernel is available
+    @return true if the saturation counters were calculated
+ */
+bool CtAccumulation::_accFrame(Data& src, Data& dst, Data *sat_data)
 {
   DEB_MEMBER_FUNCT();
   DEB_PARAM() << DEB_VAR2(src, dst);
@@ -1453,6 +1778,18 @@ void CtAccumulation::_accFrame(Data& src, Data& dst) const
 
   DEB_TRACE() << DEB_VAR3(m_pars.filter, threshold_value, offset_value);
 
+  _AccKernel kernel;
+  if(_getAccKernel(src, dst, sat_data, kernel))
+  {
+    int nb_items = src.dimensions[0] * src.dimensions[1];
+    long long nb_saturated = kernel.func(src.data(), dst.data(), nb_items,
+                                         kernel.pars);
+    if(!kernel.pars.sat_image)
+      return false;
+    _setSaturatedCounter(src, nb_saturated);
+    return true;
+  }
+
   switch (m_pars.filter)
   {
   case Filter::FILTER_NONE:
@@ -1462,6 +1799,133 @@ void CtAccumulation::_accFrame(Data& src, Data& dst) const
   case Filter::FILTER_OFFSET_THEN_THRESHOLD_MIN:
     acc_frame_with_offset_then_threshold(src, dst, offset_value, threshold_value); break;
   }
+  return false;
+}
+
+/** @brief accumulate the row bands of src into dst, with the help of
+    the processing threads
+    @return true if the saturation counters were calculated
+ */
+bool CtAccumulation::_accTiledFrame(Data& src, Data& dst, Data *sat_data,
+                                    std::vector<Mutex>& tile_locks,
+                                    int first_tile)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR3(src, dst, first_tile);
+
+  _AccKernel kernel;
+  if(!_getAccKernel(src, dst, sat_data, kernel))
+  {
+    // generic path: the whole frame at once
+    std::vector<Mutex>::iterator it;
+    for(it = tile_locks.begin(); it != tile_locks.end(); ++it)
+      it->lock();
+    try
+    {
+      _accFrame(src, dst);
+    }
+    catch(...)
+    {
+      for(it = tile_locks.begin(); it != tile_locks.end(); ++it)
+        it->unlock();
+      throw;
+    }
+    for(it = tile_locks.begin(); it != tile_locks.end(); ++it)
+      it->unlock();
+    return false;
+  }
+
+  AccKernels::AccFunc func = kernel.func;
+  const AccKernels::Params& pars = kernel.pars;
+  const char *src_ptr = (const char*)src.data();
+  char *dst_ptr = (char*)dst.data();
+  int src_depth = src.depth();
+  int dst_depth = dst.depth();
+  TileFunc acc_tile = [&](long first_pixel, int nb_pixels) {
+    AccKernels::Params tile_pars = pars;
+    if(tile_pars.sat_image)
+      tile_pars.sat_image += first_pixel;
+    if(tile_pars.mask)
+      tile_pars.mask += first_pixel;
+    return func(src_ptr + first_pixel * src_depth,
+                dst_ptr + first_pixel * dst_depth, nb_pixels, tile_pars);
+  };
+  long long nb_saturated = _runTiles(src, acc_tile, tile_locks, first_tile);
+
+  if(!kernel.pars.sat_image)
+    return false;
+  _setSaturatedCounter(src, nb_saturated);
+  return true;
+}
+
+/** @brief run func on the row bands of frame, with the help of the
+    processing threads
+    @return the sum of the func results
+ */
+long long CtAccumulation::_runTiles(const Data& frame, const TileFunc& func,
+                                    std::vector<Mutex>& tile_locks,
+                                    int first_tile)
+{
+  DEB_MEMBER_FUNCT();
+
+  std::shared_ptr<_TileJob> job(new _TileJob(frame, func, tile_locks,
+                                             first_tile));
+  PoolThreadMgr& pool = PoolThreadMgr::get();
+  int nb_helpers = std::min(job->getNbTiles(), pool.getNumberOfThread()) - 1;
+  DEB_TRACE() << DEB_VAR2(job->getNbTiles(), nb_helpers);
+  for(int i = 0; i < nb_helpers; ++i)
+  {
+    _TileTask *task = new _TileTask(job);
+    TaskMgr *mgr = new TaskMgr();
+    mgr->addSinkTask(0, task);
+    task->unref();
+    mgr->setInputData(const_cast<Data&>(frame));
+    pool.addProcess(mgr);
+  }
+
+  // the helpers arriving late find nothing left to do
+  while(job->processNextTile())
+    continue;
+  return job->waitAllTiles();
+}
+
+/** @brief store the frame in the median samples of its accumulated image
+ */
+void CtAccumulation::_medianAddFrame(_ProcAccInfo &info, Data &src,
+                                     int frame_idx)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR2(src, frame_idx);
+
+  AccMedianStack& median = *info.median;
+  const void *src_ptr = src.data();
+  TileFunc add_tile = [&](long first_pixel, int nb_pixels) {
+    median.addFrame(src_ptr, frame_idx, first_pixel, nb_pixels);
+    return 0LL;
+  };
+  _runTiles(src, add_tile, *info.tile_locks, frame_idx);
+}
+
+/** @brief compute the median image from the samples, which are released
+ */
+void CtAccumulation::_medianReduce(_ProcAccInfo &info, Data &dst)
+{
+  DEB_MEMBER_FUNCT();
+
+  AccKernels::Params pars = AccKernels::Params();
+  get_filter_params(m_pars, pars);
+  AccKernels::PixelType dst_type;
+  if(!get_acc_pixel_type(dst.type, dst_type))
+    THROW_CTL_ERROR(NotSupported) << "Invalid median output: " << dst;
+
+  AccMedianStack& median = *info.median;
+  void *dst_ptr = dst.data();
+  TileFunc median_tile = [&](long first_pixel, int nb_pixels) {
+    median.getMedian(dst_ptr, dst_type, first_pixel, nb_pixels, pars);
+    return 0LL;
+  };
+  _runTiles(dst, median_tile, *info.tile_locks, 0);
+  info.median.reset();
 }
 
 #ifdef WITH_CONFIG
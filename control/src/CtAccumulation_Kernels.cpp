@@ -0,0 +1,89 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <cstddef>
+
+#include "CtAccumulation_Kernels.h"
+
+namespace
+{
+#include "CtAccumulation_KernelsImpl.h"
+
+Isa detect_isa()
+{
+#ifdef LIMA_ACC_X86_KERNELS
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+    return IsaAVX512;
+  if(__builtin_cpu_supports("avx2"))
+    return IsaAVX2;
+#endif
+  return IsaScalar;
+}
+}
+
+using namespace lima;
+
+AccKernels::AccFunc AccKernels::lookupScalar(PixelType src,PixelType dst,
+					     const Params& pars)
+{
+  return lookup(src,dst,pars);
+}
+
+AccKernels::Isa AccKernels::getBestIsa()
+{
+  static const Isa best_isa = detect_isa();
+  return best_isa;
+}
+
+const char *AccKernels::getIsaName(Isa isa)
+{
+  switch(isa)
+    {
+    case IsaScalar:	return "scalar";
+    case IsaAVX2:	return "avx2";
+    case IsaAVX512:	return "avx512";
+    default:		return "unknown";
+    }
+}
+
+AccKernels::AccFunc AccKernels::getAccFunc(PixelType src,PixelType dst,
+					   const Params& pars,Isa isa)
+{
+  if(isa > getBestIsa())
+    return NULL;
+
+  switch(isa)
+    {
+#ifdef LIMA_ACC_X86_KERNELS
+    case IsaAVX512:	return lookupAVX512(src,dst,pars);
+    case IsaAVX2:	return lookupAVX2(src,dst,pars);
+#endif
+    case IsaScalar:	return lookupScalar(src,dst,pars);
+    default:		return NULL;
+    }
+}
+
+AccKernels::AccFunc AccKernels::getAccFunc(PixelType src,PixelType dst,
+					   const Params& pars)
+{
+  return getAccFunc(src,dst,pars,getBestIsa());
+}
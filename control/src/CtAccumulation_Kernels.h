@@ -0,0 +1,78 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef CTACCUMULATION_KERNELS_H
+#define CTACCUMULATION_KERNELS_H
+
+// Fused accumulation kernels: one pass over the sub-frame adds the
+// (filtered) pixels to the accumulation image and counts the saturated
+// pixels. The same code is compiled for several instruction sets
+// (CtAccumulation_Kernels_<isa>.cpp), the best one is chosen at runtime.
+//
+// Only plain types here: the ISA specific translation units must not
+// instantiate any inline code shared with the rest of the library.
+
+namespace lima {
+namespace AccKernels {
+
+enum PixelType { U8, S8, U16, S16, U32, S32, NbPixelTypes };
+enum FilterMode { FilterNone, FilterThreshold, FilterOffsetThreshold };
+enum Isa { IsaScalar, IsaAVX2, IsaAVX512, NbIsas };
+
+struct Params
+{
+  FilterMode		filter;
+  long long		threshold;	// accumulate if pixel > threshold
+  long long		offset;		// subtracted before the threshold
+
+  // saturation: NULL sat_image means no saturation count
+  unsigned short*	sat_image;	// per pixel counter
+  const char*		mask;		// optional, 0 means excluded
+  long long		sat_threshold;
+};
+
+/// returns the number of saturated pixels
+typedef long long (*AccFunc)(const void *src,void *dst,int nb_pixels,
+			     const Params& pars);
+
+/** @brief best kernel for the (src,dst) types and parameters,
+ *  NULL if not supported (the caller uses the generic path)
+ */
+AccFunc getAccFunc(PixelType src,PixelType dst,const Params& pars);
+/** @brief kernel for a given instruction set, NULL if not available
+ */
+AccFunc getAccFunc(PixelType src,PixelType dst,const Params& pars,Isa isa);
+/** @brief best instruction set supported by this CPU and build
+ */
+Isa getBestIsa();
+const char *getIsaName(Isa isa);
+
+// per instruction set entry points
+AccFunc lookupScalar(PixelType src,PixelType dst,const Params& pars);
+#ifdef LIMA_ACC_X86_KERNELS
+AccFunc lookupAVX2(PixelType src,PixelType dst,const Params& pars);
+AccFunc lookupAVX512(PixelType src,PixelType dst,const Params& pars);
+#endif
+
+} // namespace AccKernels
+} // namespace lima
+
+#endif // CTACCUMULATION_KERNELS_H
@@ -0,0 +1,161 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+// Kernel templates, included inside an anonymous namespace by each
+// CtAccumulation_Kernels*.cpp: every instruction set gets its own
+// (internal linkage) instantiations. No include guard on purpose.
+//
+// The loops are written branch-free on the pixel type width so that the
+// compiler vectorizes them; the results are bit-identical to the generic
+// pixel_accumulate* functors of CtAccumulation.cpp.
+
+using namespace lima::AccKernels;
+
+// pixel range and arithmetic type of the offset subtraction
+template <class T> struct pixel_traits;
+template <> struct pixel_traits<unsigned char>
+{ typedef int calc; static const long long min = 0, max = 0xff; };
+template <> struct pixel_traits<char>
+{ typedef int calc; static const long long min = -0x80, max = 0x7f; };
+template <> struct pixel_traits<unsigned short>
+{ typedef int calc; static const long long min = 0, max = 0xffff; };
+template <> struct pixel_traits<short>
+{ typedef int calc; static const long long min = -0x8000, max = 0x7fff; };
+template <> struct pixel_traits<unsigned int>
+{ typedef long long calc; static const long long min = 0, max = 0xffffffffLL; };
+template <> struct pixel_traits<int>
+{ typedef long long calc; static const long long min = -0x80000000LL,
+			  max = 0x7fffffffLL; };
+
+/** @brief convert "x > threshold" into "x >= ge" in the type of x
+ */
+template <class T>
+inline void threshold_ge(long long threshold, T& ge, bool& never)
+{
+  never = (threshold >= pixel_traits<T>::max);
+  if (never || (threshold < pixel_traits<T>::min))
+    ge = T(pixel_traits<T>::min);
+  else
+    ge = T(threshold + 1);
+}
+
+template <class S, class D, int FILTER, bool SAT, bool MASK>
+long long acc_kernel(const void *src_ptr, void *dst_ptr, int nb_pixels,
+		     const Params& pars)
+{
+  typedef typename pixel_traits<S>::calc C;
+  const S * __restrict__ src = (const S *) src_ptr;
+  D * __restrict__ dst = (D *) dst_ptr;
+  unsigned short * __restrict__ sat = pars.sat_image;
+  const char * __restrict__ mask = pars.mask;
+
+  S acc_ge, sat_ge;
+  D diff_ge;
+  bool acc_never, sat_never, diff_never;
+  threshold_ge(pars.threshold, acc_ge, acc_never);
+  threshold_ge(pars.threshold, diff_ge, diff_never);
+  threshold_ge(pars.sat_threshold, sat_ge, sat_never);
+  const C offset = C(pars.offset);
+  const bool unsigned_dst = (D(-1) > D(0));
+
+  unsigned int nb_sat = 0;
+  for (int i = 0; i < nb_pixels; ++i) {
+    S s = src[i];
+    D v;
+    if (FILTER == FilterNone) {
+      v = D(s);
+    } else if (FILTER == FilterThreshold) {
+      v = (!acc_never && (s >= acc_ge)) ? D(s) : D(0);
+    } else {
+      D d = D(C(s) - offset);
+      if (unsigned_dst && (C(s) < offset))
+	d = 0;
+      v = (!diff_never && (d >= diff_ge)) ? d : D(0);
+    }
+    dst[i] += v;
+
+    if (SAT) {
+      bool hit = !sat_never && (s >= sat_ge);
+      if (MASK)
+	hit = hit && mask[i];
+      sat[i] += hit;
+      nb_sat += hit;
+    }
+  }
+  return nb_sat;
+}
+
+template <class S, class D, int FILTER>
+inline AccFunc lookup_sat(const Params& pars)
+{
+  if (!pars.sat_image)
+    return &acc_kernel<S, D, FILTER, false, false>;
+  else if (!pars.mask)
+    return &acc_kernel<S, D, FILTER, true, false>;
+  else
+    return &acc_kernel<S, D, FILTER, true, true>;
+}
+
+template <class S, class D>
+inline AccFunc lookup_filter(const Params& pars)
+{
+  // the offset subtraction must not overflow the calc type
+  const long long max_offset = (sizeof(typename pixel_traits<S>::calc) < 8) ?
+			       (1LL << 30) : (1LL << 62);
+  switch (pars.filter) {
+  case FilterNone:
+    return lookup_sat<S, D, FilterNone>(pars);
+  case FilterThreshold:
+    return lookup_sat<S, D, FilterThreshold>(pars);
+  case FilterOffsetThreshold:
+    if ((pars.offset > max_offset) || (pars.offset < -max_offset))
+      return 0;
+    return lookup_sat<S, D, FilterOffsetThreshold>(pars);
+  }
+  return 0;
+}
+
+// same (src,dst) combinations as transform_pixel in CtAccumulation.cpp
+template <class S>
+inline AccFunc lookup_dst(PixelType dst, bool signed_src, const Params& pars)
+{
+  switch (dst) {
+  case U16: return signed_src ? 0 : lookup_filter<S, unsigned short>(pars);
+  case S16: return lookup_filter<S, short>(pars);
+  case U32: return signed_src ? 0 : lookup_filter<S, unsigned int>(pars);
+  case S32: return lookup_filter<S, int>(pars);
+  default:  return 0;
+  }
+}
+
+inline AccFunc lookup(PixelType src, PixelType dst, const Params& pars)
+{
+  switch (src) {
+  case U8:  return lookup_dst<unsigned char>(dst, false, pars);
+  case S8:  return lookup_dst<char>(dst, true, pars);
+  case U16: return lookup_dst<unsigned short>(dst, false, pars);
+  case S16: return lookup_dst<short>(dst, true, pars);
+  case U32: return lookup_dst<unsigned int>(dst, false, pars);
+  case S32: return lookup_dst<int>(dst, true, pars);
+  default:  return 0;
+  }
+}
@@ -0,0 +1,284 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <algorithm>
+#include <type_traits>
+
+#include "CtAccumulation_Median.h"
+#include "lima/Exceptions.h"
+
+using namespace lima;
+using namespace lima::AccKernels;
+
+namespace
+{
+
+// 8-bit histograms
+const int HISTO_BINS = 256;
+typedef unsigned short HistoCount;
+
+// order preserving bin of a 8-bit pixel
+template <class S>
+inline int histo_bin(S s)
+{
+  return (unsigned char) s ^ (std::is_signed<S>::value ? 0x80 : 0);
+}
+
+template <class S>
+inline S histo_value(int bin)
+{
+  return S(bin ^ (std::is_signed<S>::value ? 0x80 : 0));
+}
+
+// the value added by the pixel_accumulate* functors of CtAccumulation.cpp
+template <class D, class S>
+inline long long filter_value(S s, const Params& pars)
+{
+  switch(pars.filter)
+    {
+    case FilterThreshold:
+      return (s > pars.threshold) ? s : 0;
+    case FilterOffsetThreshold:
+      {
+	D d = D(s - pars.offset);
+	if(!std::is_signed<D>::value && (s < pars.offset))
+	  d = 0;
+	return (d > pars.threshold) ? d : 0;
+      }
+    default:
+      return s;
+    }
+}
+
+template <class D, class S>
+inline D median_value(S lo, S hi, const Params& pars)
+{
+  return D((filter_value<D>(lo, pars) + filter_value<D>(hi, pars)) / 2);
+}
+
+template <class S>
+void stage_frame(const S *src, S *stage, int nb_frames, int frame_idx,
+		 long first_pixel, int nb_pixels)
+{
+  src += first_pixel;
+  stage += first_pixel * nb_frames + frame_idx;
+  for(int i = 0; i < nb_pixels; ++i, stage += nb_frames)
+    *stage = src[i];
+}
+
+template <class S>
+void histo_frame(const S *src, HistoCount *histo, long first_pixel,
+		 int nb_pixels)
+{
+  src += first_pixel;
+  histo += first_pixel * HISTO_BINS;
+  for(int i = 0; i < nb_pixels; ++i, histo += HISTO_BINS)
+    ++histo[histo_bin(src[i])];
+}
+
+template <class S, class D>
+void stage_median(S *stage, int nb_frames, D *dst, long first_pixel,
+		  int nb_pixels, const Params& pars)
+{
+  int mid = nb_frames / 2;
+  bool odd = (nb_frames % 2);
+  stage += first_pixel * nb_frames;
+  dst += first_pixel;
+  for(int i = 0; i < nb_pixels; ++i, stage += nb_frames)
+    {
+      std::nth_element(stage, stage + mid, stage + nb_frames);
+      S hi = stage[mid];
+      S lo = odd ? hi : *std::max_element(stage, stage + mid);
+      dst[i] = median_value<D>(lo, hi, pars);
+    }
+}
+
+template <class S, class D>
+void histo_median(const HistoCount *histo, int nb_frames, D *dst,
+		  long first_pixel, int nb_pixels, const Params& pars)
+{
+  int lo_rank = (nb_frames - 1) / 2;
+  int hi_rank = nb_frames / 2;
+  histo += first_pixel * HISTO_BINS;
+  dst += first_pixel;
+  for(int i = 0; i < nb_pixels; ++i, histo += HISTO_BINS)
+    {
+      int count = 0, lo_bin = -1, bin = 0;
+      for(; bin < HISTO_BINS; ++bin)
+	{
+	  count += histo[bin];
+	  if((lo_bin < 0) && (count > lo_rank))
+	    lo_bin = bin;
+	  if(count > hi_rank)
+	    break;
+	}
+      dst[i] = median_value<D>(histo_value<S>(lo_bin), histo_value<S>(bin),
+			       pars);
+    }
+}
+
+template <class S, class D>
+void get_median(void *buffer, bool histogram, int nb_frames, void *dst,
+		long first_pixel, int nb_pixels, const Params& pars)
+{
+  if(histogram)
+    histo_median<S>((const HistoCount *) buffer, nb_frames, (D *) dst,
+		    first_pixel, nb_pixels, pars);
+  else
+    stage_median((S *) buffer, nb_frames, (D *) dst, first_pixel, nb_pixels,
+		 pars);
+}
+
+template <class S>
+void get_median(PixelType dst_type, void *buffer, bool histogram,
+		int nb_frames, void *dst, long first_pixel, int nb_pixels,
+		const Params& pars)
+{
+  switch(dst_type)
+    {
+    case U16:
+      return get_median<S, unsigned short>(buffer, histogram, nb_frames, dst,
+					   first_pixel, nb_pixels, pars);
+    case S16:
+      return get_median<S, short>(buffer, histogram, nb_frames, dst,
+				  first_pixel, nb_pixels, pars);
+    case U32:
+      return get_median<S, unsigned int>(buffer, histogram, nb_frames, dst,
+					 first_pixel, nb_pixels, pars);
+    case S32:
+      return get_median<S, int>(buffer, histogram, nb_frames, dst,
+				first_pixel, nb_pixels, pars);
+    default:
+      throw LIMA_CTL_EXC(NotSupported, "Invalid median output type");
+    }
+}
+
+template <class S>
+void add_frame(const void *src, void *buffer, bool histogram, int nb_frames,
+	       int frame_idx, long first_pixel, int nb_pixels)
+{
+  if(histogram)
+    histo_frame((const S *) src, (HistoCount *) buffer, first_pixel,
+		nb_pixels);
+  else
+    stage_frame((const S *) src, (S *) buffer, nb_frames, frame_idx,
+		first_pixel, nb_pixels);
+}
+
+int pixel_depth(PixelType type)
+{
+  switch(type)
+    {
+    case U8: case S8:	return 1;
+    case U16: case S16:	return 2;
+    case U32: case S32:	return 4;
+    default:		return 0;
+    }
+}
+
+} // anonymous namespace
+
+AccMedianStack::AccMedianStack(PixelType src_type,long nb_pixels,
+			       int nb_frames) :
+  m_src_type(src_type),
+  m_nb_pixels(nb_pixels),
+  m_nb_frames(nb_frames),
+  m_histogram(false)
+{
+  DEB_CONSTRUCTOR();
+  DEB_PARAM() << DEB_VAR3(src_type,nb_pixels,nb_frames);
+
+  int depth = pixel_depth(src_type);
+  if(!depth)
+    THROW_CTL_ERROR(NotSupported) << "Invalid median pixel type";
+  if(nb_frames < 1)
+    THROW_CTL_ERROR(InvalidValue) << "Invalid median nb_frames: " << nb_frames;
+
+  // a histogram is smaller than the samples
+  long histo_size = HISTO_BINS * sizeof(HistoCount);
+  m_histogram = ((depth == 1) && (nb_frames * depth > histo_size) &&
+		 (nb_frames <= 0xffff));
+  if(m_histogram)
+    m_buffer.alloc(nb_pixels * histo_size);
+  else
+    m_buffer.alloc(size_t(nb_pixels) * nb_frames * depth, false);
+
+  DEB_TRACE() << DEB_VAR2(m_histogram,m_buffer.getSize());
+}
+
+void AccMedianStack::addFrame(const void *src,int frame_idx,long first_pixel,
+			      int nb_pixels)
+{
+  void *buffer = m_buffer.getPtr();
+  switch(m_src_type)
+    {
+    case U8:
+      return add_frame<unsigned char>(src,buffer,m_histogram,m_nb_frames,
+				      frame_idx,first_pixel,nb_pixels);
+    case S8:
+      return add_frame<char>(src,buffer,m_histogram,m_nb_frames,
+			     frame_idx,first_pixel,nb_pixels);
+    case U16:
+      return add_frame<unsigned short>(src,buffer,m_histogram,m_nb_frames,
+				       frame_idx,first_pixel,nb_pixels);
+    case S16:
+      return add_frame<short>(src,buffer,m_histogram,m_nb_frames,
+			      frame_idx,first_pixel,nb_pixels);
+    case U32:
+      return add_frame<unsigned int>(src,buffer,m_histogram,m_nb_frames,
+				     frame_idx,first_pixel,nb_pixels);
+    case S32:
+      return add_frame<int>(src,buffer,m_histogram,m_nb_frames,
+			    frame_idx,first_pixel,nb_pixels);
+    default:
+      break;
+    }
+}
+
+void AccMedianStack::getMedian(void *dst,PixelType dst_type,
+			       long first_pixel,int nb_pixels,
+			       const Params& filter)
+{
+  void *buffer = m_buffer.getPtr();
+  switch(m_src_type)
+    {
+    case U8:
+      return get_median<unsigned char>(dst_type,buffer,m_histogram,m_nb_frames,
+				       dst,first_pixel,nb_pixels,filter);
+    case S8:
+      return get_median<char>(dst_type,buffer,m_histogram,m_nb_frames,
+			      dst,first_pixel,nb_pixels,filter);
+    case U16:
+      return get_median<unsigned short>(dst_type,buffer,m_histogram,m_nb_frames,
+					dst,first_pixel,nb_pixels,filter);
+    case S16:
+      return get_median<short>(dst_type,buffer,m_histogram,m_nb_frames,
+			       dst,first_pixel,nb_pixels,filter);
+    case U32:
+      return get_median<unsigned int>(dst_type,buffer,m_histogram,m_nb_frames,
+				      dst,first_pixel,nb_pixels,filter);
+    case S32:
+      return get_median<int>(dst_type,buffer,m_histogram,m_nb_frames,
+			     dst,first_pixel,nb_pixels,filter);
+    default:
+      break;
+    }
+}
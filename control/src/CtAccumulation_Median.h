@@ -0,0 +1,74 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef CTACCUMULATION_MEDIAN_H
+#define CTACCUMULATION_MEDIAN_H
+
+#include "lima/Debug.h"
+#include "lima/MemUtils.h"
+#include "CtAccumulation_Kernels.h"
+
+namespace lima
+{
+  /** @brief per-pixel sample store for the median accumulation.
+   *
+   *  The samples are kept pixel-major in a single buffer (all the frames
+   *  of a pixel are contiguous) so that the selection works in cache.
+   *  8-bit pixels use a histogram instead when it is smaller, i.e. when
+   *  more than 512 frames are accumulated.
+   *
+   *  The pixel ranges given to addFrame and getMedian can be processed
+   *  concurrently as long as they do not overlap.
+   */
+  class AccMedianStack
+  {
+    DEB_CLASS_NAMESPC(DebModControl,"AccMedianStack","Control");
+  public:
+    AccMedianStack(AccKernels::PixelType src_type,long nb_pixels,int nb_frames);
+
+    bool usesHistogram() const { return m_histogram; }
+
+    /** @brief store the pixels [first_pixel,first_pixel + nb_pixels)
+     *  of frame frame_idx (0 <= frame_idx < nb_frames),
+     *  src points to the beginning of the frame
+     */
+    void addFrame(const void *src,int frame_idx,long first_pixel,int nb_pixels);
+
+    /** @brief write the median of the pixels [first_pixel,
+     *  first_pixel + nb_pixels) in dst, once all the frames are added.
+     *  The accumulation filter is applied to the selected samples,
+     *  an even number of frames gives the mean of the two middle ones.
+     *  The samples are reordered.
+     */
+    void getMedian(void *dst,AccKernels::PixelType dst_type,
+		   long first_pixel,int nb_pixels,
+		   const AccKernels::Params& filter);
+
+  private:
+    AccKernels::PixelType	m_src_type;
+    long			m_nb_pixels;
+    int				m_nb_frames;
+    bool			m_histogram;
+    MemBuffer			m_buffer;
+  };
+}
+
+#endif // CTACCUMULATION_MEDIAN_H
@@ -22,6 +22,7 @@
 #include "lima/CtBuffer.h"
 #include "lima/CtAccumulation.h"
 #include "lima/CtSaving.h"
+#include "lima/CtFrameTrace.h"
 #include "lima/SidebandData.h"
 
 #ifdef __unix
@@ -44,6 +45,14 @@ public:
     return "Managed";
   }
 
+  // one descriptor per acquired frame: recycle its memory
+  static void *operator new(size_t size)
+  { return Pool::get().alloc(size); }
+  static void operator delete(void *p, size_t size)
+  { Pool::get().release(p, size); }
+
+  typedef ObjectPool<_DataBuffer> Pool;
+
 private:
   friend class CtBuffer;
   void *m_map_ref;
@@ -54,6 +63,11 @@ bool CtBufferFrameCB::newFrameReady(const HwFrameInfoType& frame_info)
   DEB_MEMBER_FUNCT();
   DEB_PARAM() << DEB_VAR1(frame_info);
 
+  // accumulated frames are numbered by CtAccumulation: traced from there
+  if(!m_ct_accumulation)
+    m_ct->frameTrace()->stamp(CtFrameTrace::HwFrameReady,
+			      frame_info.acq_frame_nb);
+
   Data fdata;
   m_ct->buffer()->getDataFromHwFrameInfo(fdata,frame_info);
   if(m_ct_accumulation)
@@ -256,6 +270,8 @@ void CtBuffer::setup(CtControl *ct)
   }
   m_hw_buffer->prepareAlloc(hwNbBuffer);
   m_hw_buffer->setNbBuffers(hwNbBuffer);
+  // at most one managed descriptor per HW buffer
+  _DataBuffer::Pool::get().reserve(hwNbBuffer);
 
   if(nbuffers > max_nb_buffers)
     nbuffers = max_nb_buffers;
@@ -341,6 +357,13 @@ void CtBuffer::_release(_DataBuffer *fbuf)
     m_cond.signal();
 }
 
+void CtBuffer::getPoolStats(ObjectPoolStats& stats) const
+{
+  DEB_MEMBER_FUNCT();
+  _DataBuffer::Pool::get().getStats(stats);
+  DEB_RETURN() << DEB_VAR1(stats);
+}
+
 bool CtBuffer::waitBuffersReleased(double timeout)
 {
   DEB_MEMBER_FUNCT();
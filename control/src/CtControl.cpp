@@ -19,6 +19,7 @@
 // You should have received a copy of the GNU General Public License
 // along with this program; if not, see <http://www.gnu.org/licenses/>.
 //###########################################################################
+#include <algorithm>
 #include <string>
 #include <sstream>
 
@@ -34,6 +35,7 @@
 #include "lima/CtAccumulation.h"
 #include "lima/CtVideo.h"
 #include "lima/CtEvent.h"
+#include "lima/CtFrameTrace.h"
 #ifdef WITH_CONFIG
 #include "lima/CtConfig.h"
 #endif
@@ -307,6 +309,132 @@ bool CtControl::ImageStatusThread::waitIdle(double timeout)
 }
 
 
+/** @brief Image status counters updated without the CtControl lock.
+ *
+ *  Each counter has its own re-ordering set protected by a private mutex,
+ *  so the HW thread, the processing pool and the saving threads only
+ *  serialize on the stage they update. Values are published as atomics
+ *  inside a (multi-writer) seqlock write section, allowing a consistent
+ *  ImageStatus snapshot to be taken without locking.
+ */
+class CtControl::_ImageCounters
+{
+public:
+  enum Index {
+    Acquired, BaseReady, Ready, Saved, CounterReady, Compressed, NbCounters,
+  };
+
+  static unsigned mask(Index idx)
+  { return 1U << idx; }
+
+  _ImageCounters() : m_write_begin(0), m_write_end(0) {}
+
+  long get(Index idx) const
+  { return m_cnt[idx].value.load(std::memory_order_acquire); }
+
+  void getStatus(ImageStatus& status) const;
+
+  long increment(Index idx, Data& data, long step = 1, unsigned mirror = 0);
+  long add(Index idx, long step = 1);
+  void reset();
+  void clearPending();
+
+private:
+  struct Counter
+  {
+    Counter() : mutex(MutexAttr::Normal), value(-1) {}
+
+    Mutex mutex;
+    SortedDataType pending;
+    std::atomic<long> value;
+  };
+
+  void _beginWrite()
+  {
+    m_write_begin.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  void _endWrite()
+  { m_write_end.fetch_add(1, std::memory_order_release); }
+
+  void _store(Index idx, long val)
+  { m_cnt[idx].value.store(val, std::memory_order_relaxed); }
+
+  Counter m_cnt[NbCounters];
+  std::atomic<unsigned long> m_write_begin;
+  std::atomic<unsigned long> m_write_end;
+};
+
+/** @brief snapshot of all the counters.
+ *  The snapshot is valid if no writer started or finished while reading,
+ *  that is if the begin count equals the end count read before.
+ */
+void CtControl::_ImageCounters::getStatus(ImageStatus& status) const
+{
+  while (true) {
+    unsigned long end = m_write_end.load(std::memory_order_acquire);
+    std::memory_order o = std::memory_order_relaxed;
+    status.LastImageAcquired = m_cnt[Acquired].value.load(o);
+    status.LastBaseImageReady = m_cnt[BaseReady].value.load(o);
+    status.LastImageReady = m_cnt[Ready].value.load(o);
+    status.LastImageSaved = m_cnt[Saved].value.load(o);
+    status.LastCounterReady = m_cnt[CounterReady].value.load(o);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (m_write_begin.load(std::memory_order_relaxed) == end)
+      break;
+  }
+}
+
+/** @brief re-order and increment a counter.
+ *  The counters in mirror mask are set to the same value: they must not
+ *  be incremented concurrently by other threads.
+ */
+long CtControl::_ImageCounters::increment(Index idx, Data& data, long step,
+					  unsigned mirror)
+{
+  Counter& cnt = m_cnt[idx];
+  AutoMutex l(cnt.mutex);
+  long prev = cnt.value.load(std::memory_order_relaxed);
+  long val = _increment_image_cnt(data, prev, cnt.pending, step);
+  if (val != prev) {
+    _beginWrite();
+    _store(idx, val);
+    for (int i = 0; i < NbCounters; ++i)
+      if (mirror & mask(Index(i)))
+	_store(Index(i), val);
+    _endWrite();
+  }
+  return val;
+}
+
+/** @brief increment a counter not needing re-ordering
+ */
+long CtControl::_ImageCounters::add(Index idx, long step)
+{
+  _beginWrite();
+  long val = m_cnt[idx].value.fetch_add(step, std::memory_order_relaxed);
+  _endWrite();
+  return val + step;
+}
+
+void CtControl::_ImageCounters::reset()
+{
+  _beginWrite();
+  for (int i = 0; i < NbCounters; ++i)
+    _store(Index(i), -1);
+  _endWrite();
+}
+
+void CtControl::_ImageCounters::clearPending()
+{
+  for (int i = 0; i < NbCounters; ++i) {
+    AutoMutex l(m_cnt[i].mutex);
+    m_cnt[i].pending.clear();
+  }
+}
+
+
 // --- helper
 
 
@@ -315,18 +443,15 @@ CtControl::CtControl(HwInterface *hw) :
   m_op_int_active(false),
   m_op_ext_link_task_active(false),
   m_op_ext_sink_task_active(false),
-  m_images_acquired(CtControl::ltData()),
-  m_base_images_ready(CtControl::ltData()),
-  m_images_ready(CtControl::ltData()),
-  m_images_compressed(CtControl::ltData()),
-  m_images_saved(CtControl::ltData()),
-  m_last_image_compressed(-1),
+  m_img_counters(new _ImageCounters),
+  m_acq_fault(false),
   m_images_buffer_size(16),
   m_policy(All), m_ready(false),
   m_autosave(false),
   m_saving_compression(false),
   m_saving_nb_zbuffers(0),
   m_running(false),
+  m_img_status_thread_nb(0),
   m_reconstruction_cbk(NULL),
   m_prepare_timeout(2)
 {
@@ -342,6 +467,8 @@ CtControl::CtControl(HwInterface *hw) :
   m_ct_accumulation = new CtAccumulation(*this);
   m_ct_video = new CtVideo(*this);
   m_ct_event = new CtEvent(*this);
+  m_ct_frame_trace = new CtFrameTrace();
+  m_ct_spill_tier = new CtSpillTier();
 
   //Saving
   m_ct_saving= new CtSaving(*this);
@@ -440,11 +567,14 @@ CtControl::~CtControl()
   delete m_ct_accumulation;
   delete m_ct_video;
   delete m_ct_event;
+  delete m_ct_frame_trace;
+  delete m_ct_spill_tier;
 
   delete m_op_int;
   delete m_op_ext;
 
   delete m_soft_op_error_handler;
+  delete m_img_counters;
 }
 
 TaskMgr::EventCallback *CtControl::getSoftOpErrorHandler()
@@ -500,16 +630,18 @@ void CtControl::prepareAcq()
   PoolThreadMgr::get().abort();
   m_ct_saving->_resetReadyFlag();
 
+  // the frame numbers restart: drop the previous trace stamps
+  m_ct_frame_trace->_prepareAcq();
+
   // reset acq status without notifying callbacks
   resetStatus(true);
   
   //Clear all re-ordered image counters
-  m_images_acquired.clear();
-  m_base_images_ready.clear();
-  m_images_ready.clear();
-  m_images_compressed.clear();
-  m_images_saved.clear();
-  m_images_buffer.clear();
+  m_img_counters->clearPending();
+  {
+    AutoMutex aLock(m_images_buffer_lock);
+    m_images_buffer.clear();
+  }
 
   //Clear saving: common & frame headers, ZBuffers and statistics
   m_ct_saving->resetInternalCommonHeader();
@@ -553,6 +685,17 @@ void CtControl::prepareAcq()
   DEB_TRACE() << "Prepare Accumulation if needed";
   m_ct_accumulation->prepare();
 
+  DEB_TRACE() << "Prepare Spill Tier if needed";
+  // the slots hold the frames given to the saving: when accumulating,
+  // the accumulation buffers (32 bit by default), not the HW frames
+  FrameDim saved_dim;
+  if(m_ct_buffer->isAccumulationActive())
+    saved_dim = m_ct_accumulation->m_frame_dim[CtAccumulation::AccImg];
+  else
+    m_ct_image->getImageDim(saved_dim);
+  DEB_TRACE() << DEB_VAR1(saved_dim);
+  m_ct_spill_tier->prepare(saved_dim.getMemSize(), m_nb_buffers);
+
   DEB_TRACE() << "Prepare Saving if needed";
   m_ct_saving->_prepare();
   m_autosave= m_ct_saving->hasAutoSaveMode();
@@ -665,12 +808,12 @@ void CtControl::startAcq()
       int nbFrames4Acq;
       m_ct_acq->getAcqNbFrames(nbFrames4Acq);
       nbFrames4Acq -= 2;
-      m_ready = m_status.ImageCounters.LastImageAcquired != nbFrames4Acq;
+      m_ready = (m_img_counters->get(_ImageCounters::Acquired) != nbFrames4Acq);
     }
 
   bool was_running = m_running;
   m_running = true;
-  m_status.AcquisitionStatus = AcqRunning;
+  _setAcqStatus(AcqRunning);
 
   if (!was_running)
     m_ct_video->_startAcqTime();
@@ -715,7 +858,7 @@ void CtControl::_stopAcq(bool faulty_acq)
     m_ready = false;
     m_running = false;
     if (faulty_acq)
-      m_status.AcquisitionStatus = AcqFault;
+      _setAcqStatus(AcqFault);
   }
 
   _calcAcqStatus();
@@ -734,7 +877,7 @@ void CtControl::abortAcq()
   m_ct_saving->_resetReadyFlag();
 
   AutoMutex aLock(m_cond.mutex());
-  m_status.AcquisitionStatus = AcqReady;
+  _setAcqStatus(AcqReady);
 }
 
 void CtControl::getStatus(Status& status) const
@@ -743,6 +886,7 @@ void CtControl::getStatus(Status& status) const
 
   AutoMutex aLock(m_cond.mutex());
   status = m_status;
+  m_img_counters->getStatus(status.ImageCounters);
   HwInterface::Status aHwStatus;
   m_hw->getStatus(aHwStatus);
   DEB_TRACE() << DEB_VAR1(aHwStatus);
@@ -781,7 +925,7 @@ void CtControl::stopAcqAsync(AcqStatus acq_status, ErrorCode error_code,
     AutoMutex lock(m_cond.mutex());
     bool status_change = (m_status.AcquisitionStatus != acq_status);
     if (status_change) {
-      m_status.AcquisitionStatus = acq_status;
+      _setAcqStatus(acq_status);
       m_status.Error = error_code;
     }
   }
@@ -808,11 +952,12 @@ void CtControl::_updateImageStatusThreads(bool force)
 {
   DEB_MEMBER_FUNCT();
   
+  // registration is not allowed during the acquisition
+  if (m_img_status_thread_nb == 0)
+    return;
+
   ImageStatus status;
-  {
-    AutoMutex aLock(m_cond.mutex());
-    status = m_status.ImageCounters;
-  }
+  m_img_counters->getStatus(status);
 
   ReadWriteLock::ReadGuard guard(m_img_status_thread_list_lock);
   for(ImageStatusThreadList::iterator i = m_img_status_thread_list.begin();
@@ -826,23 +971,21 @@ void CtControl::_updateImageStatusThreads(bool force)
 void CtControl::_calcAcqStatus()
 {
   DEB_MEMBER_FUNCT();
-  
-  AutoMutex aLock(m_cond.mutex());
-
-  AcqStatus& acq_status = m_status.AcquisitionStatus;
-  DEB_TRACE() << DEB_VAR2(acq_status, m_running);
-  if((acq_status != AcqRunning) && (acq_status != AcqFault))
-    return;
 
-  const ImageStatus& img_cntrs = m_status.ImageCounters;
+  // The end-of-acquisition condition is first checked on a lock-free
+  // snapshot of the counters, the lock is only needed to change the status
+  bool running = m_running;
   int acq_nb_frames;
   m_ct_acq->getAcqNbFrames(acq_nb_frames);
 
   bool endless = (acq_nb_frames == 0);
-  if(m_running && endless)
+  if(running && endless)
     return;
 
-  long last_frame = (m_running ? (acq_nb_frames - 1) : img_cntrs.LastImageAcquired);
+  ImageStatus img_cntrs;
+  m_img_counters->getStatus(img_cntrs);
+
+  long last_frame = (running ? (acq_nb_frames - 1) : img_cntrs.LastImageAcquired);
   DEB_TRACE() << DEB_VAR2(last_frame, img_cntrs);
 
   bool hw_acq_end = (img_cntrs.LastImageAcquired == last_frame);
@@ -857,21 +1000,47 @@ void CtControl::_calcAcqStatus()
   if(!acq_end)
     return;
 
+  AutoMutex aLock(m_cond.mutex());
+
+  AcqStatus acq_status = m_status.AcquisitionStatus;
+  DEB_TRACE() << DEB_VAR2(acq_status, m_running);
+  if((acq_status != AcqRunning) && (acq_status != AcqFault))
+    return;
+
   if(acq_status == AcqRunning)
-    acq_status = AcqReady;
+    _setAcqStatus(AcqReady);
   DEB_TRACE() << DEB_VAR1(m_status);
 
   aLock.unlock();
 
   _updateImageStatusThreads(true);
+  m_ct_video->_acqFinished();
+}
+
+void CtControl::getPoolStats(PoolStats& stats) const
+{
+  DEB_MEMBER_FUNCT();
+
+  m_ct_buffer->getPoolStats(stats.DataBuffers);
+  m_ct_saving->getPoolStats(stats.SavingData);
+
+  DEB_RETURN() << DEB_VAR1(stats);
+}
+
+void CtControl::getSpillStats(CtSpillTier::Stats& stats) const
+{
+  DEB_MEMBER_FUNCT();
+
+  m_ct_spill_tier->getStats(stats);
+
+  DEB_RETURN() << DEB_VAR1(stats);
 }
 
 void CtControl::getImageStatus(ImageStatus& status) const
 {
   DEB_MEMBER_FUNCT();
   
-  AutoMutex aLock(m_cond.mutex());
-  status= m_status.ImageCounters;
+  m_img_counters->getStatus(status);
   
   DEB_RETURN() << DEB_VAR1(status);
 }
@@ -892,8 +1061,36 @@ void CtControl::ReadBaseImage(Data &aReturnData,long frameNumber,
   readBlock(aReturnData, frameNumber, readBlockLen, true);
 }
 
+void CtControl::ReadImageBlock(DataBlock &aBlock,long frameNumber,
+			       long readBlockLen)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR2(frameNumber, readBlockLen);
+  readBlock(aBlock, frameNumber, readBlockLen, false);
+}
+
+void CtControl::ReadBaseImageBlock(DataBlock &aBlock,long frameNumber,
+				   long readBlockLen)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR2(frameNumber, readBlockLen);
+  readBlock(aBlock, frameNumber, readBlockLen, true);
+}
+
 void CtControl::readBlock(Data &aReturnData,long frameNumber,long readBlockLen,
 			  bool baseImage)
+{
+  DEB_MEMBER_FUNCT();
+  DataBlock aBlock;
+  readBlock(aBlock, frameNumber, readBlockLen, baseImage);
+  aReturnData = aBlock.getContiguous();
+  DEB_RETURN() << DEB_VAR1(aReturnData);
+}
+
+/** @brief collect the buffers of the frames, no copy
+ */
+void CtControl::readBlock(DataBlock &aBlock,long frameNumber,long readBlockLen,
+			  bool baseImage)
 {
   DEB_MEMBER_FUNCT();
   DEB_PARAM() << DEB_VAR3(frameNumber, readBlockLen, baseImage);
@@ -932,14 +1129,7 @@ void CtControl::readBlock(Data &aReturnData,long frameNumber,long readBlockLen,
   } else if (frameNumber + readBlockLen - 1 > lastFrame)
     THROW_CTL_ERROR(Error) << "Frame(s) not available yet";
 
-  bool one_block = (readBlockLen == 1);
-  if (concatNbFrames > 1) {
-    long firstBuffer = frameNumber / concatNbFrames;
-    long lastBuffer = (frameNumber + readBlockLen - 1) / concatNbFrames;
-    one_block = (firstBuffer == lastBuffer);
-  }
-
-  char *p = NULL;
+  aBlock = DataBlock();
   long framesRead = 0; 
   while (framesRead < readBlockLen) {
     int nbFrames = 1;
@@ -961,31 +1151,13 @@ void CtControl::readBlock(Data &aReturnData,long frameNumber,long readBlockLen,
 			     << "HwBuffer dim (" << auxData.size() << "): "
 			     << DEB_VAR1(auxData);
 
-    if (one_block) {
-      aReturnData = auxData;
-    } else {
-      if (p == NULL) {
-	aReturnData = auxData;
-	Buffer *buffer = new Buffer(imageSize * readBlockLen);
-	aReturnData.setBuffer(buffer);
-	buffer->unref();
-	if (readBlockLen > 1) {
-	  if (aReturnData.dimensions.size() == 2)
-	    aReturnData.dimensions.push_back(readBlockLen);
-	  else
-	    aReturnData.dimensions[2] = readBlockLen;
-	}
-	p = (char *) aReturnData.data();
-      }
-      memcpy(p, auxData.data(), imageSize * nbFrames);
-      p += imageSize * nbFrames;
-    }
+    aBlock._addSegment(auxData, nbFrames, imageSize);
 
     framesRead += nbFrames;
     frameNumber += nbFrames;
   }
 
-  DEB_RETURN() << DEB_VAR1(aReturnData);
+  DEB_RETURN() << DEB_VAR1(aBlock.getNbSegments());
 }
 
 void CtControl::readOneImageBuffer(Data &aReturnData,long frameNumber, 
@@ -994,13 +1166,14 @@ void CtControl::readOneImageBuffer(Data &aReturnData,long frameNumber,
   DEB_MEMBER_FUNCT();
   DEB_PARAM() << DEB_VAR3(frameNumber, readBlockLen, baseImage);
 
-  AutoMutex aLock(m_cond.mutex());
+  AutoMutex aLock(m_images_buffer_lock);
   if(m_op_ext_link_task_active && !baseImage)
     {
       std::map<int,Data>::iterator i = m_images_buffer.find(frameNumber);
       if(i == m_images_buffer.end())
 	{
-	  if(frameNumber < m_status.ImageCounters.LastImageReady - m_images_buffer_size)
+	  long last_image_ready = m_img_counters->get(_ImageCounters::Ready);
+	  if(frameNumber < last_image_ready - m_images_buffer_size)
 	    THROW_CTL_ERROR(Error) << "Frame no more available";
 	  else
 	    THROW_CTL_ERROR(Error) << "Frame not available yet";
@@ -1101,21 +1274,22 @@ void CtControl::resetStatus(bool only_acq_status)
   DEB_TRACE() << "Reseting the status";
   AutoMutex aLock(m_cond.mutex());
   if (only_acq_status) {
-    m_status.AcquisitionStatus = AcqReady;
+    _setAcqStatus(AcqReady);
     return;
   }
   m_status.reset();
-  m_last_image_compressed = -1;
+  m_acq_fault = false;
+  m_img_counters->reset();
   aLock.unlock();
   _updateImageStatusThreads(true);
 }
 
-inline bool CtControl::_mustSkipProcessing(Data& data, AutoMutex& l)
+inline bool CtControl::_mustSkipProcessing(Data& data)
 {
   DEB_MEMBER_FUNCT();
   DEB_PARAM() << DEB_VAR2(data, m_running);
-  ImageStatus &imgStatus = m_status.ImageCounters;
-  bool skip = !m_running && (data.frameNumber > imgStatus.LastImageAcquired);
+  bool skip = !m_running &&
+    (data.frameNumber > m_img_counters->get(_ImageCounters::Acquired));
   DEB_RETURN() << DEB_VAR1(skip);
   return skip;
 }
@@ -1127,33 +1301,37 @@ bool CtControl::newFrameReady(Data& fdata)
 
   DEB_TRACE() << "Frame acq.nb " << fdata.frameNumber << " received";
 
-  {
-    AutoMutex aLock(m_cond.mutex());
-    DEB_TRACE() << DEB_VAR1(m_running);
-    if(_mustSkipProcessing(fdata, aLock) || _checkOverrun(fdata, aLock))
-      return false;// Stop HW Acquisition on stop / overrun
-
-    ImageStatus &imgStatus = m_status.ImageCounters;
-    imgStatus.LastImageAcquired = _increment_image_cnt(fdata,
-						       imgStatus.LastImageAcquired,
-						       m_images_acquired);
-  }
+  DEB_TRACE() << DEB_VAR1(m_running);
+  if(_mustSkipProcessing(fdata) || _checkOverrun(fdata))
+    return false;// Stop HW Acquisition on stop / overrun
+
+  m_ct_frame_trace->stamp(CtFrameTrace::Acquired, fdata.frameNumber);
+  m_img_counters->increment(_ImageCounters::Acquired, fdata);
 
-  TaskMgr *mgr = new TaskMgr();
-  mgr->setEventCallback(m_soft_op_error_handler);
-  mgr->setInputData(fdata);
+  // TaskMgr is owned (and deleted) by PoolThreadMgr: only allocate it
+  // if there is something to process
+  bool internal_tasks = (!m_ct_buffer->isAccumulationActive() &&
+			 m_op_int->hasTasks());
+  bool ext_link_task, ext_sink_task;
+  m_op_ext->isTaskActive(ext_link_task, ext_sink_task);
 
   int internal_stage = 0;
-  if (!m_ct_buffer->isAccumulationActive())
-    m_op_int->addTo(*mgr, internal_stage);
+  if (internal_tasks || ext_link_task || ext_sink_task) {
+    TaskMgr *mgr = new TaskMgr();
+    mgr->setEventCallback(m_soft_op_error_handler);
+    mgr->setInputData(fdata);
 
-  int last_link,last_sink;
-  m_op_ext->addTo(*mgr, internal_stage, last_link, last_sink);
+    if (internal_tasks)
+      m_op_int->addTo(*mgr, internal_stage);
 
-  if (internal_stage || (last_link >= 0) || (last_sink >= 0))
-    PoolThreadMgr::get().addProcess(mgr);
-  else
-    delete mgr;
+    int last_link,last_sink;
+    m_op_ext->addTo(*mgr, internal_stage, last_link, last_sink);
+
+    if (internal_stage || (last_link >= 0) || (last_sink >= 0))
+      PoolThreadMgr::get().addProcess(mgr);
+    else
+      delete mgr;
+  }
   if (!internal_stage)
     newBaseImageReady(fdata);
 
@@ -1168,18 +1346,15 @@ void CtControl::newBaseImageReady(Data &aData)
   DEB_MEMBER_FUNCT();
   DEB_PARAM() << DEB_VAR1(aData);
 
-  AutoMutex aLock(m_cond.mutex());
-
-  if(_mustSkipProcessing(aData, aLock))
+  if(_mustSkipProcessing(aData))
     return;
 
-  ImageStatus &imgStatus = m_status.ImageCounters;
-  imgStatus.LastBaseImageReady = _increment_image_cnt(aData,imgStatus.LastBaseImageReady,
-						      m_base_images_ready);
+  // without ext link task the last image is the base image
+  unsigned mirror = 0;
   if(!m_op_ext_link_task_active)
-    imgStatus.LastImageReady = imgStatus.LastBaseImageReady;
-
-  aLock.unlock();
+    mirror = _ImageCounters::mask(_ImageCounters::Ready);
+  m_ct_frame_trace->stamp(CtFrameTrace::BaseImageReady, aData.frameNumber);
+  m_img_counters->increment(_ImageCounters::BaseReady, aData, 1, mirror);
 
   if(m_autosave && !m_op_ext_link_task_active)
     newFrameToSave(aData);
@@ -1202,21 +1377,19 @@ void CtControl::newImageReady(Data &aData)
   DEB_MEMBER_FUNCT();
   DEB_PARAM() << DEB_VAR1(aData);
 
-  AutoMutex aLock(m_cond.mutex());
-
-  if(_mustSkipProcessing(aData, aLock))
+  if(_mustSkipProcessing(aData))
     return;
 
-  ImageStatus &imgStatus = m_status.ImageCounters;
-  imgStatus.LastImageReady = _increment_image_cnt(aData,imgStatus.LastImageReady,
-						  m_images_ready);
+  m_ct_frame_trace->stamp(CtFrameTrace::ImageReady, aData.frameNumber);
+  m_img_counters->increment(_ImageCounters::Ready, aData);
 
-  m_images_buffer.insert(std::pair<int,Data>(aData.frameNumber,aData));
-  //pop out the oldest Data
-  if(int(m_images_buffer.size()) > m_images_buffer_size)
-    m_images_buffer.erase(m_images_buffer.begin());
-
-  aLock.unlock();
+  {
+    AutoMutex aLock(m_images_buffer_lock);
+    m_images_buffer.insert(std::pair<int,Data>(aData.frameNumber,aData));
+    //pop out the oldest Data
+    if(int(m_images_buffer.size()) > m_images_buffer_size)
+      m_images_buffer.erase(m_images_buffer.begin());
+  }
 
   if(m_autosave)
     newFrameToSave(aData);
@@ -1232,13 +1405,12 @@ void CtControl::newImageReady(Data &aData)
 void CtControl::newCounterReady(Data& aData)
 {
   DEB_MEMBER_FUNCT();
-  AutoMutex aLock(m_cond.mutex());
 
-  if(_mustSkipProcessing(aData, aLock))
+  if(_mustSkipProcessing(aData))
     return;
   
-  ++m_status.ImageCounters.LastCounterReady;
-  aLock.unlock();
+  m_ct_frame_trace->stamp(CtFrameTrace::CounterReady, aData.frameNumber);
+  m_img_counters->add(_ImageCounters::CounterReady);
   _calcAcqStatus();
 }
 /** function to re-order image counters
@@ -1273,11 +1445,8 @@ void CtControl::newImageCompressed(Data &data)
 {
   DEB_MEMBER_FUNCT();
 
-  AutoMutex aLock(m_cond.mutex());
-
-  m_last_image_compressed = _increment_image_cnt(data,m_last_image_compressed,
-						 m_images_compressed);
-  aLock.unlock();
+  m_ct_frame_trace->stamp(CtFrameTrace::ImageCompressed, data.frameNumber);
+  m_img_counters->increment(_ImageCounters::Compressed, data);
 
   // TODO: activate when ImageStatus includes LastImageCompressed
   // _updateImageStatusThreads(false);
@@ -1301,20 +1470,16 @@ void CtControl::newImageSaved(Data &data)
     if (extra_frames > 0)
       frames_per_callback = extra_frames;
   }
-  AutoMutex aLock(m_cond.mutex());
-  ImageStatus &imgStatus = m_status.ImageCounters;
-
-  imgStatus.LastImageSaved = _increment_image_cnt(data,imgStatus.LastImageSaved,
-						  m_images_saved,
-						  frames_per_callback);
+  // no acquisition/processing path in HW saving: all follow saved counter
+  unsigned mirror = 0;
   if(savingManagedMode == CtSaving::Hardware)
-    {
-      imgStatus.LastImageAcquired = imgStatus.LastImageSaved;
-      imgStatus.LastBaseImageReady = imgStatus.LastImageSaved;
-      imgStatus.LastImageReady = imgStatus.LastImageSaved;
-    }
+    mirror = (_ImageCounters::mask(_ImageCounters::Acquired) |
+	      _ImageCounters::mask(_ImageCounters::BaseReady) |
+	      _ImageCounters::mask(_ImageCounters::Ready));
 
-  aLock.unlock();
+  m_ct_frame_trace->stamp(CtFrameTrace::ImageSaved, data.frameNumber);
+  m_img_counters->increment(_ImageCounters::Saved, data, frames_per_callback,
+			    mirror);
 
   _updateImageStatusThreads(false);
   _calcAcqStatus();
@@ -1352,6 +1517,7 @@ void CtControl::registerImageStatusCallback(ImageStatusCallback& cb)
   cb.setImageStatusCallbackGen(this);
   m_img_status_thread_list.push_back(thread);
   thread.forget();
+  m_img_status_thread_nb = m_img_status_thread_list.size();
 }
 /** unregisterImageStatusCallback is not thread safe!!!
  */
@@ -1371,18 +1537,21 @@ void CtControl::unregisterImageStatusCallback(ImageStatusCallback& cb)
 
   AutoPtr<ImageStatusThread> thread = *i; 
   m_img_status_thread_list.erase(i);
+  m_img_status_thread_nb = m_img_status_thread_list.size();
   cb.setImageStatusCallbackGen(NULL);
 }
 
 /** @brief this methode check if an overrun 
- *  @warning this methode is call under lock
+ *  @warning this methode works on a lock-free snapshot of the counters
  */
-bool CtControl::_checkOverrun(Data& aData, AutoMutex& l)
+bool CtControl::_checkOverrun(Data& aData)
 {
   DEB_MEMBER_FUNCT();
-  if(m_status.AcquisitionStatus == AcqFault) return true;
+  if(m_acq_fault) return true;
 
-  const ImageStatus &imageStatus = m_status.ImageCounters;
+  ImageStatus imageStatus;
+  m_img_counters->getStatus(imageStatus);
+  long last_image_compressed = m_img_counters->get(_ImageCounters::Compressed);
 
   // ext ops are not in-place, relaxing hw buffer limit to LastImageReady
   // if no ext ops, full processing chain needs orig hw buffer
@@ -1395,14 +1564,23 @@ bool CtControl::_checkOverrun(Data& aData, AutoMutex& l)
 
   long lastUsedForSave;
   if(full_chain)
-    lastUsedForSave = m_saving_compression ? m_last_image_compressed :
+    lastUsedForSave = m_saving_compression ? last_image_compressed :
       imageStatus.LastImageSaved;
   else
     lastUsedForSave = imageStatus.LastImageReady;
+  // the frames moved to the spill tier do not hold a HW buffer any more
+  if(full_chain && m_autosave && m_ct_saving->_isSpillActive())
+    {
+      long lastUnpinned =
+	m_ct_saving->_getLastUnpinnedFrame(imageStatus.LastImageReady);
+      lastUsedForSave = std::max(lastUsedForSave, lastUnpinned);
+    }
   long imageToSave = imageStatus.LastImageAcquired - lastUsedForSave;
+  if(m_autosave && m_ct_spill_tier->checkRingUsage(imageToSave))
+    m_ct_saving->_requestSpill();
 
   long compressedToSave = !m_saving_compression ? 0 :
-    (m_last_image_compressed - imageStatus.LastImageSaved);
+    (last_image_compressed - imageStatus.LastImageSaved);
 
   bool overrunFlag = false;
   ErrorCode error_code = NoError;
@@ -1415,10 +1593,8 @@ bool CtControl::_checkOverrun(Data& aData, AutoMutex& l)
     {
       overrunFlag = true;
       int first_to_save = -1, last_to_save = -1;
-      if (m_autosave) {
-        AutoMutexUnlock u(l);
+      if (m_autosave)
         m_ct_saving->getSaveCounters(first_to_save, last_to_save);
-      }
 
       DEB_ERROR() << DEB_VAR2(first_to_save, last_to_save);
       int frames_to_save;
@@ -1439,14 +1615,111 @@ bool CtControl::_checkOverrun(Data& aData, AutoMutex& l)
     }
 
   if (overrunFlag) {
-    AutoMutexUnlock u(l);
-    DEB_ERROR() << DEB_VAR2(m_status, error_code);
+    m_ct_frame_trace->stamp(CtFrameTrace::Overrun, aData.frameNumber);
+    DEB_ERROR() << DEB_VAR2(imageStatus, error_code);
     stopAcqAsync(AcqFault, error_code, aData);
   }
 
   DEB_RETURN() << DEB_VAR1(overrunFlag);
   return overrunFlag;
 }
+// ----------------------------------------------------------------------------
+// class DataBlock
+// ----------------------------------------------------------------------------
+CtControl::DataBlock::DataBlock() :
+  m_nb_frames(0),
+  m_frame_mem_size(0)
+{
+}
+
+int CtControl::DataBlock::getNbFrames() const
+{
+  return m_nb_frames;
+}
+
+int CtControl::DataBlock::getNbSegments() const
+{
+  return m_segments.size();
+}
+
+Data CtControl::DataBlock::getSegment(int segment) const
+{
+  DEB_MEMBER_FUNCT();
+  if ((segment < 0) || (segment >= getNbSegments()))
+    THROW_CTL_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(segment);
+  return m_segments[segment];
+}
+
+void CtControl::DataBlock::_addSegment(Data& data,int nb_frames,
+				       int frame_mem_size)
+{
+  m_segments.push_back(data);
+  m_first_frames.push_back(m_nb_frames);
+  m_nb_frames += nb_frames;
+  m_frame_mem_size = frame_mem_size;
+}
+
+void CtControl::DataBlock::_findFrame(int frame,int& segment,int& offset) const
+{
+  DEB_MEMBER_FUNCT();
+  if ((frame < 0) || (frame >= m_nb_frames))
+    THROW_CTL_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(frame);
+  std::vector<int>::const_iterator i = std::upper_bound(m_first_frames.begin(),
+							m_first_frames.end(),
+							frame);
+  segment = (i - m_first_frames.begin()) - 1;
+  offset = frame - m_first_frames[segment];
+}
+
+Data CtControl::DataBlock::getFrame(int frame) const
+{
+  DEB_MEMBER_FUNCT();
+  int segment, offset;
+  _findFrame(frame, segment, offset);
+  const Data& aSegment = m_segments[segment];
+  if ((aSegment.dimensions.size() < 3) || (aSegment.dimensions[2] == 1))
+    return aSegment;
+
+  // the frame buffer holds a reference on the segment one
+  Data aFrame = aSegment;
+  aFrame.dimensions.resize(2);
+  aFrame.frameNumber += offset;
+  char *ptr = (char *) aSegment.data() + long(offset) * m_frame_mem_size;
+  Data aParent = aSegment;
+  MappedBuffer *buffer = new MappedBuffer(ptr, [aParent](void *) {});
+  aFrame.setBuffer(buffer);
+  buffer->unref();
+  return aFrame;
+}
+
+Data CtControl::DataBlock::getContiguous() const
+{
+  DEB_MEMBER_FUNCT();
+  if (m_segments.empty())
+    return Data();
+  else if (m_segments.size() == 1)
+    return m_segments.front();
+
+  Data aReturnData = m_segments.front();
+  Buffer *buffer = new Buffer(long(m_frame_mem_size) * m_nb_frames);
+  aReturnData.setBuffer(buffer);
+  buffer->unref();
+  if (aReturnData.dimensions.size() == 2)
+    aReturnData.dimensions.push_back(m_nb_frames);
+  else
+    aReturnData.dimensions[2] = m_nb_frames;
+
+  char *p = (char *) aReturnData.data();
+  for (int i = 0; i < getNbSegments(); ++i) {
+    int nb_frames = (((i + 1 < getNbSegments()) ? m_first_frames[i + 1] :
+		      m_nb_frames) - m_first_frames[i]);
+    long size = long(m_frame_mem_size) * nb_frames;
+    memcpy(p, m_segments[i].data(), size);
+    p += size;
+  }
+  return aReturnData;
+}
+
 // ----------------------------------------------------------------------------
 // Struct ImageStatus
 // ----------------------------------------------------------------------------
@@ -1567,6 +1840,8 @@ CtAccumulation* 	CtControl::accumulation() 	{ return m_ct_accumulation; }
 CtVideo*		CtControl::video()		{ return m_ct_video;}
 CtShutter* 		CtControl::shutter() 		{ return m_ct_shutter; }
 CtEvent* 		CtControl::event()		{ return m_ct_event; }
+CtFrameTrace*		CtControl::frameTrace()		{ return m_ct_frame_trace; }
+CtSpillTier*		CtControl::spillTier()		{ return m_ct_spill_tier; }
 #ifdef WITH_CONFIG
 CtConfig*		CtControl::config()		{ return m_ct_config; }
 #endif
@@ -0,0 +1,531 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <thread>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "lima/CtFrameTrace.h"
+#include "lima/Exceptions.h"
+
+using namespace lima;
+
+// frames in flight: the origin of a frame is kept until frame + NB_SLOTS
+static const long NB_SLOTS = 1 << 16;
+// histogram buckets: SUB_COUNT per power of 2, up to 2^40 ns (~18 min)
+static const int SUB_BITS = 5;
+static const int SUB_COUNT = 1 << SUB_BITS;
+static const int MAX_BITS = 40;
+static const int NB_BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_COUNT;
+static const int DEFAULT_RING_SIZE = 16 * 1024;
+
+static std::atomic<unsigned long long> next_ring_key(1);
+
+static inline long long _now_ns()
+{
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static inline int _msb(unsigned long long v)
+{
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanReverse64(&index,v);
+  return int(index);
+#else
+  return 63 - __builtin_clzll(v);
+#endif
+}
+
+static inline int _bucket(long long ns)
+{
+  if(ns < SUB_COUNT)
+    return ns < 0 ? 0 : int(ns);
+  int shift = _msb(ns) - SUB_BITS;
+  int bucket = (shift + 1) * SUB_COUNT + int((ns >> shift) - SUB_COUNT);
+  return std::min(bucket,NB_BUCKETS - 1);
+}
+
+struct CtFrameTrace::_Stamp
+{
+  long long	time;		// ns
+  long		frame;
+  int		stage;
+};
+
+/** @brief stamps of one thread, written by this thread only
+ *
+ *  The entries are atomic: read() may run concurrently with push(),
+ *  the entries overwritten during the copy are detected with the
+ *  m_started counter, bumped before an entry is written (a seqlock).
+ */
+class CtFrameTrace::_Ring
+{
+public:
+  _Ring(int size,int thread_index) :
+    m_stamps(size),m_started(0),m_head(0),m_thread_index(thread_index),
+    m_thread_id(std::this_thread::get_id()) {}
+
+  void push(const _Stamp& s)
+  {
+    unsigned long long head = m_head.load(std::memory_order_relaxed);
+    m_started.store(head + 1,std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    _Entry& e = m_stamps[head % m_stamps.size()];
+    e.time.store(s.time,std::memory_order_relaxed);
+    e.frame.store(s.frame,std::memory_order_relaxed);
+    e.stage.store(s.stage,std::memory_order_relaxed);
+    m_head.store(head + 1,std::memory_order_release);
+  }
+
+  /// the stamps not overwritten during the copy
+  void read(std::vector<_Stamp>& stamps) const
+  {
+    unsigned long long size = m_stamps.size();
+    unsigned long long end = m_head.load(std::memory_order_acquire);
+    unsigned long long begin = (end > size) ? end - size : 0;
+    std::vector<_Stamp> copy;
+    for(unsigned long long i = begin;i < end;++i)
+      {
+	const _Entry& e = m_stamps[i % size];
+	_Stamp s = {e.time.load(std::memory_order_relaxed),
+		    e.frame.load(std::memory_order_relaxed),
+		    e.stage.load(std::memory_order_relaxed)};
+	copy.push_back(s);
+      }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    unsigned long long started = m_started.load(std::memory_order_relaxed);
+    if(started > size + begin)
+      copy.erase(copy.begin(),
+		 copy.begin() + std::min<unsigned long long>(started - size - begin,
+							     copy.size()));
+    stamps.insert(stamps.end(),copy.begin(),copy.end());
+  }
+
+  /// with the thread not stamping
+  void clear()
+  {
+    m_head.store(0,std::memory_order_relaxed);
+    m_started.store(0,std::memory_order_release);
+  }
+  int threadIndex() const { return m_thread_index; }
+  std::thread::id threadId() const { return m_thread_id; }
+
+private:
+  struct _Entry
+  {
+    std::atomic<long long>	time;
+    std::atomic<long>		frame;
+    std::atomic<int>		stage;
+  };
+
+  std::vector<_Entry>			m_stamps;
+  std::atomic<unsigned long long>	m_started;
+  std::atomic<unsigned long long>	m_head;
+  int					m_thread_index;
+  std::thread::id			m_thread_id;
+};
+
+class CtFrameTrace::_Tables
+{
+public:
+  struct Slot
+  {
+    std::atomic<long>		frame;
+    std::atomic<long long>	origin;
+  };
+  struct StageHisto
+  {
+    std::atomic<long long>	count;
+    std::atomic<long long>	sum;
+    std::atomic<long long>	min;
+    std::atomic<long long>	max;
+    std::atomic<long long>	buckets[NB_BUCKETS];
+  };
+
+  _Tables() : slots(new Slot[NB_SLOTS]) { reset(); }
+  ~_Tables() { delete [] slots; }
+
+  void reset()
+  {
+    resetFrames();
+    for(int s = 0;s < NbStages;++s)
+      {
+	StageHisto& h = histos[s];
+	h.count = h.sum = h.max = 0;
+	h.min = -1;
+	for(int b = 0;b < NB_BUCKETS;++b)
+	  h.buckets[b] = 0;
+      }
+  }
+
+  void resetFrames()
+  {
+    for(long i = 0;i < NB_SLOTS;++i)
+      slots[i].frame = -1,slots[i].origin = 0;
+    t0 = _now_ns();
+  }
+
+  void add(Stage stage,long long latency)
+  {
+    StageHisto& h = histos[stage];
+    h.count.fetch_add(1,std::memory_order_relaxed);
+    h.sum.fetch_add(latency,std::memory_order_relaxed);
+    h.buckets[_bucket(latency)].fetch_add(1,std::memory_order_relaxed);
+    long long prev = h.min.load(std::memory_order_relaxed);
+    while((prev < 0 || latency < prev) &&
+	  !h.min.compare_exchange_weak(prev,latency,std::memory_order_relaxed));
+    prev = h.max.load(std::memory_order_relaxed);
+    while(latency > prev &&
+	  !h.max.compare_exchange_weak(prev,latency,std::memory_order_relaxed));
+  }
+
+  Slot*		slots;
+  StageHisto	histos[NbStages];
+  long long	t0;
+};
+
+CtFrameTrace::Histogram::Histogram()
+{
+  reset();
+}
+
+void CtFrameTrace::Histogram::reset()
+{
+  Count = 0;
+  Min = Max = Mean = 0;
+  Buckets.assign(NB_BUCKETS,0);
+}
+
+double CtFrameTrace::Histogram::getPercentile(double percent) const
+{
+  if(!Count)
+    return 0;
+  long long rank = (long long)(Count * percent / 100.);
+  long long nb = 0;
+  for(int b = 0;b < int(Buckets.size());++b)
+    {
+      nb += Buckets[b];
+      if(nb > rank)
+	return std::min(std::max(getBucketLowerBound(b),Min),Max);
+    }
+  return Max;
+}
+
+double CtFrameTrace::Histogram::getBucketLowerBound(int bucket)
+{
+  if(bucket < SUB_COUNT)
+    return bucket * 1e-9;
+  int shift = bucket / SUB_COUNT - 1;
+  long long sub = bucket % SUB_COUNT;
+  return double((SUB_COUNT + sub) << shift) * 1e-9;
+}
+
+CtFrameTrace::CtFrameTrace() :
+  m_active(false),
+  m_tables(new _Tables),
+  m_ring_size(DEFAULT_RING_SIZE),
+  m_ring_key(next_ring_key++)
+{
+  DEB_CONSTRUCTOR();
+}
+
+CtFrameTrace::~CtFrameTrace()
+{
+  DEB_DESTRUCTOR();
+
+  for(std::vector<_Ring*>::iterator i = m_rings.begin();i != m_rings.end();++i)
+    delete *i;
+  for(std::vector<_Ring*>::iterator i = m_old_rings.begin();
+      i != m_old_rings.end();++i)
+    delete *i;
+  delete m_tables;
+}
+
+void CtFrameTrace::setActive(bool active)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(active);
+
+  m_active = active;
+}
+
+void CtFrameTrace::getActive(bool& active) const
+{
+  DEB_MEMBER_FUNCT();
+  active = m_active;
+  DEB_RETURN() << DEB_VAR1(active);
+}
+
+void CtFrameTrace::setRingSize(int nb_stamps)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(nb_stamps);
+
+  if(nb_stamps < 0)
+    THROW_CTL_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(nb_stamps);
+
+  AutoMutex lock(m_lock);
+  if(nb_stamps == m_ring_size)
+    return;
+  m_ring_size = nb_stamps;
+  // the threads may still hold the current rings: keep them
+  m_old_rings.insert(m_old_rings.end(),m_rings.begin(),m_rings.end());
+  m_rings.clear();
+  m_ring_key = next_ring_key++;
+}
+
+void CtFrameTrace::getRingSize(int& nb_stamps) const
+{
+  DEB_MEMBER_FUNCT();
+  AutoMutex lock(m_lock);
+  nb_stamps = m_ring_size;
+  DEB_RETURN() << DEB_VAR1(nb_stamps);
+}
+
+/** @brief to be called with the acquisition stopped: the stamps in
+ *  progress could be counted in the new histograms
+ */
+void CtFrameTrace::reset()
+{
+  DEB_MEMBER_FUNCT();
+
+  AutoMutex lock(m_lock);
+  m_tables->reset();
+  for(std::vector<_Ring*>::iterator i = m_rings.begin();i != m_rings.end();++i)
+    (*i)->clear();
+}
+
+/** @brief a new acquisition restarts the frame numbers: forget the
+ *  stamps and the frame origins of the previous one, the histograms
+ *  keep accumulating until reset()
+ */
+void CtFrameTrace::_prepareAcq()
+{
+  DEB_MEMBER_FUNCT();
+
+  AutoMutex lock(m_lock);
+  m_tables->resetFrames();
+  for(std::vector<_Ring*>::iterator i = m_rings.begin();i != m_rings.end();++i)
+    (*i)->clear();
+}
+
+void CtFrameTrace::getHistogram(Stage stage,Histogram& histogram) const
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(stage);
+
+  if(stage < 0 || stage >= NbStages)
+    THROW_CTL_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(stage);
+
+  const _Tables::StageHisto& h = m_tables->histos[stage];
+  histogram.reset();
+  for(int b = 0;b < NB_BUCKETS;++b)
+    histogram.Buckets[b] = h.buckets[b].load(std::memory_order_relaxed);
+  histogram.Count = h.count;
+  if(histogram.Count)
+    {
+      histogram.Min = std::max<long long>(h.min,0) * 1e-9;
+      histogram.Max = h.max * 1e-9;
+      histogram.Mean = h.sum * 1e-9 / histogram.Count;
+    }
+  DEB_RETURN() << DEB_VAR1(histogram);
+}
+
+const char* CtFrameTrace::getStageName(Stage stage)
+{
+  switch(stage)
+    {
+    case HwFrameReady:		return "HwFrameReady";
+    case Acquired:		return "Acquired";
+    case BaseImageReady:	return "BaseImageReady";
+    case ImageReady:		return "ImageReady";
+    case CounterReady:		return "CounterReady";
+    case ImageCompressed:	return "ImageCompressed";
+    case ImageSaved:		return "ImageSaved";
+    case Overrun:		return "Overrun";
+    default:			return "Unknown";
+    }
+}
+
+/** @brief Chrome trace-event JSON.
+ *
+ *  Each stamp is a complete event ("X") starting at the previous stamp of
+ *  the same frame, on the thread which reached the stage; the first
+ *  stamp of a frame and the overruns are instant events.
+ */
+void CtFrameTrace::getChromeTrace(std::string& json) const
+{
+  DEB_MEMBER_FUNCT();
+
+  struct Item
+  {
+    long long	time;
+    int		stage;
+    int		thread;
+    bool operator<(const Item& o) const { return time < o.time; }
+  };
+  typedef std::map<long,std::vector<Item> > FrameMap;
+
+  FrameMap frames;
+  std::vector<int> threads;
+  long long t0;
+  {
+    AutoMutex lock(m_lock);
+    t0 = m_tables->t0;
+    for(std::vector<_Ring*>::const_iterator r = m_rings.begin();
+	r != m_rings.end();++r)
+      {
+	std::vector<_Stamp> stamps;
+	(*r)->read(stamps);
+	int thread = (*r)->threadIndex();
+	threads.push_back(thread);
+	for(std::vector<_Stamp>::iterator s = stamps.begin();
+	    s != stamps.end();++s)
+	  {
+	    Item item = {s->time,s->stage,thread};
+	    frames[s->frame].push_back(item);
+	  }
+      }
+  }
+
+  std::ostringstream os;
+  os.setf(std::ios::fixed);
+  os.precision(3);
+  os << "{\"traceEvents\":[";
+  const char *sep = "\n";
+  for(std::vector<int>::iterator t = threads.begin();t != threads.end();++t)
+    {
+      os << sep << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+	 << "\"tid\":" << *t << ",\"args\":{\"name\":\"lima-" << *t << "\"}}";
+      sep = ",\n";
+    }
+  for(FrameMap::iterator f = frames.begin();f != frames.end();++f)
+    {
+      std::vector<Item>& items = f->second;
+      std::stable_sort(items.begin(),items.end());
+      for(size_t i = 0;i < items.size();++i)
+	{
+	  const Item& item = items[i];
+	  Stage stage = Stage(item.stage);
+	  os << sep << "{\"name\":\"" << getStageName(stage)
+	     << "\",\"cat\":\"frame\",\"pid\":1,\"tid\":" << item.thread;
+	  sep = ",\n";
+	  if(!i || stage == Overrun)
+	    os << ",\"ph\":\"i\",\"s\":\"" << (stage == Overrun ? 'g' : 't')
+	       << "\",\"ts\":" << (item.time - t0) * 1e-3;
+	  else
+	    {
+	      const Item& prev = items[i - 1];
+	      os << ",\"ph\":\"X\",\"ts\":" << (prev.time - t0) * 1e-3
+		 << ",\"dur\":" << (item.time - prev.time) * 1e-3;
+	    }
+	  os << ",\"args\":{\"frame\":" << f->first;
+	  if(i && stage != Overrun)
+	    os << ",\"from\":\"" << getStageName(Stage(items[i - 1].stage))
+	       << "\"";
+	  os << "}}";
+	}
+    }
+  os << "\n],\"displayTimeUnit\":\"ms\"}\n";
+  json = os.str();
+}
+
+void CtFrameTrace::dumpChromeTrace(const std::string& filename) const
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(filename);
+
+  std::string json;
+  getChromeTrace(json);
+  std::ofstream out(filename.c_str());
+  if(!out)
+    THROW_CTL_ERROR(Error) << "Can't open file: " << DEB_VAR1(filename);
+  out << json;
+  if(!out)
+    THROW_CTL_ERROR(Error) << "Error writing file: " << DEB_VAR1(filename);
+}
+
+void CtFrameTrace::_stamp(Stage stage,long frame)
+{
+  long long now = _now_ns();
+
+  _Tables::Slot& slot = m_tables->slots[frame & (NB_SLOTS - 1)];
+  long slot_frame = slot.frame.load(std::memory_order_acquire);
+  long long latency = 0;
+  if(stage == HwFrameReady || (stage == Acquired && slot_frame != frame))
+    {
+      // first stamp of the frame
+      slot.frame.store(-1,std::memory_order_relaxed);
+      slot.origin.store(now,std::memory_order_relaxed);
+      slot.frame.store(frame,std::memory_order_release);
+    }
+  else if(slot_frame == frame)
+    {
+      long long origin = slot.origin.load(std::memory_order_relaxed);
+      latency = std::max(now - origin,0LL);
+    }
+  else
+    latency = -1;		// origin not seen (or already recycled)
+
+  if(latency >= 0)
+    m_tables->add(stage,latency);
+
+  _Ring* ring = _getRing();
+  if(ring)
+    {
+      _Stamp s = {now,frame,int(stage)};
+      ring->push(s);
+    }
+}
+
+CtFrameTrace::_Ring* CtFrameTrace::_getRing()
+{
+  // one ring per thread: found once, then cached
+  static thread_local unsigned long long t_key = 0;
+  static thread_local _Ring* t_ring = NULL;
+
+  if(t_key == m_ring_key.load(std::memory_order_relaxed))
+    return t_ring;
+
+  AutoMutex lock(m_lock);
+  t_key = m_ring_key;
+  t_ring = NULL;
+  if(!m_ring_size)
+    return NULL;
+  // the thread may alternate between several instances
+  std::thread::id id = std::this_thread::get_id();
+  for(std::vector<_Ring*>::iterator i = m_rings.begin();i != m_rings.end();++i)
+    if((*i)->threadId() == id)
+      return t_ring = *i;
+  int thread_index = int(m_rings.size() + m_old_rings.size()) + 1;
+  t_ring = new _Ring(m_ring_size,thread_index);
+  m_rings.push_back(t_ring);
+  return t_ring;
+}
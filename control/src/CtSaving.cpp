@@ -20,6 +20,7 @@
 // along with this program; if not, see <http://www.gnu.org/licenses/>.
 //###########################################################################
 #include <cmath>
+#include <fstream>
 #include <sstream>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -74,6 +75,7 @@ using namespace lima;
 static const char DIR_SEPARATOR = '/';
 static const int COMPRESSION_PRIORITY = 0;
 static const int SAVING_PRIORITY = 1;
+static const int NB_STREAMS = 5;
 /** @brief save task class
  */
 class CtSaving::Stream::_SaveTask : public SinkTaskBase
@@ -81,7 +83,7 @@ class CtSaving::Stream::_SaveTask : public SinkTaskBase
 	DEB_CLASS_NAMESPC(DebModControl, "CtSaving::Stream::_SaveTask", "Control");
 public:
 	_SaveTask(CtSaving::Stream& stream, Data& data)
-		: SinkTaskBase(), m_stream(stream)
+		: SinkTaskBase(), m_async(false), m_stream(stream)
 	{
 		m_stream.prepareWritingFrame(data);
 	}
@@ -91,10 +93,19 @@ public:
 		DEB_MEMBER_FUNCT();
 		DEB_PARAM() << DEB_VAR1(aData);
 
-		m_stream.writeFile(aData, m_header);
+		m_stream.writeFile(aData, m_header, m_async);
 	}
 
+	// one task per frame and per stream: recycle its memory
+	static void* operator new(size_t size)
+	{ return Pool::get().alloc(size); }
+	static void operator delete(void* p, size_t size)
+	{ Pool::get().release(p, size); }
+
+	typedef ObjectPool<_SaveTask> Pool;
+
 	CtSaving::HeaderMap	 m_header;
+	bool			 m_async;
 private:
 	CtSaving::Stream& m_stream;
 };
@@ -182,16 +193,82 @@ private:
 	CtEvent& m_event;
 };
 
+/** @brief copies the queued frames into the spill tier
+
+	Not a pool task: the pool threads may all be blocked writing on the
+	filesystem that makes the spilling necessary.
+*/
+class CtSaving::_SpillThread : public Thread
+{
+	DEB_CLASS_NAMESPC(DebModControl, "CtSaving::_SpillThread", "Control");
+public:
+	_SpillThread(CtSaving& saving)
+		: m_saving(saving), m_requested(false), m_quit(false)
+	{
+		start();
+	}
+
+	virtual ~_SpillThread()
+	{
+		{
+			AutoMutex lock(m_cond.mutex());
+			m_quit = true;
+			m_cond.broadcast();
+		}
+		join();
+	}
+
+	void request()
+	{
+		AutoMutex lock(m_cond.mutex());
+		if (!m_requested) {
+			m_requested = true;
+			m_cond.broadcast();
+		}
+	}
+
+protected:
+	virtual void threadFunction()
+	{
+		DEB_MEMBER_FUNCT();
+		AutoMutex lock(m_cond.mutex());
+		while (!m_quit) {
+			if (!m_requested) {
+				m_cond.wait();
+				continue;
+			}
+			m_requested = false;
+			AutoMutexUnlock u(lock);
+			try {
+				m_saving._spillFrames();
+			} catch (Exception& e) {
+				DEB_ERROR() << "Spilling frames: " << e.getErrMsg();
+			}
+		}
+	}
+
+private:
+	CtSaving& m_saving;
+	Cond m_cond;
+	bool m_requested;
+	bool m_quit;
+};
+
 struct CtSaving::_SavingSidebandData : public sideband::Data
 {
 	Mutex m_lock;
 	std::atomic<long> m_nb_cbk{0};
+	// per stream pending asynchronous writes (+1 while writeFile runs)
+	std::atomic<int> m_async_refs[NB_STREAMS];
 	ZBufferList m_buffers;
 	SaveContainer::FrameParameters m_params;
 	SaveContainer::Stat m_stat;
 
 	_SavingSidebandData(::Data& data) : m_stat(data)
-	{}
+	{
+		for (int s = 0; s < NB_STREAMS; ++s)
+			m_async_refs[s] = 0;
+	}
 
 	std::string repr() override {
 		std::ostringstream os;
@@ -237,7 +314,8 @@ void CtSaving::_createSavingData(Data& data)
 		DEB_ERROR() << "Saving SidebandData already created";
 		return;
 	}
-	_SavingDataPtr saving = std::make_shared<_SavingSidebandData>(data);
+	typedef ObjectPoolAllocator<_SavingSidebandData> Allocator;
+	_SavingDataPtr saving = std::allocate_shared<_SavingSidebandData>(Allocator(), data);
 	if (!data.sideband.insert(m_saving_data_key, saving))
 		THROW_CTL_ERROR(Error) << "Saving SidebandData of wrong type";
 
@@ -256,7 +334,7 @@ CtSaving::Parameters::Parameters()
 	: imageType(Bpp8), nextNumber(0), fileFormat(RAW), savingMode(Manual),
 	overwritePolicy(Abort), useHwComp(false),
 	indexFormat("%04d"), framesPerFile(1), everyNFrames(1),
-	nbframes(0)
+	nbframes(0), stripePolicy(RoundRobin), stripeMaxWritingTasks(0)
 {
 }
 
@@ -284,6 +362,17 @@ void CtSaving::Parameters::checkValid() const
 	default:
 		break;
 	}
+
+	if (isStriped()) {
+		if (stripeMaxWritingTasks < 0)
+			THROW_CTL_ERROR(InvalidValue) << "Invalid "
+				<< DEB_VAR1(stripeMaxWritingTasks);
+		// the next acquisition must find the file in the same directory
+		if ((stripePolicy == LeastQueue) &&
+		    ((overwritePolicy == Append) || (overwritePolicy == MultiSet)))
+			THROW_CTL_ERROR(InvalidValue) << "LeastQueue stripe policy "
+				"does not support " << overwritePolicy << " overwrite policy";
+	}
 }
 
 
@@ -579,14 +668,24 @@ void CtSaving::Stream::createSaveContainer()
 	m_cnt_status = Init;
 }
 
-void CtSaving::Stream::writeFile(Data& data, HeaderMap& header)
+void CtSaving::Stream::writeFile(Data& data, HeaderMap& header, bool async)
 {
 	DEB_MEMBER_FUNCT();
 
+	if (async)
+		m_save_cnt->asyncWriteStart(data);
+
+	// on error the frame is never reported as saved
 	m_save_cnt->writeFile(data, header);
 
-	AutoMutex lock(m_cond.mutex());
-	m_cnt_status = Open;
+	{
+		AutoMutex lock(m_cond.mutex());
+		m_cnt_status = Open;
+	}
+
+	// the frame is finished by its last completed write
+	if (async)
+		m_save_cnt->asyncWriteCompleted(data);
 }
 
 
@@ -605,8 +704,10 @@ SinkTaskBase* CtSaving::Stream::getTask(TaskType type, const HeaderMap& header,
 	else {
 		_SaveTask* real_task = new _SaveTask(*this, data);
 		real_task->m_header = header;
+		real_task->m_async = m_save_cnt->isAsyncWrite();
 		save_task = real_task;
-		save_task->setEventCallback(m_saving_cbk);
+		if (!real_task->m_async)
+			save_task->setEventCallback(m_saving_cbk);
 		priority = SAVING_PRIORITY;
 	}
 
@@ -671,6 +772,13 @@ public:
 		saving_setting.set("everyNFrames", pars.everyNFrames);
 		saving_setting.set("nbframes", pars.nbframes);
 
+		Setting stripe_dirs = saving_setting.addList("stripeDirectories");
+		std::vector<std::string>::const_iterator d, dend = pars.stripeDirectories.end();
+		for (d = pars.stripeDirectories.begin(); d != dend; ++d)
+			stripe_dirs.append(*d);
+		saving_setting.set("stripePolicy", convert_2_string(pars.stripePolicy));
+		saving_setting.set("stripeMaxWritingTasks", pars.stripeMaxWritingTasks);
+
 		CtSaving::ManagedMode managedmode;
 		m_saving.getManagedMode(managedmode);
 		saving_setting.set("managedmode", convert_2_string(managedmode));
@@ -723,6 +831,21 @@ public:
 		if (saving_setting.get("nbframes", nbframes))
 			pars.nbframes = nbframes;
 
+		Setting stripe_dirs;
+		if (saving_setting.getList("stripeDirectories", stripe_dirs)) {
+			pars.stripeDirectories.resize(stripe_dirs.getLength());
+			for (int i = 0; i < stripe_dirs.getLength(); ++i)
+				stripe_dirs.get(i, pars.stripeDirectories[i]);
+		}
+
+		std::string strstripePolicy;
+		if (saving_setting.get("stripePolicy", strstripePolicy))
+			convert_from_string(strstripePolicy, pars.stripePolicy);
+
+		long stripeMaxWritingTasks;
+		if (saving_setting.get("stripeMaxWritingTasks", stripeMaxWritingTasks))
+			pars.stripeMaxWritingTasks = stripeMaxWritingTasks;
+
 		std::string strmanagedmode;
 		if (saving_setting.get("managedmode", strmanagedmode))
 		{
@@ -742,15 +865,19 @@ private:
 CtSaving::CtSaving(CtControl& aCtrl) :
 	m_ctrl(aCtrl),
 	m_stream(NULL),
+	m_header_keys(std::make_shared<SavingHeaderKeys>()),
 	m_frames_to_save(-1, -1),
 	m_end_cbk(NULL),
 	m_managed_mode(Software),
 	m_saving_stop(false),
-	m_saving_error_handler(NULL)
+	m_saving_error_handler(NULL),
+	m_spill_active(false),
+	m_oldest_pinned(-1),
+	m_spill_thread(NULL)
 {
 	DEB_CONSTRUCTOR();
 
-	m_nb_stream = 5;
+	m_nb_stream = NB_STREAMS;
 	m_stream = new Stream * [m_nb_stream];
 	for (int s = 0; s < m_nb_stream; ++s)
 		m_stream[s] = new Stream(*this, s);
@@ -810,6 +937,8 @@ CtSaving::~CtSaving()
 {
 	DEB_DESTRUCTOR();
 
+	delete m_spill_thread;
+
 	for (int s = 0; s < m_nb_stream; ++s)
 		delete m_stream[s];
 	delete[] m_stream;
@@ -888,6 +1017,105 @@ void CtSaving::getDirectory(std::string& directory, int stream_idx) const
 
 	DEB_RETURN() << DEB_VAR1(directory);
 }
+/** @brief distribute the files of a saving stream over several directories
+ *
+ *  The files are written in the stripe directories (e.g. one per disk)
+ *  and the Parameters::directory only receives the stripe index file:
+ *  \<prefix\>stripes.idx, one line per file with its number, stripe
+ *  index, full path, first frame and number of frames (cut at the last
+ *  acquired frame after a stop). With the Overwrite policy each
+ *  acquisition rewrites the index, otherwise its files are appended
+ *  after an "# acquisition" line.
+ *  An empty list disables the striping.
+ */
+void CtSaving::setStripeDirectories(const std::vector<std::string>& directories,
+				    int stream_idx)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(directories.size(), stream_idx);
+
+	AutoMutex aLock(m_cond.mutex());
+	Stream& stream = getStream(stream_idx);
+	Parameters pars = stream.getParameters(Auto);
+	std::vector<std::string>::const_iterator d, dend = directories.end();
+	for (d = directories.begin(); d != dend; ++d)
+		stream.checkDirectoryAccess(*d);
+	pars.stripeDirectories = directories;
+	stream.setParameters(pars);
+}
+/** @brief get the stripe directories of a saving stream
+ */
+void CtSaving::getStripeDirectories(std::vector<std::string>& directories,
+				    int stream_idx) const
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(stream_idx);
+
+	AutoMutex aLock(m_cond.mutex());
+	const Stream& stream = getStream(stream_idx);
+	const Parameters& pars = stream.getParameters(Auto);
+	directories = pars.stripeDirectories;
+
+	DEB_RETURN() << DEB_VAR1(directories.size());
+}
+/** @brief set how the files are distributed over the stripe directories
+ */
+void CtSaving::setStripePolicy(StripePolicy policy, int stream_idx)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(policy, stream_idx);
+
+	AutoMutex aLock(m_cond.mutex());
+	Stream& stream = getStream(stream_idx);
+	Parameters pars = stream.getParameters(Auto);
+	pars.stripePolicy = policy;
+	stream.setParameters(pars);
+}
+/** @brief get the stripe policy of a saving stream
+ */
+void CtSaving::getStripePolicy(StripePolicy& policy, int stream_idx) const
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(stream_idx);
+
+	AutoMutex aLock(m_cond.mutex());
+	const Stream& stream = getStream(stream_idx);
+	const Parameters& pars = stream.getParameters(Auto);
+	policy = pars.stripePolicy;
+
+	DEB_RETURN() << DEB_VAR1(policy);
+}
+/** @brief set the maximum number of parallel writes per stripe directory,
+ *  0 means no limit
+ */
+void CtSaving::setStripeMaxWritingTasks(long nb_tasks, int stream_idx)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(nb_tasks, stream_idx);
+
+	if (nb_tasks < 0)
+		THROW_CTL_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(nb_tasks);
+
+	AutoMutex aLock(m_cond.mutex());
+	Stream& stream = getStream(stream_idx);
+	Parameters pars = stream.getParameters(Auto);
+	pars.stripeMaxWritingTasks = nb_tasks;
+	stream.setParameters(pars);
+}
+/** @brief get the maximum number of parallel writes per stripe directory
+ */
+void CtSaving::getStripeMaxWritingTasks(long& nb_tasks, int stream_idx) const
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(stream_idx);
+
+	AutoMutex aLock(m_cond.mutex());
+	const Stream& stream = getStream(stream_idx);
+	const Parameters& pars = stream.getParameters(Auto);
+	nb_tasks = pars.stripeMaxWritingTasks;
+
+	DEB_RETURN() << DEB_VAR1(nb_tasks);
+}
 /** @brief set the filename prefix for a saving stream
  */
 void CtSaving::setPrefix(const std::string& prefix, int stream_idx)
@@ -1539,6 +1767,96 @@ inline void CtSaving::_clearFrameDatas()
 	DEB_MEMBER_FUNCT();
 	m_frame_datas.clear();
 	m_frames_to_save.first = m_frames_to_save.second = -1;
+	m_pinned_frames.clear();
+	m_oldest_pinned = -1;
+}
+
+/** @brief last frame not holding a HW buffer any more
+
+	The frames in the saving chain not yet spilled are pinned in their
+	HW buffer, as well as the frames still in processing (after
+	last_image_ready).
+*/
+long CtSaving::_getLastUnpinnedFrame(long last_image_ready) const
+{
+	long oldest = m_oldest_pinned.load(std::memory_order_relaxed);
+	if (oldest < 0)
+		return last_image_ready;
+	return std::min(oldest - 1, last_image_ready);
+}
+
+inline void CtSaving::_pinFrame(long frame_nr)
+{
+	m_pinned_frames.insert(frame_nr);
+	m_oldest_pinned = *m_pinned_frames.begin();
+}
+
+inline void CtSaving::_unpinFrame(long frame_nr)
+{
+	if (!m_pinned_frames.erase(frame_nr))
+		return;
+	m_oldest_pinned = (m_pinned_frames.empty() ? -1 :
+			   *m_pinned_frames.begin());
+}
+
+void CtSaving::_requestSpill()
+{
+	if (m_spill_active && m_spill_thread)
+		m_spill_thread->request();
+}
+
+/** @brief move the queued frames, oldest first, into the spill tier
+
+	The frames being written keep their HW buffer. The copy is done
+	without the lock: a frame posted to the saving meanwhile is written
+	from its HW buffer and its copy is dropped.
+*/
+void CtSaving::_spillFrames()
+{
+	DEB_MEMBER_FUNCT();
+
+	CtSpillTier& tier = *m_ctrl.spillTier();
+	const int batch_size = 16;
+	std::vector<Data> batch;
+	batch.reserve(batch_size);
+
+	AutoMutex aLock(m_cond.mutex());
+	for (;;) {
+		batch.clear();
+		FrameMap::iterator it, end = m_frame_datas.end();
+		for (it = m_frame_datas.begin(); it != end; ++it) {
+			if (m_pinned_frames.count(it->first) == 0)
+				continue;
+			batch.push_back(it->second);
+			if (int(batch.size()) == batch_size)
+				break;
+		}
+		if (batch.empty())
+			break;
+
+		int nb_spilled = 0;
+		{
+			AutoMutexUnlock u(aLock);
+			for (; nb_spilled < int(batch.size()); ++nb_spilled)
+				if (!tier.spill(batch[nb_spilled]))
+					break;
+		}
+
+		for (int i = 0; i < nb_spilled; ++i) {
+			Data& spilled = batch[i];
+			long frame_nr = spilled.frameNumber;
+			it = m_frame_datas.find(frame_nr);
+			if (it == m_frame_datas.end())
+				continue;
+			it->second.setBuffer(spilled.buffer);
+			_unpinFrame(frame_nr);
+			DEB_TRACE() << "Spilled frame " << frame_nr;
+		}
+		if (nb_spilled < int(batch.size())) {
+			DEB_WARNING() << "Spill tier full";
+			break;
+		}
+	}
 }
 
 /** @brief clear the common header
@@ -1558,6 +1876,7 @@ void CtSaving::resetCommonHeader()
 			THROW_CTL_ERROR(NotSupported) << "Common header is not supported";
 	}
 	m_common_header.clear();
+	m_common_header_cache.reset();
 }
 /** @brief set the common header.
 	This is the header which will be write for all frame for this acquisition
@@ -1578,6 +1897,7 @@ void CtSaving::setCommonHeader(const HeaderMap& header)
 			THROW_CTL_ERROR(NotSupported) << "Common header is not supported";
 	}
 	m_common_header = header;
+	m_common_header_cache.reset();
 }
 /** @brief replace/add field in the common header
  */
@@ -1597,6 +1917,7 @@ void CtSaving::updateCommonHeader(const HeaderMap& header)
 		if (!result.second)
 			result.first->second = i->second;
 	}
+	m_common_header_cache.reset();
 }
 /** @brief get the current common header
  */
@@ -1618,6 +1939,7 @@ void CtSaving::addToCommonHeader(const HeaderValue& value)
 
 	AutoMutex aLock(m_cond.mutex());
 	m_common_header.insert(value);
+	m_common_header_cache.reset();
 }
 /** @brief add/replace a header value in the current frame header
  */
@@ -1627,7 +1949,8 @@ void CtSaving::addToFrameHeader(long frame_nr, const HeaderValue& value)
 	DEB_PARAM() << DEB_VAR2(frame_nr, value);
 
 	AutoMutex aLock(m_cond.mutex());
-	m_frame_headers[frame_nr].insert(value);
+	SavingHeaderKeys::Key key = m_header_keys->intern(value.first);
+	_getFrameHeader(frame_nr).set(key, value.second, false);
 }
 /** @brief add/replace several value in the current frame header
  */
@@ -1637,20 +1960,43 @@ void CtSaving::updateFrameHeader(long frame_nr, const HeaderMap& header)
 	DEB_PARAM() << DEB_VAR2(frame_nr, header);
 
 	AutoMutex aLock(m_cond.mutex());
-	HeaderMap& frameHeader = m_frame_headers[frame_nr];
-	for (HeaderMap::const_iterator i = header.begin();
-		i != header.end(); ++i)
-	{
-		std::pair<HeaderMap::iterator, bool> result =
-			frameHeader.insert(HeaderMap::value_type(i->first, i->second));
-		//if it exist, update
-		if (!result.second)
-			result.first->second = i->second;
-	}
+	_getFrameHeader(frame_nr).update(header);
 	aLock.unlock();
 
 	_validateFrameHeader(frame_nr);
 }
+/** @brief add/replace the same keys in the header of several frames.
+	The keys are looked up once for all the frames
+ */
+void CtSaving::updateFrameHeaders(long first_frame_nr, long nb_frames,
+				  const std::vector<std::string>& keys,
+				  const std::vector<std::string>& values)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR3(first_frame_nr, nb_frames, keys.size());
+
+	size_t nb_keys = keys.size();
+	if ((nb_frames < 0) || (values.size() != nb_frames * nb_keys))
+		THROW_CTL_ERROR(InvalidValue) << "Invalid "
+					      << DEB_VAR3(nb_frames, nb_keys,
+							  values.size());
+
+	AutoMutex aLock(m_cond.mutex());
+	std::vector<SavingHeaderKeys::Key> key_list;
+	key_list.reserve(nb_keys);
+	for (size_t k = 0; k < nb_keys; ++k)
+		key_list.push_back(m_header_keys->intern(keys[k]));
+	std::vector<std::string>::const_iterator v = values.begin();
+	for (long i = 0; i < nb_frames; ++i) {
+		SavingFrameHeader& frameHeader = _getFrameHeader(first_frame_nr + i);
+		for (size_t k = 0; k < nb_keys; ++k, ++v)
+			frameHeader.set(key_list[k], *v);
+	}
+	aLock.unlock();
+
+	for (long i = 0; i < nb_frames; ++i)
+		_validateFrameHeader(first_frame_nr + i);
+}
 /** @brief validate a header for a frame.
 	this mean that the header is ready and can now be save.
 	If you are in AutoHeader this will trigger the saving if the data frame is available
@@ -1689,16 +2035,19 @@ void CtSaving::_validateFrameHeader(long frame_nr)
 	if (!(need_compression || can_save))
 		return;
 
-	HeaderMap task_header;
+	_TakenHeader taken_header;
 	FrameHeaderMap::iterator aHeaderIter;
 	aHeaderIter = m_frame_headers.find(frame_nr);
 	bool keep_header = need_compression;
-	_takeHeader(aHeaderIter, task_header, keep_header);
+	_takeHeader(aHeaderIter, taken_header, keep_header);
 
 	_eraseFrameData(frame_iter);
 
 	aLock.unlock();
 
+	HeaderMap task_header;
+	taken_header.get(task_header);
+
 	TaskType task_type = need_compression ? Compression : Save;
 	TaskList task_list;
 	int priority;
@@ -1729,7 +2078,7 @@ void CtSaving::getFrameHeader(long frame_nr, HeaderMap& header) const
 	AutoMutex aLock(m_cond.mutex());
 	FrameHeaderMap::const_iterator i = m_frame_headers.find(frame_nr);
 	if (i != m_frame_headers.end())
-		header.insert(i->second.begin(), i->second.end());
+		i->second.get(header, false);
 
 	DEB_RETURN() << DEB_VAR1(header);
 }
@@ -1745,7 +2094,8 @@ void CtSaving::takeFrameHeader(long frame_nr, HeaderMap& header)
 	FrameHeaderMap::iterator i = m_frame_headers.find(frame_nr);
 	if (i != m_frame_headers.end())
 	{
-		header = i->second;
+		header.clear();
+		i->second.get(header);
 		m_frame_headers.erase(i);
 	}
 
@@ -1771,36 +2121,54 @@ void CtSaving::removeAllFrameHeaders()
 
 	AutoMutex aLock(m_cond.mutex());
 	m_frame_headers.clear();
+	m_header_keys = std::make_shared<SavingHeaderKeys>();
 }
 
 // Private methodes
 
-void CtSaving::_getCommonHeader(HeaderMap& header)
+CtSaving::CommonHeaderRef CtSaving::_getCommonHeader()
 {
-	header.insert(m_internal_common_header.begin(),
-		m_internal_common_header.end());
-	header.insert(m_common_header.begin(), m_common_header.end());
+	if (!m_common_header_cache) {
+		std::shared_ptr<HeaderMap> header = std::make_shared<HeaderMap>();
+		header->insert(m_internal_common_header.begin(),
+			m_internal_common_header.end());
+		header->insert(m_common_header.begin(), m_common_header.end());
+		m_common_header_cache = header;
+	}
+	return m_common_header_cache;
 }
+SavingFrameHeader& CtSaving::_getFrameHeader(long frame_nr)
+{
+	FrameHeaderMap::iterator i = m_frame_headers.find(frame_nr);
+	if (i == m_frame_headers.end()) {
+		FrameHeaderMap::value_type v(frame_nr, SavingFrameHeader(m_header_keys));
+		i = m_frame_headers.insert(v).first;
+	}
+	return i->second;
+}
+/** @brief move the frame header out of the map, called locked.
+	The HeaderMap is built by _TakenHeader::get once unlocked
+ */
 void CtSaving::_takeHeader(FrameHeaderMap::iterator& headerIter,
-	HeaderMap& header, bool keep_in_map)
+	_TakenHeader& header, bool keep_in_map)
 {
-	_getCommonHeader(header);
+	header.common = _getCommonHeader();
 
 	if (headerIter == m_frame_headers.end())
 		return;
 
-	HeaderMap& aFrameHeaderMap = headerIter->second;
-	for (HeaderMap::iterator i = aFrameHeaderMap.begin();
-		i != aFrameHeaderMap.end(); ++i)
-	{
-		std::pair<HeaderMap::iterator, bool> result =
-			header.insert(HeaderMap::value_type(i->first, i->second));
-		if (!result.second)
-			result.first->second = i->second;
-	}
-
-	if (!keep_in_map)
+	if (keep_in_map) {
+		header.frame = headerIter->second;
+	} else {
+		header.frame = std::move(headerIter->second);
 		m_frame_headers.erase(headerIter);
+	}
+}
+void CtSaving::_TakenHeader::get(HeaderMap& header) const
+{
+	if (common)
+		header = *common;
+	frame.get(header);
 }
 
 void CtSaving::setEndCallback(TaskEventCallback* aCbkPt)
@@ -1819,12 +2187,14 @@ void CtSaving::resetInternalCommonHeader()
 {
 	AutoMutex aLock(m_cond.mutex());
 	m_internal_common_header.clear();
+	m_common_header_cache.reset();
 }
 
 void CtSaving::addToInternalCommonHeader(const HeaderValue& value)
 {
 	AutoMutex aLock(m_cond.mutex());
 	m_internal_common_header.insert(value);
+	m_common_header_cache.reset();
 }
 
 bool CtSaving::_controlIsFault()
@@ -1880,6 +2250,8 @@ void CtSaving::frameReady(Data& sData)
 	SavingMode saving_mode = getAcqSavingMode();
 	bool auto_header = (saving_mode == AutoHeader);
 	long frame_nr = aData.frameNumber;
+	if (m_spill_active && !need_compression)
+		_pinFrame(frame_nr);
 	FrameHeaderMap::iterator aHeaderIter;
 	aHeaderIter = m_frame_headers.find(frame_nr);
 	bool header_available = (aHeaderIter != m_frame_headers.end());
@@ -1893,12 +2265,15 @@ void CtSaving::frameReady(Data& sData)
 		return;
 	}
 
-	HeaderMap task_header;
+	_TakenHeader taken_header;
 	bool keep_header = need_compression;
-	_takeHeader(aHeaderIter, task_header, keep_header);
+	_takeHeader(aHeaderIter, taken_header, keep_header);
 
 	aLock.unlock();
 
+	HeaderMap task_header;
+	taken_header.get(task_header);
+
 	TaskType task_type = need_compression ? Compression : Save;
 	TaskList task_list;
 	int priority;
@@ -2126,13 +2501,15 @@ void CtSaving::writeFrame(int aFrameNumber, int aNbFrames, bool synchronous)
 	}
 
 	// Saving
-	HeaderMap header;
+	_TakenHeader taken_header;
 	{
 		AutoMutex lock(m_cond.mutex());
 		FrameHeaderMap::iterator aHeaderIter;
 		aHeaderIter = m_frame_headers.find(anImage2Save.frameNumber);
-		_takeHeader(aHeaderIter, header, false);
+		_takeHeader(aHeaderIter, taken_header, false);
 	}
+	HeaderMap header;
+	taken_header.get(header);
 
 	if (synchronous)
 		_synchronousSaving(anImage2Save, header);
@@ -2252,12 +2629,15 @@ void CtSaving::_compressionFinished(Data& aData, Stream& stream)
 		return;
 	}
 
-	HeaderMap header;
+	_TakenHeader taken_header;
 	FrameHeaderMap::iterator header_it = m_frame_headers.find(frame_nr);
-	_takeHeader(header_it, header, false);
+	_takeHeader(header_it, taken_header, false);
 
 	aLock.unlock();
 
+	HeaderMap header;
+	taken_header.get(header);
+
 	TaskList task_list;
 	int priority;
 	_getTaskList(Save, aData, header, task_list, priority);
@@ -2299,6 +2679,8 @@ void CtSaving::_saveFinished(Data& aData, Stream& stream)
 	aData.releaseBuffer(); // release finished data
 
 	AutoMutex aLock(m_cond.mutex());
+	if (m_spill_active)
+		_unpinFrame(aData.frameNumber);
 
 	SavingMode saving_mode = getAcqSavingMode();
 	bool auto_saving = (saving_mode == AutoFrame) || (saving_mode == AutoHeader);
@@ -2335,11 +2717,14 @@ void CtSaving::_saveFinished(Data& aData, Stream& stream)
 	Data nextData = data_it->second;
 	_eraseFrameData(data_it);
 
-	HeaderMap task_header;
-	_takeHeader(header_it, task_header, false);
+	_TakenHeader taken_header;
+	_takeHeader(header_it, taken_header, false);
 
 	aLock.unlock();
 
+	HeaderMap task_header;
+	taken_header.get(task_header);
+
 	TaskList task_list;
 	int priority;
 	_getTaskList(Save, nextData, task_header, task_list, priority);
@@ -2360,7 +2745,7 @@ void CtSaving::_setSavingError(CtControl::ErrorCode anErrorCode)
 	{
 		AutoMutex aLock(m_ctrl.m_cond.mutex());
 		if (m_ctrl.m_status.AcquisitionStatus != AcqFault) {
-			m_ctrl.m_status.AcquisitionStatus = AcqFault;
+			m_ctrl._setAcqStatus(AcqFault);
 			m_ctrl.m_status.Error = anErrorCode;
 			DEB_ERROR() << DEB_VAR2(m_ctrl.m_status, saving_mode);
 		}
@@ -2368,6 +2753,18 @@ void CtSaving::_setSavingError(CtControl::ErrorCode anErrorCode)
 
 	m_ctrl.stopAcq();
 }
+/** @brief statistics of the per-frame saving object pools
+ */
+void CtSaving::getPoolStats(ObjectPoolStats& stats) const
+{
+	DEB_MEMBER_FUNCT();
+	ObjectPoolStats task_stats;
+	ObjectPool<_SavingSidebandData>::get().getStats(stats);
+	Stream::_SaveTask::Pool::get().getStats(task_stats);
+	stats += task_stats;
+	DEB_RETURN() << DEB_VAR1(stats);
+}
+
 /** @brief preparing new acquisition
 	this methode will resetLastFrameNb if mode is AutoSave
 	and validate the parameter for this new acquisition
@@ -2384,8 +2781,18 @@ void CtSaving::_prepare()
 	if (!m_saving_error_handler)
 		m_saving_error_handler = new _SavingErrorHandler(*this, *m_ctrl.event());
 
+	// new key table, unless headers were pushed before the start
+	if (m_frame_headers.empty())
+		m_header_keys = std::make_shared<SavingHeaderKeys>();
+
 	if (m_managed_mode == Software)
 	{
+		// per-frame saving objects live at most as long as the buffers
+		long nb_buffers;
+		m_ctrl.buffer()->getNumber(nb_buffers);
+		ObjectPool<_SavingSidebandData>::get().reserve(nb_buffers);
+		Stream::_SaveTask::Pool::get().reserve(nb_buffers * m_nb_stream);
+
 		//prepare all the active streams
 		for (int s = 0; s < m_nb_stream; ++s) {
 			Stream& stream = getStream(s);
@@ -2438,6 +2845,16 @@ void CtSaving::_prepare()
 			}
 		}
 	}
+
+	// the compression releases the HW buffers by itself
+	m_spill_active = (hasAutoSaveMode() && (m_managed_mode == Software) &&
+			  !_needParallelCompression() &&
+			  m_ctrl.spillTier()->isEnabled());
+	m_pinned_frames.clear();
+	m_oldest_pinned = -1;
+	if (m_spill_active && !m_spill_thread)
+		m_spill_thread = new _SpillThread(*this);
+
 	m_saving_stop = false;
 }
 
@@ -2492,9 +2909,11 @@ CtConfig::ModuleTypeCallback* CtSaving::_getConfigHandler()
 #endif //WITH_CONFIG
 
 CtSaving::SaveContainer::SaveContainer(Stream& stream)
-	: m_lock(m_cond.mutex()), m_stream(stream), m_statistic_size(16),
+	: m_lock(m_cond.mutex()), m_stream(stream), m_async_write(false),
+	  m_statistic_size(16),
 	  m_log_stat_enable(false), m_log_stat_file(NULL),
-	  m_max_writing_task(1), m_last_task_closes_all(false), m_nb_zbuffers(0)
+	  m_max_writing_task(1), m_last_task_closes_all(false),
+	  m_stripe_index_started(false), m_nb_zbuffers(0)
 {
 	DEB_CONSTRUCTOR();
 }
@@ -2531,20 +2950,13 @@ void CtSaving::SaveContainer::writeFile(Data& aData, HeaderMap& aHeader)
 
 		void exec()
 		{
-			DEB_MEMBER_FUNCT();
-			bool close_all = false;
-			{
-				AutoMutex lock(m_c.m_lock);
-				WritingTasks& running_tasks = m_c.m_running_tasks;
-				WritingTasks::iterator it = running_tasks.find(m_frameId);
-				if (it == running_tasks.end())
-					THROW_CTL_ERROR(Error) << "Could not find running task";
-				running_tasks.erase(it);
-				if (running_tasks.empty() && m_c.m_last_task_closes_all)
-					close_all = true;
-			}
-			if (close_all)
-				m_c.close();
+			m_done = true;
+			m_c._runningTaskFinished(m_frameId);
+		}
+
+		// @brief the last asynchronous write will remove the task
+		void release()
+		{
 			m_done = true;
 		}
 
@@ -2654,19 +3066,61 @@ void CtSaving::SaveContainer::writeFile(Data& aData, HeaderMap& aHeader)
 		}
 	}
 
-	double diff;
 	{
 		AutoMutex l(saving->m_lock);
 		stat.write_size = write_size;
+	}
+
+	// asynchronous writes: the frame is done by asyncWriteCompleted
+	if (_isAsyncWrite(aData)) {
+		running_cleanup.release();
+		return;
+	}
+
+	_writeFinished(aData);
+	running_cleanup.exec();
+	writeFileStat(aData);
+}
+
+/** @brief the frame writes are done: update its writing statistics
+ */
+void CtSaving::SaveContainer::_writeFinished(Data& aData)
+{
+	DEB_MEMBER_FUNCT();
+
+	_SavingDataPtr saving = _getSavingData(aData);
+	Stat& stat = saving->m_stat;
+
+	double diff;
+	{
+		AutoMutex l(saving->m_lock);
 		stat.writing_end = Timestamp::now();
 		diff = stat.writing_end - stat.writing_start;
 	}
 
 	DEB_TRACE() << "Write took : " << diff << "s";
+}
 
-	running_cleanup.exec();
+/** @brief remove the frame from the running tasks, a new frame can be
+ *  written (setMaxConcurrentWritingTask)
+ */
+void CtSaving::SaveContainer::_runningTaskFinished(long frameId)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(frameId);
 
-	writeFileStat(aData);
+	bool close_all = false;
+	{
+		AutoMutex lock(m_lock);
+		WritingTasks::iterator it = m_running_tasks.find(frameId);
+		if (it == m_running_tasks.end())
+			THROW_CTL_ERROR(Error) << "Could not find running task";
+		m_running_tasks.erase(it);
+		if (m_running_tasks.empty() && m_last_task_closes_all)
+			close_all = true;
+	}
+	if (close_all)
+		close();
 }
 
 void CtSaving::SaveContainer::writeFileStat(Data& aData)
@@ -2938,6 +3392,11 @@ void CtSaving::SaveContainer::clear()
 
 	AutoMutex aLock(m_lock);
 	m_statistic.clear();
+	m_file_stripes.clear();
+	{
+		AutoMutex index_lock(m_stripe_index_lock);
+		m_stripe_index_started = false;
+	}
 	_clear();			// call inheritance if needed
 }
 
@@ -2953,6 +3412,11 @@ void CtSaving::SaveContainer::prepare(CtControl& ct)
 	m_frames_to_write = nb_frames;
 	m_files_to_write = 0;
 	m_written_frames = 0;
+	m_file_stripes.clear();
+	{
+		AutoMutex index_lock(m_stripe_index_lock);
+		m_stripe_index_started = false;
+	}
 	if (m_frames_to_write && 	// if not live
 		pars.savingMode != CtSaving::Manual)
 	{
@@ -3049,6 +3513,7 @@ void CtSaving::SaveContainer::updateNbFrames(long nb_acquired_frames)
 	
 	AutoMutex lock(m_lock);
 	m_frames_to_write = nb_acquired_frames;
+	_truncateStripeIndex(nb_acquired_frames);
 
 	// Remove waiting tasks that will never run
 	m_waiting_tasks.erase(
@@ -3114,7 +3579,8 @@ bool CtSaving::SaveContainer::isReadyFor(Data& data) const
 		ready = ((next == -1) || (frameId == next));
 	} else if (frame_par.m_threadable) {
 		DEB_TRACE() << DEB_VAR2(running_tasks, m_max_writing_task);
-		ready = (running_tasks + 1 <= m_max_writing_task);
+		ready = ((running_tasks + 1 <= m_max_writing_task) &&
+			 _isStripeReady(frame_par.m_pars));
 	} else
 		ready = false;
 
@@ -3154,13 +3620,287 @@ void CtSaving::SaveContainer::prepareWritingFrame(Data& data)
 		CtSaving::Parameters pars = m_stream.getParameters(Acq);
 		frame_par.setParameters(pars);
 	}
+	CtSaving::Parameters& pars = frame_par.m_pars;
+	std::string index_directory = pars.directory;
+	bool new_stripe_file = false;
+	long first_frame = frameId, nb_frames = pars.framesPerFile;
 
 	AutoMutex lock(m_lock);
 	WritingTasks::iterator it = m_waiting_tasks.find(frameId);
 	if (it == m_waiting_tasks.end())
 		THROW_CTL_ERROR(Error) << "Frame not in waiting WritingTasks";
+	if (pars.isStriped() && (frame_par.m_stripe < 0)) {
+		// the file directory is chosen by its first frame
+		int stripe = _getStripe(pars);
+		new_stripe_file = m_file_stripes.emplace(pars.nextNumber,
+							 stripe).second;
+		frame_par.m_stripe = stripe;
+		pars.directory = pars.stripeDirectories[stripe];
+		DEB_TRACE() << DEB_VAR3(pars.nextNumber, stripe, pars.directory);
+		// the last file of the acquisition holds the remaining frames
+		const Parameters& acq_pars = m_stream.getParameters(Acq);
+		long frames_per_file = ((acq_pars.overwritePolicy == MultiSet) ?
+					1 : acq_pars.framesPerFile);
+		first_frame = frameId - frameId % frames_per_file;
+		nb_frames = frames_per_file;
+		if (m_frames_to_write > 0)
+			nb_frames = std::min(nb_frames,
+					     m_frames_to_write - first_frame);
+	}
 	m_waiting_tasks.erase(it);
 	m_running_tasks.emplace(frameId, saving);
+	lock.unlock();
+
+	if (new_stripe_file)
+		_addStripeIndex(index_directory, pars, frame_par.m_stripe,
+				first_frame, nb_frames);
+}
+
+int CtSaving::SaveContainer::_getStripeNbRunningTasks(int stripe) const
+{
+	int nb_tasks = 0;
+	WritingTasks::const_iterator it, end = m_running_tasks.end();
+	for (it = m_running_tasks.begin(); it != end; ++it)
+		if (it->second->m_params.m_stripe == stripe)
+			++nb_tasks;
+	return nb_tasks;
+}
+
+/** @brief the stripe directory of the file pars.nextNumber, m_lock held
+ */
+int CtSaving::SaveContainer::_getStripe(const Parameters& pars) const
+{
+	DEB_MEMBER_FUNCT();
+
+	std::map<long, int>::const_iterator f = m_file_stripes.find(pars.nextNumber);
+	if (f != m_file_stripes.end())
+		return f->second;
+
+	int nb_stripes = pars.stripeDirectories.size();
+	if (pars.stripePolicy == RoundRobin)
+		return std::max(pars.nextNumber, 0L) % nb_stripes;
+
+	int stripe = 0;
+	int min_tasks = _getStripeNbRunningTasks(0);
+	for (int s = 1; (s < nb_stripes) && (min_tasks > 0); ++s) {
+		int nb_tasks = _getStripeNbRunningTasks(s);
+		if (nb_tasks < min_tasks) {
+			stripe = s;
+			min_tasks = nb_tasks;
+		}
+	}
+	DEB_TRACE() << DEB_VAR2(stripe, min_tasks);
+	return stripe;
+}
+
+/** @brief check the per-directory write limit, m_lock held
+ */
+bool CtSaving::SaveContainer::_isStripeReady(const Parameters& pars) const
+{
+	if (!pars.isStriped() || (pars.stripeMaxWritingTasks <= 0))
+		return true;
+	int stripe = _getStripe(pars);
+	return _getStripeNbRunningTasks(stripe) < pars.stripeMaxWritingTasks;
+}
+
+/** @brief record the directory of a new striped file in the index file
+ */
+void CtSaving::SaveContainer::_addStripeIndex(const std::string& index_directory,
+					      const Parameters& pars, int stripe,
+					      long first_frame, long nb_frames)
+{
+	DEB_MEMBER_FUNCT();
+
+	std::string index_name = (index_directory + DIR_SEPARATOR +
+				  pars.prefix + "stripes.idx");
+	AutoMutex lock(m_stripe_index_lock);
+	// the first file of an acquisition rewrites the index in Overwrite
+	// mode, otherwise it is appended after an acquisition marker
+	bool acq_start = !m_stripe_index_started;
+	bool overwrite = acq_start && (pars.overwritePolicy == Overwrite);
+	bool new_index = overwrite || (access(index_name.c_str(), F_OK) != 0);
+	FILE* index_file = fopen(index_name.c_str(), overwrite ? "w" : "a");
+	if (!index_file) {
+		DEB_WARNING() << "Could not open stripe index " << index_name;
+		return;
+	}
+	m_stripe_index_started = true;
+	if (new_index)
+		fprintf(index_file, "# file_nb stripe filename "
+			"first_frame nb_frames\n");
+	else if (acq_start)
+		fprintf(index_file, "# acquisition\n");
+	std::string filename = _getFilename(pars);
+	fprintf(index_file, "%ld %d %s %ld %ld\n", pars.nextNumber, stripe,
+		filename.c_str(), first_frame, nb_frames);
+	fclose(index_file);
+}
+
+/** @brief after a stop, cut the nb_frames of the index entries of this
+ *  acquisition at the number of acquired frames, m_lock held
+ */
+void CtSaving::SaveContainer::_truncateStripeIndex(long nb_acquired_frames)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(nb_acquired_frames);
+
+	const Parameters& pars = m_stream.getParameters(Acq);
+	AutoMutex lock(m_stripe_index_lock);
+	if (!pars.isStriped() || !m_stripe_index_started)
+		return;
+
+	std::string index_name = (pars.directory + DIR_SEPARATOR +
+				  pars.prefix + "stripes.idx");
+	std::ifstream index_in(index_name.c_str());
+	std::vector<std::string> lines;
+	std::string line;
+	size_t acq_first = 0;	// after the last header or marker
+	while (getline(index_in, line)) {
+		lines.push_back(line);
+		if (!line.empty() && (line[0] == '#'))
+			acq_first = lines.size();
+	}
+	index_in.close();
+
+	bool changed = false;
+	for (size_t i = acq_first; i < lines.size(); ++i) {
+		std::istringstream is(lines[i]);
+		long file_nb, first_frame, nb_frames;
+		int stripe;
+		std::string filename;
+		if (!(is >> file_nb >> stripe >> filename >> first_frame >> nb_frames))
+			continue;
+		long nb = std::min(nb_frames, nb_acquired_frames - first_frame);
+		if (nb == nb_frames)
+			continue;
+		std::ostringstream os;
+		os << file_nb << " " << stripe << " " << filename << " "
+		   << first_frame << " " << nb;
+		lines[i] = os.str();
+		changed = true;
+	}
+	if (!changed)
+		return;
+
+	FILE* index_file = fopen(index_name.c_str(), "w");
+	if (!index_file) {
+		DEB_WARNING() << "Could not rewrite stripe index " << index_name;
+		return;
+	}
+	for (size_t i = 0; i < lines.size(); ++i)
+		fprintf(index_file, "%s\n", lines[i].c_str());
+	fclose(index_file);
+}
+
+bool CtSaving::SaveContainer::_hasOption(const Parameters& pars,
+					 const std::string& option)
+{
+	DEB_STATIC_FUNCT();
+	DEB_PARAM() << DEB_VAR2(pars.options, option);
+
+	std::stringstream ss(pars.options);
+	std::string field;
+	bool found = false;
+	while (!found && getline(ss, field, '|'))
+		found = (field == option);
+
+	DEB_RETURN() << DEB_VAR1(found);
+	return found;
+}
+
+std::string CtSaving::SaveContainer::_getOptionValue(const Parameters& pars,
+						     const std::string& option)
+{
+	DEB_STATIC_FUNCT();
+	DEB_PARAM() << DEB_VAR2(pars.options, option);
+
+	std::stringstream ss(pars.options);
+	std::string field, value;
+	const std::string prefix = option + "=";
+	while (getline(ss, field, '|'))
+		if (field.compare(0, prefix.size(), prefix) == 0)
+			value = field.substr(prefix.size());
+
+	DEB_RETURN() << DEB_VAR1(value);
+	return value;
+}
+
+int CtSaving::SaveContainer::_getCompressionBlockSize(const Parameters& pars)
+{
+	DEB_STATIC_FUNCT();
+
+	std::string value = _getOptionValue(pars, "COMPRESSION_BLOCK_SIZE");
+	if (value.empty())
+		return 0;
+
+	char* end;
+	long long block_size = strtoll(value.c_str(), &end, 10);
+	switch (toupper(*end)) {
+	case 'K': block_size <<= 10; ++end; break;
+	case 'M': block_size <<= 20; ++end; break;
+	}
+	// smaller blocks would mostly compress the block boundaries
+	const long long min_block_size = 64 * 1024;
+	if (*end || (block_size < min_block_size) || (block_size > (1LL << 30)))
+		THROW_CTL_ERROR(InvalidValue) << "Invalid COMPRESSION_BLOCK_SIZE: "
+					      << value;
+
+	DEB_RETURN() << DEB_VAR1(block_size);
+	return int(block_size);
+}
+
+std::string CtSaving::SaveContainer::_getFilename(const Parameters& pars)
+{
+	std::string aFileName = pars.directory + DIR_SEPARATOR + pars.prefix;
+	long index = pars.nextNumber;
+	char idx[64];
+	if (index < 0) index = 0;
+	snprintf(idx, sizeof(idx), pars.indexFormat.c_str(), index);
+	aFileName += idx;
+	aFileName += pars.suffix;
+	return aFileName;
+}
+
+void CtSaving::SaveContainer::asyncWriteStart(Data& data)
+{
+	DEB_MEMBER_FUNCT();
+	_SavingDataPtr saving = _getSavingData(data);
+	saving->m_async_refs[m_stream.getIndex()] = 1;
+}
+
+/** @brief release one reference on the frame asynchronous writes,
+ *  the last one reports the frame as saved
+ */
+void CtSaving::SaveContainer::asyncWriteCompleted(Data& data)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(data.frameNumber);
+
+	_SavingDataPtr saving = _getSavingData(data);
+	if (--saving->m_async_refs[m_stream.getIndex()] > 0)
+		return;
+
+	// statistics and throttling count the completed writes
+	_writeFinished(data);
+	try {
+		_runningTaskFinished(data.frameNumber);
+	} catch (Exception&) {
+		m_stream.setSavingError(CtControl::SaveUnknownError);
+	}
+	writeFileStat(data);
+	m_stream.saveFinished(data);
+}
+
+bool CtSaving::SaveContainer::_isAsyncWrite(Data& data)
+{
+	_SavingDataPtr saving = _getSavingData(data);
+	return saving->m_async_refs[m_stream.getIndex()] > 0;
+}
+
+void CtSaving::SaveContainer::_asyncWriteSubmitted(Data& data)
+{
+	_SavingDataPtr saving = _getSavingData(data);
+	++saving->m_async_refs[m_stream.getIndex()];
 }
 
 void CtSaving::SaveContainer::createSavingData(Data& data)
@@ -3295,14 +4035,7 @@ CtSaving::SaveContainer::open(FrameParameters& fpars)
 		opening.add(lock);
 	}
 
-	std::string aFileName = pars.directory + DIR_SEPARATOR + pars.prefix;
-	long index = pars.nextNumber;
-	char idx[64];
-	if (index < 0) index = 0;
-	snprintf(idx, sizeof(idx), pars.indexFormat.c_str(), index);
-	aFileName += idx;
-	aFileName += pars.suffix;
-
+	std::string aFileName = _getFilename(pars);
 	DEB_TRACE() << DEB_VAR1(aFileName);
 
 	if (pars.overwritePolicy == Abort &&
@@ -3603,38 +4336,48 @@ void CtSaving::SaveContainer::_clear()
 #define CTSAVING_MKDIR(a,b) mkdir(a,b)
 #endif
 void CtSaving::Stream::checkWriteAccess()
+{
+	DEB_MEMBER_FUNCT();
+
+	_checkWriteAccess(m_pars.directory);
+	std::vector<std::string>::const_iterator d, dend = m_pars.stripeDirectories.end();
+	for (d = m_pars.stripeDirectories.begin(); d != dend; ++d)
+		_checkWriteAccess(*d);
+}
+
+void CtSaving::Stream::_checkWriteAccess(const std::string& directory)
 {
 	DEB_MEMBER_FUNCT();
 	std::string output;
 	// check if directory exist
 	DEB_TRACE() << "Check if directory exist";
-	if (!access(m_pars.directory.c_str(), F_OK))
+	if (!access(directory.c_str(), F_OK))
 	{
 		// check if it's a directory
 		struct stat aDirectoryStat;
-		if (stat(m_pars.directory.c_str(), &aDirectoryStat))
+		if (stat(directory.c_str(), &aDirectoryStat))
 		{
-			output = "Can stat directory : " + m_pars.directory;
+			output = "Can stat directory : " + directory;
 			THROW_CTL_ERROR(Error) << output;
 		}
 		DEB_TRACE() << "Check if it's really a directory";
 		if (!S_ISDIR(aDirectoryStat.st_mode))
 		{
-			output = "Path : " + m_pars.directory + " is not a directory";
+			output = "Path : " + directory + " is not a directory";
 			THROW_CTL_ERROR(Error) << output;
 		}
 
 		// check if it's writable
 		DEB_TRACE() << "Check if directory is writable";
-		if (access(m_pars.directory.c_str(), W_OK))
+		if (access(directory.c_str(), W_OK))
 		{
-			output = "Directory : " + m_pars.directory + " is not writable";
+			output = "Directory : " + directory + " is not writable";
 			THROW_CTL_ERROR(Error) << output;
 		}
 	}
-	else if (CTSAVING_MKDIR(m_pars.directory.c_str(), 0777))
+	else if (CTSAVING_MKDIR(directory.c_str(), 0777))
 	{
-		output = "Directory : " + m_pars.directory + " can't be created";
+		output = "Directory : " + directory + " can't be created";
 		THROW_CTL_ERROR(Error) << output;
 	}
 	else				// Creation was successful don't need to test other thing
@@ -3659,18 +4402,18 @@ void CtSaving::Stream::checkWriteAccess()
 		const int maxNameLen = FILENAME_MAX;
 		char filesToSearch[maxNameLen];
 
-		sprintf_s(filesToSearch, FILENAME_MAX, "%s/*.*", m_pars.directory.c_str());
+		sprintf_s(filesToSearch, FILENAME_MAX, "%s/*.*", directory.c_str());
 		if ((hFind = FindFirstFile(filesToSearch, &FindFileData)) == INVALID_HANDLE_VALUE)
 #else
 		struct dirent buffer;
 		struct dirent* result;
 		const int maxNameLen = 256;
 
-		DIR* aDirPt = opendir(m_pars.directory.c_str());
+		DIR* aDirPt = opendir(directory.c_str());
 		if (!aDirPt)
 #endif
 		{
-			output = "Can't open directory : " + m_pars.directory;
+			output = "Can't open directory : " + directory;
 			THROW_CTL_ERROR(Error) << output;
 		}
 
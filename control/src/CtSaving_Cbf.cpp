@@ -26,7 +26,10 @@
 #include <openssl/bio.h>
 #include <openssl/evp.h>
 
+#include <algorithm>
+
 #include "CtSaving_Cbf.h"
+#include "CtSaving_Cbf_Kernels.h"
 
 #include "processlib/SinkTask.h"
 
@@ -35,6 +38,95 @@ using namespace lima;
 static const char *DEFAULT_CATEGORY = "Misc";
 static const char LIMA_HEADER_KEY_SEPARATOR = '/';
 static const long int WRITE_BUFFER_SIZE = 64*1024;
+// the compressed data is handed to the MD5 thread by chunks
+static const long int MD5_CHUNK_SIZE = 256*1024;
+// free compressed buffers kept for the next frames
+static const size_t MAX_FREE_BUFFERS = 16;
+
+static void _md5(const void* buffer,long size,unsigned char digest[16])
+{
+  MD5_CTX context;
+  MD5Init(&context);
+  MD5Update(&context,(unsigned char*)buffer,size);
+  MD5Final(digest,&context);
+}
+
+/** @brief MD5 of a buffer being filled by another thread.
+ *
+ *  The compression task publishes the size of the encoded data as it
+ *  grows, the digest of the first blocks is computed while the next
+ *  ones are encoded.
+ */
+class SaveContainerCbf::_Md5Thread : public Thread
+{
+  DEB_CLASS_NAMESPC(DebModControl,"SaveContainerCbf::_Md5Thread","Control");
+public:
+  _Md5Thread() : m_buffer(NULL),m_size(0),m_hashed(0),m_quit(false) {}
+  virtual ~_Md5Thread() {}
+
+  void stop()
+  {
+    {
+      AutoMutex lock(m_cond.mutex());
+      m_quit = true;
+      m_cond.broadcast();
+    }
+    join();
+  }
+  void begin(const void* buffer)
+  {
+    AutoMutex lock(m_cond.mutex());
+    MD5Init(&m_context);
+    m_buffer = (unsigned char*)buffer;
+    m_size = m_hashed = 0;
+  }
+  /// the first size bytes of the buffer are ready
+  void push(long size)
+  {
+    AutoMutex lock(m_cond.mutex());
+    m_size = size;
+    m_cond.broadcast();
+  }
+  void end(unsigned char digest[16])
+  {
+    AutoMutex lock(m_cond.mutex());
+    while(m_hashed < m_size)
+      m_cond.wait();
+    MD5Final(digest,&m_context);
+    m_buffer = NULL;
+  }
+
+protected:
+  virtual void threadFunction()
+  {
+    AutoMutex lock(m_cond.mutex());
+    while(!m_quit)
+      {
+	if(m_hashed == m_size)
+	  {
+	    m_cond.wait();
+	    continue;
+	  }
+	unsigned char* data = m_buffer + m_hashed;
+	long size = m_size - m_hashed;
+	{
+	  // m_context is not touched by end() before m_hashed == m_size
+	  AutoMutexUnlock u(lock);
+	  MD5Update(&m_context,data,size);
+	}
+	m_hashed += size;
+	m_cond.broadcast();
+      }
+  }
+
+private:
+  Cond			m_cond;
+  MD5_CTX		m_context;
+  unsigned char*	m_buffer;
+  long			m_size;
+  long			m_hashed;
+  bool			m_quit;
+};
 
 struct SaveContainerCbf::_File
 {
@@ -211,75 +303,105 @@ class SaveContainerCbf::MHCompression : public SinkTaskBase
   CtSaving::HeaderMap	m_header;
   void*			m_buffer;
   int			m_buffer_size;
+  long			m_buffer_capacity;
   void*			m_header_str;
   int			m_header_size;
   int			m_header_memory_size;
 public:
   MHCompression(SaveContainerCbf &save_cnt,const CtSaving::HeaderMap &header) :
     SinkTaskBase(),m_container(save_cnt),m_header(header),
-    m_buffer(NULL),m_header_str(NULL),m_header_size(0),m_header_memory_size(0) {}
+    m_buffer(NULL),m_buffer_size(0),m_buffer_capacity(0),
+    m_header_str(NULL),m_header_size(0),m_header_memory_size(0) {}
   virtual ~MHCompression() 
   {
-    if(m_buffer) free(m_buffer);
+    if(m_buffer) m_container._releaseBuffer(m_buffer,m_buffer_capacity);
     if(m_header_str) free(m_header_str);
   }
   virtual void process(Data &aData)
   {
     DEB_MEMBER_FUNCT();
 
-    if(aData.type != Data::INT32)
-      THROW_CTL_ERROR(Error) << "cbf mini header only manage signed int data type";
+    CbfKernels::PixelType pixel_type;
+    const char* element_type;
+    switch(aData.type)
+      {
+      case Data::INT16:
+	pixel_type = CbfKernels::S16;
+	element_type = "signed 16-bit integer";break;
+      case Data::UINT16:
+	pixel_type = CbfKernels::U16;
+	element_type = "unsigned 16-bit integer";break;
+      case Data::INT32:
+	pixel_type = CbfKernels::S32;
+	element_type = "signed 32-bit integer";break;
+      case Data::UINT32:
+	pixel_type = CbfKernels::U32;
+	element_type = "unsigned 32-bit integer";break;
+      default:
+	THROW_CTL_ERROR(Error) << "cbf mini header only manage 16 and 32 bit integer data types";
+      }
 
     long width = aData.dimensions[0];
     long height = aData.dimensions[1];
     long nb_pixel = width * height;
-    long nb_pixel_4 = nb_pixel / 4;
-    if(posix_memalign(&m_buffer,4*1024,nb_pixel * sizeof(int) * 2))
-      THROW_CTL_ERROR(Error) << "Can't allocate compressed buffer";
-    union { char *cp; short *sp; int *ip;} dst;
-    dst.cp = (char*)m_buffer;
-    int *src = (int*)aData.data();
-    int prev_val = 0;
-    int nb_pixel_uncompressed = 0;
-    for(int i = 0; i < nb_pixel; ++i,++src)
+    // past nb_pixel / 4 deltas stored on 4 bytes or more, the raw data
+    // is saved. Worst case: 3 bytes per pixel, 15 per large delta.
+    long max_large = nb_pixel / 4;
+    long buffer_size = std::max<long>(nb_pixel * 3 + max_large * 12,
+				      aData.size());
+    m_buffer = m_container._getBuffer(buffer_size,m_buffer_capacity);
+
+    CbfKernels::EncodeFunc encode = CbfKernels::getEncodeFunc(pixel_type);
+    int delta[CbfKernels::BlockSize];
+    unsigned char cls[CbfKernels::BlockSize];
+    char* buffer = (char*)m_buffer;
+    char* dst = buffer;
+    char* pushed = buffer;
+    long large_budget = max_large;
+    // only needed if the compressed data is larger than a chunk
+    _Md5Thread* md5 = NULL;
+    for(long first = 0;dst && first < nb_pixel;first += CbfKernels::BlockSize)
       {
-	int val = *src;
-	int diff = val - prev_val;
-	if(abs(diff) <= 127)
-	  *dst.cp++ = diff;
-	else
+	int nb = int(std::min<long>(CbfKernels::BlockSize,nb_pixel - first));
+	dst = encode(aData.data(),first,nb,dst,delta,cls,large_budget);
+	if(dst && (dst - pushed) >= MD5_CHUNK_SIZE)
 	  {
-	    *dst.cp++ = 0x80;
-	    if(abs(diff) <= 32767)
-	      *dst.sp++ = diff;
-	    else
+	    if(!md5)
 	      {
-		*dst.sp++ = 0x8000;
-		*dst.ip++ = diff;
-		if(++nb_pixel_uncompressed > nb_pixel_4)
-		  goto end;
+		md5 = m_container._getMd5Thread();
+		md5->begin(buffer);
 	      }
+	    md5->push(dst - buffer);
+	    pushed = dst;
 	  }
-	prev_val = val;
       }
-    m_buffer_size = dst.cp - (char*)m_buffer;
-  end:
+
     const char* cbf_convertion;
-    if(!m_buffer_size)		// compression went wrong
+    unsigned char digest_str[16];
+    if(dst)
+      {
+	m_buffer_size = dst - buffer;
+	cbf_convertion = "x-CBF_BYTE_OFFSET";
+	if(md5)
+	  {
+	    md5->push(m_buffer_size);
+	    md5->end(digest_str);
+	  }
+	else
+	  _md5(buffer,m_buffer_size,digest_str);
+      }
+    else			// compression went wrong
       {
+	if(md5)
+	  md5->end(digest_str);
 	memcpy(m_buffer,aData.data(),aData.size());
 	m_buffer_size = aData.size();
 	cbf_convertion = "x-CBF_NONE";
+	_md5(buffer,m_buffer_size,digest_str);
       }
-    else
-      cbf_convertion = "x-CBF_BYTE_OFFSET";
+    if(md5)
+      m_container._releaseMd5Thread(md5);
 
-    //MD5
-    MD5_CTX context;
-    MD5Init(&context);
-    MD5Update(&context,(unsigned char*)m_buffer,m_buffer_size);
-    unsigned char digest_str[16];
-    MD5Final(digest_str,&context);
     //MD5 in base64
     BIO *base64_filter = BIO_new(BIO_f_base64());
     BIO_set_flags(base64_filter, BIO_FLAGS_BASE64_NO_NL);
@@ -306,23 +428,24 @@ Content-Type: application/octet-stream;\r\n\
 Content-Transfer-Encoding: BINARY\r\n\
 X-Binary-Size: %d\r\n\
 X-Binary-ID: 1\r\n\
-X-Binary-Element-Type: \"signed 32-bit integer\"\r\n\
+X-Binary-Element-Type: \"%s\"\r\n\
 X-Binary-Element-Byte-Order: LITTLE_ENDIAN\r\n\
 Content-MD5: %24s\r\n\
-X-Binary-Number-of-Elements: %d\r\n\
-X-Binary-Size-Fastest-Dimension: %d\r\n\
-X-Binary-Size-Second-Dimension: %d\r\n\
+X-Binary-Number-of-Elements: %ld\r\n\
+X-Binary-Size-Fastest-Dimension: %ld\r\n\
+X-Binary-Size-Second-Dimension: %ld\r\n\
 X-Binary-Size-Padding: 1\r\n\
 \r\n\
 \f\032\004\325\
-", cbf_convertion,m_buffer_size, digest.c_str(),nb_pixel, 
+", cbf_convertion,m_buffer_size,element_type,digest.c_str(),nb_pixel,
 		   width, height);
 
     Handle h;
     h.format = CtSaving::CBFMiniHeader;
     h.data_buffer = m_buffer,h.data_buffer_size = m_buffer_size;
+    h.data_buffer_capacity = m_buffer_capacity;
     // transfer ownership to Handler
-    m_buffer = NULL,m_buffer_size = 0;
+    m_buffer = NULL,m_buffer_size = 0,m_buffer_capacity = 0;
 
     h.header_data = m_header_str,h.header_data_size = m_header_size;
     // transfer ownership to Handler
@@ -424,6 +547,17 @@ SaveContainerCbf::SaveContainerCbf(CtSaving::Stream& stream,
 SaveContainerCbf::~SaveContainerCbf()
 {
   DEB_DESTRUCTOR();
+
+  _clear();
+  for(std::vector<PoolBuffer>::iterator i = m_free_buffers.begin();
+      i != m_free_buffers.end();++i)
+    free(i->first);
+  for(std::vector<_Md5Thread*>::iterator i = m_md5_threads.begin();
+      i != m_md5_threads.end();++i)
+    {
+      (*i)->stop();
+      delete *i;
+    }
 }
 
 SinkTaskBase* SaveContainerCbf::getCompressionTask(const CtSaving::HeaderMap &header)
@@ -479,13 +613,7 @@ void SaveContainerCbf::_clear()
   dataId2cbfHandle::iterator i = m_cbfs.begin();
   while(i != m_cbfs.end())
     {
-      if(i->second.format == CtSaving::CBFMiniHeader)
-	{
-	  free(i->second.data_buffer);
-	  free(i->second.header_data);
-	}
-      else
-	cbf_free_handle(i->second.handle);
+      _freeHandle(i->second);
       dataId2cbfHandle::iterator previous = i++;
       m_cbfs.erase(previous);
     }
@@ -501,7 +629,8 @@ int SaveContainerCbf::_writeCbfData(_File* file,Data &aData)
 				 file->m_fout);
       if(write_size != size_t(handle.header_data_size))
 	{
-	  free(handle.header_data),free(handle.data_buffer);
+	  free(handle.header_data);
+	  _releaseBuffer(handle.data_buffer,handle.data_buffer_capacity);
 	  DEB_ERROR() << "Can't write header";
 	  return -1;		// error
 	}
@@ -511,7 +640,7 @@ int SaveContainerCbf::_writeCbfData(_File* file,Data &aData)
 			  file->m_fout);
       bool return_flag = write_size != size_t(handle.data_buffer_size);
       if(return_flag) DEB_ERROR() << "Cannot write image data";
-      free(handle.data_buffer);
+      _releaseBuffer(handle.data_buffer,handle.data_buffer_capacity);
       return return_flag;
     }
   else
@@ -539,13 +668,93 @@ void SaveContainerCbf::_setHandle(int dataId,Handle& handle)
     m_cbfs.insert(std::pair<int,Handle>(dataId,handle));
   if(!result.second)		// It can happend if _open failed
     {
-      if(result.first->second.format == CtSaving::CBFMiniHeader)
-	{
-	  free(result.first->second.data_buffer);
-	  free(result.first->second.header_data);
-	}
-      else
-	cbf_free_handle(result.first->second.handle);
+      _freeHandle(result.first->second);
       result.first->second = handle;
     }
 }
+
+/** @brief free the resources of a handle, called with the lock held
+ */
+void SaveContainerCbf::_freeHandle(Handle& handle)
+{
+  if(handle.format == CtSaving::CBFMiniHeader)
+    {
+      _putBuffer(handle.data_buffer,handle.data_buffer_capacity);
+      free(handle.header_data);
+    }
+  else
+    cbf_free_handle(handle.handle);
+}
+
+/** @brief a compressed buffer of at least size bytes
+ */
+void* SaveContainerCbf::_getBuffer(long size,long& capacity)
+{
+  DEB_MEMBER_FUNCT();
+
+  void* buffer = NULL;
+  {
+    AutoMutex aLock(m_lock);
+    std::vector<PoolBuffer>::iterator i = m_free_buffers.begin();
+    while(i != m_free_buffers.end() && i->second < size)
+      ++i;
+    if(i != m_free_buffers.end())
+      {
+	buffer = i->first,capacity = i->second;
+	m_free_buffers.erase(i);
+	return buffer;
+      }
+    // the frame size changed, the small buffers are useless
+    if(!m_free_buffers.empty())
+      {
+	free(m_free_buffers.back().first);
+	m_free_buffers.pop_back();
+      }
+  }
+
+  if(posix_memalign(&buffer,4*1024,size))
+    THROW_CTL_ERROR(Error) << "Can't allocate compressed buffer";
+  capacity = size;
+  return buffer;
+}
+
+void SaveContainerCbf::_releaseBuffer(void* buffer,long capacity)
+{
+  AutoMutex aLock(m_lock);
+  _putBuffer(buffer,capacity);
+}
+
+/** @brief give a buffer back to the pool, called with the lock held
+ */
+void SaveContainerCbf::_putBuffer(void* buffer,long capacity)
+{
+  if(!buffer)
+    return;
+  if(m_free_buffers.size() < MAX_FREE_BUFFERS)
+    m_free_buffers.push_back(PoolBuffer(buffer,capacity));
+  else
+    free(buffer);
+}
+
+SaveContainerCbf::_Md5Thread* SaveContainerCbf::_getMd5Thread()
+{
+  DEB_MEMBER_FUNCT();
+  {
+    AutoMutex aLock(m_lock);
+    if(!m_md5_threads.empty())
+      {
+	_Md5Thread* md5 = m_md5_threads.back();
+	m_md5_threads.pop_back();
+	return md5;
+      }
+  }
+  _Md5Thread* md5 = new _Md5Thread();
+  md5->start();
+  return md5;
+}
+
+void SaveContainerCbf::_releaseMd5Thread(_Md5Thread* md5)
+{
+  AutoMutex aLock(m_lock);
+  m_md5_threads.push_back(md5);
+}
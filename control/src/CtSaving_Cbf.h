@@ -22,6 +22,9 @@
 #ifndef CTSAVING_CBF_H
 #define CTSAVING_CBF_H
 
+#include <utility>
+#include <vector>
+
 #include <cbflib/cbf.h>
 
 #include "lima/CtSaving.h"
@@ -33,6 +36,7 @@ namespace lima {
     DEB_CLASS_NAMESPC(DebModControl,"Saving CBF Container","Control");
     class Compression;
     class MHCompression;
+    class _Md5Thread;
     struct _File;
   public:
     struct Handle
@@ -41,6 +45,7 @@ namespace lima {
       cbf_handle		handle;
       void*			data_buffer;
       int			data_buffer_size;
+      long			data_buffer_capacity;	// from the pool
       void*			header_data;
       int			header_data_size;
     };
@@ -69,8 +74,20 @@ namespace lima {
     typedef std::map<int,Handle> dataId2cbfHandle;
     void _setHandle(int dataId,Handle&);
     Handle _takeHandle(int dataId);
-    
+    void _freeHandle(Handle&);
+
+    // mini header compressed buffers, reused from frame to frame
+    typedef std::pair<void*,long> PoolBuffer;
+    void* _getBuffer(long size,long& capacity);
+    void _releaseBuffer(void* buffer,long capacity);
+    void _putBuffer(void* buffer,long capacity);
+
+    _Md5Thread* _getMd5Thread();
+    void _releaseMd5Thread(_Md5Thread*);
+
     dataId2cbfHandle		m_cbfs;
+    std::vector<PoolBuffer>	m_free_buffers;
+    std::vector<_Md5Thread*>	m_md5_threads;	// idle ones
     Mutex			m_lock;
     CtSaving::FileFormat	m_format;
   };
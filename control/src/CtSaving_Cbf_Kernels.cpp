@@ -0,0 +1,82 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <cstring>
+
+#include "CtSaving_Cbf_Kernels.h"
+
+namespace
+{
+#include "CtSaving_Cbf_KernelsImpl.h"
+
+Isa detect_isa()
+{
+#ifdef LIMA_CBF_X86_KERNELS
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))
+    return IsaAVX2;
+#endif
+  return IsaScalar;
+}
+}
+
+using namespace lima;
+
+CbfKernels::EncodeFunc CbfKernels::lookupScalar(PixelType type)
+{
+  return lookup(type);
+}
+
+CbfKernels::Isa CbfKernels::getBestIsa()
+{
+  static const Isa best_isa = detect_isa();
+  return best_isa;
+}
+
+const char *CbfKernels::getIsaName(Isa isa)
+{
+  switch(isa)
+    {
+    case IsaScalar:	return "scalar";
+    case IsaAVX2:	return "avx2";
+    default:		return "unknown";
+    }
+}
+
+CbfKernels::EncodeFunc CbfKernels::getEncodeFunc(PixelType type,Isa isa)
+{
+  if(isa > getBestIsa())
+    return NULL;
+
+  switch(isa)
+    {
+#ifdef LIMA_CBF_X86_KERNELS
+    case IsaAVX2:	return lookupAVX2(type);
+#endif
+    case IsaScalar:	return lookupScalar(type);
+    default:		return NULL;
+    }
+}
+
+CbfKernels::EncodeFunc CbfKernels::getEncodeFunc(PixelType type)
+{
+  return getEncodeFunc(type,getBestIsa());
+}
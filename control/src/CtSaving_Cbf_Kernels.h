@@ -0,0 +1,78 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef CTSAVING_CBF_KERNELS_H
+#define CTSAVING_CBF_KERNELS_H
+
+// CBF byte-offset encoding kernels. A block of pixels is encoded in two
+// passes: the first one (branch-free, vectorized) computes the delta with
+// the previous pixel and its size class, the second one stores the
+// classes in the output stream, 16 one-byte deltas at a time.
+// The same code is compiled for several instruction sets
+// (CtSaving_Cbf_Kernels_<isa>.cpp), the best one is chosen at runtime.
+//
+// Only plain types here: the ISA specific translation units must not
+// instantiate any inline code shared with the rest of the library.
+
+namespace lima {
+namespace CbfKernels {
+
+enum PixelType { S16, U16, S32, U32, NbPixelTypes };
+enum Isa { IsaScalar, IsaAVX2, NbIsas };
+
+/// the encoding scratch needs BlockSize entries
+enum { BlockSize = 4096 };
+
+/** @brief byte-offset encode nb_pixels (<= BlockSize) pixels of src,
+ *  starting at pixel first (the reference of the first one is
+ *  src[first - 1], 0 for the first pixel of the image).
+ *
+ *  delta and cls are the scratch of the first pass.
+ *  large_budget is decremented for each pixel stored on 4 bytes or more:
+ *  the kernel stops and returns NULL when it becomes negative,
+ *  otherwise it returns the end of the stored data.
+ *  dst must have room for 15 bytes per pixel in the worst case.
+ */
+typedef char *(*EncodeFunc)(const void *src,long first,int nb_pixels,
+			    char *dst,int *delta,unsigned char *cls,
+			    long& large_budget);
+
+/** @brief best kernel for the pixel type
+ */
+EncodeFunc getEncodeFunc(PixelType type);
+/** @brief kernel for a given instruction set, NULL if not available
+ */
+EncodeFunc getEncodeFunc(PixelType type,Isa isa);
+/** @brief best instruction set supported by this CPU and build
+ */
+Isa getBestIsa();
+const char *getIsaName(Isa isa);
+
+// per instruction set entry points
+EncodeFunc lookupScalar(PixelType type);
+#ifdef LIMA_CBF_X86_KERNELS
+EncodeFunc lookupAVX2(PixelType type);
+#endif
+
+} // namespace CbfKernels
+} // namespace lima
+
+#endif // CTSAVING_CBF_KERNELS_H
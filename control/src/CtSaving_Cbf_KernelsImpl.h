@@ -0,0 +1,136 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+// Kernel templates, included inside an anonymous namespace by each
+// CtSaving_Cbf_Kernels*.cpp: every instruction set gets its own
+// (internal linkage) instantiations. No include guard on purpose.
+
+using namespace lima::CbfKernels;
+
+inline void store16(char *dst,short v) { memcpy(dst,&v,sizeof(v)); }
+inline void store32(char *dst,int v) { memcpy(dst,&v,sizeof(v)); }
+inline void store64(char *dst,long long v) { memcpy(dst,&v,sizeof(v)); }
+
+/** @brief pass 1: deltas (modulo 2^32) and escape flags, branch-free.
+ *
+ *  Everything is done on 32-bit lanes so that the loop vectorizes:
+ *  the flag is set if the delta does not fit in [-127,127], a wrapped
+ *  32-bit delta outside this range is always flagged.
+ */
+template <class T>
+void delta_pass(const T *src,long first,int nb_pixels,
+		int *delta,unsigned char *cls)
+{
+  const T *p = src + first;
+  unsigned int prev = first ? (unsigned int)p[-1] : 0;
+  unsigned int d = (unsigned int)p[0] - prev;
+  delta[0] = d;
+  cls[0] = d + 127u > 254u;
+  for(int i = 1;i < nb_pixels;++i)
+    {
+      unsigned int d = (unsigned int)p[i] - (unsigned int)p[i - 1];
+      delta[i] = d;
+      cls[i] = d + 127u > 254u;
+    }
+}
+
+/** @brief the exact delta of an escaped pixel:
+ *  0x80 + 2 bytes, 0x80 0x8000 + 4 bytes,
+ *  or 0x80 0x8000 0x80000000 + 8 bytes (32-bit pixels only)
+ */
+template <class T>
+inline char *store_escaped(const T *src,long index,char *dst,
+			   long& large_budget)
+{
+  long long d = (long long)src[index] -
+		(index ? (long long)src[index - 1] : 0LL);
+  *dst = char(0x80);
+  if(d >= -32767 && d <= 32767)
+    {
+      store16(dst + 1,short(d));
+      return dst + 3;
+    }
+  if(--large_budget < 0)
+    return NULL;
+  store16(dst + 1,short(0x8000));
+  if(d >= -2147483647LL && d <= 2147483647LL)
+    {
+      store32(dst + 3,int(d));
+      return dst + 7;
+    }
+  store32(dst + 3,int(0x80000000));
+  store64(dst + 7,d);
+  return dst + 15;
+}
+
+/** @brief pass 2: compacting store, 16 one-byte deltas at a time
+ */
+template <class T>
+char *store_pass(const T *src,long first,int nb_pixels,char *dst,
+		 const int *delta,const unsigned char *cls,long& large_budget)
+{
+  int i = 0;
+  while(i < nb_pixels)
+    {
+      if(i + 16 <= nb_pixels)
+	{
+	  unsigned long long c0,c1;
+	  memcpy(&c0,cls + i,8),memcpy(&c1,cls + i + 8,8);
+	  if(!(c0 | c1))	// the common case
+	    {
+	      for(int j = 0;j < 16;++j)
+		dst[j] = char(delta[i + j]);
+	      dst += 16,i += 16;
+	      continue;
+	    }
+	}
+      if(!cls[i])
+	*dst++ = char(delta[i]);
+      else if(!(dst = store_escaped(src,first + i,dst,large_budget)))
+	return NULL;
+      ++i;
+    }
+  return dst;
+}
+
+template <class T>
+char *encode(const void *src,long first,int nb_pixels,char *dst,
+	     int *delta,unsigned char *cls,long& large_budget)
+{
+  if(nb_pixels <= 0)
+    return dst;
+  delta_pass((const T*)src,first,nb_pixels,delta,cls);
+  return store_pass((const T*)src,first,nb_pixels,dst,delta,cls,
+		    large_budget);
+}
+
+inline EncodeFunc lookup(PixelType type)
+{
+  switch(type)
+    {
+    case S16:	return &encode<short>;
+    case U16:	return &encode<unsigned short>;
+    case S32:	return &encode<int>;
+    case U32:	return &encode<unsigned int>;
+    default:	return 0;
+    }
+}
@@ -25,14 +25,177 @@
 #include "lima/CtSaving_Compression.h"
 #include "CtSaving_Edf.h"
 
+#include "processlib/PoolThreadMgr.h"
+#include "processlib/TaskMgr.h"
+
+#include <atomic>
+#include <functional>
+
 using namespace lima;
 
+#if defined(WITH_Z_COMPRESSION) || defined(WITH_LZ4_COMPRESSION) || \
+    defined(WITH_BS_COMPRESSION)
+/*******************************************************************
+ * \brief the compression blocks of a frame, shared with the helper
+ *  threads
+ *******************************************************************/
+class _ZBlockJob
+{
+  DEB_CLASS_NAMESPC(DebModControl,"Block Compression Job","Control");
+public:
+  typedef std::function<void(int block)> BlockFunc;
+
+  _ZBlockJob(const BlockFunc& func, int nb_blocks) :
+    m_func(func), m_nb_blocks(nb_blocks), m_next_block(0), m_nb_done(0)
+  {}
+
+  bool processNextBlock()
+  {
+    int block = m_next_block++;
+    if(block >= m_nb_blocks)
+      return false;
+    std::string error;
+    try {
+      m_func(block);
+    } catch(Exception& e) {
+      error = e.getErrMsg();
+    } catch(std::exception& e) {
+      error = e.what();
+    }
+    AutoMutex aLock(m_cond.mutex());
+    if(!error.empty() && m_error.empty())
+      m_error = error;
+    if(++m_nb_done == m_nb_blocks)
+      m_cond.broadcast();
+    return true;
+  }
+
+  void waitAllBlocks()
+  {
+    DEB_MEMBER_FUNCT();
+    AutoMutex aLock(m_cond.mutex());
+    while(m_nb_done < m_nb_blocks)
+      m_cond.wait();
+    if(!m_error.empty())
+      THROW_CTL_ERROR(Error) << "Block compression failed: " << m_error;
+  }
+
+private:
+  BlockFunc		m_func;
+  int			m_nb_blocks;
+  std::atomic<int>	m_next_block;
+  Cond			m_cond;
+  int			m_nb_done;
+  std::string		m_error;
+};
+
+class _ZBlockTask : public SinkTaskBase
+{
+public:
+  _ZBlockTask(std::shared_ptr<_ZBlockJob> job) : m_job(job) {}
+
+  virtual void process(Data&)
+  {
+    while(m_job->processNextBlock())
+      continue;
+  }
+
+private:
+  std::shared_ptr<_ZBlockJob> m_job;
+};
+
+/** @brief run func on the nb_blocks blocks of aData, with the help of
+    the processing threads
+ */
+static void _runBlocks(Data &aData, int nb_blocks,
+		       const _ZBlockJob::BlockFunc& func)
+{
+  std::shared_ptr<_ZBlockJob> job(new _ZBlockJob(func, nb_blocks));
+  PoolThreadMgr& pool = PoolThreadMgr::get();
+  int nb_helpers = std::min(nb_blocks, pool.getNumberOfThread()) - 1;
+  for(int i = 0; i < nb_helpers; ++i)
+    {
+      _ZBlockTask *task = new _ZBlockTask(job);
+      TaskMgr *mgr = new TaskMgr();
+      mgr->addSinkTask(0, task);
+      task->unref();
+      mgr->setInputData(aData);
+      pool.addProcess(mgr);
+    }
+
+  // the helpers arriving late find nothing left to do
+  while(job->processNextBlock())
+    continue;
+  job->waitAllBlocks();
+}
+#endif
+
+#ifdef WITH_Z_COMPRESSION
+// room for the empty stored block ending a Z_SYNC_FLUSH
+static const int DEFLATE_FLUSH_SIZE = 16;
+static const int GZIP_HEADER_SIZE = 10;
+static const int GZIP_TRAILER_SIZE = 8;
+static const int ZLIB_HEADER_SIZE = 2;
+static const int ZLIB_TRAILER_SIZE = 4;
+
+static inline int _deflateBlockBound(int size)
+{
+  return int(compressBound(size)) + DEFLATE_FLUSH_SIZE;
+}
+
+/** @brief raw deflate of prefix + src into out.
+    The block ends byte aligned (Z_SYNC_FLUSH) so the next one can be
+    appended, the last one ends the deflate stream (Z_FINISH).
+    @return the compressed size
+ */
+static int _deflateBlock(int level, const char *prefix, int prefix_size,
+			 const char *src, int size, bool last,
+			 char *out, int out_size)
+{
+  z_stream_s strm;
+  strm.zalloc = NULL;
+  strm.zfree = NULL;
+  strm.opaque = NULL;
+  if(deflateInit2(&strm, level, Z_DEFLATED, -MAX_WBITS, 8,
+		  Z_DEFAULT_STRATEGY) != Z_OK)
+    throw LIMA_CTL_EXC(Error, "Can't init compression struct");
+
+  strm.next_out = (Bytef*)out;
+  strm.avail_out = out_size;
+  int res = Z_OK;
+  if(prefix_size)
+    {
+      strm.next_in = (Bytef*)prefix;
+      strm.avail_in = prefix_size;
+      res = deflate(&strm, Z_NO_FLUSH);
+    }
+  if(res == Z_OK)
+    {
+      strm.next_in = (Bytef*)src;
+      strm.avail_in = size;
+      res = deflate(&strm, last ? Z_FINISH : Z_SYNC_FLUSH);
+    }
+  int compressed_size = out_size - strm.avail_out;
+  bool ok = (last ? res == Z_STREAM_END :
+	     (res == Z_OK && !strm.avail_in && strm.avail_out));
+  deflateEnd(&strm);
+  if(!ok)
+    {
+      std::ostringstream msg;
+      msg << "deflate error: res=" << res << ", out_size=" << out_size;
+      throw LIMA_CTL_EXC(Error, msg.str());
+    }
+  return compressed_size;
+}
+#endif // WITH_Z_COMPRESSION
+
 #ifdef WITH_Z_COMPRESSION
 const int FileZCompression::BUFFER_HELPER_SIZE = 64 * 1024;
 
 FileZCompression::FileZCompression(SaveContainerEdf &save_cnt,
-				   const CtSaving::HeaderMap &header) :
-  m_container(save_cnt),m_header(header)
+				   const CtSaving::HeaderMap &header,
+				   int block_size) :
+  m_container(save_cnt),m_header(header),m_block_size(block_size)
 {
   DEB_CONSTRUCTOR();
   
@@ -64,6 +227,12 @@ void FileZCompression::process(Data &aData)
 {
   DEB_MEMBER_FUNCT();
   DEB_PARAM() << DEB_VAR1(aData.frameNumber);
+  if(BlockCompression::getNbBlocks(aData.size(),m_block_size) > 1)
+    {
+      _block_compression(aData);
+      return;
+    }
+
   ZBufferList aBufferListPt = _compress_header(aData, false);
   _compression((char*)aData.data(),aData.size(),aBufferListPt);
   _end_compression(aBufferListPt);
@@ -71,6 +240,85 @@ void FileZCompression::process(Data &aData)
   m_container._setBuffers(aData,std::move(aBufferListPt));
 }
 
+/** @brief pigz-like gzip stream: one gzip member, the EDF header and the
+    data blocks are deflated in parallel, their CRCs are combined
+ */
+void FileZCompression::_block_compression(Data &aData)
+{
+  DEB_MEMBER_FUNCT();
+
+  std::ostringstream buffer;
+  m_container._writeEdfHeader(aData,m_header,buffer);
+  const std::string& header = buffer.str();
+
+  const char *src = (const char*)aData.data();
+  int size = aData.size();
+  int nb_blocks = BlockCompression::getNbBlocks(size,m_block_size);
+  DEB_TRACE() << DEB_VAR2(m_block_size,nb_blocks);
+
+  ZBufferList aBufferListPt;
+  aBufferListPt.reserve(nb_blocks);
+  std::vector<int> buffer_sizes(nb_blocks);
+  for(int i = 0;i < nb_blocks;++i)
+    {
+      int block_size = std::min(m_block_size,size - i * m_block_size);
+      int& buffer_size = buffer_sizes[i];
+      buffer_size = _deflateBlockBound(block_size);
+      if(i == 0)
+	buffer_size += GZIP_HEADER_SIZE + _deflateBlockBound(header.size());
+      if(i == nb_blocks - 1)
+	buffer_size += GZIP_TRAILER_SIZE;
+      aBufferListPt.emplace_back(buffer_size);
+    }
+
+  std::vector<uLong> crcs(nb_blocks);
+  auto compress_block = [&](int i) {
+    const char *block = src + long(i) * m_block_size;
+    int block_size = std::min(m_block_size,size - i * m_block_size);
+    ZBuffer& out = aBufferListPt[i];
+    char *out_ptr = (char*)out.ptr();
+    int out_size = buffer_sizes[i];
+    uLong crc = crc32(0L,Z_NULL,0);
+    int prefix_size = 0;
+    if(i == 0)
+      {
+	out_ptr += GZIP_HEADER_SIZE;
+	out_size -= GZIP_HEADER_SIZE;
+	prefix_size = header.size();
+	crc = crc32(crc,(const Bytef*)header.data(),prefix_size);
+      }
+    bool last = (i == nb_blocks - 1);
+    if(last)
+      out_size -= GZIP_TRAILER_SIZE;
+    int compressed_size = _deflateBlock(8,header.data(),prefix_size,
+					block,block_size,last,
+					out_ptr,out_size);
+    crcs[i] = crc32(crc,(const Bytef*)block,block_size);
+    out.used_size = (out_ptr - (char*)out.ptr()) + compressed_size;
+  };
+  _runBlocks(aData,nb_blocks,compress_block);
+
+  static const unsigned char gzip_header[GZIP_HEADER_SIZE] = {
+    0x1f,0x8b,Z_DEFLATED,0,0,0,0,0,0,0x03, // no name, no mtime, unix
+  };
+  memcpy(aBufferListPt.front().ptr(),gzip_header,GZIP_HEADER_SIZE);
+
+  uLong crc = crcs[0];
+  for(int i = 1;i < nb_blocks;++i)
+    crc = crc32_combine(crc,crcs[i],std::min(m_block_size,size - i * m_block_size));
+  unsigned long total_size = header.size() + size;
+  ZBuffer& last = aBufferListPt.back();
+  unsigned char *trailer = (unsigned char*)last.ptr() + last.used_size;
+  for(int i = 0;i < 4;++i)
+    {
+      trailer[i] = (crc >> (8 * i)) & 0xff;
+      trailer[4 + i] = (total_size >> (8 * i)) & 0xff;
+    }
+  last.used_size += GZIP_TRAILER_SIZE;
+
+  m_container._setBuffers(aData,std::move(aBufferListPt));
+}
+
 ZBufferList FileZCompression::compress_header(Data &aData)
 {
   return _compress_header(aData, true);
@@ -139,8 +387,9 @@ void FileZCompression::_end_compression(ZBufferList& return_buffers)
 
 #ifdef WITH_LZ4_COMPRESSION
 FileLz4Compression::FileLz4Compression(SaveContainerEdf &save_cnt,
-				       const CtSaving::HeaderMap &header) :
-  m_container(save_cnt),m_header(header)
+				       const CtSaving::HeaderMap &header,
+				       int block_size) :
+  m_container(save_cnt),m_header(header),m_block_size(block_size)
 {
   DEB_CONSTRUCTOR();
   
@@ -159,10 +408,51 @@ void FileLz4Compression::process(Data &aData)
   DEB_MEMBER_FUNCT();
   DEB_PARAM() << DEB_VAR1(aData.frameNumber);
   ZBufferList aBufferListPt = compress_header(aData);
-  _compression((char*)aData.data(),aData.size(),aBufferListPt);
+  if(BlockCompression::getNbBlocks(aData.size(),m_block_size) > 1)
+    _block_compression(aData,aBufferListPt);
+  else
+    _compression((char*)aData.data(),aData.size(),aBufferListPt);
   m_container._setBuffers(aData,std::move(aBufferListPt));
 }
 
+/** @brief the data blocks are compressed in parallel as independent LZ4
+    frames, appended to the header frame
+ */
+void FileLz4Compression::_block_compression(Data &aData,
+					    ZBufferList& return_buffers)
+{
+  DEB_MEMBER_FUNCT();
+
+  const char *src = (const char*)aData.data();
+  int size = aData.size();
+  int nb_blocks = BlockCompression::getNbBlocks(size,m_block_size);
+  DEB_TRACE() << DEB_VAR2(m_block_size,nb_blocks);
+
+  int first = return_buffers.size();
+  return_buffers.reserve(first + nb_blocks);
+  std::vector<size_t> buffer_sizes(nb_blocks);
+  for(int i = 0;i < nb_blocks;++i)
+    {
+      int block_size = std::min(m_block_size,size - i * m_block_size);
+      buffer_sizes[i] = LZ4F_compressFrameBound(block_size,&lz4_preferences);
+      return_buffers.emplace_back(buffer_sizes[i]);
+    }
+
+  auto compress_block = [&](int i) {
+    const char *block = src + long(i) * m_block_size;
+    int block_size = std::min(m_block_size,size - i * m_block_size);
+    ZBuffer& out = return_buffers[first + i];
+    size_t compressed_size = LZ4F_compressFrame(out.ptr(),buffer_sizes[i],
+						block,block_size,
+						&lz4_preferences);
+    if(LZ4F_isError(compressed_size))
+      throw LIMA_CTL_EXC(Error,std::string("LZ4 compression failed: ") +
+			 LZ4F_getErrorName(compressed_size));
+    out.used_size = compressed_size;
+  };
+  _runBlocks(aData,nb_blocks,compress_block);
+}
+
 ZBufferList FileLz4Compression::compress_header(Data &aData)
 {
   DEB_MEMBER_FUNCT();
@@ -218,8 +508,9 @@ extern void bshuf_write_uint32_BE(void* buf, uint32_t num);
 }
 
 
-ImageBsCompression::ImageBsCompression(CtSaving::SaveContainer &save_cnt):
-  m_container(save_cnt)
+ImageBsCompression::ImageBsCompression(CtSaving::SaveContainer &save_cnt,
+				       int block_size):
+  m_container(save_cnt), m_block_size(block_size)
 {
   DEB_CONSTRUCTOR();
   DEB_TRACE() << "BitShuffle using SSE2=" << bshuf_using_SSE2() << " AVX2=" << bshuf_using_AVX2();
@@ -245,15 +536,18 @@ void ImageBsCompression::process(Data &aData)
   DEB_MEMBER_FUNCT();
   DEB_PARAM() << DEB_VAR1(aData.frameNumber);
   ZBufferList aBufferListPt;
-  _compression((char*)aData.data(), aData.size(), aData.depth(), aBufferListPt);
+  _compression(aData, aBufferListPt);
   m_container._setBuffers(aData,std::move(aBufferListPt));
 }
 
-void ImageBsCompression::_compression(const char *src,int data_size,int data_depth,
-				      ZBufferList& return_buffers)
+void ImageBsCompression::_compression(Data &aData, ZBufferList& return_buffers)
 {
   DEB_MEMBER_FUNCT();
 
+  const char *src = (const char*)aData.data();
+  int data_size = aData.size();
+  int data_depth = aData.depth();
+
   unsigned int bs_block_size= 0;
   unsigned int bs_in_size= (unsigned int)(data_size/data_depth);
 
@@ -274,7 +568,45 @@ void ImageBsCompression::_compression(const char *src,int data_size,int data_dep
   bs_buffer += 8;
   bshuf_write_uint32_BE(bs_buffer, bs_block_size);
   bs_buffer += 4;
-  int64_t bs_out_size = bshuf_compress_lz4(src, bs_buffer, bs_in_size, data_depth, bs_block_size);
+
+  // the parallel blocks hold a whole number of bitshuffle blocks:
+  // their outputs appended are the output of a single call
+  size_t bs_elems = bshuf_default_block_size(data_depth);
+  int block_elems = std::max<int>(m_block_size / (bs_elems * data_depth), 1) * bs_elems;
+  int nb_blocks = BlockCompression::getNbBlocks(bs_in_size, m_block_size ? block_elems : 0);
+
+  int64_t bs_out_size;
+  if (nb_blocks > 1) {
+    DEB_TRACE() << DEB_VAR2(block_elems, nb_blocks);
+    std::vector<int64_t> out_offsets(nb_blocks + 1), out_sizes(nb_blocks);
+    for (int i = 0; i < nb_blocks; ++i) {
+      int nb_elems = std::min<int>(block_elems, bs_in_size - i * block_elems);
+      out_offsets[i + 1] = (out_offsets[i] +
+			    bshuf_compress_lz4_bound(nb_elems, data_depth, bs_elems));
+    }
+
+    auto compress_block = [&](int i) {
+      int nb_elems = std::min<int>(block_elems, bs_in_size - i * block_elems);
+      const char *block = src + long(i) * block_elems * data_depth;
+      out_sizes[i] = bshuf_compress_lz4(block, bs_buffer + out_offsets[i],
+					nb_elems, data_depth, bs_elems);
+      if (out_sizes[i] < 0) {
+	std::ostringstream msg;
+	msg << "BS Compression failed: error code [" << out_sizes[i] << "]";
+	throw LIMA_CTL_EXC(Error, msg.str());
+      }
+    };
+    _runBlocks(aData, nb_blocks, compress_block);
+
+    // pack the blocks
+    bs_out_size = out_sizes[0];
+    for (int i = 1; i < nb_blocks; ++i) {
+      memmove(bs_buffer + bs_out_size, bs_buffer + out_offsets[i], out_sizes[i]);
+      bs_out_size += out_sizes[i];
+    }
+  } else {
+    bs_out_size = bshuf_compress_lz4(src, bs_buffer, bs_in_size, data_depth, bs_block_size);
+  }
   if (bs_out_size < 0)
     THROW_CTL_ERROR(Error) << "BS Compression failed: error code [" << bs_out_size << "]";
 
@@ -285,8 +617,9 @@ void ImageBsCompression::_compression(const char *src,int data_size,int data_dep
 #endif // WITH_BS_COMPRESSION
 
 #ifdef WITH_Z_COMPRESSION
-ImageZCompression::ImageZCompression(CtSaving::SaveContainer &save_cnt,  int  level):
-  m_container(save_cnt), m_compression_level(level)
+ImageZCompression::ImageZCompression(CtSaving::SaveContainer &save_cnt,  int  level,
+				     int block_size):
+  m_container(save_cnt), m_compression_level(level), m_block_size(block_size)
 {
   DEB_CONSTRUCTOR();
 };
@@ -295,9 +628,17 @@ ImageZCompression::~ImageZCompression()
 {
 }
 
-int ImageZCompression::calcBufferSize(int data_size, int data_depth)
+int ImageZCompression::calcBufferSize(int data_size, int data_depth,
+				      int block_size)
 {
-  return int(compressBound(data_size));
+  int nb_blocks = BlockCompression::getNbBlocks(data_size, block_size);
+  if (nb_blocks == 1)
+    return int(compressBound(data_size));
+
+  int buffer_size = ZLIB_HEADER_SIZE + ZLIB_TRAILER_SIZE;
+  for (int i = 0; i < nb_blocks; ++i)
+    buffer_size += _deflateBlockBound(std::min(block_size, data_size - i * block_size));
+  return buffer_size;
 }
 
 void ImageZCompression::process(Data &aData)
@@ -305,16 +646,20 @@ void ImageZCompression::process(Data &aData)
   DEB_MEMBER_FUNCT();
   DEB_PARAM() << DEB_VAR1(aData.frameNumber);
   ZBufferList aBufferListPt;
-  _compression((char*)aData.data(),aData.size(),aBufferListPt);
+  _compression(aData,aBufferListPt);
   m_container._setBuffers(aData,std::move(aBufferListPt));
 }
 
-void ImageZCompression::_compression(const char *src,int size,
+void ImageZCompression::_compression(Data &aData,
 				     ZBufferList& return_buffers)
 {
   DEB_MEMBER_FUNCT();
+  const char *src = (const char*)aData.data();
+  int size = aData.size();
+  int nb_blocks = BlockCompression::getNbBlocks(size, m_block_size);
+
   // cannot know compression ratio in advance so allocate a buffer large enough
-  uLong buffer_size = compressBound(size);
+  uLong buffer_size = calcBufferSize(size, aData.depth(), m_block_size);
   BufferHelper& buffer_helper = m_container.getZBufferHelper();
   std::shared_ptr<void> p = buffer_helper.getBuffer(buffer_size);
   if (!p)
@@ -322,12 +667,60 @@ void ImageZCompression::_compression(const char *src,int size,
   return_buffers.emplace_back(p, buffer_size);
   ZBuffer& newBuffer = return_buffers.back();
   char* buffer = (char*)newBuffer.ptr();
-  
-  int status;
-  if ((status=compress2((Bytef*)buffer, &buffer_size, (Bytef*)src, size, m_compression_level)) < 0)
-    THROW_CTL_ERROR(Error) << "Compression failed: error code " << status;
-        
-  newBuffer.used_size = buffer_size;
+
+  if (nb_blocks == 1) {
+    int status;
+    if ((status=compress2((Bytef*)buffer, &buffer_size, (Bytef*)src, size, m_compression_level)) < 0)
+      THROW_CTL_ERROR(Error) << "Compression failed: error code " << status;
+
+    newBuffer.used_size = buffer_size;
+    return;
+  }
+
+  // zlib stream of deflate blocks compressed in parallel, each one in
+  // its own region of buffer, then packed
+  DEB_TRACE() << DEB_VAR2(m_block_size, nb_blocks);
+  std::vector<int> out_offsets(nb_blocks + 1), out_sizes(nb_blocks);
+  std::vector<uLong> adlers(nb_blocks);
+  out_offsets[0] = ZLIB_HEADER_SIZE;
+  for (int i = 0; i < nb_blocks; ++i) {
+    int block_size = std::min(m_block_size, size - i * m_block_size);
+    out_offsets[i + 1] = out_offsets[i] + _deflateBlockBound(block_size);
+  }
+
+  auto compress_block = [&](int i) {
+    const char *block = src + long(i) * m_block_size;
+    int block_size = std::min(m_block_size, size - i * m_block_size);
+    out_sizes[i] = _deflateBlock(m_compression_level, NULL, 0,
+				 block, block_size, i == nb_blocks - 1,
+				 buffer + out_offsets[i],
+				 out_offsets[i + 1] - out_offsets[i]);
+    adlers[i] = adler32(adler32(0L, Z_NULL, 0), (const Bytef*)block, block_size);
+  };
+  _runBlocks(aData, nb_blocks, compress_block);
+
+  // CMF: deflate with a 32K window, FLG: compression level, no dictionary
+  int level = m_compression_level;
+  if (level == Z_DEFAULT_COMPRESSION)
+    level = 6;
+  int flevel = (level < 2) ? 0 : (level < 6) ? 1 : (level == 6) ? 2 : 3;
+  unsigned char cmf = 0x78, flg = flevel << 6;
+  flg |= (31 - ((cmf << 8) | flg) % 31) % 31;
+  buffer[0] = cmf;
+  buffer[1] = flg;
+
+  long out_size = ZLIB_HEADER_SIZE + out_sizes[0];
+  uLong adler = adlers[0];
+  for (int i = 1; i < nb_blocks; ++i) {
+    memmove(buffer + out_size, buffer + out_offsets[i], out_sizes[i]);
+    out_size += out_sizes[i];
+    adler = adler32_combine(adler, adlers[i],
+			    std::min(m_block_size, size - i * m_block_size));
+  }
+  unsigned char *trailer = (unsigned char*)buffer + out_size;
+  for (int i = 0; i < ZLIB_TRAILER_SIZE; ++i)
+    trailer[i] = (adler >> (8 * (ZLIB_TRAILER_SIZE - 1 - i))) & 0xff;
+  newBuffer.used_size = out_size + ZLIB_TRAILER_SIZE;
 }
 #endif // WITH_Z_COMPRESSION
 
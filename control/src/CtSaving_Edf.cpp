@@ -26,7 +26,13 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <cstring>
+#include <sstream>
 static const long int WRITE_BUFFER_SIZE = 64*1024;
+// O_DIRECT offset/size/memory alignment, covers 512 and 4k sector devices
+static const long int DIRECT_IO_ALIGNMENT = 4*1024;
+// io_uring submission queue size
+static const int IO_URING_QUEUE_DEPTH = 64;
 #else
 #include <processlib/win/unistd.h>
 #include <processlib/win/time_compat.h>
@@ -152,24 +158,177 @@ SaveContainerEdf::File::File(SaveContainerEdf& cont,
 			     std::ios_base::openmode openFlags)
   : m_cont(cont), m_filename(filename)
 #ifdef __unix
-    , m_height(0), m_size(0)
+    , m_height(0), m_size(0), m_fd(-1), m_direct(false), m_offset(0),
+    m_stage_len(0)
+#endif
+#ifdef WITH_IO_URING
+    , m_async(false), m_refs(1)
 #endif
 {
-  m_fout.exceptions(std::ios_base::failbit | std::ios_base::badbit);
-  m_fout.open(filename.c_str(),openFlags);
 #ifdef __unix
   m_buffer = m_cont.getNewBuffer();
-  m_fout.rdbuf()->pubsetbuf((char*)m_buffer,WRITE_BUFFER_SIZE);
+  try
+    {
+      if(m_cont.m_direct_io && _openFd(openFlags,true))
+	m_direct = true;
+#ifdef WITH_IO_URING
+      if(m_cont.isAsyncWrite() && (isFd() || _openFd(openFlags,false)))
+	m_async = true;
+#endif
+      if(isFd())
+	return;
+#endif
+      m_fout.exceptions(std::ios_base::failbit | std::ios_base::badbit);
+      m_fout.open(filename.c_str(),openFlags);
+#ifdef __unix
+      m_fout.rdbuf()->pubsetbuf((char*)m_buffer,WRITE_BUFFER_SIZE);
+    }
+  catch(...)
+    {
+      m_cont.releaseBuffer(m_buffer);
+      throw;
+    }
 #endif
 }
 
 SaveContainerEdf::File::~File()
 {
 #ifdef __unix
+  if(isFd())
+    _closeFd();
   m_cont.releaseBuffer(m_buffer);
 #endif
 }
 
+#ifdef __unix
+/** @brief open the file descriptor, with O_DIRECT if direct,
+ *  bypassing the page cache.
+ *
+ *  Returns false if the filesystem does not support O_DIRECT (tmpfs...)
+ *  or if the file to append to is not block-aligned: the caller then
+ *  falls back on the stdio stream.
+ */
+bool SaveContainerEdf::File::_openFd(std::ios_base::openmode openFlags,
+				     bool direct)
+{
+  DEB_STATIC_FUNCT();
+
+  bool append = openFlags & std::ios_base::app;
+  int flags = O_WRONLY | O_CREAT | (direct ? O_DIRECT : 0) |
+	      (append ? 0 : O_TRUNC);
+  m_fd = ::open(m_filename.c_str(),flags,0666);
+  if(m_fd < 0)
+    {
+      if(!direct || (errno != EINVAL))
+	throw std::ios_base::failure(std::string("Failed to open : ") +
+				     m_filename + ": " + strerror(errno));
+      DEB_WARNING() << "O_DIRECT not supported for " << m_filename
+		    << ", using buffered I/O";
+      return false;
+    }
+
+  if(append)
+    {
+      struct stat st;
+      if(fstat(m_fd,&st) || (direct && (st.st_size % DIRECT_IO_ALIGNMENT)))
+	{
+	  DEB_WARNING() << "Cannot append with O_DIRECT to " << m_filename
+			<< ", using buffered I/O";
+	  ::close(m_fd);
+	  m_fd = -1;
+	  return false;
+	}
+      m_offset = st.st_size;
+    }
+  return true;
+}
+
+/** @brief write the pending tail, with O_DIRECT padded to the
+ *  block size and then truncated to the real file size
+ */
+void SaveContainerEdf::File::_closeFd()
+{
+  DEB_STATIC_FUNCT();
+
+  try
+    {
+      if(m_stage_len && !m_direct)
+	_pwrite((char*)m_buffer,m_stage_len);
+      else if(m_stage_len)
+	{
+	  long long file_size = m_offset + m_stage_len;
+	  size_t aligned_len = ((m_stage_len + DIRECT_IO_ALIGNMENT - 1) /
+				DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT);
+	  memset((char*)m_buffer + m_stage_len,0,aligned_len - m_stage_len);
+	  _pwrite((char*)m_buffer,aligned_len);
+	  if(ftruncate(m_fd,file_size))
+	    DEB_ERROR() << "Error truncating " << m_filename << ": "
+			<< strerror(errno);
+	}
+    }
+  catch(std::ios_base::failure& e)
+    {
+      DEB_ERROR() << e.what();
+    }
+  ::close(m_fd);
+  m_fd = -1;
+}
+
+inline void SaveContainerEdf::File::_pwrite(const char *data,size_t size)
+{
+  while(size)
+    {
+      ssize_t nb_written = ::pwrite(m_fd,data,size,m_offset);
+      if(nb_written < 0 && errno == EINTR)
+	continue;
+      else if(nb_written <= 0)
+	throw std::ios_base::failure(std::string("Failed to write ") +
+				     m_filename + ": " + strerror(errno));
+      data += nb_written;
+      size -= nb_written;
+      m_offset += nb_written;
+    }
+}
+
+/** @brief synchronous write on the file descriptor.
+ *
+ *  Block-aligned data (page-aligned HW buffers, block padded headers)
+ *  goes straight from the caller memory to the device. Only unaligned
+ *  parts are copied into the (aligned) staging buffer.
+ */
+void SaveContainerEdf::File::directWrite(const char *data,size_t size)
+{
+  char *stage = (char*)m_buffer;
+  while(size)
+    {
+      bool aligned = !((unsigned long)data % DIRECT_IO_ALIGNMENT);
+      if(!m_stage_len && aligned && (size >= size_t(DIRECT_IO_ALIGNMENT)))
+	{
+	  size_t len = size / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+	  _pwrite(data,len);
+	  data += len;
+	  size -= len;
+	  continue;
+	}
+
+      size_t len = std::min(size,size_t(WRITE_BUFFER_SIZE) - m_stage_len);
+      memcpy(stage + m_stage_len,data,len);
+      m_stage_len += len;
+      data += len;
+      size -= len;
+
+      // flush the complete blocks, keep the tail for the next write
+      size_t flush_len = m_stage_len / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+      if(flush_len && (!size || (m_stage_len == size_t(WRITE_BUFFER_SIZE))))
+	{
+	  _pwrite(stage,flush_len);
+	  m_stage_len -= flush_len;
+	  memmove(stage,stage + flush_len,m_stage_len);
+	}
+    }
+}
+#endif
+
 /** @brief saving container
  *
  *  This class manage file saving
@@ -177,10 +336,13 @@ SaveContainerEdf::File::~File()
 SaveContainerEdf::SaveContainerEdf(CtSaving::Stream& stream,
 				   CtSaving::FileFormat format) :
   CtSaving::SaveContainer(stream),
+#ifdef WITH_IO_URING
+  m_uring(NULL),
+#endif
 #ifdef __unix
-  m_nb_buffers(0),
+  m_nb_buffers(0), m_direct_io(false),
 #endif
-  m_format(format), m_frames_per_file(0)
+  m_format(format), m_frames_per_file(0), m_compression_block_size(0)
 {
   DEB_CONSTRUCTOR();
 }
@@ -188,6 +350,12 @@ SaveContainerEdf::SaveContainerEdf(CtSaving::Stream& stream,
 SaveContainerEdf::~SaveContainerEdf()
 {
   DEB_DESTRUCTOR();
+#ifdef WITH_IO_URING
+  // wait for the pending writes, they release files and buffers
+  if(m_uring)
+    m_uring->drain();
+  delete m_uring;
+#endif
 #ifdef __unix
   if(int(m_free_buffers.size()) != m_nb_buffers)
     DEB_WARNING() << "Missing free buffers: "
@@ -203,6 +371,7 @@ void *SaveContainerEdf::getNewBuffer()
 {
   DEB_MEMBER_FUNCT();
 
+  AutoMutex lock(m_buffers_lock);
   void *buffer;
   if(!m_free_buffers.empty())
     {
@@ -221,14 +390,54 @@ void *SaveContainerEdf::getNewBuffer()
 void SaveContainerEdf::releaseBuffer(void *buffer)
 {
   DEB_MEMBER_FUNCT();
+  AutoMutex lock(m_buffers_lock);
   m_free_buffers.push(buffer);
 }
 #endif
 
 void SaveContainerEdf::_prepare(CtControl&)
 {
+  DEB_MEMBER_FUNCT();
+
   const CtSaving::Parameters& pars = m_stream.getParameters(CtSaving::Acq);
   m_frames_per_file = pars.framesPerFile;
+  m_compression_block_size = _getCompressionBlockSize(pars);
+  DEB_TRACE() << DEB_VAR1(m_compression_block_size);
+
+  bool direct_io = _hasOption(pars,"DIRECT_IO");
+#ifdef __unix
+  bool direct_io_format = (m_format == CtSaving::RAW ||
+			   m_format == CtSaving::EDF);
+  if(direct_io && !direct_io_format)
+    DEB_WARNING() << "DIRECT_IO option only supported by RAW and EDF formats";
+  m_direct_io = direct_io && direct_io_format;
+  DEB_TRACE() << DEB_VAR1(m_direct_io);
+#else
+  if(direct_io)
+    DEB_WARNING() << "DIRECT_IO option not supported on this platform";
+#endif
+
+  bool io_uring = _hasOption(pars,"IO_URING");
+  m_async_write = false;
+#ifdef WITH_IO_URING
+  if(io_uring && !direct_io_format)
+    DEB_WARNING() << "IO_URING option only supported by RAW and EDF formats";
+  else if(io_uring && (pars.savingMode == CtSaving::Manual))
+    DEB_WARNING() << "IO_URING option ignored in Manual saving mode";
+  else if(io_uring)
+    {
+      if(!m_uring && IoUringWriter::isAvailable())
+	m_uring = new IoUringWriter(IO_URING_QUEUE_DEPTH);
+      if(!m_uring)
+	DEB_WARNING() << "io_uring not available, using synchronous writes";
+      m_async_write = (m_uring != NULL);
+      _AsyncWrite::Pool::get().reserve(2 * IO_URING_QUEUE_DEPTH);
+    }
+  DEB_TRACE() << DEB_VAR1(m_async_write);
+#else
+  if(io_uring)
+    DEB_WARNING() << "IO_URING option not compiled, using synchronous writes";
+#endif
 }
 
 void* SaveContainerEdf::_open(const std::string &filename,
@@ -243,7 +452,11 @@ void SaveContainerEdf::_close(void* f)
 {
   DEB_MEMBER_FUNCT();
   File* file = (File*) f;
+#ifdef WITH_IO_URING
+  file->unref();
+#else
   delete file;
+#endif
 }
 
 long SaveContainerEdf::_writeFile(void* f,Data &aData,
@@ -253,6 +466,17 @@ long SaveContainerEdf::_writeFile(void* f,Data &aData,
   DEB_MEMBER_FUNCT();
   long write_size = 0;
   File* file = (File*) f;
+#ifdef __unix
+  if(file->isFd())
+    {
+#ifdef WITH_IO_URING
+      if(file->isAsync() && _isAsyncWrite(aData) &&
+	 _writeAsync(*file,aData,aHeader,aFormat,write_size))
+	return write_size;
+#endif
+      return _writeDirect(*file,aData,aHeader,aFormat);
+    }
+#endif
   File::Stream* fout = &file->m_fout;
 
 #if defined(WITH_Z_COMPRESSION) || defined(WITH_LZ4_COMPRESSION)
@@ -310,18 +534,142 @@ long SaveContainerEdf::_writeFile(void* f,Data &aData,
   return write_size;
 }
 
+#ifdef __unix
+long SaveContainerEdf::_writeDirect(File& file,Data &aData,
+				    CtSaving::HeaderMap &aHeader,
+				    CtSaving::FileFormat aFormat)
+{
+  DEB_MEMBER_FUNCT();
+  long write_size = 0;
+
+  if(aFormat == CtSaving::EDF)
+    {
+      // header padded to the block size: the image stays aligned
+      std::ostringstream sout;
+      MmapInfo info = _writeEdfHeader(aData,aHeader,sout,0,
+				      file.isDirect() ? DIRECT_IO_ALIGNMENT :
+				      1024);
+      const std::string& header = sout.str();
+      file.directWrite(header.data(),header.size());
+      write_size += info.header_size;
+    }
+  file.directWrite((char*)aData.data(),aData.size());
+  write_size += aData.size();
+  return write_size;
+}
+#endif
+
+#ifdef WITH_IO_URING
+SaveContainerEdf::_AsyncWrite::_AsyncWrite(SaveContainerEdf& cont,
+					   File& file,Data& data) :
+  m_cont(cont), m_file(&file), m_data(data), m_buffer(NULL)
+{
+  m_file->ref();
+}
+
+SaveContainerEdf::_AsyncWrite::~_AsyncWrite()
+{
+  if(m_file)
+    m_file->unref();
+  if(m_buffer)
+    m_cont.releaseBuffer(m_buffer);
+}
+
+/** @brief called from the io_uring completion thread
+ */
+void SaveContainerEdf::_AsyncWrite::finished(int error)
+{
+  DEB_STATIC_FUNCT();
+
+  // the last write of a closed file closes it before the frame is done
+  File *file = m_file;
+  m_file = NULL;
+  file->unref();
+
+  if(error == ENOSPC)
+    m_cont.m_stream.setSavingError(CtControl::SaveDiskFull);
+  else if(error)
+    m_cont.m_stream.setSavingError(CtControl::SaveUnknownError);
+  // a failed write still finishes the frame, its buffer must be released
+  m_cont.asyncWriteCompleted(m_data);
+}
+
+/** @brief queue the frame writes at the current end of file.
+ *
+ *  Returns false if the frame must be written synchronously:
+ *  with O_DIRECT, when the image is not block-aligned or a tail is
+ *  already staged.
+ */
+bool SaveContainerEdf::_writeAsync(File& file,Data &aData,
+				   CtSaving::HeaderMap &aHeader,
+				   CtSaving::FileFormat aFormat,
+				   long& write_size)
+{
+  DEB_MEMBER_FUNCT();
+
+  bool direct = file.isDirect();
+  bool aligned = (!((unsigned long)aData.data() % DIRECT_IO_ALIGNMENT) &&
+		  !(aData.size() % DIRECT_IO_ALIGNMENT));
+  if(file.m_stage_len || (direct && !aligned))
+    return false;
+
+  write_size = 0;
+  if(aFormat == CtSaving::EDF)
+    {
+      std::ostringstream sout;
+      MmapInfo info = _writeEdfHeader(aData,aHeader,sout,0,
+				      direct ? DIRECT_IO_ALIGNMENT : 1024);
+      const std::string& header = sout.str();
+      if(header.size() > size_t(WRITE_BUFFER_SIZE))
+	return false;
+
+      _AsyncWrite *req = new _AsyncWrite(*this,file,aData);
+      req->m_buffer = getNewBuffer();
+      memcpy(req->m_buffer,header.data(),header.size());
+      _submitAsync(file,req,(char*)req->m_buffer,header.size());
+      write_size += info.header_size;
+    }
+
+  _AsyncWrite *req = new _AsyncWrite(*this,file,aData);
+  _submitAsync(file,req,(char*)aData.data(),aData.size());
+  write_size += aData.size();
+
+  m_uring->submit();
+  return true;
+}
+
+inline void SaveContainerEdf::_submitAsync(File& file,_AsyncWrite *req,
+					   const char *data,size_t size)
+{
+  req->fd = file.m_fd;
+  req->buf = data;
+  req->len = size;
+  req->offset = file.m_offset;
+  try
+    {
+      _asyncWriteSubmitted(req->m_data);
+      m_uring->queue(req);
+    }
+  catch(...)
+    {
+      delete req;
+      throw;
+    }
+  file.m_offset += size;
+}
+#endif
 
 SinkTaskBase* SaveContainerEdf::getCompressionTask(const CtSaving::HeaderMap& header)
 {
 #ifdef WITH_Z_COMPRESSION
   if(m_format == CtSaving::EDFGZ)
-    return new FileZCompression(*this,header);
+    return new FileZCompression(*this,header,m_compression_block_size);
   else
 #endif
     
 #ifdef WITH_LZ4_COMPRESSION
   if(m_format == CtSaving::EDFLZ4)
-    return new FileLz4Compression(*this,header);
+    return new FileLz4Compression(*this,header,m_compression_block_size);
   else
 #endif
   return NULL;
@@ -25,6 +25,12 @@
 #include "lima/CtSaving.h"
 #include "lima/CtSaving_Compression.h"
 
+#ifdef WITH_IO_URING
+#include "lima/ObjectPool.h"
+#include "CtSaving_IoUring.h"
+#include <atomic>
+#endif
+
 #include <stack>
 
 namespace lima {
@@ -86,7 +92,8 @@ namespace lima {
     };
     template<class Stream>
     MmapInfo _writeEdfHeader(Data&,CtSaving::HeaderMap&,
-			     Stream&,int nbCharReserved = 0);
+			     Stream&,int nbCharReserved = 0,
+			     int headerAlignment = 1024);
 
 #ifdef WIN32
     class _OfStream
@@ -135,19 +142,88 @@ namespace lima {
       MmapInfo			 m_mmap_info;
       long long			 m_height;
       long long			 m_size;
+
+      // file descriptor mode (O_DIRECT or io_uring):
+      // m_buffer holds the non block-aligned tail
+      bool isFd() const
+      { return m_fd >= 0; }
+      bool isDirect() const
+      { return m_direct; }
+      void directWrite(const char *data,size_t size);
+
+      int			 m_fd;
+      bool			 m_direct;
+      long long			 m_offset;
+      size_t			 m_stage_len;
+
+#ifdef WITH_IO_URING
+      // io_uring mode: each pending write holds a reference,
+      // the file is closed when the last one is released
+      bool isAsync() const
+      { return m_async; }
+      void ref()
+      { ++m_refs; }
+      void unref()
+      { if(--m_refs == 0) delete this; }
+
+      bool			 m_async;
+      std::atomic<int>		 m_refs;
+#endif
+
+    private:
+      bool _openFd(std::ios_base::openmode openFlags,bool direct);
+      void _closeFd();
+      void _pwrite(const char *data,size_t size);
+#endif
+    };
+
+#ifdef __unix
+    long _writeDirect(File&,Data&,CtSaving::HeaderMap&,CtSaving::FileFormat);
 #endif
+
+#ifdef WITH_IO_URING
+    struct _AsyncWrite : public IoUringWriter::Request
+    {
+      _AsyncWrite(SaveContainerEdf& cont,File& file,Data& data);
+      virtual ~_AsyncWrite();
+
+      virtual void finished(int error);
+
+      // one or two writes per frame: recycle their memory
+      static void* operator new(size_t size)
+      { return Pool::get().alloc(size); }
+      static void operator delete(void* p,size_t size)
+      { Pool::get().release(p,size); }
+
+      typedef ObjectPool<_AsyncWrite> Pool;
+
+      SaveContainerEdf&		 m_cont;
+      File*			 m_file;
+      Data			 m_data;
+      void*			 m_buffer; // owned header copy, if any
     };
 
+    bool _writeAsync(File&,Data&,CtSaving::HeaderMap&,CtSaving::FileFormat,
+		     long& write_size);
+    void _submitAsync(File&,_AsyncWrite*,const char *data,size_t size);
+
+    IoUringWriter*		 m_uring;
+#endif
+
 #ifdef __unix
     void *getNewBuffer();
     void releaseBuffer(void *buffer);
 
+    // the buffers are also released from the io_uring completion thread
+    Mutex			 m_buffers_lock;
     std::stack<void*>		 m_free_buffers;
     int				 m_nb_buffers;
+    bool			 m_direct_io;
 #endif
 
     CtSaving::FileFormat	 m_format;
     long			 m_frames_per_file;
+    int				 m_compression_block_size;
   };
 
   template<class Stream>
@@ -155,7 +231,8 @@ namespace lima {
     SaveContainerEdf::_writeEdfHeader(Data &aData,
 				      CtSaving::HeaderMap &aHeader,
 				      Stream &sout,
-				      int nbCharReserved)
+				      int nbCharReserved,
+				      int headerAlignment)
     {
       time_t ctime_now;
       time(&ctime_now);
@@ -246,9 +323,10 @@ namespace lima {
       long long aEndPosition = sout.tellp();
       
       long long lenght = aEndPosition - aStartPosition + 2;
-      long long finalHeaderLenght = (lenght + 1023) & ~1023; // 1024 alignment
-      snprintf(aBuffer,sizeof(aBuffer),"%*s}\n",int(finalHeaderLenght - lenght),"");
-      sout << aBuffer;
+      long long finalHeaderLenght = ((lenght + headerAlignment - 1) /
+				     headerAlignment * headerAlignment);
+      // the padding may be longer than aBuffer (DIRECT_IO alignment)
+      sout << std::string(finalHeaderLenght - lenght,' ') << "}\n";
       mmap_info.header_size = finalHeaderLenght;
       return mmap_info;
     }
@@ -20,6 +20,8 @@
 // along with this program; if not, see <http://www.gnu.org/licenses/>.
 //###########################################################################
 #include <cmath>
+#include <cstring>
+#include <vector>
 #include "CtSaving_Hdf5.h"
 #include "lima/CtControl.h"
 #include "lima/CtImage.h"
@@ -44,7 +46,11 @@ struct SaveContainerHdf5::_File
 		m_dataset_extended(false),
 		m_entry_index(0),
 		m_nb_frames(0),
-		m_frame_cnt(0)
+		m_frame_cnt(0),
+		m_chunk_frames(1),
+		m_chunk_direct(false),
+		m_chunk_start(0),
+		m_chunk_fill(0)
 	{}
 
 	bool m_format_written;
@@ -66,6 +72,14 @@ struct SaveContainerHdf5::_File
 	int m_file_index;
 	int m_nb_frames;
 	int m_frame_cnt;
+	// more than one frame per chunk: the images and their timestamps
+	// are staged and written together by _writeChunk
+	int m_chunk_frames;
+	bool m_chunk_direct;		// dataset chunked by m_chunk_frames
+	hsize_t m_chunk_start;
+	int m_chunk_fill;
+	std::vector<char> m_chunk_buffer;
+	std::vector<double> m_chunk_timestamps;
 };
 
 /* Static function helper*/
@@ -132,6 +146,34 @@ void write_h5_attribute(L location,const char* entry_name,std::string& val)
 	attr.write(datatype, val);
 }
 
+/** @brief write an already filtered (compressed) chunk as-is,
+ *  bypassing the HDF5 filter pipeline and its internal copy
+ */
+static herr_t write_h5_chunk(hid_t dataset, const hsize_t* offset,
+			     size_t size, const void* buf)
+{
+	uint32_t filter_mask = 0;	// all the dataset filters applied
+#if H5_VERSION_GE(1,10,3)
+	return H5Dwrite_chunk(dataset, H5P_DEFAULT, filter_mask, offset, size, buf);
+#else
+	return H5DOwrite_chunk(dataset, H5P_DEFAULT, filter_mask, offset, size, buf);
+#endif
+}
+
+/** @brief write nb consecutive frame timestamps with a single hyperslab
+ */
+static void write_h5_timestamps(DataSet& dataset, hsize_t start, hsize_t nb,
+				const double* timestamps)
+{
+	hsize_t offset[] = {start};
+	hsize_t count[] = {nb};
+
+	DataSpace file_space = dataset.getSpace();
+	file_space.selectHyperslab(H5S_SELECT_SET, count, offset);
+	DataSpace mem_space(RANK_ONE, count);
+	dataset.write(timestamps, PredType::NATIVE_DOUBLE, mem_space, file_space);
+}
+
 /** @brief helper to calculate an optimized chuncking of the image data set
  *
  *
@@ -183,7 +225,8 @@ static void calculate_chunck(hsize_t* data_size, hsize_t* chunck, int  depth)
  *  This class manage file saving
  */
 SaveContainerHdf5::SaveContainerHdf5(CtSaving::Stream& stream, CtSaving::FileFormat format)
-	: CtSaving::SaveContainer(stream), m_format(format) {
+	: CtSaving::SaveContainer(stream), m_format(format),
+	  m_compression_block_size(0), m_chunk_frames(1) {
 	DEB_CONSTRUCTOR();
 #if defined(WITH_BS_COMPRESSION)
 	if (format == CtSaving::HDF5BS) {
@@ -254,6 +297,25 @@ void SaveContainerHdf5::_prepare(CtControl& control) {
 	// Keep track of number of frames per file for offset calculation
 	m_frames_per_file = saving_pars.framesPerFile;
 	m_every_n_frames = saving_pars.everyNFrames;
+
+	// CHUNK_FRAMES=<n>: stack n images per chunk, one write per chunk
+	m_chunk_frames = 1;
+	std::string chunk_frames = _getOptionValue(saving_pars, "CHUNK_FRAMES");
+	if (!chunk_frames.empty()) {
+		int nb_frames = atoi(chunk_frames.c_str());
+		if (nb_frames < 1)
+			THROW_CTL_ERROR(InvalidValue) << "Invalid CHUNK_FRAMES: "
+						      << chunk_frames;
+		else if (m_format != CtSaving::HDF5)
+			DEB_WARNING() << "CHUNK_FRAMES ignored, compressed formats "
+				      << "write one image per chunk";
+		else
+			m_chunk_frames = nb_frames;
+	}
+	DEB_TRACE() << DEB_VAR1(m_chunk_frames);
+
+	m_compression_block_size = _getCompressionBlockSize(saving_pars);
+	DEB_TRACE() << DEB_VAR1(m_compression_block_size);
 	AutoMutex lock(m_lock);
 	m_file_cnt = 0;
 }
@@ -510,6 +572,14 @@ void SaveContainerHdf5::_close(void* f) {
 	DEB_MEMBER_FUNCT();
 
 	AutoPtr<_File> file = (_File*)f;
+
+	try {
+		// last (partial) chunk
+		_writeChunk(*file);
+	} catch (H5::Exception &e) {
+		THROW_CTL_ERROR(Error) << e.getCDetailMsg();
+	}
+
 	if (!file->m_in_append || m_is_multiset) {
 		// Finally create in the instrument group a link to the instrument detector data
 		file->m_instrument_detector_plot.link(H5L_TYPE_SOFT, file->m_path_to_data , "data");
@@ -615,8 +685,15 @@ long SaveContainerHdf5::_writeFile(void* f,Data &aData,
 			// Create property list for the dataset and setup chunk size
 			DSetCreatPropList plist;
 			hsize_t chunk_dims[RANK_THREE];
-			// test direct chunk write, so chunk dims is 1 image size
-			chunk_dims[0] = 1; chunk_dims[1] = data_dims[1]; chunk_dims[2] = data_dims[2];
+			// direct chunk write of 1 image, or of m_chunk_frames
+			// staged images (HDF5 chunks are limited to 4GB)
+			hsize_t chunk_frames = std::min(m_chunk_frames, file->m_nb_frames);
+			hsize_t max_chunk_frames = ((1ULL << 32) - 1) / aData.size();
+			if (chunk_frames > max_chunk_frames)
+				chunk_frames = std::max(max_chunk_frames, hsize_t(1));
+			file->m_chunk_frames = chunk_frames;
+			file->m_chunk_direct = true;
+			chunk_dims[0] = chunk_frames; chunk_dims[1] = data_dims[1]; chunk_dims[2] = data_dims[2];
 
 			plist.setChunk(RANK_THREE, chunk_dims);
 
@@ -667,6 +744,9 @@ long SaveContainerHdf5::_writeFile(void* f,Data &aData,
 			file->m_image_dataset.extend(data_dims);
 			file->m_image_dataspace = DataSpace(file->m_image_dataset.getSpace());
 			file->m_dataset_extended = true;
+			// existing chunk layout: stage, then write hyperslabs
+			file->m_chunk_frames = m_chunk_frames;
+			file->m_chunk_direct = false;
 		}
 		// write the image data, use the local frame number
 		hsize_t image_nb = file->m_frame_cnt++;
@@ -676,54 +756,56 @@ long SaveContainerHdf5::_writeFile(void* f,Data &aData,
 				    << DEB_VAR5(aData.frameNumber, m_file_cnt,
 						m_frames_per_file, image_nb, expected_nb);
 
-		// we test direct chunk write
+		if (file->m_chunk_frames > 1) {
+			_stageFrame(*file, aData, image_nb);
+			buf_size = aData.size();
+			DEB_RETURN() << DEB_VAR1(buf_size);
+			return buf_size;
+		}
+
+		// one image per chunk: write it directly, the compressed
+		// formats were already filtered by the compression tasks
 		hsize_t offset[RANK_THREE] = {image_nb, 0U, 0U};
-		uint32_t filter_mask = 0;
 		hid_t dataset = file->m_image_dataset.getId();
 		herr_t  status;
 		void * buf_data;
-		hid_t dxpl;
-
-		dxpl = H5Pcreate(H5P_DATASET_XFER);
 
 		ZBufferList buffers;
+		std::vector<char> chunk;
 		if ((aFormat == CtSaving::HDF5GZ) || (aFormat == CtSaving::HDF5BS))  {
 			buffers = std::move(_takeBuffers(aData));
-			// with single chunk, only one buffer allocated
-			ZBuffer& b = buffers.front();
-			buf_size = b.used_size;
-			buf_data = b.ptr();
+			if (buffers.empty())
+				THROW_CTL_ERROR(Error) << "No compressed buffer for "
+						       << DEB_VAR1(aData.frameNumber);
+			if (buffers.size() == 1) {
+				ZBuffer& b = buffers.front();
+				buf_size = b.used_size;
+				buf_data = b.ptr();
+			} else {
+				// several blobs (hw compression): gather the chunk
+				for (ZBuffer& b : buffers)
+					buf_size += b.used_size;
+				chunk.resize(buf_size);
+				char *p = chunk.data();
+				for (ZBuffer& b : buffers) {
+					memcpy(p, b.ptr(), b.used_size);
+					p += b.used_size;
+				}
+				buf_data = chunk.data();
+			}
 		} else {
 			buf_data = aData.data();
 			buf_size = aData.size();
 		}
 
-		//DEB_ALWAYS() << "Image #"<< aData.frameNumber << " buf_size = "<< buf_size;
-		status = H5DOwrite_chunk(dataset, dxpl, filter_mask, offset, buf_size, buf_data);
+		status = write_h5_chunk(dataset, offset, buf_size, buf_data);
 		if (status<0)
-			THROW_CTL_ERROR(Error) << "H5DOwrite_chunk() failed"
+			THROW_CTL_ERROR(Error) << "Direct chunk write failed"
 					       << DEB_VAR5(aData.frameNumber, m_file_cnt, file->m_file_index, offset[0], buf_size);
 
 		if(file->m_timestamps_dataset.getHDFObjType() >= 0) // not initialized
-		  {
-		    hsize_t timestamps_offset[] = {image_nb};
-		    hsize_t timestamps_stride[] = {1};
-		    hsize_t timestamps_count[] = {1};
-
-		    auto file_dspace= H5Dget_space(file->m_timestamps_dataset.getId());
-		    hsize_t dim1[] = {1};
-		    auto mem_dspace = H5Screate_simple(RANK_ONE, dim1, NULL);
-
-		    H5Sselect_hyperslab(file_dspace, H5S_SELECT_SET,
-					timestamps_offset, timestamps_stride,
-					timestamps_count, NULL);
-		    
-		    H5Dwrite(file->m_timestamps_dataset.getId(), H5T_NATIVE_DOUBLE,
-			     mem_dspace, file_dspace, H5P_DEFAULT, &aData.timestamp);
-
-		    H5Sclose(file_dspace);
-		    H5Sclose(mem_dspace);
-		  }
+			write_h5_timestamps(file->m_timestamps_dataset, image_nb, 1,
+					    &aData.timestamp);
 	// catch failure caused by the DataSet operations
 	} catch (DataSetIException& error) {
 		THROW_CTL_ERROR(Error) << "DataSet not created successfully " << error.getCDetailMsg();
@@ -746,6 +828,77 @@ long SaveContainerHdf5::_writeFile(void* f,Data &aData,
 	return buf_size;
 }
 
+/** @brief copy the image into the file chunk staging buffer,
+ *  the chunk is written when full
+ */
+void SaveContainerHdf5::_stageFrame(_File& file, Data& aData, hsize_t image_nb) {
+	DEB_MEMBER_FUNCT();
+
+	size_t frame_size = aData.size();
+	if (file.m_chunk_buffer.empty()) {
+		file.m_chunk_buffer.resize(file.m_chunk_frames * frame_size);
+		file.m_chunk_timestamps.resize(file.m_chunk_frames);
+	} else if (file.m_chunk_buffer.size() != file.m_chunk_frames * frame_size) {
+		THROW_CTL_ERROR(Error) << "Image size changed: " << DEB_VAR1(frame_size);
+	}
+
+	// not contiguous: write what is staged
+	if (file.m_chunk_fill && (image_nb != file.m_chunk_start + file.m_chunk_fill))
+		_writeChunk(file);
+	if (!file.m_chunk_fill)
+		file.m_chunk_start = image_nb;
+
+	int idx = file.m_chunk_fill++;
+	memcpy(file.m_chunk_buffer.data() + idx * frame_size, aData.data(), frame_size);
+	file.m_chunk_timestamps[idx] = aData.timestamp;
+
+	if (file.m_chunk_fill == file.m_chunk_frames)
+		_writeChunk(file);
+}
+
+/** @brief write the staged images and their timestamps at once
+ */
+void SaveContainerHdf5::_writeChunk(_File& file) {
+	DEB_MEMBER_FUNCT();
+
+	if (!file.m_chunk_fill)
+		return;
+
+	hsize_t start = file.m_chunk_start;
+	hsize_t nb = file.m_chunk_fill;
+	size_t frame_size = file.m_chunk_buffer.size() / file.m_chunk_frames;
+	DEB_TRACE() << DEB_VAR3(file.m_file_index, start, nb);
+
+	hsize_t offset[RANK_THREE] = {start, 0U, 0U};
+	if (file.m_chunk_direct && !(start % file.m_chunk_frames)) {
+		// the frames beyond the dataset end only pad the last chunk
+		size_t used = nb * frame_size;
+		memset(file.m_chunk_buffer.data() + used, 0, file.m_chunk_buffer.size() - used);
+		herr_t status = write_h5_chunk(file.m_image_dataset.getId(), offset,
+					       file.m_chunk_buffer.size(),
+					       file.m_chunk_buffer.data());
+		if (status < 0)
+			THROW_CTL_ERROR(Error) << "Direct chunk write failed"
+					       << DEB_VAR3(file.m_file_index, start, nb);
+	} else {
+		hsize_t dims[RANK_THREE];
+		file.m_image_dataspace.getSimpleExtentDims(dims);
+		hsize_t count[RANK_THREE] = {nb, dims[1], dims[2]};
+		DataSpace file_space = file.m_image_dataset.getSpace();
+		file_space.selectHyperslab(H5S_SELECT_SET, count, offset);
+		DataSpace mem_space(RANK_THREE, count);
+		file.m_image_dataset.write(file.m_chunk_buffer.data(),
+					   file.m_image_dataset.getDataType(),
+					   mem_space, file_space);
+	}
+
+	if (file.m_timestamps_dataset.getHDFObjType() >= 0)
+		write_h5_timestamps(file.m_timestamps_dataset, start, nb,
+				    file.m_chunk_timestamps.data());
+
+	file.m_chunk_fill = 0;
+}
+
 int SaveContainerHdf5::findLastEntry(const _File &file) {
 	char entryName[32];
 	int index = -1;
@@ -770,12 +923,13 @@ SinkTaskBase* SaveContainerHdf5::getCompressionTask(const CtSaving::HeaderMap& /
 #if defined(WITH_Z_COMPRESSION)
 	if(m_format == CtSaving::HDF5GZ) {
 		m_compression_level = 6;
-		return new ImageZCompression(*this, m_compression_level);
+		return new ImageZCompression(*this, m_compression_level,
+					     m_compression_block_size);
 	}
 #endif
 #if defined(WITH_BS_COMPRESSION)
 	if(m_format == CtSaving::HDF5BS) {
-		return new ImageBsCompression(*this);
+		return new ImageBsCompression(*this, m_compression_block_size);
 	}
 #endif
 	return NULL;
@@ -784,8 +938,11 @@ SinkTaskBase* SaveContainerHdf5::getCompressionTask(const CtSaving::HeaderMap& /
 int SaveContainerHdf5::getCompressedBufferSize(int data_size, int data_depth)
 {
 #if defined(WITH_Z_COMPRESSION)
+	// called before _prepare
+	const CtSaving::Parameters& pars = m_stream.getParameters(CtSaving::Acq);
 	if(m_format == CtSaving::HDF5GZ)
-		return ImageZCompression::calcBufferSize(data_size, data_depth);
+		return ImageZCompression::calcBufferSize(data_size, data_depth,
+							 _getCompressionBlockSize(pars));
 #endif
 #if defined(WITH_BS_COMPRESSION)
 	if(m_format == CtSaving::HDF5BS)
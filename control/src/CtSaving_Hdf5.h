@@ -69,6 +69,8 @@ protected:
 private:
 	struct _File;
 	int findLastEntry(const _File&);
+	void _stageFrame(_File&, Data&, hsize_t image_nb);
+	void _writeChunk(_File&);
 
 	struct Parameters{
 		string det_name;
@@ -105,6 +107,8 @@ private:
 	HwInterface *m_hw_int;
 	bool m_is_multiset;
 	int m_compression_level;
+	int m_compression_block_size;
+	int m_chunk_frames;
 	int m_frames_per_file;
         int m_every_n_frames;     
 	int m_file_cnt;
@@ -0,0 +1,116 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+#include "lima/CtSaving_Header.h"
+
+#include <algorithm>
+
+using namespace lima;
+
+SavingHeaderKeys::Key SavingHeaderKeys::intern(const std::string& name)
+{
+  std::unordered_map<std::string, unsigned>::iterator i = m_ids.find(name);
+  if (i == m_ids.end())
+    i = m_ids.emplace(name, unsigned(m_ids.size())).first;
+  Key key = {&i->first, i->second};
+  return key;
+}
+
+void SavingFrameHeader::set(const SavingHeaderKeys::Key& key,
+			    const std::string& value, bool replace)
+{
+  // the keys usually come in the same order for all the frames
+  std::vector<Entry>::iterator i = m_entries.end();
+  if (!m_entries.empty() && (m_entries.back().id >= key.id))
+    i = std::lower_bound(m_entries.begin(), m_entries.end(), key.id,
+			 [](const Entry& e, unsigned id) { return e.id < id; });
+
+  bool found = (i != m_entries.end()) && (i->id == key.id);
+  if (found && !replace)
+    return;
+
+  unsigned offset = unsigned(m_values.size());
+  unsigned len = unsigned(value.size());
+  if (found && (len <= i->len)) {
+    offset = i->offset;
+    m_dead_size += i->len - len;
+    m_values.replace(offset, len, value);
+  } else {
+    m_values.append(value);
+    if (found)
+      m_dead_size += i->len;
+  }
+
+  if (found) {
+    i->offset = offset;
+    i->len = len;
+  } else {
+    Entry entry = {key.id, offset, len, key.name};
+    m_entries.insert(i, entry);
+  }
+
+  if ((m_dead_size > 4096) && (m_dead_size > m_values.size() / 2))
+    _compact();
+}
+
+void SavingFrameHeader::set(const std::string& name, const std::string& value,
+			    bool replace)
+{
+  if (!m_keys)
+    m_keys = std::make_shared<SavingHeaderKeys>();
+  set(m_keys->intern(name), value, replace);
+}
+
+void SavingFrameHeader::update(const HeaderMap& header, bool replace)
+{
+  if (!m_keys)
+    m_keys = std::make_shared<SavingHeaderKeys>();
+  m_entries.reserve(m_entries.size() + header.size());
+  for (HeaderMap::const_iterator i = header.begin(); i != header.end(); ++i)
+    set(m_keys->intern(i->first), i->second, replace);
+}
+
+void SavingFrameHeader::get(HeaderMap& header, bool replace) const
+{
+  std::vector<Entry>::const_iterator i, end = m_entries.end();
+  for (i = m_entries.begin(); i != end; ++i) {
+    std::string value(m_values, i->offset, i->len);
+    std::pair<HeaderMap::iterator, bool> result =
+      header.insert(HeaderMap::value_type(*i->name, std::string()));
+    if (result.second || replace)
+      result.first->second.swap(value);
+  }
+}
+
+void SavingFrameHeader::_compact()
+{
+  std::string values;
+  values.reserve(m_values.size() - m_dead_size);
+  std::vector<Entry>::iterator i, end = m_entries.end();
+  for (i = m_entries.begin(); i != end; ++i) {
+    unsigned offset = unsigned(values.size());
+    values.append(m_values, i->offset, i->len);
+    i->offset = offset;
+  }
+  m_values.swap(values);
+  m_dead_size = 0;
+}
@@ -0,0 +1,276 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <cerrno>
+#include <cstring>
+#include <ios>
+#include <string>
+
+#include "CtSaving_IoUring.h"
+#include "lima/Exceptions.h"
+
+using namespace lima;
+
+class IoUringWriter::_CompletionThread : public Thread
+{
+  DEB_CLASS_NAMESPC(DebModControl,"IoUringWriter::_CompletionThread",
+		    "Control");
+public:
+  _CompletionThread(IoUringWriter& writer) : m_writer(writer) {}
+  virtual ~_CompletionThread() {}
+
+protected:
+  virtual void threadFunction()
+  {
+    m_writer._completionLoop();
+  }
+
+private:
+  IoUringWriter& m_writer;
+};
+
+bool IoUringWriter::isAvailable()
+{
+  DEB_STATIC_FUNCT();
+  io_uring ring;
+  int ret = io_uring_queue_init(2,&ring,0);
+  if(ret < 0)
+    {
+      DEB_TRACE() << "io_uring not available: " << strerror(-ret);
+      return false;
+    }
+  io_uring_queue_exit(&ring);
+  return true;
+}
+
+IoUringWriter::IoUringWriter(int queue_depth,int batch_size) :
+  m_queue_depth(queue_depth),
+  m_batch_size(batch_size),
+  m_nb_queued(0),
+  m_nb_inflight(0),
+  m_nb_requests(0),
+  m_thread(NULL)
+{
+  DEB_CONSTRUCTOR();
+  DEB_PARAM() << DEB_VAR2(queue_depth,batch_size);
+
+  int ret = io_uring_queue_init(queue_depth,&m_ring,0);
+  if(ret < 0)
+    THROW_CTL_ERROR(Error) << "io_uring_queue_init failed: " << strerror(-ret);
+
+  m_thread = new _CompletionThread(*this);
+  m_thread->start();
+}
+
+IoUringWriter::~IoUringWriter()
+{
+  DEB_DESTRUCTOR();
+
+  drain();
+
+  {
+    AutoMutex lock(m_cond.mutex());
+    // a request-less nop stops the completion thread
+    io_uring_sqe *sqe = _getSqe();
+    io_uring_prep_nop(sqe);
+    io_uring_sqe_set_data(sqe,NULL);
+    ++m_nb_queued;
+    if(_submitQueued() < 0)
+      DEB_ERROR() << "Could not stop the completion thread";
+  }
+
+  m_thread->join();
+  delete m_thread;
+  io_uring_queue_exit(&m_ring);
+}
+
+void IoUringWriter::queue(Request *req)
+{
+  DEB_MEMBER_FUNCT();
+
+  AutoMutex lock(m_cond.mutex());
+  // the completion queue holds 2 x queue_depth entries: never overflow it
+  while(m_nb_queued + m_nb_inflight >= 2 * m_queue_depth)
+    {
+      _submitQueued();
+      m_cond.wait();
+    }
+  _queue(req);
+  ++m_nb_requests;
+}
+
+void IoUringWriter::submit()
+{
+  DEB_MEMBER_FUNCT();
+
+  AutoMutex lock(m_cond.mutex());
+  // otherwise the completion thread will submit them with the next ones
+  if(!m_nb_inflight || (m_nb_queued >= m_batch_size))
+    {
+      int ret = _submitQueued();
+      if(ret < 0)
+	throw std::ios_base::failure(std::string("io_uring_submit failed: ") +
+				     strerror(-ret));
+    }
+}
+
+/** @brief the writes are done when their finished callback returned:
+ *  m_nb_inflight drops before it is called
+ */
+void IoUringWriter::drain()
+{
+  DEB_MEMBER_FUNCT();
+
+  AutoMutex lock(m_cond.mutex());
+  _submitQueued();
+  while(m_nb_requests)
+    m_cond.wait();
+}
+
+/** @brief get a free submission entry, called with the lock held
+ */
+io_uring_sqe *IoUringWriter::_getSqe()
+{
+  DEB_MEMBER_FUNCT();
+
+  io_uring_sqe *sqe = io_uring_get_sqe(&m_ring);
+  if(!sqe)
+    {
+      // submission queue full: send it
+      _submitQueued();
+      sqe = io_uring_get_sqe(&m_ring);
+    }
+  if(!sqe)
+    throw std::ios_base::failure("io_uring submission queue full");
+  return sqe;
+}
+
+inline void IoUringWriter::_queue(Request *req)
+{
+  io_uring_sqe *sqe = _getSqe();
+  io_uring_prep_write(sqe,req->fd,req->buf,req->len,req->offset);
+  io_uring_sqe_set_data(sqe,req);
+  ++m_nb_queued;
+}
+
+/** @brief submit all the queued entries, called with the lock held
+ */
+int IoUringWriter::_submitQueued()
+{
+  DEB_MEMBER_FUNCT();
+
+  if(!m_nb_queued)
+    return 0;
+  int ret = io_uring_submit(&m_ring);
+  if(ret < 0)
+    {
+      DEB_ERROR() << "io_uring_submit failed: " << strerror(-ret);
+      return ret;
+    }
+  DEB_TRACE() << "Submitted " << ret << " write(s)";
+  m_nb_queued -= ret;
+  m_nb_inflight += ret;
+  return ret;
+}
+
+void IoUringWriter::_completionLoop()
+{
+  DEB_MEMBER_FUNCT();
+
+  while(true)
+    {
+      io_uring_cqe *cqe;
+      int ret = io_uring_wait_cqe(&m_ring,&cqe);
+      if(ret == -EINTR)
+	continue;
+      else if(ret < 0)
+	{
+	  DEB_ERROR() << "io_uring_wait_cqe failed: " << strerror(-ret);
+	  break;
+	}
+
+      Request *req = (Request*) io_uring_cqe_get_data(cqe);
+      int res = cqe->res;
+      io_uring_cqe_seen(&m_ring,cqe);
+
+      if(!req)			// quit nop
+	{
+	  AutoMutex lock(m_cond.mutex());
+	  --m_nb_inflight;
+	  m_cond.broadcast();
+	  break;
+	}
+
+      bool done = true;
+      int error = 0;
+      if((res == -EINTR) || (res == -EAGAIN))
+	done = false;
+      else if(res < 0)
+	error = -res;
+      else if(res == 0)
+	error = EIO;
+      else if(size_t(res) < req->len)
+	{
+	  // short write: send the remaining bytes
+	  req->buf += res;
+	  req->len -= res;
+	  req->offset += res;
+	  done = false;
+	}
+
+      {
+	AutoMutex lock(m_cond.mutex());
+	--m_nb_inflight;
+	try
+	  {
+	    if(!done)
+	      _queue(req);
+	  }
+	catch(std::ios_base::failure&)
+	  {
+	    error = EIO;
+	    done = true;
+	  }
+	// flush the requests accumulated while the writes were in flight
+	_submitQueued();
+	m_cond.broadcast();
+      }
+
+      if(!done)
+	continue;
+
+      if(error)
+	DEB_ERROR() << "Write error on fd " << req->fd << ": " << strerror(error);
+      try
+	{
+	  req->finished(error);
+	}
+      catch(...)
+	{
+	  DEB_ERROR() << "Unexpected exception in write completion";
+	}
+      delete req;
+
+      AutoMutex lock(m_cond.mutex());
+      --m_nb_requests;
+      m_cond.broadcast();
+    }
+}
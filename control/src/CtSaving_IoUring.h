@@ -0,0 +1,94 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef CTSAVING_IOURING_H
+#define CTSAVING_IOURING_H
+
+#include "lima/Debug.h"
+#include "lima/ThreadUtils.h"
+
+#include <liburing.h>
+
+namespace lima {
+
+  /** @brief asynchronous pwrite engine on top of io_uring.
+   *
+   *  Saving tasks queue their writes and return, a single completion
+   *  thread reaps the results and calls Request::finished.
+   *  While writes are in flight, new requests are accumulated in the
+   *  submission queue and sent in one system call, either when the batch
+   *  is full or when the completion thread gets a result.
+   */
+  class IoUringWriter
+  {
+    DEB_CLASS_NAMESPC(DebModControl,"IoUringWriter","Control");
+  public:
+    struct Request
+    {
+      Request() : fd(-1), buf(NULL), len(0), offset(0) {}
+      virtual ~Request() {}
+
+      /** @brief called from the completion thread once all the bytes
+       *  are written (error == 0) or on failure (errno value).
+       *  The request is deleted just after.
+       */
+      virtual void finished(int error) = 0;
+
+      int		fd;
+      const char*	buf;
+      size_t		len;
+      long long		offset;
+    };
+
+    IoUringWriter(int queue_depth = 64,int batch_size = 8);
+    ~IoUringWriter();
+
+    // @brief false if the kernel (or a seccomp policy) denies io_uring
+    static bool isAvailable();
+
+    // @brief the writer takes the ownership of the request
+    void queue(Request*);
+    // @brief send the queued requests, unless the batch can still grow
+    void submit();
+    // @brief wait until all the requests are finished and deleted
+    void drain();
+
+  private:
+    class _CompletionThread;
+    friend class _CompletionThread;
+
+    io_uring_sqe* _getSqe();
+    void _queue(Request*);
+    int _submitQueued();
+    void _completionLoop();
+
+    io_uring			 m_ring;
+    Cond			 m_cond;
+    int				 m_queue_depth;
+    int				 m_batch_size;
+    int				 m_nb_queued;
+    int				 m_nb_inflight;
+    int				 m_nb_requests; ///< queued, not yet finished
+    _CompletionThread*		 m_thread;
+  };
+
+}
+#endif // CTSAVING_IOURING_H
@@ -0,0 +1,359 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#ifdef __unix
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "lima/CtSpillTier.h"
+#include "lima/Exceptions.h"
+
+using namespace lima;
+
+static const double DEFAULT_HIGH_WATER_MARK = 50.0;
+
+static inline void _updateMax(std::atomic<long>& peak,long val)
+{
+  long prev = peak.load(std::memory_order_relaxed);
+  while((val > prev) &&
+	!peak.compare_exchange_weak(prev,val,std::memory_order_relaxed))
+    ;
+}
+
+/** @brief scratch file mapping, split in frame slots.
+ *
+ *  Shared by the tier and the spilled buffers, so that it is unmapped
+ *  only when the last spilled frame is saved.
+ */
+class CtSpillTier::_Scratch
+{
+  DEB_CLASS_NAMESPC(DebModControl,"SpillTier::_Scratch","Control");
+public:
+  _Scratch(const std::string& directory,long slot_size,long nb_slots);
+  ~_Scratch();
+
+  long getSlotSize() const { return m_slot_size; }
+  long getNbSlots() const { return m_nb_slots; }
+
+  long getNbUsed() const
+  {
+    AutoMutex l(m_lock);
+    return m_nb_slots - long(m_free.size());
+  }
+
+  /// NULL if all the slots are used
+  char *get(long& slot,long& nb_used)
+  {
+    AutoMutex l(m_lock);
+    if(m_free.empty())
+      return NULL;
+    slot = m_free.back();
+    m_free.pop_back();
+    nb_used = m_nb_slots - long(m_free.size());
+    return m_base + slot * m_slot_size;
+  }
+
+  void put(long slot)
+  {
+    AutoMutex l(m_lock);
+    m_free.push_back(slot);
+  }
+
+private:
+  long			m_slot_size;
+  long			m_nb_slots;
+  char*			m_base;
+  mutable Mutex		m_lock;
+  std::vector<long>	m_free;
+};
+
+CtSpillTier::_Scratch::_Scratch(const std::string& directory,
+				long slot_size,long nb_slots)
+  : m_slot_size(slot_size),m_nb_slots(nb_slots),m_base(NULL)
+{
+  DEB_CONSTRUCTOR();
+  DEB_PARAM() << DEB_VAR3(directory,slot_size,nb_slots);
+
+#ifdef __unix
+  std::string path = directory + "/lima_spill_XXXXXX";
+  std::vector<char> name(path.begin(),path.end());
+  name.push_back('\0');
+  int fd = mkstemp(name.data());
+  if(fd < 0)
+    THROW_CTL_ERROR(Error) << "Cannot create spill file in " << directory
+			   << ": " << strerror(errno);
+  // no left-over file on crash: the mapping keeps the blocks
+  unlink(name.data());
+
+  off_t size = off_t(slot_size) * nb_slots;
+  int ret = posix_fallocate(fd,0,size);
+  if(ret == 0)
+    {
+      void *p = mmap(NULL,size,PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+      if(p == MAP_FAILED)
+	ret = errno;
+      else
+	m_base = (char *) p;
+    }
+  close(fd);
+  if(ret != 0)
+    THROW_CTL_ERROR(Error) << "Cannot allocate " << (size >> 20)
+			   << " MB spill file in " << directory << ": "
+			   << strerror(ret);
+#else
+  THROW_CTL_ERROR(NotSupported) << "Spill tier only available on Unix";
+#endif
+
+  // first slots reused first: hot in the page cache
+  m_free.reserve(nb_slots);
+  for(long slot = nb_slots - 1;slot >= 0;--slot)
+    m_free.push_back(slot);
+}
+
+CtSpillTier::_Scratch::~_Scratch()
+{
+  DEB_DESTRUCTOR();
+#ifdef __unix
+  if(m_base)
+    munmap(m_base,size_t(m_slot_size) * m_nb_slots);
+#endif
+}
+
+CtSpillTier::Stats::Stats() :
+  Enabled(false),
+  NbSlots(0),
+  Occupancy(0),
+  PeakOccupancy(0),
+  NbSpilled(0),
+  NbRefused(0),
+  SpillRate(0),
+  PeakRingUsage(0)
+{
+}
+
+CtSpillTier::CtSpillTier() :
+  m_max_size(0),
+  m_high_water_mark(DEFAULT_HIGH_WATER_MARK),
+  m_active(false),
+  m_nb_buffers(0),
+  m_high_water_frames(0),
+  m_peak_occupancy(0),
+  m_nb_spilled(0),
+  m_nb_refused(0),
+  m_peak_ring_frames(0)
+{
+  DEB_CONSTRUCTOR();
+}
+
+CtSpillTier::~CtSpillTier()
+{
+  DEB_DESTRUCTOR();
+}
+
+void CtSpillTier::setDirectory(const std::string& directory)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(directory);
+  AutoMutex l(m_lock);
+  m_directory = directory;
+}
+
+void CtSpillTier::getDirectory(std::string& directory) const
+{
+  DEB_MEMBER_FUNCT();
+  AutoMutex l(m_lock);
+  directory = m_directory;
+  DEB_RETURN() << DEB_VAR1(directory);
+}
+
+void CtSpillTier::setMaxSize(long size_mb)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(size_mb);
+  if(size_mb < 0)
+    THROW_CTL_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(size_mb);
+  AutoMutex l(m_lock);
+  m_max_size = size_mb;
+}
+
+void CtSpillTier::getMaxSize(long& size_mb) const
+{
+  DEB_MEMBER_FUNCT();
+  AutoMutex l(m_lock);
+  size_mb = m_max_size;
+  DEB_RETURN() << DEB_VAR1(size_mb);
+}
+
+void CtSpillTier::setHighWaterMark(double percent)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(percent);
+  if((percent <= 0) || (percent > 100))
+    THROW_CTL_ERROR(InvalidValue) << "High-water mark outside (0,100]: "
+				  << percent;
+  AutoMutex l(m_lock);
+  m_high_water_mark = percent;
+}
+
+void CtSpillTier::getHighWaterMark(double& percent) const
+{
+  DEB_MEMBER_FUNCT();
+  AutoMutex l(m_lock);
+  percent = m_high_water_mark;
+  DEB_RETURN() << DEB_VAR1(percent);
+}
+
+bool CtSpillTier::isEnabled() const
+{
+  AutoMutex l(m_lock);
+  return !m_directory.empty() && (m_max_size > 0);
+}
+
+void CtSpillTier::getStats(Stats& stats) const
+{
+  DEB_MEMBER_FUNCT();
+
+  std::shared_ptr<_Scratch> scratch;
+  long nb_buffers;
+  double elapsed;
+  {
+    AutoMutex l(m_lock);
+    if(m_active)
+      scratch = m_scratch;
+    nb_buffers = m_nb_buffers;
+    elapsed = m_start.isSet() ? double(Timestamp::now() - m_start) : 0;
+  }
+
+  stats = Stats();
+  stats.Enabled = !!scratch;
+  if(scratch)
+    {
+      stats.NbSlots = scratch->getNbSlots();
+      stats.Occupancy = scratch->getNbUsed();
+    }
+  stats.PeakOccupancy = m_peak_occupancy;
+  stats.NbSpilled = m_nb_spilled;
+  stats.NbRefused = m_nb_refused;
+  if(elapsed > 0)
+    stats.SpillRate = stats.NbSpilled / elapsed;
+  if(nb_buffers > 0)
+    stats.PeakRingUsage = 100.0 * m_peak_ring_frames / nb_buffers;
+
+  DEB_RETURN() << DEB_VAR1(stats);
+}
+
+void CtSpillTier::prepare(long frame_mem_size,long nb_buffers)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR2(frame_mem_size,nb_buffers);
+
+  AutoMutex l(m_lock);
+  m_nb_buffers = nb_buffers;
+  m_high_water_frames = std::max(1L,long(nb_buffers * m_high_water_mark /
+					  100));
+  m_start = Timestamp::now();
+  m_peak_occupancy = 0;
+  m_nb_spilled = 0;
+  m_nb_refused = 0;
+  m_peak_ring_frames = 0;
+
+  m_active = false;
+  if(m_directory.empty() || (m_max_size == 0) || (frame_mem_size <= 0))
+    {
+      m_scratch.reset();
+      return;
+    }
+
+  long page_size = 4096;
+#ifdef __unix
+  page_size = sysconf(_SC_PAGESIZE);
+#endif
+  long slot_size = (frame_mem_size + page_size - 1) / page_size * page_size;
+  long nb_slots = (long long)(m_max_size) * 1024 * 1024 / slot_size;
+  if(nb_slots == 0)
+    THROW_CTL_ERROR(InvalidValue) << "Spill tier max. size (" << m_max_size
+				  << " MB) smaller than a frame";
+
+  // keep the file if the geometry did not change and it is not in use
+  if(!m_scratch || (m_scratch->getSlotSize() != slot_size) ||
+     (m_scratch->getNbSlots() != nb_slots) || (m_scratch->getNbUsed() != 0))
+    {
+      m_scratch.reset();
+      m_scratch = std::make_shared<_Scratch>(m_directory,slot_size,nb_slots);
+      DEB_TRACE() << "Spill file: " << DEB_VAR2(slot_size,nb_slots);
+    }
+  m_active = true;
+}
+
+bool CtSpillTier::spill(Data& data)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(data);
+
+  std::shared_ptr<_Scratch> scratch;
+  {
+    AutoMutex l(m_lock);
+    scratch = m_scratch;
+  }
+  long size = data.size();
+  if(!scratch)
+    return false;
+  else if(size > scratch->getSlotSize())
+    {
+      ++m_nb_refused;
+      DEB_WARNING() << "Frame larger than a slot: " << DEB_VAR1(size);
+      return false;
+    }
+
+  long slot,nb_used;
+  char *ptr = scratch->get(slot,nb_used);
+  if(!ptr)
+    {
+      ++m_nb_refused;
+      DEB_RETURN() << "Tier full";
+      return false;
+    }
+  memcpy(ptr,data.data(),size);
+
+  // the slot is back in the tier when the frame is saved
+  MappedBuffer *buffer = new MappedBuffer(ptr,[scratch,slot](void *) {
+      scratch->put(slot);
+    });
+  data.setBuffer(buffer);
+  buffer->unref();
+
+  ++m_nb_spilled;
+  _updateMax(m_peak_occupancy,nb_used);
+  return true;
+}
+
+bool CtSpillTier::checkRingUsage(long nb_frames)
+{
+  _updateMax(m_peak_ring_frames,nb_frames);
+  return m_active && (nb_frames >= m_high_water_frames);
+}
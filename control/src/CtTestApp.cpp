@@ -503,6 +503,9 @@ void CtTestApp::runAcq(const index_map& indexes)
 	bool acq_interrupted = false;
 	bool all_saved = false;
 	bool auto_frame = (m_pars->saving_mode == CtSaving::AutoFrame);
+	double acquired_elapsed = -1;
+	double ready_elapsed = -1;
+	double saved_elapsed = -1;
 	Timestamp last_display_ts = Timestamp::now();
 	const double& display_time = m_pars->test_acq_loop_display_time;
 	while (true) {
@@ -537,6 +540,16 @@ void CtTestApp::runAcq(const index_map& indexes)
 				     << DEB_VAR2(elapsed, frame_rate);
 			all_acquired = true;
 		}
+		// stage completion, independent of the display period
+		if ((img_status.LastImageAcquired == last_frame) &&
+		    (acquired_elapsed < 0))
+			acquired_elapsed = ts - t0;
+		if ((img_status.LastImageReady == last_frame) &&
+		    (ready_elapsed < 0))
+			ready_elapsed = ts - t0;
+		if ((img_status.LastImageSaved == last_frame) &&
+		    (saved_elapsed < 0))
+			saved_elapsed = ts - t0;
 		bool acq_running = (acq_status == AcqRunning);
 		auto acq_error = control_status.Error;
 		bool saving_error = false;
@@ -605,6 +618,24 @@ void CtTestApp::runAcq(const index_map& indexes)
 	double elapsed = t - t0;
 	DEB_ALWAYS() << DEB_VAR1(elapsed);
 
+	// sustained rates, from startAcq to the last frame of each stage
+	FrameDim frame_dim;
+	m_ct->image()->getImageDim(frame_dim);
+	double frame_bytes = frame_dim.getMemSize();
+	struct { const char *stage; double elapsed; } stages[] = {
+		{"acquired", acquired_elapsed},
+		{"ready", ready_elapsed},
+		{"saved", saved_elapsed},
+	};
+	for (auto& s : stages) {
+		if ((s.elapsed <= 0) || (last_frame < 0))
+			continue;
+		double frame_rate = (last_frame + 1) / s.elapsed;
+		double gbyte_rate = frame_rate * frame_bytes / 1e9;
+		DEB_ALWAYS() << "Throughput " << s.stage << ": "
+			     << DEB_VAR3(s.elapsed, frame_rate, gbyte_rate);
+	}
+
 	if (show_statistics && (saved_frame >= 0)) {
 		int statistics_size = save->getStatisticHistorySize();
 		double incoming_speed;
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <list>
 #include "lima/HwVideoCtrlObj.h"
 #include "lima/CtVideo.h"
@@ -9,8 +10,6 @@
 #include "processlib/PoolThreadMgr.h"
 #include "processlib/SinkTask.h"
 #include "processlib/TaskMgr.h"
-#include "processlib/Binning.h"
-#include "processlib/SoftRoi.h"
 
 using namespace lima;
 enum ParModifyMask
@@ -36,20 +35,26 @@ public:
     DEB_PARAM() << DEB_VAR1(aData);
     
     AutoMutex aLock(m_cnt.m_cond.mutex());
-    VideoImage *anImage = m_cnt.m_write_image;
-    DEB_TRACE() << DEB_VAR1(*anImage);
-    while(anImage->inused) {
-      m_cnt.m_cond.wait();
-      if (anImage != m_cnt.m_write_image) {
-	DEB_TRACE() << "Read/write swapped";
-	anImage = m_cnt.m_write_image;
-      }
-    }
+    VideoImage *anImage = m_cnt._get_write_image();
     DEB_TRACE() << DEB_VAR1(*anImage);
     anImage->inused = -1;	// Write Mode
+    Bin aBin = m_bin;
+    Roi aRoi = m_roi;
     aLock.unlock();
     
-    data2Image(aData,*anImage);
+    // binning, roi and copy in one pass, straight into the image
+    try
+      {
+	data2Image(aData,*anImage,aBin,aRoi);
+      }
+    catch(...)
+      {
+	aLock.lock();
+	anImage->inused = 0;
+	anImage->frameNumber = -1;
+	m_cnt.m_cond.broadcast();
+	throw;
+      }
     
     //Check if data is still available
     bool still_available = _check_available(aData);
@@ -65,14 +70,8 @@ public:
 
     ++m_cnt.m_image_counter;
 
-    // if read Image is not use, swap
-    if(!m_cnt.m_read_image->inused)
+    if(m_cnt._publish_image(anImage))
       {
-	DEB_TRACE() << "swapping read and write";
-	m_cnt.m_write_image = m_cnt.m_read_image;
-	m_cnt.m_write_image->frameNumber = -1;
-	m_cnt.m_read_image = anImage;
-
 	if(m_cnt.m_image_callback)
 	  {
 	    CtVideo::Image anImageWrapper(&m_cnt,anImage,aLock);
@@ -85,6 +84,9 @@ public:
 
   long m_nb_buffer;
   bool m_data_always_available;
+  // set under lock by CtVideo::_data_2_image
+  Bin m_bin;
+  Roi m_roi;
 
 private:
   inline bool _check_available(Data& aData)
@@ -192,8 +194,8 @@ bool CtVideo::_InternalImageCBK::newImage(char * data,int width,int height,Video
 
   aLock.lock();
   ++m_video.m_image_counter;
-  VideoImage *anImage = m_video.m_write_image;
-  if(anImage->inused) return true;			// Skip it (Should never happen!)
+  VideoImage *anImage = m_video._get_write_image(false);
+  if(!anImage) return true;			// Skip it, all images are read
   anImage->inused = -1;		// Write Mode
   aLock.unlock();
   
@@ -202,13 +204,8 @@ bool CtVideo::_InternalImageCBK::newImage(char * data,int width,int height,Video
 
   aLock.lock();
   anImage->inused = 0;
-  // if read Image is not use, swap
-  if(!m_video.m_read_image->inused)
+  if(m_video._publish_image(anImage))
     {
-      m_video.m_write_image = m_video.m_read_image;
-      m_video.m_write_image->frameNumber = -1;
-      m_video.m_read_image = anImage;
-   
       if(m_video.m_image_callback)
 	{
 	  CtVideo::Image anImageWrapper(&m_video,anImage,aLock);
@@ -409,9 +406,11 @@ long long CtVideo::Image::frameNumber() const
 CtVideo::CtVideo(CtControl &ct) :
   m_pars_modify_mask(0),
   m_ready_flag(true),
+  m_max_image_rate(0.),
   m_image_counter(-1),
   m_read_image(new VideoImage()),
   m_write_image(new VideoImage()),
+  m_spare_image(new VideoImage()),
   m_image_callback(NULL),
   m_internal_image_callback(NULL),
   m_ct(ct),
@@ -442,6 +441,7 @@ CtVideo::~CtVideo()
   m_data_2_image_cb->unref();
   delete m_read_image;
   delete m_write_image;
+  delete m_spare_image;
   delete m_internal_image_callback;
 }
 
@@ -747,6 +747,22 @@ void CtVideo::getBin(Bin &aBin) const
   aBin = m_pars.bin;
 }
 
+void CtVideo::setMaxImageRate(double rate)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(rate);
+  if(rate < 0.)
+    THROW_CTL_ERROR(InvalidValue) << "Invalid image rate: " << DEB_VAR1(rate);
+  AutoMutex aLock(m_cond.mutex());
+  m_max_image_rate = rate;
+}
+
+void CtVideo::getMaxImageRate(double &rate) const
+{
+  AutoMutex aLock(m_cond.mutex());
+  rate = m_max_image_rate;
+}
+
 // --- images
 void CtVideo::getLastImage(CtVideo::Image &anImage) const
 {
@@ -856,13 +872,22 @@ void CtVideo::frameReady(Data &aData)
       AutoMutex aLock(m_cond.mutex());
       if(m_active_flag)
 	{
+	  // rate policy: frames closer than 1/rate to the last one are
+	  // skipped, the latest one is shown at the end of the acquisition
+	  Timestamp now = Timestamp::now();
+	  if(m_max_image_rate > 0. && m_last_image_time.isSet() &&
+	     now - m_last_image_time < 1. / m_max_image_rate)
+	    {
+	      if(aData.frameNumber > m_skipped_data.frameNumber)
+		m_skipped_data = aData;
+	      return;
+	    }
+	  // busy policy: only the latest pending frame is kept
 	  if(m_ready_flag)
 	    {
 	      m_ready_flag = false;
-	      Bin aBin = m_pars.bin;
-	      Roi aRoi = m_pars.roi;
-	      aLock.unlock();
-	      _data_2_image(aData,aBin,aRoi);
+	      m_last_image_time = now;
+	      _data_2_image(aData,aLock);
 	    }
 	  else
 	    m_last_data = aData;
@@ -870,36 +895,66 @@ void CtVideo::frameReady(Data &aData)
     }
 }
 
-void CtVideo::_data_2_image(Data &aData,Bin &aBin,Roi &aRoi)
+/** @brief schedule the conversion of aData, called under lock.
+ *  The same task is reused for every frame: it bins, crops and converts
+ *  in a single pass into the write image, no intermediate frame.
+ */
+void CtVideo::_data_2_image(Data &aData,AutoMutex &aLock)
 {
   DEB_MEMBER_FUNCT();
+  if(m_skipped_data.frameNumber <= aData.frameNumber)
+    m_skipped_data = Data();
+  m_data_2_image_task->m_bin = m_pars.bin;
+  m_data_2_image_task->m_roi = m_pars.roi;
+  aLock.unlock();
+
   TaskMgr *anImageCopy = new TaskMgr();
-  int runLevel = 0;
-  if(aBin.getX() > 1 || aBin.getY() > 1)
+  anImageCopy->addSinkTask(0,m_data_2_image_task);
+  anImageCopy->setInputData(aData);
+  
+  PoolThreadMgr::get().addProcess(anImageCopy);
+}
+
+/** @brief image to write in, called under lock.
+ *  When the write image is still read by a client, the spare one is used
+ *  instead: the writer only waits if both are in use, or returns NULL
+ *  if wait_for_image is false.
+ */
+VideoImage* CtVideo::_get_write_image(bool wait_for_image)
+{
+  while(m_write_image->inused)
     {
-      Tasks::Binning *aBinTaskPt = new Tasks::Binning();
-      aBinTaskPt->mXFactor = aBin.getX();
-      aBinTaskPt->mYFactor = aBin.getY();
-      anImageCopy->setLinkTask(runLevel,aBinTaskPt);
-      aBinTaskPt->setProcessingInPlace(false);
-      aBinTaskPt->unref();
-      ++runLevel;
+      if(!m_spare_image->inused)
+	{
+	  std::swap(m_write_image,m_spare_image);
+	  break;
+	}
+      if(!wait_for_image)
+	return NULL;
+      m_cond.wait();
     }
-  if(aRoi.isActive())
+  return m_write_image;
+}
+
+/** @brief make the written image the read one, called under lock.
+ *  If the read image is still used, it becomes the spare image.
+ *  Return false when all the images are in use: the new image is dropped.
+ */
+bool CtVideo::_publish_image(VideoImage *anImage)
+{
+  VideoImage *old_read = m_read_image;
+  if(old_read->inused)
     {
-      Point topl= aRoi.getTopLeft();
-      Point botr= aRoi.getBottomRight();
-      Tasks::SoftRoi *aSoftRoiTaskPt = new Tasks::SoftRoi();
-      aSoftRoiTaskPt->setRoi(topl.x, botr.x, topl.y, botr.y);
-      anImageCopy->setLinkTask(runLevel,aSoftRoiTaskPt);
-      aSoftRoiTaskPt->setProcessingInPlace(!runLevel);
-      aSoftRoiTaskPt->unref();
-      ++runLevel;
+      if(m_spare_image->inused)
+	return false;
+      m_write_image = m_spare_image;
+      m_spare_image = old_read;
     }
-  anImageCopy->addSinkTask(runLevel,m_data_2_image_task);
-  anImageCopy->setInputData(aData);
-  
-  PoolThreadMgr::get().addProcess(anImageCopy);
+  else
+    m_write_image = old_read;
+  m_write_image->frameNumber = -1;
+  m_read_image = anImage;
+  return true;
 }
 
 void CtVideo::_data2image_finnished(Data&)
@@ -910,22 +965,42 @@ void CtVideo::_data2image_finnished(Data&)
     {
       Data aData = m_last_data;
       m_last_data = Data();
-      Bin aBin = m_pars.bin;
-      Roi aRoi = m_pars.roi;
-      aLock.unlock();
-      _data_2_image(aData,aBin,aRoi);
+      m_last_image_time = Timestamp::now();
+      _data_2_image(aData,aLock);
     }
   else
     m_ready_flag = true;
 }
 
+/** @brief end of acquisition: show the last frame skipped by the rate
+ */
+void CtVideo::_acqFinished()
+{
+  DEB_MEMBER_FUNCT();
+  AutoMutex aLock(m_cond.mutex());
+  if(!m_active_flag || m_skipped_data.empty())
+    return;
+
+  Data aData = m_skipped_data;
+  m_skipped_data = Data();
+  if(m_ready_flag)
+    {
+      m_ready_flag = false;
+      m_last_image_time = Timestamp::now();
+      _data_2_image(aData,aLock);
+    }
+  else if(aData.frameNumber > m_last_data.frameNumber)
+    m_last_data = aData;
+}
+
 void CtVideo::_apply_params(AutoMutex &aLock,bool aForceLiveFlag)
 {
   if(m_ct.acquisition()->isMonitorMode())
     return;
 
   if(aForceLiveFlag && !m_pars.live)
-      m_read_image->frameNumber = m_write_image->frameNumber = m_image_counter = -1;
+      m_read_image->frameNumber = m_write_image->frameNumber =
+	m_spare_image->frameNumber = m_image_counter = -1;
   
   if(aForceLiveFlag || m_pars.live)
     {
@@ -1063,6 +1138,9 @@ void CtVideo::_prepareAcq()
   
   m_read_image->frameNumber = -1;
   m_write_image->frameNumber = -1;
+  m_spare_image->frameNumber = -1;
+  m_last_image_time = Timestamp();
+  m_skipped_data = Data();
 
   m_data_2_image_task->m_data_always_available = false;
   SoftOpExternalMgr* op_ext = m_ct.externalOperation();
@@ -71,7 +71,7 @@ class TestSaving:
         del self.cam_hw
 
     @core.DEB_MEMBER_FUNCT
-    def start(self, exp_time, nb_frames, directory, prefix, fmt, overwrite, framesperfile, threads, repeats, log_stat):
+    def start(self, exp_time, nb_frames, directory, prefix, fmt, overwrite, framesperfile, threads, repeats, log_stat, options=''):
         if fmt.lower() not in self.format_list:
             raise ValueError("Unsupported file format. Should be one of %s" % str(self.format_list))
 
@@ -88,6 +88,7 @@ class TestSaving:
         self.ct_saving.setFormatAsString(fmt)
         self.ct_saving.setFormatSuffix()
         self.ct_saving.setFramesPerFile(fpf)
+        self.ct_saving.setOptions(options)
         self.ct_saving.setOverwritePolicy(self.overwrite2limaoverwrite[overwrite])
         self.ct_saving.setSavingMode(self.ct_saving.AutoFrame)
         # self.ct_saving.setNextNumber(0)
@@ -139,6 +140,7 @@ def main(argv):
     camera_list = ['simulator', 'maxipix']
     parser.add_argument('-c', '--camera', help='camera to test', choices=camera_list, required=False, default='simulator')
     parser.add_argument('-l', '--log-stat', help='log statistics', required=False, default=False, action='store_true')
+    parser.add_argument('-O', '--options', help="saving options, e.g. 'COMPRESSION_BLOCK_SIZE=4M'", required=False, default='')
     args = parser.parse_args()
 
     if args.verbose == 1:
@@ -172,7 +174,8 @@ def main(argv):
                     args.framesperfile,
                     args.threads,
                     repeat,
-                    args.log_stat
+                    args.log_stat,
+                    args.options
                 )
             except core.Exception:
                 raise RuntimeError
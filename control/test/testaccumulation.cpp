@@ -0,0 +1,141 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+// Accumulation micro-benchmark: 16-bit frames are accumulated into a
+// 32-bit image with the saturation count active.
+// The generic path (frame copy, saturation pass, accumulation functor) is
+// compared with the fused kernels of every instruction set supported by
+// the CPU; the results must be identical.
+//
+// usage: testaccumulation [nb_frames [width height]]
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <random>
+
+#include "../src/CtAccumulation_Kernels.h"
+#include "lima/Timestamp.h"
+
+using namespace std;
+using namespace lima;
+
+namespace
+{
+
+typedef unsigned short SrcType;
+typedef unsigned int DstType;
+
+const long long threshold = 10;
+const long long sat_threshold = 4000;
+
+struct Result
+{
+	Result(int nb_pixels) : acc(nb_pixels), sat(nb_pixels), nb_sat(0) {}
+
+	vector<DstType> acc;
+	vector<unsigned short> sat;
+	long long nb_sat;
+};
+
+// what CtAccumulation does without the kernels
+double run_generic(const vector<SrcType>& frame, int nb_frames, Result& r)
+{
+	int nb_pixels = frame.size();
+	vector<SrcType> copy(nb_pixels);
+
+	Timestamp t0 = Timestamp::now();
+	for (int f = 0; f < nb_frames; ++f) {
+		// the saturation task works on a copy of the frame
+		memcpy(copy.data(), frame.data(), nb_pixels * sizeof(SrcType));
+		for (int i = 0; i < nb_pixels; ++i)
+			if (copy[i] > sat_threshold) {
+				++r.sat[i];
+				++r.nb_sat;
+			}
+
+		for (int i = 0; i < nb_pixels; ++i)
+			if (frame[i] > threshold)
+				r.acc[i] += frame[i];
+	}
+	return nb_frames / (Timestamp::now() - t0);
+}
+
+double run_kernel(AccKernels::AccFunc func, const vector<SrcType>& frame,
+		  int nb_frames, Result& r)
+{
+	AccKernels::Params pars;
+	pars.filter = AccKernels::FilterThreshold;
+	pars.threshold = threshold;
+	pars.offset = 0;
+	pars.sat_image = r.sat.data();
+	pars.mask = NULL;
+	pars.sat_threshold = sat_threshold;
+
+	Timestamp t0 = Timestamp::now();
+	for (int f = 0; f < nb_frames; ++f)
+		r.nb_sat += func(frame.data(), r.acc.data(), frame.size(), pars);
+	return nb_frames / (Timestamp::now() - t0);
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+	int nb_frames = (argc > 1) ? atoi(argv[1]) : 100;
+	int width = (argc > 3) ? atoi(argv[2]) : 2048;
+	int height = (argc > 3) ? atoi(argv[3]) : 2048;
+	int nb_pixels = width * height;
+
+	vector<SrcType> frame(nb_pixels);
+	mt19937 gen(0);
+	uniform_int_distribution<int> dist(0, 4095 + 200);
+	for (auto& p : frame)
+		p = dist(gen);
+
+	Result ref(nb_pixels);
+	double ref_rate = run_generic(frame, nb_frames, ref);
+	cout << "generic: " << ref_rate << " frames/s" << endl;
+
+	AccKernels::Params pars = AccKernels::Params();
+	pars.filter = AccKernels::FilterThreshold;
+	pars.sat_image = ref.sat.data();
+
+	int ret = 0;
+	for (int i = 0; i <= AccKernels::getBestIsa(); ++i) {
+		AccKernels::Isa isa = AccKernels::Isa(i);
+		AccKernels::AccFunc func = getAccFunc(AccKernels::U16,
+						      AccKernels::U32,
+						      pars, isa);
+		if (!func)
+			continue;
+		Result r(nb_pixels);
+		double rate = run_kernel(func, frame, nb_frames, r);
+		bool ok = ((r.acc == ref.acc) && (r.sat == ref.sat) &&
+			   (r.nb_sat == ref.nb_sat));
+		cout << AccKernels::getIsaName(isa) << ": " << rate
+		     << " frames/s, x" << rate / ref_rate
+		     << (ok ? "" : " *** MISMATCH ***") << endl;
+		if (!ok)
+			ret = 1;
+	}
+	return ret;
+}
@@ -0,0 +1,187 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+// CBF byte-offset micro-benchmark: Pilatus-like 32-bit frames (low counts,
+// a few hot pixels) are encoded by the old one-pass scalar encoder and by
+// the two-pass kernels of every instruction set supported by the CPU.
+// The streams must be identical and decode back to the frame; the 16-bit
+// and unsigned 32-bit kernels are checked by decoding.
+//
+// usage: testcbfencode [nb_frames [width height]]
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <random>
+
+#include "../src/CtSaving_Cbf_Kernels.h"
+#include "lima/Timestamp.h"
+
+using namespace std;
+using namespace lima;
+
+namespace
+{
+
+// the encoder of the CBF mini header task before the kernels
+long encode_ref(const int *src, long nb_pixels, char *buffer)
+{
+	union { char *cp; short *sp; int *ip; } dst;
+	dst.cp = buffer;
+	int prev_val = 0;
+	for (long i = 0; i < nb_pixels; ++i, ++src) {
+		int val = *src;
+		int diff = val - prev_val;
+		if (abs(diff) <= 127)
+			*dst.cp++ = diff;
+		else {
+			*dst.cp++ = 0x80;
+			if (abs(diff) <= 32767)
+				*dst.sp++ = diff;
+			else {
+				*dst.sp++ = 0x8000;
+				*dst.ip++ = diff;
+			}
+		}
+		prev_val = val;
+	}
+	return dst.cp - buffer;
+}
+
+template <class T>
+bool decode(const char *p, long size, const vector<T>& frame)
+{
+	const char *end = p + size;
+	long long val = 0;
+	for (auto expected : frame) {
+		if (p >= end)
+			return false;
+		long long diff = (signed char) *p++;
+		if (diff == -128) {
+			short s;
+			memcpy(&s, p, 2), p += 2;
+			diff = s;
+			if (s == -32768) {
+				int i;
+				memcpy(&i, p, 4), p += 4;
+				diff = i;
+				if (i == int(0x80000000)) {
+					memcpy(&diff, p, 8), p += 8;
+				}
+			}
+		}
+		val += diff;
+		if (T(val) != expected)
+			return false;
+	}
+	return p == end;
+}
+
+long encode(CbfKernels::EncodeFunc func, const void *src, long nb_pixels,
+	    char *buffer)
+{
+	int delta[CbfKernels::BlockSize];
+	unsigned char cls[CbfKernels::BlockSize];
+	long large_budget = nb_pixels;
+	char *dst = buffer;
+	for (long first = 0; first < nb_pixels && dst;
+	     first += CbfKernels::BlockSize) {
+		int nb = min<long>(CbfKernels::BlockSize, nb_pixels - first);
+		dst = func(src, first, nb, dst, delta, cls, large_budget);
+	}
+	return dst ? dst - buffer : -1;
+}
+
+template <class T>
+bool check_type(CbfKernels::PixelType type, CbfKernels::Isa isa,
+		long long min_val, long long max_val)
+{
+	vector<T> frame(100000);
+	mt19937 gen(1);
+	uniform_int_distribution<long long> dist(min_val, max_val);
+	uniform_int_distribution<int> small(0, 20);
+	for (size_t i = 0; i < frame.size(); ++i)
+		// runs of small values between the large jumps
+		frame[i] = (i % 37 < 30) ? T(small(gen)) : T(dist(gen));
+	vector<char> buffer(frame.size() * 15);
+	long size = encode(getEncodeFunc(type, isa), frame.data(),
+			   frame.size(), buffer.data());
+	return (size > 0) && decode(buffer.data(), size, frame);
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+	int nb_frames = (argc > 1) ? atoi(argv[1]) : 100;
+	int width = (argc > 3) ? atoi(argv[2]) : 2463;
+	int height = (argc > 3) ? atoi(argv[3]) : 2527;
+	long nb_pixels = long(width) * height;
+
+	vector<int> frame(nb_pixels);
+	mt19937 gen(0);
+	poisson_distribution<int> dist(3);
+	uniform_int_distribution<int> hot(0, 999);
+	for (auto& p : frame)
+		p = hot(gen) ? dist(gen) : 100000;
+
+	vector<char> ref(nb_pixels * 15);
+	long ref_size = 0;
+	Timestamp t0 = Timestamp::now();
+	for (int f = 0; f < nb_frames; ++f)
+		ref_size = encode_ref(frame.data(), nb_pixels, ref.data());
+	double ref_rate = nb_frames / (Timestamp::now() - t0);
+	cout << "reference: " << ref_rate << " frames/s, "
+	     << double(ref_size) / nb_pixels << " bytes/pixel" << endl;
+
+	int ret = 0;
+	vector<char> buffer(nb_pixels * 15);
+	for (int i = 0; i <= CbfKernels::getBestIsa(); ++i) {
+		CbfKernels::Isa isa = CbfKernels::Isa(i);
+		CbfKernels::EncodeFunc func = getEncodeFunc(CbfKernels::S32,
+							    isa);
+		if (!func)
+			continue;
+		long size = 0;
+		t0 = Timestamp::now();
+		for (int f = 0; f < nb_frames; ++f)
+			size = encode(func, frame.data(), nb_pixels,
+				      buffer.data());
+		double rate = nb_frames / (Timestamp::now() - t0);
+		bool ok = ((size == ref_size) &&
+			   !memcmp(buffer.data(), ref.data(), size) &&
+			   decode(buffer.data(), size, frame));
+		ok = ok && check_type<int>(CbfKernels::S32, isa,
+					   -2147483647 - 1, 2147483647);
+		ok = ok && check_type<unsigned int>(CbfKernels::U32, isa,
+						    0, 4294967295LL);
+		ok = ok && check_type<short>(CbfKernels::S16, isa,
+					     -32768, 32767);
+		ok = ok && check_type<unsigned short>(CbfKernels::U16, isa,
+						      0, 65535);
+		cout << CbfKernels::getIsaName(isa) << ": " << rate
+		     << " frames/s, x" << rate / ref_rate
+		     << (ok ? "" : " *** MISMATCH ***") << endl;
+		if (!ok)
+			ret = 1;
+	}
+	return ret;
+}
@@ -0,0 +1,333 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+// Intra-frame parallel compression (COMPRESSION_BLOCK_SIZE option): the
+// frames span several 64K blocks, the output must be a standard stream:
+// - EDFGZ: gzip members decoded by inflate, EDF header + frame data;
+// - EDFLZ4: LZ4 frames decoded by LZ4F, EDF header + frame data;
+// - HDF5GZ: zlib chunks decoded by uncompress;
+// - HDF5BS: chunks identical to a single bshuf_compress_lz4 call.
+//
+// usage: testcompressionblocks [directory]
+
+#include "lima/CtControl.h"
+#include "lima/CtAcquisition.h"
+#include "lima/CtSaving.h"
+#include "lima/HwSyntheticInterface.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <zlib.h>
+#ifdef WITH_LZ4_COMPRESSION
+#include <lz4frame.h>
+#endif
+#ifdef WITH_HDF5_SAVING
+#include <hdf5.h>
+#include <hdf5_hl.h>
+#endif
+#ifdef WITH_BS_COMPRESSION
+#include "bitshuffle.h"
+#endif
+
+using namespace lima;
+using namespace std;
+
+const int Width = 512, Height = 384;	// 384 KB: 6 blocks of 64K
+const int FrameSize = Width * Height * 2;
+const int NbFrames = 4;
+const char *Prefix = "compressionblocks_";
+const char *Options = "COMPRESSION_BLOCK_SIZE=64K";
+
+string ramp(int frame_nb)
+{
+	string frame(FrameSize, '\0');
+	unsigned short *p = (unsigned short *) &frame[0];
+	for (int y = 0; y < Height; ++y)
+		for (int x = 0; x < Width; ++x)
+			*p++ = (x + y + frame_nb) & 0xffff;
+	return frame;
+}
+
+string read_file(const string& fname)
+{
+	ifstream f(fname.c_str(), ios::binary);
+	assert(f);
+	stringstream ss;
+	ss << f.rdbuf();
+	return ss.str();
+}
+
+void save(CtControl& ct, const string& directory,
+	  CtSaving::FileFormat format, const string& suffix,
+	  int frames_per_file)
+{
+	CtSaving::Parameters pars;
+	ct.saving()->getParameters(pars);
+	pars.directory = directory;
+	pars.prefix = Prefix;
+	pars.suffix = suffix;
+	pars.options = Options;
+	pars.nextNumber = 0;
+	pars.fileFormat = format;
+	pars.savingMode = CtSaving::AutoFrame;
+	pars.overwritePolicy = CtSaving::Overwrite;
+	pars.framesPerFile = frames_per_file;
+	ct.saving()->setParameters(pars);
+
+	ct.prepareAcq();
+	ct.startAcq();
+	for (int i = 0; i < 2000; ++i) {
+		CtControl::Status status;
+		ct.getStatus(status);
+		assert(status.AcquisitionStatus != AcqFault);
+		if (status.ImageCounters.LastImageSaved == NbFrames - 1)
+			return;
+		usleep(5000);
+	}
+	cerr << "Acquisition timeout" << endl;
+	exit(1);
+}
+
+string file_name(const string& directory, int file_nb, const string& suffix)
+{
+	char fname[64];
+	snprintf(fname, sizeof(fname), "%s%04d", Prefix, file_nb);
+	return directory + "/" + fname + suffix;
+}
+
+// the EDF frames: header ending with "}\n", then the ramp
+void check_edf(const string& content, int first_frame, int nb_frames)
+{
+	size_t offset = 0;
+	for (int i = 0; i < nb_frames; ++i) {
+		assert(content.compare(offset, 2, "{\n") == 0);
+		size_t end = content.find("}\n", offset);
+		assert(end != string::npos);
+		size_t header_size = end + 2 - offset;
+		assert(header_size % 1024 == 0);
+		offset += header_size;
+		assert(content.compare(offset, FrameSize,
+				       ramp(first_frame + i)) == 0);
+		offset += FrameSize;
+	}
+	assert(offset == content.size());
+}
+
+// a gzip member per frame
+string gunzip(const string& in)
+{
+	string out;
+	z_stream strm;
+	memset(&strm, 0, sizeof(strm));
+	int ret = inflateInit2(&strm, 31);
+	assert(ret == Z_OK);
+	strm.next_in = (Bytef *) in.data();
+	strm.avail_in = in.size();
+	vector<char> buffer(1 << 16);
+	do {
+		if (ret == Z_STREAM_END)
+			inflateReset(&strm);	// next member
+		strm.next_out = (Bytef *) buffer.data();
+		strm.avail_out = buffer.size();
+		ret = inflate(&strm, Z_NO_FLUSH);
+		assert((ret == Z_OK) || (ret == Z_STREAM_END));
+		out.append(buffer.data(), buffer.size() - strm.avail_out);
+	} while (strm.avail_in || (ret != Z_STREAM_END));
+	inflateEnd(&strm);
+	return out;
+}
+
+void test_edfgz(CtControl& ct, const string& directory)
+{
+	cout << "EDFGZ" << endl;
+	save(ct, directory, CtSaving::EDFGZ, ".edf.gz", 2);
+	for (int i = 0; i < NbFrames / 2; ++i) {
+		string fname = file_name(directory, i, ".edf.gz");
+		check_edf(gunzip(read_file(fname)), i * 2, 2);
+		unlink(fname.c_str());
+	}
+}
+
+#ifdef WITH_LZ4_COMPRESSION
+// all the LZ4 frames of the file
+string lz4_decompress(const string& in)
+{
+	LZ4F_dctx *dctx;
+	size_t ret = LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+	assert(!LZ4F_isError(ret));
+	string out;
+	vector<char> buffer(1 << 16);
+	const char *src = in.data();
+	size_t left = in.size(), dst_size;
+	do {
+		size_t src_size = left;
+		dst_size = buffer.size();
+		ret = LZ4F_decompress(dctx, buffer.data(), &dst_size,
+				      src, &src_size, NULL);
+		assert(!LZ4F_isError(ret));
+		out.append(buffer.data(), dst_size);
+		src += src_size;
+		left -= src_size;
+	} while (left || (dst_size == buffer.size()));
+	assert(ret == 0);	// the last frame is complete
+	LZ4F_freeDecompressionContext(dctx);
+	return out;
+}
+
+void test_edflz4(CtControl& ct, const string& directory)
+{
+	cout << "EDFLZ4" << endl;
+	save(ct, directory, CtSaving::EDFLZ4, ".edf.lz4", 2);
+	for (int i = 0; i < NbFrames / 2; ++i) {
+		string fname = file_name(directory, i, ".edf.lz4");
+		check_edf(lz4_decompress(read_file(fname)), i * 2, 2);
+		unlink(fname.c_str());
+	}
+}
+#endif
+
+#ifdef WITH_HDF5_SAVING
+// the raw (still compressed) chunk of each frame
+vector<string> read_chunks(const string& fname)
+{
+	hid_t file = H5Fopen(fname.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	assert(file >= 0);
+	hid_t dataset = H5Dopen2(file, "/entry_0000/measurement/data",
+				 H5P_DEFAULT);
+	assert(dataset >= 0);
+
+	vector<string> chunks;
+	for (int i = 0; i < NbFrames; ++i) {
+		hsize_t offset[] = {hsize_t(i), 0, 0};
+		hsize_t chunk_size;
+		herr_t ret = H5Dget_chunk_storage_size(dataset, offset,
+						       &chunk_size);
+		assert(ret >= 0);
+		string chunk(chunk_size, '\0');
+		uint32_t filter_mask;
+#if H5_VERSION_GE(1,10,3)
+		ret = H5Dread_chunk(dataset, H5P_DEFAULT, offset,
+				    &filter_mask, &chunk[0]);
+#else
+		ret = H5DOread_chunk(dataset, H5P_DEFAULT, offset,
+				     &filter_mask, &chunk[0]);
+#endif
+		assert((ret >= 0) && !filter_mask);
+		chunks.push_back(chunk);
+	}
+	H5Dclose(dataset);
+	H5Fclose(file);
+	return chunks;
+}
+
+void test_hdf5gz(CtControl& ct, const string& directory)
+{
+	cout << "HDF5GZ" << endl;
+	save(ct, directory, CtSaving::HDF5GZ, ".h5", NbFrames);
+	string fname = file_name(directory, 0, ".h5");
+	vector<string> chunks = read_chunks(fname);
+	for (int i = 0; i < NbFrames; ++i) {
+		string frame(FrameSize, '\0');
+		uLongf frame_size = FrameSize;
+		int ret = uncompress((Bytef *) &frame[0], &frame_size,
+				     (const Bytef *) chunks[i].data(),
+				     chunks[i].size());
+		assert((ret == Z_OK) && (frame_size == uLongf(FrameSize)));
+		assert(frame == ramp(i));
+	}
+	unlink(fname.c_str());
+}
+
+#ifdef WITH_BS_COMPRESSION
+extern "C" {
+void bshuf_write_uint64_BE(void* buf, uint64_t num);
+void bshuf_write_uint32_BE(void* buf, uint32_t num);
+}
+
+void test_hdf5bs(CtControl& ct, const string& directory)
+{
+	cout << "HDF5BS" << endl;
+	save(ct, directory, CtSaving::HDF5BS, ".h5", NbFrames);
+	string fname = file_name(directory, 0, ".h5");
+	vector<string> chunks = read_chunks(fname);
+	for (int i = 0; i < NbFrames; ++i) {
+		string frame = ramp(i);
+		size_t nb_elems = FrameSize / 2;
+		string ref(12 + bshuf_compress_lz4_bound(nb_elems, 2, 0), '\0');
+		bshuf_write_uint64_BE(&ref[0], FrameSize);
+		bshuf_write_uint32_BE(&ref[8], 0);
+		int64_t size = bshuf_compress_lz4(frame.data(), &ref[12],
+						  nb_elems, 2, 0);
+		assert(size > 0);
+		ref.resize(12 + size);
+		assert(chunks[i] == ref);
+	}
+	unlink(fname.c_str());
+}
+#endif
+#endif
+
+int main(int argc, char *argv[])
+{
+	string directory = string((argc > 1) ? argv[1] : ".") +
+			   "/testcompressionblocks_data";
+	mkdir(directory.c_str(), 0777);
+
+	HwSyntheticInterface::Config config;
+	config.frame_size = Size(Width, Height);
+	config.image_type = Bpp16;
+	config.pattern = HwSyntheticInterface::Ramp;
+	HwSyntheticInterface hw(config);
+	CtControl ct(&hw);
+	ct.acquisition()->setAcqExpoTime(0.001);
+	ct.acquisition()->setAcqNbFrames(NbFrames);
+
+	try {
+		test_edfgz(ct, directory);
+#ifdef WITH_LZ4_COMPRESSION
+		test_edflz4(ct, directory);
+#endif
+#ifdef WITH_HDF5_SAVING
+		test_hdf5gz(ct, directory);
+#ifdef WITH_BS_COMPRESSION
+		test_hdf5bs(ct, directory);
+#endif
+#endif
+	} catch (Exception& e) {
+		cerr << "LIMA Exception: " << e.getErrMsg() << endl;
+		return 1;
+	}
+
+	rmdir(directory.c_str());
+	cout << "OK" << endl;
+	return 0;
+}
@@ -0,0 +1,301 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+// CtControl::ReadImageBlock in Concatenation mode: the frames of a block
+// are views on the acquisition buffers (getFrame inside a concatenated
+// buffer, getContiguous across several buffers), the buffers stay mapped
+// while the block or a frame taken from it is alive.
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+
+#include "lima/HwInterface.h"
+#include "lima/HwDetInfoCtrlObj.h"
+#include "lima/HwSyncCtrlObj.h"
+#include "lima/HwBufferMgr.h"
+#include "lima/CtControl.h"
+#include "lima/CtAcquisition.h"
+#include "lima/CtBuffer.h"
+#include "lima/Timestamp.h"
+
+using namespace std;
+using namespace lima;
+
+namespace
+{
+
+const Size det_size(64, 32);
+const ImageType det_image_type = Bpp16;
+const int NbConcatFrames = 4, NbFrames = 12;
+
+unsigned short pixel(int x, int y, int frame_nb)
+{
+	return (x + y + frame_nb * 100) & 0xffff;
+}
+
+class BlockDetInfoCtrlObj : public HwDetInfoCtrlObj
+{
+public:
+	virtual void getMaxImageSize(Size& max_image_size)
+	{ max_image_size = det_size; }
+	virtual void getDetectorImageSize(Size& det_image_size)
+	{ det_image_size = det_size; }
+	virtual void getDefImageType(ImageType& def_image_type)
+	{ def_image_type = det_image_type; }
+	virtual void getCurrImageType(ImageType& curr_image_type)
+	{ curr_image_type = det_image_type; }
+	virtual void setCurrImageType(ImageType curr_image_type)
+	{
+		if (curr_image_type != det_image_type)
+			throw LIMA_HW_EXC(NotSupported, "Invalid image type");
+	}
+	virtual void getPixelSize(double& x_size, double& y_size)
+	{ x_size = y_size = 1e-6; }
+	virtual void getDetectorType(string& det_type)
+	{ det_type = "Test"; }
+	virtual void getDetectorModel(string& det_model)
+	{ det_model = "DataBlock"; }
+	virtual void registerMaxImageSizeCallback(HwMaxImageSizeCallback&)
+	{}
+	virtual void unregisterMaxImageSizeCallback(HwMaxImageSizeCallback&)
+	{}
+};
+
+class BlockSyncCtrlObj : public HwSyncCtrlObj
+{
+public:
+	BlockSyncCtrlObj() : m_exp_time(1e-3), m_nb_frames(1) {}
+
+	virtual bool checkTrigMode(TrigMode trig_mode)
+	{ return trig_mode == IntTrig; }
+	virtual void setTrigMode(TrigMode trig_mode)
+	{
+		if (!checkTrigMode(trig_mode))
+			throw LIMA_HW_EXC(NotSupported, "Invalid trigger mode");
+	}
+	virtual void getTrigMode(TrigMode& trig_mode)
+	{ trig_mode = IntTrig; }
+	virtual void setExpTime(double exp_time)
+	{ m_exp_time = exp_time; }
+	virtual void getExpTime(double& exp_time)
+	{ exp_time = m_exp_time; }
+	virtual void setLatTime(double)
+	{}
+	virtual void getLatTime(double& lat_time)
+	{ lat_time = 0; }
+	virtual void setNbHwFrames(int nb_frames)
+	{ m_nb_frames = nb_frames; }
+	virtual void getNbHwFrames(int& nb_frames)
+	{ nb_frames = m_nb_frames; }
+	virtual void getValidRanges(ValidRangesType& valid_ranges)
+	{ valid_ranges = ValidRangesType(1e-6, 1e6, 0, 1e6); }
+
+private:
+	double m_exp_time;
+	int m_nb_frames;
+};
+
+// the buffer sync makes the frames Managed: CtBuffer maps each buffer
+// while a Data refers to it
+class BlockInterface : public HwInterface
+{
+public:
+	BlockInterface()
+	{
+		m_buffer.getBufferSync(m_cond);
+		m_cap_list.push_back(HwCap(&m_det_info));
+		m_cap_list.push_back(HwCap(&m_sync));
+		m_cap_list.push_back(HwCap(&m_buffer));
+	}
+
+	virtual void getCapList(CapList& cap_list) const
+	{ cap_list = m_cap_list; }
+	virtual void reset(ResetLevel)
+	{}
+	virtual void prepareAcq()
+	{}
+	virtual void startAcq()
+	{ m_buffer.getBuffer().setStartTimestamp(Timestamp::now()); }
+	virtual void stopAcq()
+	{}
+	virtual void getStatus(StatusType& status)
+	{
+		status.set(HwInterface::StatusType::Ready);
+	}
+	virtual int getNbHwAcquiredFrames()
+	{ return m_buffer.getNbAcquiredFrames(); }
+
+	void pushFrame(int frame_nb)
+	{
+		StdBufferCbMgr& buffer_mgr = m_buffer.getBuffer();
+		unsigned short *p;
+		p = (unsigned short *) buffer_mgr.getFrameBufferPtr(frame_nb);
+		for (int y = 0; y < det_size.getHeight(); ++y)
+			for (int x = 0; x < det_size.getWidth(); ++x)
+				*p++ = pixel(x, y, frame_nb);
+
+		HwFrameInfoType frame_info;
+		frame_info.acq_frame_nb = frame_nb;
+		buffer_mgr.newFrameReady(frame_info);
+	}
+
+private:
+	CapList m_cap_list;
+	Cond m_cond;
+	BlockDetInfoCtrlObj m_det_info;
+	BlockSyncCtrlObj m_sync;
+	SoftBufferCtrlObj m_buffer;
+};
+
+void check_frame(const Data& data, int frame_nb)
+{
+	assert(data.dimensions.size() == 2);
+	assert(data.dimensions[0] == det_size.getWidth());
+	assert(data.dimensions[1] == det_size.getHeight());
+	assert(data.frameNumber == frame_nb);
+	const unsigned short *p = (const unsigned short *) data.data();
+	for (int y = 0; y < det_size.getHeight(); ++y)
+		for (int x = 0; x < det_size.getWidth(); ++x)
+			assert(*p++ == pixel(x, y, frame_nb));
+}
+
+void acquire(CtControl& control, BlockInterface& hw)
+{
+	CtAcquisition *acq = control.acquisition();
+	acq->setAcqMode(Concatenation);
+	acq->setConcatNbFrames(NbConcatFrames);
+	acq->setAcqNbFrames(NbFrames);
+	control.prepareAcq();
+	control.startAcq();
+	for (int i = 0; i < NbFrames; ++i)
+		hw.pushFrame(i);
+
+	CtControl::Status status;
+	do
+		control.getStatus(status);
+	while (status.AcquisitionStatus == AcqRunning);
+	assert(status.AcquisitionStatus == AcqReady);
+	assert(status.ImageCounters.LastBaseImageReady == NbFrames - 1);
+}
+
+// frames 5-6 are in the second concatenated buffer: one 3D segment
+void test_frame_in_buffer(CtControl& control)
+{
+	CtControl::DataBlock block;
+	control.ReadImageBlock(block, 5, 2);
+	assert(block.getNbFrames() == 2);
+	assert(block.getNbSegments() == 1);
+
+	Data segment = block.getSegment(0);
+	assert(segment.dimensions.size() == 3);
+	assert(segment.dimensions[2] == 2);
+	assert(segment.frameNumber == 5);
+
+	int frame_mem_size = FrameDim(det_size, det_image_type).getMemSize();
+	for (int i = 0; i < 2; ++i) {
+		Data frame = block.getFrame(i);
+		check_frame(frame, 5 + i);
+		// a view, not a copy
+		assert(frame.data() ==
+		       (char *) segment.data() + i * frame_mem_size);
+	}
+
+	// the contiguous data of a single segment is the segment itself
+	Data contiguous = block.getContiguous();
+	assert(contiguous.data() == segment.data());
+	cout << "getFrame inside a concatenated buffer: OK" << endl;
+}
+
+// frames 2-9 span the three buffers: 2 + 4 + 2 frames
+void test_contiguous(CtControl& control)
+{
+	CtControl::DataBlock block;
+	control.ReadImageBlock(block, 2, 8);
+	assert(block.getNbFrames() == 8);
+	assert(block.getNbSegments() == 3);
+	assert(block.getSegment(0).dimensions[2] == 2);
+	assert(block.getSegment(1).dimensions[2] == 4);
+	assert(block.getSegment(2).dimensions[2] == 2);
+
+	for (int i = 0; i < 8; ++i)
+		check_frame(block.getFrame(i), 2 + i);
+
+	Data contiguous = block.getContiguous();
+	assert(contiguous.dimensions.size() == 3);
+	assert(contiguous.dimensions[2] == 8);
+	assert(contiguous.frameNumber == 2);
+	for (int s = 0; s < 3; ++s)
+		assert(contiguous.data() != block.getSegment(s).data());
+	const unsigned short *p = (const unsigned short *) contiguous.data();
+	for (int f = 2; f < 10; ++f)
+		for (int y = 0; y < det_size.getHeight(); ++y)
+			for (int x = 0; x < det_size.getWidth(); ++x)
+				assert(*p++ == pixel(x, y, f));
+
+	// the copy does not pin the buffers
+	Data frame = block.getFrame(0);
+	frame = Data();
+	block = CtControl::DataBlock();
+	assert(control.buffer()->waitBuffersReleased(1.0));
+	check_frame(contiguous, 2);
+	cout << "getContiguous across several buffers: OK" << endl;
+}
+
+void test_pinned(CtControl& control)
+{
+	CtBuffer *buffer = control.buffer();
+	assert(buffer->waitBuffersReleased(1.0));
+
+	Data frame;
+	{
+		CtControl::DataBlock block;
+		control.ReadImageBlock(block, 3, 6);
+		assert(block.getNbSegments() == 3);
+		assert(!buffer->waitBuffersReleased(0.1));
+		frame = block.getFrame(2);
+	}
+	// the frame keeps its buffer mapped after the block is gone
+	assert(!buffer->waitBuffersReleased(0.1));
+	check_frame(frame, 5);
+
+	frame = Data();
+	assert(buffer->waitBuffersReleased(1.0));
+	cout << "buffers pinned while the block is alive: OK" << endl;
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+	BlockInterface hw;
+	CtControl control(&hw);
+
+	acquire(control, hw);
+	test_frame_in_buffer(control);
+	test_contiguous(control);
+	test_pinned(control);
+
+	// the released buffers can be reused
+	acquire(control, hw);
+	test_frame_in_buffer(control);
+
+	return 0;
+}
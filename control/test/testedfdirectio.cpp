@@ -0,0 +1,173 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+// EDF round-trip with the DIRECT_IO option (and IO_URING if available):
+// with O_DIRECT the header is padded to the 4 KB block size, it must
+// still end with "}\n" and be followed by the intact image.
+// The directory must be on a filesystem supporting O_DIRECT to test the
+// 4 KB padding, tmpfs falls back to buffered writes.
+//
+// usage: testedfdirectio [directory]
+
+#include "lima/CtControl.h"
+#include "lima/CtAcquisition.h"
+#include "lima/CtSaving.h"
+#include "lima/HwSyntheticInterface.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace lima;
+using namespace std;
+
+const int Width = 256, Height = 128;
+const int NbFrames = 6, FramesPerFile = 3;
+const char *Prefix = "edfdirectio_";
+
+bool run_acq(CtControl& ct)
+{
+	ct.prepareAcq();
+	ct.startAcq();
+	for (int i = 0; i < 2000; ++i) {
+		CtControl::Status status;
+		ct.getStatus(status);
+		if (status.AcquisitionStatus == AcqFault)
+			return false;
+		if (status.ImageCounters.LastImageSaved == NbFrames - 1)
+			return true;
+		usleep(5000);
+	}
+	return false;
+}
+
+long header_value(const string& header, const string& key)
+{
+	size_t pos = header.find("\n" + key + " = ");
+	assert(pos != string::npos);
+	return atol(header.c_str() + pos + key.size() + 4);
+}
+
+// the frames of a file: aligned header ending with "}\n", then the ramp
+int check_file(const string& fname, int first_frame, int nb_frames)
+{
+	ifstream f(fname.c_str(), ios::binary);
+	stringstream ss;
+	ss << f.rdbuf();
+	const string content = ss.str();
+
+	size_t offset = 0;
+	for (int i = 0; i < nb_frames; ++i) {
+		assert(content.compare(offset, 2, "{\n") == 0);
+		size_t end = content.find("}\n", offset);
+		assert(end != string::npos);
+		size_t header_size = end + 2 - offset;
+		assert(header_size % 1024 == 0);
+		// only spaces between the last value and the closing brace
+		size_t last = content.find_last_not_of(' ', end - 1);
+		assert(content[last] == '\n');
+
+		const string header = content.substr(offset, header_size);
+		long size = header_value(header, "Size");
+		long frame_nb = header_value(header, "acq_frame_nb");
+		assert(size == Width * Height * 2);
+		assert(frame_nb == first_frame + i);
+		offset += header_size;
+		assert(offset + size <= content.size());
+
+		const unsigned short *p;
+		p = reinterpret_cast<const unsigned short *>(&content[offset]);
+		for (int y = 0; y < Height; ++y)
+			for (int x = 0; x < Width; ++x, ++p)
+				assert(*p == ((x + y + frame_nb) & 0xffff));
+		offset += size;
+		cout << fname << ": frame " << frame_nb << ": "
+		     << "header_size=" << header_size << endl;
+	}
+	assert(offset == content.size());
+	return 0;
+}
+
+void test_options(CtControl& ct, const string& directory,
+		  const string& options)
+{
+	cout << "Options: " << options << endl;
+
+	CtSaving::Parameters pars;
+	ct.saving()->getParameters(pars);
+	pars.directory = directory;
+	pars.prefix = Prefix;
+	pars.suffix = ".edf";
+	pars.options = options;
+	pars.nextNumber = 0;
+	pars.fileFormat = CtSaving::EDF;
+	pars.savingMode = CtSaving::AutoFrame;
+	pars.overwritePolicy = CtSaving::Overwrite;
+	pars.framesPerFile = FramesPerFile;
+	ct.saving()->setParameters(pars);
+
+	bool ok = run_acq(ct);
+	assert(ok);
+
+	for (int i = 0; i < NbFrames / FramesPerFile; ++i) {
+		char fname[64];
+		snprintf(fname, sizeof(fname), "%s%04d.edf", Prefix, i);
+		string path = directory + "/" + fname;
+		check_file(path, i * FramesPerFile, FramesPerFile);
+		unlink(path.c_str());
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	string directory = string((argc > 1) ? argv[1] : ".") +
+			   "/testedfdirectio_data";
+	mkdir(directory.c_str(), 0777);
+
+	HwSyntheticInterface::Config config;
+	config.frame_size = Size(Width, Height);
+	config.image_type = Bpp16;
+	config.pattern = HwSyntheticInterface::Ramp;
+	HwSyntheticInterface hw(config);
+	CtControl ct(&hw);
+	ct.acquisition()->setAcqExpoTime(0.001);
+	ct.acquisition()->setAcqNbFrames(NbFrames);
+
+	try {
+		test_options(ct, directory, "");
+		test_options(ct, directory, "DIRECT_IO");
+		test_options(ct, directory, "DIRECT_IO|IO_URING");
+	} catch (Exception& e) {
+		cerr << "LIMA Exception: " << e.getErrMsg() << endl;
+		return 1;
+	}
+
+	rmdir(directory.c_str());
+	cout << "OK" << endl;
+	return 0;
+}
@@ -0,0 +1,280 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+// Frame ingestion micro-benchmark: several threads push frames through
+// the HwFrameCallback -> CtControl::newFrameReady path as fast as possible,
+// the achieved frame rate is printed for each number of threads.
+// If a directory is given, the RAW and EDF saving throughput is measured
+// with the buffered (stdio), the DIRECT_IO and the IO_URING writers.
+//
+// usage: testframerate [nb_frames [max_nb_threads [saving_dir [width height]]]]
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+#include "lima/HwInterface.h"
+#include "lima/HwDetInfoCtrlObj.h"
+#include "lima/HwSyncCtrlObj.h"
+#include "lima/HwBufferMgr.h"
+#include "lima/CtControl.h"
+#include "lima/CtAcquisition.h"
+#include "lima/CtSaving.h"
+#include "lima/CtBuffer.h"
+#include "lima/Timestamp.h"
+
+using namespace std;
+using namespace lima;
+
+namespace
+{
+
+Size det_size(64, 64);
+const ImageType det_image_type = Bpp16;
+
+class BenchDetInfoCtrlObj : public HwDetInfoCtrlObj
+{
+public:
+	virtual void getMaxImageSize(Size& max_image_size)
+	{ max_image_size = det_size; }
+	virtual void getDetectorImageSize(Size& det_image_size)
+	{ det_image_size = det_size; }
+	virtual void getDefImageType(ImageType& def_image_type)
+	{ def_image_type = det_image_type; }
+	virtual void getCurrImageType(ImageType& curr_image_type)
+	{ curr_image_type = det_image_type; }
+	virtual void setCurrImageType(ImageType curr_image_type)
+	{
+		if (curr_image_type != det_image_type)
+			throw LIMA_HW_EXC(NotSupported, "Invalid image type");
+	}
+	virtual void getPixelSize(double& x_size, double& y_size)
+	{ x_size = y_size = 1e-6; }
+	virtual void getDetectorType(string& det_type)
+	{ det_type = "Bench"; }
+	virtual void getDetectorModel(string& det_model)
+	{ det_model = "FrameRate"; }
+	virtual void registerMaxImageSizeCallback(HwMaxImageSizeCallback&)
+	{}
+	virtual void unregisterMaxImageSizeCallback(HwMaxImageSizeCallback&)
+	{}
+};
+
+class BenchSyncCtrlObj : public HwSyncCtrlObj
+{
+public:
+	BenchSyncCtrlObj() : m_exp_time(1e-6), m_nb_frames(1) {}
+
+	virtual bool checkTrigMode(TrigMode trig_mode)
+	{ return trig_mode == IntTrig; }
+	virtual void setTrigMode(TrigMode trig_mode)
+	{
+		if (!checkTrigMode(trig_mode))
+			throw LIMA_HW_EXC(NotSupported, "Invalid trigger mode");
+	}
+	virtual void getTrigMode(TrigMode& trig_mode)
+	{ trig_mode = IntTrig; }
+	virtual void setExpTime(double exp_time)
+	{ m_exp_time = exp_time; }
+	virtual void getExpTime(double& exp_time)
+	{ exp_time = m_exp_time; }
+	virtual void setLatTime(double)
+	{}
+	virtual void getLatTime(double& lat_time)
+	{ lat_time = 0; }
+	virtual void setNbHwFrames(int nb_frames)
+	{ m_nb_frames = nb_frames; }
+	virtual void getNbHwFrames(int& nb_frames)
+	{ nb_frames = m_nb_frames; }
+	virtual void getValidRanges(ValidRangesType& valid_ranges)
+	{ valid_ranges = ValidRangesType(1e-6, 1e6, 0, 1e6); }
+
+private:
+	double m_exp_time;
+	int m_nb_frames;
+};
+
+class BenchInterface : public HwInterface
+{
+public:
+	BenchInterface()
+	{
+		m_cap_list.push_back(HwCap(&m_det_info));
+		m_cap_list.push_back(HwCap(&m_sync));
+		m_cap_list.push_back(HwCap(&m_buffer));
+	}
+
+	virtual void getCapList(CapList& cap_list) const
+	{ cap_list = m_cap_list; }
+	virtual void reset(ResetLevel)
+	{}
+	virtual void prepareAcq()
+	{}
+	virtual void startAcq()
+	{ m_buffer.getBuffer().setStartTimestamp(Timestamp::now()); }
+	virtual void stopAcq()
+	{}
+	virtual void getStatus(StatusType& status)
+	{
+		status.set(HwInterface::StatusType::Ready);
+	}
+	virtual int getNbHwAcquiredFrames()
+	{ return m_buffer.getNbAcquiredFrames(); }
+
+	// called concurrently by the pushing threads
+	bool pushFrame(int frame_nb)
+	{
+		HwFrameInfoType frame_info;
+		frame_info.acq_frame_nb = frame_nb;
+		return m_buffer.getBuffer().newFrameReady(frame_info);
+	}
+
+private:
+	CapList m_cap_list;
+	BenchDetInfoCtrlObj m_det_info;
+	BenchSyncCtrlObj m_sync;
+	SoftBufferCtrlObj m_buffer;
+};
+
+double run(CtControl& control, BenchInterface& hw, int nb_threads,
+	   int nb_frames, bool saving = false)
+{
+	control.acquisition()->setAcqNbFrames(nb_frames);
+	control.prepareAcq();
+	control.startAcq();
+
+	// when saving, do not overrun the buffers: the writer is the limit
+	long nb_buffers;
+	control.buffer()->getNumber(nb_buffers);
+	long max_pending = saving ? max(nb_buffers / 2, 1L) : 0;
+
+	atomic<int> next_frame(0);
+	auto push_func = [&]() {
+		int frame_nb;
+		while ((frame_nb = next_frame++) < nb_frames) {
+			CtControl::ImageStatus img_status;
+			while (max_pending) {
+				control.getImageStatus(img_status);
+				if (frame_nb - img_status.LastImageSaved <= max_pending)
+					break;
+				this_thread::sleep_for(chrono::microseconds(50));
+			}
+			if (!hw.pushFrame(frame_nb))
+				break;
+		}
+	};
+
+	Timestamp t0 = Timestamp::now();
+	vector<thread> thread_list;
+	for (int i = 0; i < nb_threads; ++i)
+		thread_list.push_back(thread(push_func));
+	for (auto& t : thread_list)
+		t.join();
+
+	CtControl::Status status;
+	do
+		control.getStatus(status);
+	while (status.AcquisitionStatus == AcqRunning);
+	Timestamp elapsed = Timestamp::now() - t0;
+
+	if (status.AcquisitionStatus != AcqReady) {
+		cerr << "Acquisition failed: " << status << endl;
+		exit(1);
+	}
+	const CtControl::ImageStatus& img_status = status.ImageCounters;
+	long last_image = (saving ? img_status.LastImageSaved :
+			   img_status.LastImageReady);
+	if (last_image != nb_frames - 1) {
+		cerr << "Missing frames: " << img_status << endl;
+		exit(1);
+	}
+	return nb_frames / elapsed;
+}
+
+void run_saving(CtControl& control, BenchInterface& hw, int nb_frames,
+		const string& directory)
+{
+	struct {
+		CtSaving::FileFormat format;
+		const char *suffix;
+		const char *options;
+	} configs[] = {
+		{CtSaving::RAW, ".raw", ""},
+		{CtSaving::RAW, ".raw", "DIRECT_IO"},
+		{CtSaving::EDF, ".edf", ""},
+		{CtSaving::EDF, ".edf", "DIRECT_IO"},
+		{CtSaving::RAW, ".raw", "IO_URING"},
+		{CtSaving::RAW, ".raw", "DIRECT_IO|IO_URING"},
+		{CtSaving::EDF, ".edf", "IO_URING"},
+		{CtSaving::EDF, ".edf", "DIRECT_IO|IO_URING"},
+	};
+
+	CtSaving *saving = control.saving();
+	FrameDim frame_dim(det_size, det_image_type);
+	double frame_mb = frame_dim.getMemSize() / 1e6;
+	for (auto& c : configs) {
+		CtSaving::Parameters pars;
+		saving->getParameters(pars);
+		pars.directory = directory;
+		pars.prefix = "testframerate_";
+		pars.suffix = c.suffix;
+		pars.fileFormat = c.format;
+		pars.savingMode = CtSaving::AutoFrame;
+		pars.overwritePolicy = CtSaving::Overwrite;
+		pars.framesPerFile = 100;
+		pars.nextNumber = 0;
+		pars.options = c.options;
+		saving->setParameters(pars);
+
+		double rate = run(control, hw, 1, nb_frames, true);
+		cout << "saving " << c.suffix << " [" << c.options << "]"
+		     << ", frames=" << nb_frames << ": " << rate
+		     << " frames/s, " << rate * frame_mb << " MB/s" << endl;
+	}
+	saving->setSavingMode(CtSaving::Manual);
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+	int nb_frames = (argc > 1) ? atoi(argv[1]) : 50000;
+	int max_nb_threads = (argc > 2) ? atoi(argv[2]) : 8;
+	string saving_dir = (argc > 3) ? argv[3] : "";
+	if (argc > 5)
+		det_size = Size(atoi(argv[4]), atoi(argv[5]));
+
+	BenchInterface hw;
+	CtControl control(&hw);
+
+	for (int nb_threads = 1; nb_threads <= max_nb_threads; nb_threads *= 2) {
+		double rate = run(control, hw, nb_threads, nb_frames);
+		cout << "threads=" << nb_threads << ", frames=" << nb_frames
+		     << ": " << rate << " frames/s" << endl;
+	}
+
+	if (!saving_dir.empty())
+		run_saving(control, hw, nb_frames, saving_dir);
+
+	return 0;
+}
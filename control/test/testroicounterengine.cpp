@@ -0,0 +1,190 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+// Compare the fused ROI counter engine with the per-ROI tasks on the same
+// frame, for the rectangles (overlapping, masked), the arcs (partial,
+// full, clipped by the frame), the LUTs and the LUT masks.
+
+#include "lima/SoftOpExternalMgr.h"
+#include "lima/SizeUtils.h"
+
+#include "processlib/TaskMgr.h"
+
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <map>
+
+using namespace std;
+using namespace lima;
+
+typedef SoftOpRoiCounter::RoiNameAndResults RoiNameAndResults;
+typedef map<string, Tasks::RoiCounterResult> ResultMap;
+
+const int Width = 1024, Height = 768;
+
+Data make_frame(Data::TYPE type, int frame_nb)
+{
+	Data data;
+	data.type = type;
+	data.dimensions.push_back(Width);
+	data.dimensions.push_back(Height);
+	data.frameNumber = frame_nb;
+	Buffer *buffer = new Buffer(data.size());
+	data.setBuffer(buffer);
+	buffer->unref();
+	return data;
+}
+
+Data make_ramp()
+{
+	Data frame = make_frame(Data::UINT16, 0);
+	unsigned short *p = (unsigned short *) frame.data();
+	for (int y = 0; y < Height; ++y)
+		for (int x = 0; x < Width; ++x)
+			*p++ = (x * 7 + y * 13) % 4093;
+	return frame;
+}
+
+// process frame_nb with the op and return its results
+ResultMap process(SoftOpExternalMgr& mgr, SoftOpRoiCounter *roi_op,
+		  Data& frame, int frame_nb)
+{
+	Data data = frame;
+	data.frameNumber = frame_nb;
+
+	TaskMgr task_mgr;
+	task_mgr.setInputData(data);
+	int last_link_task, last_sink_task;
+	mgr.addTo(task_mgr, 0, last_link_task, last_sink_task);
+	task_mgr.syncProcess();
+
+	ResultMap results;
+	list<RoiNameAndResults> counters;
+	roi_op->readCounters(frame_nb, counters);
+	list<RoiNameAndResults>::iterator i, end = counters.end();
+	for (i = counters.begin(); i != end; ++i) {
+		assert(i->second.size() == 1);
+		const Tasks::RoiCounterResult& result = i->second.front();
+		assert(result.frameNumber == frame_nb);
+		results[i->first] = result;
+	}
+	return results;
+}
+
+bool same(double a, double b)
+{
+	return fabs(a - b) <= 1e-9 * max(1., fabs(a));
+}
+
+void compare(const ResultMap& tasks, const ResultMap& fused)
+{
+	assert(tasks.size() == fused.size());
+	ResultMap::const_iterator t, f;
+	for (t = tasks.begin(), f = fused.begin(); t != tasks.end(); ++t, ++f) {
+		assert(t->first == f->first);
+		const Tasks::RoiCounterResult& a = t->second;
+		const Tasks::RoiCounterResult& b = f->second;
+		cout << t->first << ": sum=" << a.sum << "/" << b.sum
+		     << ", average=" << a.average << "/" << b.average
+		     << ", std=" << a.std << "/" << b.std
+		     << ", min=" << a.minValue << "/" << b.minValue
+		     << ", max=" << a.maxValue << "/" << b.maxValue << endl;
+		assert(same(a.sum, b.sum));
+		assert(same(a.average, b.average));
+		assert(same(a.std, b.std));
+		assert(same(a.minValue, b.minValue));
+		assert(same(a.maxValue, b.maxValue));
+	}
+}
+
+void test_engine(SoftOpExternalMgr& mgr, SoftOpRoiCounter *roi_op,
+		 Data& frame, int& frame_nb)
+{
+	roi_op->setFusedEngine(false);
+	ResultMap tasks = process(mgr, roi_op, frame, frame_nb++);
+	roi_op->setFusedEngine(true);
+	ResultMap fused = process(mgr, roi_op, frame, frame_nb++);
+	compare(tasks, fused);
+}
+
+int main(int /*argc*/, char * /*argv*/ [])
+{
+	SoftOpExternalMgr mgr;
+	SoftOpInstance roi_op_inst;
+	mgr.addOp(ROICOUNTERS, "RoiCounters", 0, roi_op_inst);
+	SoftOpRoiCounter *roi_op;
+	roi_op = static_cast<SoftOpRoiCounter *>(roi_op_inst.m_opt);
+	roi_op->setBufferSize(16);
+	mgr.prepare();
+
+	list<SoftOpRoiCounter::RoiNameAndRoi> rois;
+	rois.push_back(make_pair(string("rect"), Roi(10, 20, 300, 200)));
+	rois.push_back(make_pair(string("overlap"), Roi(200, 100, 400, 400)));
+	rois.push_back(make_pair(string("corner"), Roi(824, 568, 200, 200)));
+	rois.push_back(make_pair(string("full"), Roi(0, 0, Width, Height)));
+	roi_op->updateRois(rois);
+
+	list<SoftOpRoiCounter::RoiNameAndArcRoi> arcs;
+	arcs.push_back(make_pair(string("arc"),
+				 ArcRoi(512, 384, 50, 200, 30, 250)));
+	arcs.push_back(make_pair(string("arc_full"),
+				 ArcRoi(300.5, 200.5, 0, 80, 0, 360)));
+	arcs.push_back(make_pair(string("arc_edge"),
+				 ArcRoi(1000, 20, 10, 120, -90, 45)));
+	roi_op->updateArcRois(arcs);
+
+	Data lut = make_frame(Data::FLOAT, 0);
+	lut.dimensions[0] = lut.dimensions[1] = 64;
+	float *w = (float *) lut.data();
+	for (int i = 0; i < 64 * 64; ++i)
+		w[i] = (i % 5) * 0.25;
+	roi_op->setLut("lut", Point(100, 500), lut);
+	// across the masked column band
+	roi_op->setLut("lut_band", Point(230, 300), lut);
+
+	Data lut_mask = make_frame(Data::UINT8, 0);
+	lut_mask.dimensions[0] = 100;
+	lut_mask.dimensions[1] = 50;
+	unsigned char *lm = (unsigned char *) lut_mask.data();
+	for (int i = 0; i < 100 * 50; ++i)
+		lm[i] = ((i % 100) / 10 + (i / 100) / 10) % 2;
+	roi_op->setLutMask("lut_mask", Point(200, 650), lut_mask);
+
+	Data frame = make_ramp();
+	int frame_nb = 0;
+	cout << "Without mask" << endl;
+	test_engine(mgr, roi_op, frame, frame_nb);
+
+	// mask out a column band and a block of pixels
+	Data mask = make_frame(Data::UINT8, 0);
+	unsigned char *m = (unsigned char *) mask.data();
+	for (int y = 0; y < Height; ++y)
+		for (int x = 0; x < Width; ++x)
+			*m++ = !(((x >= 250) && (x < 260)) ||
+				 ((x >= 900) && (y >= 700)));
+	roi_op->setMask(mask);
+	cout << "With mask" << endl;
+	test_engine(mgr, roi_op, frame, frame_nb);
+
+	cout << "OK" << endl;
+	return 0;
+}
@@ -0,0 +1,144 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+// SavingFrameHeader semantics, plus a comparison with the HeaderMap
+// per-frame store: nb_frames headers of nb_keys motor positions.
+//
+// usage: testsavingheader [nb_frames [nb_keys]]
+
+#include "lima/CtSaving_Header.h"
+#include "lima/Timestamp.h"
+
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+using namespace lima;
+using namespace std;
+
+typedef SavingFrameHeader::HeaderMap HeaderMap;
+
+void test_header()
+{
+	SavingFrameHeader::KeysRef keys = make_shared<SavingHeaderKeys>();
+	SavingFrameHeader h(keys);
+	assert(h.empty());
+
+	h.set(keys->intern("b"), "2");
+	h.set(keys->intern("a"), "1");
+	h.set(keys->intern("b"), "22", false);	// kept
+	h.set(keys->intern("a"), "x");		// replaced in place
+	h.set(keys->intern("c"), "333");
+	h.set(keys->intern("c"), "3333");	// appended
+	assert(h.size() == 3);
+	assert(keys->size() == 3);
+
+	HeaderMap header;
+	header["a"] = "common";
+	header["d"] = "4";
+	HeaderMap kept(header);
+	h.get(kept, false);
+	assert(kept["a"] == "common");
+	h.get(header);
+	assert(header.size() == 4);
+	assert(header["a"] == "x" && header["b"] == "2");
+	assert(header["c"] == "3333" && header["d"] == "4");
+
+	// the dead values are eventually dropped
+	string big(3000, 'v');
+	for (int i = 0; i < 10; ++i)
+		h.set(keys->intern("big"), big + char('0' + i));
+	HeaderMap last;
+	h.get(last);
+	assert(last["big"] == big + '9');
+	assert(last["a"] == "x" && last["c"] == "3333");
+
+	// a moved-out header keeps its key names
+	SavingFrameHeader moved = std::move(h);
+	keys.reset();
+	HeaderMap after;
+	moved.get(after);
+	assert(after == last);
+}
+
+void benchmark(int nb_frames, int nb_keys)
+{
+	vector<string> names;
+	for (int k = 0; k < nb_keys; ++k) {
+		ostringstream os;
+		os << "motor_position_" << k;
+		names.push_back(os.str());
+	}
+	vector<string> values;
+	for (int k = 0; k < nb_keys; ++k)
+		values.push_back(to_string(k * 1.2345));
+
+	Timestamp t0 = Timestamp::now();
+	map<long, HeaderMap> map_store;
+	for (int f = 0; f < nb_frames; ++f) {
+		HeaderMap& h = map_store[f];
+		for (int k = 0; k < nb_keys; ++k)
+			h[names[k]] = values[k];
+	}
+	for (int f = 0; f < nb_frames; ++f) {
+		HeaderMap h = map_store[f];
+		map_store.erase(f);
+	}
+	double map_time = Timestamp::now() - t0;
+
+	t0 = Timestamp::now();
+	SavingFrameHeader::KeysRef keys = make_shared<SavingHeaderKeys>();
+	vector<SavingHeaderKeys::Key> key_list;
+	for (int k = 0; k < nb_keys; ++k)
+		key_list.push_back(keys->intern(names[k]));
+	map<long, SavingFrameHeader> store;
+	for (int f = 0; f < nb_frames; ++f) {
+		SavingFrameHeader& h = store.insert(
+			make_pair(long(f), SavingFrameHeader(keys))).first->second;
+		for (int k = 0; k < nb_keys; ++k)
+			h.set(key_list[k], values[k]);
+	}
+	double store_time = Timestamp::now() - t0;
+	for (int f = 0; f < nb_frames; ++f) {
+		SavingFrameHeader h = std::move(store[f]);
+		store.erase(f);
+	}
+	double total_time = Timestamp::now() - t0;
+	double take_time = total_time - store_time;
+
+	cout << nb_frames << " frames x " << nb_keys << " keys: "
+	     << "HeaderMap=" << map_time / nb_frames * 1e6 << " us/frame, "
+	     << "SavingFrameHeader=" << total_time / nb_frames * 1e6
+	     << " us/frame (take " << take_time / nb_frames * 1e6 << " us)"
+	     << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	int nb_frames = (argc > 1) ? atoi(argv[1]) : 10000;
+	int nb_keys = (argc > 2) ? atoi(argv[2]) : 50;
+
+	test_header();
+	benchmark(nb_frames, nb_keys);
+
+	return 0;
+}
@@ -0,0 +1,350 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+// Striped saving: the files are distributed over several directories,
+// RoundRobin puts file N in stripe N % nb_stripes, LeastQueue in the
+// least busy one. The <prefix>stripes.idx index must match the files and
+// be rewritten by each acquisition in Overwrite mode, with the frames of
+// each file: the last one only holds the remaining frames.
+// The stripeMaxWritingTasks limit is checked with inotify: a stripe never
+// has more files open at the same time.
+//
+// usage: testsavingstripes [directory]
+
+#include "lima/CtControl.h"
+#include "lima/CtAcquisition.h"
+#include "lima/CtSaving.h"
+#include "lima/HwSyntheticInterface.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+using namespace lima;
+using namespace std;
+
+const int NbFrames = 12;
+const char *Prefix = "stripes_";
+
+struct IndexEntry
+{
+	long file_nb;
+	int stripe;
+	string filename;
+	long first_frame;
+	long nb_frames;
+};
+
+string stripe_dir(const string& directory, int stripe)
+{
+	ostringstream os;
+	os << directory << "/stripe" << stripe;
+	return os.str();
+}
+
+string file_name(long file_nb)
+{
+	char fname[64];
+	snprintf(fname, sizeof(fname), "%s%04ld.edf", Prefix, file_nb);
+	return fname;
+}
+
+bool exists(const string& path)
+{
+	return access(path.c_str(), F_OK) == 0;
+}
+
+#ifdef __linux__
+/// @brief open files per stripe directory, from the inotify events
+class OpenFileWatch
+{
+public:
+	OpenFileWatch(const vector<string>& dirs) :
+		m_nb_open(dirs.size()), m_max_open(dirs.size())
+	{
+		m_fd = inotify_init1(IN_NONBLOCK);
+		assert(m_fd >= 0);
+		for (size_t i = 0; i < dirs.size(); ++i) {
+			int wd = inotify_add_watch(m_fd, dirs[i].c_str(),
+						   IN_OPEN | IN_CLOSE_WRITE);
+			assert(wd >= 0);
+			m_stripes[wd] = i;
+		}
+	}
+
+	~OpenFileWatch()
+	{
+		close(m_fd);
+	}
+
+	void read()
+	{
+		char buffer[4096]
+			__attribute__((aligned(__alignof__(inotify_event))));
+		ssize_t len;
+		while ((len = ::read(m_fd, buffer, sizeof(buffer))) > 0) {
+			for (char *p = buffer; p < buffer + len;) {
+				inotify_event *event = (inotify_event *) p;
+				_event(*event);
+				p += sizeof(inotify_event) + event->len;
+			}
+		}
+	}
+
+	int maxOpen(int stripe) const
+	{
+		return m_max_open[stripe];
+	}
+
+private:
+	void _event(const inotify_event& event)
+	{
+		string name = event.len ? event.name : "";
+		if (name.find(".edf") == string::npos)
+			return;
+		int stripe = m_stripes[event.wd];
+		if (event.mask & IN_OPEN)
+			++m_nb_open[stripe];
+		if (event.mask & IN_CLOSE_WRITE)
+			--m_nb_open[stripe];
+		m_max_open[stripe] = max(m_max_open[stripe], m_nb_open[stripe]);
+	}
+
+	int m_fd;
+	map<int, int> m_stripes;
+	vector<int> m_nb_open;
+	vector<int> m_max_open;
+};
+#endif
+
+vector<IndexEntry> read_index(const string& directory)
+{
+	ifstream f((directory + "/" + Prefix + "stripes.idx").c_str());
+	assert(f);
+	vector<IndexEntry> entries;
+	string line;
+	getline(f, line);
+	assert(line == "# file_nb stripe filename first_frame nb_frames");
+	while (getline(f, line)) {
+		assert(line[0] != '#');
+		IndexEntry e;
+		istringstream is(line);
+		is >> e.file_nb >> e.stripe >> e.filename >> e.first_frame
+		   >> e.nb_frames;
+		assert(!is.fail());
+		entries.push_back(e);
+	}
+	return entries;
+}
+
+void save(CtControl& ct, const string& directory, int nb_stripes,
+	  CtSaving::StripePolicy policy, long max_tasks,
+	  long frames_per_file = 1)
+{
+	CtSaving *saving = ct.saving();
+	CtSaving::Parameters pars;
+	saving->getParameters(pars);
+	pars.directory = directory;
+	pars.prefix = Prefix;
+	pars.suffix = ".edf";
+	pars.nextNumber = 0;
+	pars.fileFormat = CtSaving::EDF;
+	pars.savingMode = CtSaving::AutoFrame;
+	pars.overwritePolicy = CtSaving::Overwrite;
+	pars.framesPerFile = frames_per_file;
+	saving->setParameters(pars);
+
+	vector<string> dirs;
+	for (int i = 0; i < nb_stripes; ++i)
+		dirs.push_back(stripe_dir(directory, i));
+	saving->setStripeDirectories(dirs);
+	saving->setStripePolicy(policy);
+	saving->setStripeMaxWritingTasks(max_tasks);
+	long check_max_tasks;
+	saving->getStripeMaxWritingTasks(check_max_tasks);
+	assert(check_max_tasks == max_tasks);
+	saving->setMaxConcurrentWritingTask(4);
+
+#ifdef __linux__
+	OpenFileWatch watch(dirs);
+#endif
+	ct.prepareAcq();
+	ct.startAcq();
+	bool done = false;
+	for (int i = 0; !done && (i < 2000); ++i) {
+		CtControl::Status status;
+		ct.getStatus(status);
+		assert(status.AcquisitionStatus != AcqFault);
+		done = (status.ImageCounters.LastImageSaved == NbFrames - 1);
+		usleep(5000);
+#ifdef __linux__
+		watch.read();
+#endif
+	}
+	assert(done);
+
+#ifdef __linux__
+	watch.read();
+	for (int i = 0; i < nb_stripes; ++i) {
+		cout << "stripe " << i << ": max open files "
+		     << watch.maxOpen(i) << endl;
+		if (max_tasks)
+			assert(watch.maxOpen(i) <= max_tasks);
+	}
+#endif
+}
+
+// check the index against the files, return the file stripes
+vector<int> check_files(const string& directory, int nb_stripes,
+			long frames_per_file = 1)
+{
+	long nb_files = (NbFrames + frames_per_file - 1) / frames_per_file;
+	vector<IndexEntry> entries = read_index(directory);
+	assert(entries.size() == size_t(nb_files));
+
+	vector<int> stripes(nb_files, -1);
+	for (size_t i = 0; i < entries.size(); ++i) {
+		const IndexEntry& e = entries[i];
+		assert((e.file_nb >= 0) && (e.file_nb < nb_files));
+		assert(stripes[e.file_nb] < 0);
+		assert((e.stripe >= 0) && (e.stripe < nb_stripes));
+		long first_frame = e.file_nb * frames_per_file;
+		long nb_frames = min(frames_per_file, NbFrames - first_frame);
+		cout << "file " << e.file_nb << ": first_frame " << e.first_frame
+		     << ", nb_frames " << e.nb_frames << endl;
+		assert(e.first_frame == first_frame);
+		assert(e.nb_frames == nb_frames);
+		string path = stripe_dir(directory, e.stripe) + "/" +
+			      file_name(e.file_nb);
+		assert(e.filename == path);
+		stripes[e.file_nb] = e.stripe;
+	}
+
+	// each file is only in its stripe directory
+	for (long f = 0; f < nb_files; ++f)
+		for (int s = 0; s < nb_stripes; ++s) {
+			string path = stripe_dir(directory, s) + "/" +
+				      file_name(f);
+			assert(exists(path) == (s == stripes[f]));
+		}
+	return stripes;
+}
+
+void cleanup(const string& directory, int nb_stripes)
+{
+	for (int s = 0; s < nb_stripes; ++s) {
+		for (long f = 0; f < NbFrames; ++f) {
+			string path = stripe_dir(directory, s) + "/" +
+				      file_name(f);
+			unlink(path.c_str());
+		}
+		rmdir(stripe_dir(directory, s).c_str());
+	}
+	unlink((directory + "/" + Prefix + "stripes.idx").c_str());
+	rmdir(directory.c_str());
+}
+
+void test_round_robin(CtControl& ct, const string& directory)
+{
+	cout << "RoundRobin" << endl;
+	const int nb_stripes = 3;
+	// twice: the index is rewritten by the Overwrite acquisition
+	for (int i = 0; i < 2; ++i) {
+		save(ct, directory, nb_stripes, CtSaving::RoundRobin, 0);
+		vector<int> stripes = check_files(directory, nb_stripes);
+		for (int f = 0; f < NbFrames; ++f)
+			assert(stripes[f] == f % nb_stripes);
+	}
+}
+
+void test_least_queue(CtControl& ct, const string& directory)
+{
+	cout << "LeastQueue" << endl;
+	const int nb_stripes = 2;
+	save(ct, directory, nb_stripes, CtSaving::LeastQueue, 1);
+	check_files(directory, nb_stripes);
+}
+
+void test_frames_per_file(CtControl& ct, const string& directory)
+{
+	cout << "FramesPerFile" << endl;
+	const int nb_stripes = 2;
+	// NbFrames is not a multiple of the frames per file
+	const long frames_per_file = 5;
+	save(ct, directory, nb_stripes, CtSaving::RoundRobin, 0,
+	     frames_per_file);
+	vector<int> stripes = check_files(directory, nb_stripes,
+					  frames_per_file);
+	for (size_t f = 0; f < stripes.size(); ++f)
+		assert(stripes[f] == int(f % nb_stripes));
+}
+
+int main(int argc, char *argv[])
+{
+	string directory = string((argc > 1) ? argv[1] : ".") +
+			   "/testsavingstripes_data";
+	mkdir(directory.c_str(), 0777);
+	for (int s = 0; s < 3; ++s)
+		mkdir(stripe_dir(directory, s).c_str(), 0777);
+
+	HwSyntheticInterface::Config config;
+	config.frame_size = Size(1024, 1024);
+	config.image_type = Bpp16;
+	config.pattern = HwSyntheticInterface::Ramp;
+	HwSyntheticInterface hw(config);
+	CtControl ct(&hw);
+	ct.acquisition()->setAcqExpoTime(0.001);
+	ct.acquisition()->setAcqNbFrames(NbFrames);
+
+	try {
+		test_round_robin(ct, directory);
+		cleanup(directory, 3);
+		mkdir(directory.c_str(), 0777);
+		for (int s = 0; s < 2; ++s)
+			mkdir(stripe_dir(directory, s).c_str(), 0777);
+		test_least_queue(ct, directory);
+		cleanup(directory, 2);
+		mkdir(directory.c_str(), 0777);
+		for (int s = 0; s < 2; ++s)
+			mkdir(stripe_dir(directory, s).c_str(), 0777);
+		test_frames_per_file(ct, directory);
+		cleanup(directory, 2);
+	} catch (Exception& e) {
+		cerr << "LIMA Exception: " << e.getErrMsg() << endl;
+		return 1;
+	}
+
+	cout << "OK" << endl;
+	return 0;
+}
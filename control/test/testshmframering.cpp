@@ -0,0 +1,139 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+// ShmBufferAllocMgr frame ring followed by a ShmFrameRingReader in a
+// child process: the frames read must be intact or reported as
+// overwritten, and the reader must see the ring replaced on realloc.
+//
+// usage: testshmframering [nb_frames [nb_buffers]]
+
+#include "lima/HwBufferMgr.h"
+#include "lima/HwShmFrameRing.h"
+
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace lima;
+using namespace std;
+
+const char *RingName = "testshmframering";
+const FrameDim FDim(Size(256, 256), Bpp16);
+
+// the frame number in every pixel, checked on a few of them
+int run_reader(int nb_frames, int nb_buffers)
+{
+	ShmFrameRingReader reader(RingName);
+	reader.open();
+	assert(reader.getFrameDim() == FDim);
+	assert(reader.getNbBuffers() == nb_buffers);
+
+	int nb_ok = 0, nb_overwritten = 0, nb_bad = 0;
+	long frame_nb = 0;
+	while (frame_nb < nb_frames) {
+		ShmFrameRingReader::Frame frame;
+		ShmFrameRingReader::Status status;
+		status = reader.waitFrame(frame_nb, frame, 5.0);
+		if (status == ShmFrameRingReader::Overwritten) {
+			++nb_overwritten;
+			frame_nb = reader.getLastFrameNb();
+			continue;
+		} else if (status != ShmFrameRingReader::Ok) {
+			cerr << "Reader: frame " << frame_nb << ": "
+			     << status << endl;
+			return 1;
+		}
+
+		// a slow consumer from time to time
+		if (frame.frame_nb % 100 == 0)
+			usleep(2000);
+		const unsigned short *ptr;
+		ptr = static_cast<const unsigned short *>(frame.ptr);
+		bool good = true;
+		for (int i = 0; i < FDim.getSize().getWidth(); i += 17)
+			good &= (ptr[i * 255] == (frame.frame_nb & 0xffff));
+		if (reader.checkFrame(frame) != ShmFrameRingReader::Ok)
+			++nb_overwritten;
+		else if (!good)
+			++nb_bad;
+		else
+			++nb_ok;
+		frame_nb = frame.frame_nb + 1;
+	}
+	cout << "Reader: " << DEB_VAR3(nb_ok, nb_overwritten, nb_bad) << endl;
+
+	// the writer reallocates the buffers
+	ShmFrameRingReader::Frame frame;
+	ShmFrameRingReader::Status status = reader.waitFrame(nb_frames, frame, 5.0);
+	if (status != ShmFrameRingReader::Stale) {
+		cerr << "Reader: expected Stale, got " << status << endl;
+		return 1;
+	}
+	return (nb_bad == 0) ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+	int nb_frames = (argc > 1) ? atoi(argv[1]) : 2000;
+	int nb_buffers = (argc > 2) ? atoi(argv[2]) : 8;
+
+	SoftBufferCtrlObj buffer_ctrl_obj(new ShmBufferAllocMgr(RingName));
+	BufferHelper::Parameters params;
+	params.reqMemSizePercent = 10;
+	buffer_ctrl_obj.setAllocParameters(params);
+	buffer_ctrl_obj.setFrameDim(FDim);
+	buffer_ctrl_obj.setNbBuffers(nb_buffers);
+	StdBufferCbMgr& buffer_mgr = buffer_ctrl_obj.getBuffer();
+
+	pid_t pid = fork();
+	if (pid == 0)
+		_exit(run_reader(nb_frames, nb_buffers));
+
+	// let the reader open the ring
+	usleep(200000);
+	buffer_mgr.setStartTimestamp(Timestamp::now());
+	int nb_pixels = FDim.getSize().getWidth() * FDim.getSize().getHeight();
+	for (int i = 0; i < nb_frames; ++i) {
+		int buffer_nb, concat_frame_nb;
+		buffer_mgr.acqFrameNb2BufferNb(i, buffer_nb, concat_frame_nb);
+		void *p = buffer_mgr.getBufferPtr(buffer_nb, concat_frame_nb);
+		unsigned short *ptr = static_cast<unsigned short *>(p);
+		for (int j = 0; j < nb_pixels; ++j)
+			ptr[j] = i;
+		HwFrameInfoType frame_info;
+		frame_info.acq_frame_nb = i;
+		buffer_mgr.newFrameReady(frame_info);
+		if (i % 4 == 0)
+			usleep(50);
+	}
+
+	usleep(100000);
+	buffer_ctrl_obj.setNbBuffers(nb_buffers / 2);
+
+	int status;
+	waitpid(pid, &status, 0);
+	bool ok = WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+	cout << (ok ? "OK" : "FAILED") << endl;
+	return ok ? 0 : 1;
+}
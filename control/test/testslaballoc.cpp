@@ -0,0 +1,168 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+// SoftBufferAllocMgr with the slabAlloc parameter: the buffers are
+// views into a single allocation, shrinking and growing
+// back within the slab keeps them (and their contents) in place, and
+// clearAllBuffers zeroes the whole slab.
+
+#include "lima/HwBufferMgr.h"
+#include "lima/MemUtils.h"
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+using namespace lima;
+using namespace std;
+
+// not a multiple of the page size: the stride is rounded up
+const FrameDim FDim(Size(100, 30), Bpp16);
+
+size_t slab_stride()
+{
+	int page_size;
+	GetPageSize(page_size);
+	return (FDim.getMemSize() + page_size - 1) / page_size * page_size;
+}
+
+vector<char *> get_buffers(SoftBufferAllocMgr& mgr)
+{
+	int nb_buffers;
+	mgr.getNbBuffers(nb_buffers);
+	vector<char *> buffers;
+	for (int i = 0; i < nb_buffers; ++i)
+		buffers.push_back((char *) mgr.getBufferPtr(i));
+	return buffers;
+}
+
+// consecutive buffers in a single allocation, a page-rounded stride apart
+void check_slab_views(const vector<char *>& buffers)
+{
+	size_t stride = slab_stride();
+	assert(((unsigned long) buffers[0] % 16) == 0);
+	for (size_t i = 1; i < buffers.size(); ++i)
+		assert(buffers[i] == buffers[0] + i * stride);
+}
+
+void fill_buffer(char *ptr, int buffer_nb)
+{
+	memset(ptr, buffer_nb + 1, FDim.getMemSize());
+}
+
+bool check_buffer(const char *ptr, int val, size_t size)
+{
+	for (size_t i = 0; i < size; ++i)
+		if (ptr[i] != val)
+			return false;
+	return true;
+}
+
+void set_slab_alloc(SoftBufferAllocMgr& mgr, bool slab_alloc)
+{
+	BufferAllocMgr::AllocParameters params;
+	mgr.getAllocParameters(params);
+	params.slabAlloc = slab_alloc;
+	params.initMem = true;
+	params.reqMemSizePercent = 10.0;
+	mgr.setAllocParameters(params);
+}
+
+void test_views(SoftBufferAllocMgr& mgr)
+{
+	mgr.allocBuffers(8, FDim);
+	vector<char *> buffers = get_buffers(mgr);
+	assert(buffers.size() == 8);
+	check_slab_views(buffers);
+	// initMem: the whole slab, padding included, is cleared
+	for (int i = 0; i < 8; ++i)
+		assert(check_buffer(buffers[i], 0, slab_stride()));
+	cout << "buffer views into the slab: OK" << endl;
+}
+
+void test_shrink_grow(SoftBufferAllocMgr& mgr)
+{
+	mgr.allocBuffers(8, FDim);
+	vector<char *> buffers = get_buffers(mgr);
+	for (int i = 0; i < 8; ++i)
+		fill_buffer(buffers[i], i);
+
+	// neither a new slab nor a new initialisation
+	mgr.allocBuffers(4, FDim);
+	vector<char *> shrunk = get_buffers(mgr);
+	assert(shrunk.size() == 4);
+	for (int i = 0; i < 4; ++i) {
+		assert(shrunk[i] == buffers[i]);
+		assert(check_buffer(shrunk[i], i + 1, FDim.getMemSize()));
+	}
+
+	mgr.allocBuffers(8, FDim);
+	vector<char *> grown = get_buffers(mgr);
+	assert(grown == buffers);
+	for (int i = 0; i < 8; ++i)
+		assert(check_buffer(grown[i], i + 1, FDim.getMemSize()));
+
+	// beyond the slab: reallocated and cleared
+	mgr.allocBuffers(12, FDim);
+	vector<char *> bigger = get_buffers(mgr);
+	assert(bigger.size() == 12);
+	check_slab_views(bigger);
+	for (int i = 0; i < 12; ++i)
+		assert(check_buffer(bigger[i], 0, FDim.getMemSize()));
+	cout << "shrink/grow within the slab: OK" << endl;
+}
+
+void test_clear(SoftBufferAllocMgr& mgr)
+{
+	mgr.allocBuffers(6, FDim);
+	vector<char *> buffers = get_buffers(mgr);
+	size_t stride = slab_stride();
+	for (int i = 0; i < 6; ++i)
+		memset(buffers[i], 0xff, stride);
+
+	mgr.clearAllBuffers();
+	for (int i = 0; i < 6; ++i)
+		assert(check_buffer(buffers[i], 0, stride));
+	assert(get_buffers(mgr) == buffers);
+	cout << "clearAllBuffers: OK" << endl;
+}
+
+int main()
+{
+	SoftBufferAllocMgr mgr;
+	set_slab_alloc(mgr, true);
+
+	test_views(mgr);
+	test_shrink_grow(mgr);
+	test_clear(mgr);
+
+	// back to one allocation per buffer
+	set_slab_alloc(mgr, false);
+	mgr.allocBuffers(4, FDim);
+	vector<char *> buffers = get_buffers(mgr);
+	assert(buffers.size() == 4);
+	mgr.clearAllBuffers();
+	for (int i = 0; i < 4; ++i)
+		assert(check_buffer(buffers[i], 0, FDim.getMemSize()));
+
+	return 0;
+}
@@ -0,0 +1,222 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+// End-to-end throughput benchmark: the HwSyntheticInterface feeds the
+// control layer at the requested rate (as fast as possible by default),
+// through the buffers, the optional ROI counters, the compression and
+// the saving. CtTestApp reports the sustained frames/s and GB/s of each
+// stage; with --bench-saving-formats the sequences cycle over the formats.
+//
+// usage: testsyntheticbench [--det-frame-size 2048x2048]
+//                           [--det-image-type Bpp16] [--det-pattern Noise]
+//                           [--det-nb-prerendered 16]
+//                           [--bench-nb-roi-counters 8]
+//                           [--bench-saving-formats EDF,EDFLZ4,HDF5BS]
+//                           [--saving-directory /tmp/bench]
+//                           [--acq-nb-frames 10000] [--test-nb-seq 3] ...
+
+#include "lima/CtTestApp.h"
+#include "lima/HwSyntheticInterface.h"
+#include "lima/SoftOpExternalMgr.h"
+
+#include <sstream>
+
+using namespace std;
+using namespace lima;
+
+DEB_GLOBAL(DebModTest);
+
+class SyntheticBenchApp : public CtTestApp
+{
+	DEB_CLASS_NAMESPC(DebModTest, "SyntheticBenchApp", "Control");
+
+ public:
+	class Pars : public CtTestApp::Pars
+	{
+		DEB_CLASS_NAMESPC(DebModTest, "SyntheticBenchApp::Pars",
+				  "Control");
+	public:
+		Size det_frame_size{512, 512};
+		ImageType det_image_type{Bpp16};
+		HwSyntheticInterface::Pattern det_pattern{
+			HwSyntheticInterface::Ramp
+		};
+		int det_nb_prerendered{0};
+
+		int bench_nb_roi_counters{0};
+		std::string bench_saving_formats;
+
+		Pars();
+	};
+
+	SyntheticBenchApp(int argc, char *argv[]) : CtTestApp(argc, argv) {}
+
+ protected:
+	virtual CtTestApp::Pars *getPars();
+	virtual CtControl *getCtControl();
+	virtual index_map getIndexMap() { return index_map(); }
+	virtual void configureAcq(const index_map& indexes);
+
+	AutoPtr<Pars> m_bench_pars;
+	AutoPtr<HwSyntheticInterface> m_interface;
+	AutoPtr<CtControl> m_ct;
+	vector<CtSaving::FileFormat> m_saving_formats;
+};
+
+SyntheticBenchApp::Pars::Pars()
+{
+	DEB_CONSTRUCTOR();
+
+	// free-running and no saving, unless requested
+	acq_expo_time = 0;
+	acq_nb_frames = {1000};
+	saving_mode = CtSaving::Manual;
+	buffer_alloc_params.reqMemSizePercent = 10.0;
+	test_acq_loop_wait_time = 1e-3;
+	test_acq_loop_display_time = 1.0;
+
+#define AddOpt(var, opt, par) \
+	m_opt_list.insert(MakeOpt(var, "", opt, par))
+
+	AddOpt(det_frame_size, "--det-frame-size", "frame size [WxH]");
+
+	AddOpt(det_image_type, "--det-image-type", "image type");
+
+	AddOpt(det_pattern, "--det-pattern",
+	       "pattern: Zero | FrameNb | Ramp | Noise");
+
+	AddOpt(det_nb_prerendered, "--det-nb-prerendered",
+	       "number of pre-rendered frames (0: render each frame)");
+
+	AddOpt(bench_nb_roi_counters, "--bench-nb-roi-counters",
+	       "number of ROI counters");
+
+	AddOpt(bench_saving_formats, "--bench-saving-formats",
+	       "comma-separated saving formats, one per sequence");
+}
+
+CtTestApp::Pars *SyntheticBenchApp::getPars()
+{
+	m_bench_pars = new Pars();
+	return m_bench_pars;
+}
+
+CtControl *SyntheticBenchApp::getCtControl()
+{
+	DEB_MEMBER_FUNCT();
+
+	HwSyntheticInterface::Config config;
+	config.frame_size = m_bench_pars->det_frame_size;
+	config.image_type = m_bench_pars->det_image_type;
+	config.pattern = m_bench_pars->det_pattern;
+	config.nb_prerendered = m_bench_pars->det_nb_prerendered;
+	DEB_ALWAYS() << DEB_VAR4(config.frame_size, config.image_type,
+				 config.pattern, config.nb_prerendered);
+	m_interface = new HwSyntheticInterface(config);
+	m_ct = new CtControl(m_interface);
+
+	istringstream is(m_bench_pars->bench_saving_formats);
+	string s;
+	while (getline(is, s, ',')) {
+		CtSaving::FileFormat format;
+		convert_from_string(s, format);
+		m_saving_formats.push_back(format);
+	}
+
+	int nb_rois = m_bench_pars->bench_nb_roi_counters;
+	if (nb_rois > 0) {
+		// ROIs of 1/4 of the frame, spread along the diagonal
+		const Size& frame_size = config.frame_size;
+		Size roi_size = frame_size / Point(2, 2);
+		Point range = Point(frame_size) - Point(roi_size);
+		list<SoftOpRoiCounter::RoiNameAndRoi> roi_list;
+		for (int i = 0; i < nb_rois; ++i) {
+			ostringstream os;
+			os << "roi" << i;
+			Point top_left = range * Point(i, i) / Point(nb_rois, nb_rois);
+			roi_list.push_back({os.str(), Roi(top_left, roi_size)});
+		}
+		SoftOpInstance op;
+		m_ct->externalOperation()->addOp(ROICOUNTERS, "bench_rois", 0,
+						 op);
+		SoftOpRoiCounter *roi_counter =
+			static_cast<SoftOpRoiCounter *>(op.m_opt);
+		roi_counter->updateRois(roi_list);
+	}
+
+	return m_ct;
+}
+
+void SyntheticBenchApp::configureAcq(const index_map& indexes)
+{
+	DEB_MEMBER_FUNCT();
+
+	if (m_saving_formats.empty())
+		return;
+
+	int nb_formats = m_saving_formats.size();
+	CtSaving::FileFormat format = m_saving_formats[indexes.at("acq") %
+						       nb_formats];
+	string suffix;
+	switch (format) {
+	case CtSaving::RAW:		suffix = ".raw";	break;
+	case CtSaving::EDF:		suffix = ".edf";	break;
+	case CtSaving::EDFGZ:		suffix = ".edf.gz";	break;
+	case CtSaving::EDFLZ4:		suffix = ".edf.lz4";	break;
+	case CtSaving::CBFFormat:
+	case CtSaving::CBFMiniHeader:	suffix = ".cbf";	break;
+	case CtSaving::TIFFFormat:	suffix = ".tiff";	break;
+	default:			suffix = ".h5";
+	}
+	DEB_ALWAYS() << "Saving " << DEB_VAR2(format, suffix);
+
+	// CtTestApp::runAcq reports the saving stage in AutoFrame mode
+	m_pars->saving_mode = CtSaving::AutoFrame;
+	m_pars->saving_suffix = suffix;
+
+	CtSaving::Parameters pars;
+	CtSaving *save = m_ct->saving();
+	save->getParameters(pars);
+	pars.savingMode = CtSaving::AutoFrame;
+	pars.directory = m_pars->saving_directory;
+	pars.prefix = m_pars->saving_prefix;
+	pars.suffix = suffix;
+	pars.fileFormat = format;
+	pars.nextNumber = m_pars->saving_next_number;
+	pars.framesPerFile = m_pars->saving_frames_per_file;
+	pars.overwritePolicy = m_pars->saving_overwrite_policy;
+	save->setParameters(pars);
+}
+
+int main(int argc, char *argv[])
+{
+	DEB_GLOBAL_FUNCT();
+
+	try {
+		SyntheticBenchApp app(argc, argv);
+		app.run();
+	} catch (Exception& e) {
+		DEB_ERROR() << "LIMA Exception: " << e.getErrMsg();
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,243 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+// HwTmpfsBufferMgr in MMap read mode: the frame is served from a private
+// mapping of its file, unmapped when the last Data on it is released or,
+// for the frames that never reached a Data, on releaseAll.
+//
+// usage: testtmpfsmmap [directory]
+
+#include "lima/HwFileEventMgr.h"
+#include "processlib/Data.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace lima;
+using namespace std;
+
+const FrameDim FDim(Size(128, 64), Bpp16);
+const int HeaderSize = 512;
+const int NbFiles = 3;
+const char *FilePattern = "frame_%04d.raw";
+
+unsigned short pixel(int i, int frame_nb)
+{
+	return frame_nb * 1000 + i % 1000;
+}
+
+class TestCallback : public HwTmpfsBufferMgr::Callback
+{
+public:
+	// only the MMap read mode is tested
+	virtual bool getFrameInfo(int, const char *,
+				  HwFileEventCallbackHelper::CallFrom,
+				  HwFrameInfoType&)
+	{ throw LIMA_HW_EXC(NotSupported, "Copy read mode"); }
+	virtual void getFrameDim(FrameDim& frame_dim)
+	{ frame_dim = FDim; }
+};
+
+string file_path(const string& dir, int frame_nb)
+{
+	char fname[64];
+	snprintf(fname, sizeof(fname), FilePattern, frame_nb);
+	return dir + "/" + fname;
+}
+
+// a header then the frame: the default getMappedFrameInfo takes the
+// frame at the end of the file
+void write_file(const string& dir, int frame_nb)
+{
+	ofstream f(file_path(dir, frame_nb).c_str(), ios::binary);
+	string header(HeaderSize, 'H');
+	f.write(header.data(), header.size());
+	int nb_pixels = Point(FDim.getSize()).getArea();
+	vector<unsigned short> frame(nb_pixels);
+	for (int i = 0; i < nb_pixels; ++i)
+		frame[i] = pixel(i, frame_nb);
+	f.write((const char *) frame.data(), FDim.getMemSize());
+	assert(f.good());
+}
+
+// the file mapped at the address (absolute path), empty if not mapped
+string mapped_file(void *ptr)
+{
+	ifstream maps("/proc/self/maps");
+	string line;
+	unsigned long addr = (unsigned long) ptr;
+	while (getline(maps, line)) {
+		unsigned long start, end;
+		char perms[8];
+		unsigned long offset;
+		char dev[16];
+		long inode;
+		int n = 0;
+		if (sscanf(line.c_str(), "%lx-%lx %7s %lx %15s %ld %n",
+			   &start, &end, perms, &offset, dev, &inode,
+			   &n) < 6)
+			continue;
+		if ((addr >= start) && (addr < end))
+			return line.substr(n);
+	}
+	return "";
+}
+
+bool is_mapped(void *ptr, int frame_nb)
+{
+	char fname[64];
+	snprintf(fname, sizeof(fname), FilePattern, frame_nb);
+	string mapped = mapped_file(ptr);
+	string suffix = string("/") + fname;
+	return ((mapped.size() > suffix.size()) &&
+		(mapped.compare(mapped.size() - suffix.size(), suffix.size(),
+				suffix) == 0));
+}
+
+void check_frame(void *ptr, int frame_nb)
+{
+	const unsigned short *p = (const unsigned short *) ptr;
+	int nb_pixels = Point(FDim.getSize()).getArea();
+	for (int i = 0; i < nb_pixels; ++i)
+		assert(p[i] == pixel(i, frame_nb));
+}
+
+// the processlib Data built by CtBuffer on a Managed frame
+Data make_data(HwBufferCtrlObj::Callback *cbk, void *frame_ptr)
+{
+	void *map_ref = cbk->map(frame_ptr);
+	assert(map_ref);
+	Data data;
+	data.type = Data::UINT16;
+	data.dimensions.push_back(FDim.getSize().getWidth());
+	data.dimensions.push_back(FDim.getSize().getHeight());
+	MappedBuffer *buffer = new MappedBuffer(frame_ptr,
+				[cbk, map_ref](void *) { cbk->release(map_ref); });
+	data.setBuffer(buffer);
+	buffer->unref();
+	return data;
+}
+
+void test_served_from_mapping(HwTmpfsBufferMgr& mgr, const string& dir)
+{
+	HwFrameInfoType info;
+	mgr.getFrameInfo(0, info);
+	assert(info.buffer_owner_ship == HwFrameInfoType::Managed);
+	assert(info.acq_frame_nb == 0);
+	assert(info.frame_dim == FDim);
+	assert(is_mapped(info.frame_ptr, 0));
+	// the mapping starts at the file start, the frame after the header
+	long page_size = sysconf(_SC_PAGESIZE);
+	assert(((unsigned long) info.frame_ptr % page_size) == HeaderSize);
+	check_frame(info.frame_ptr, 0);
+
+	// private mapping: writing into the frame leaves the file intact
+	*(unsigned short *) info.frame_ptr = 0xffff;
+	ifstream f(file_path(dir, 0).c_str(), ios::binary);
+	f.seekg(HeaderSize);
+	unsigned short first;
+	f.read((char *) &first, sizeof(first));
+	assert(first == pixel(0, 0));
+
+	Data data = make_data(mgr.getBufferCallback(), info.frame_ptr);
+	data = Data();
+	assert(mapped_file(info.frame_ptr).empty());
+	cout << "frame served from the file mapping: OK" << endl;
+}
+
+void test_release_with_data(HwTmpfsBufferMgr& mgr)
+{
+	HwBufferCtrlObj::Callback *cbk = mgr.getBufferCallback();
+	HwFrameInfoType info;
+	mgr.getFrameInfo(1, info);
+	void *ptr = info.frame_ptr;
+
+	Data data = make_data(cbk, ptr);
+	Data copy = data;
+	data = Data();
+	assert(is_mapped(ptr, 1));
+	check_frame(copy.data(), 1);
+
+	copy = Data();
+	assert(mapped_file(ptr).empty());
+	cout << "mapping released with the last Data: OK" << endl;
+}
+
+void test_release_all(HwTmpfsBufferMgr& mgr)
+{
+	HwBufferCtrlObj::Callback *cbk = mgr.getBufferCallback();
+	HwFrameInfoType pending, used;
+	mgr.getFrameInfo(1, pending);
+	mgr.getFrameInfo(2, used);
+	assert(is_mapped(pending.frame_ptr, 1));
+
+	// the frames still used by a Data survive releaseAll
+	Data data = make_data(cbk, used.frame_ptr);
+	cbk->releaseAll();
+	assert(mapped_file(pending.frame_ptr).empty());
+	assert(is_mapped(used.frame_ptr, 2));
+	check_frame(data.data(), 2);
+
+	data = Data();
+	assert(mapped_file(used.frame_ptr).empty());
+	cout << "pending mappings released on releaseAll: OK" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	string base = (argc > 1) ? argv[1] : "/tmp";
+	string templ = base + "/testtmpfsmmap_XXXXXX";
+	vector<char> dir_buffer(templ.begin(), templ.end());
+	dir_buffer.push_back('\0');
+	if (!mkdtemp(dir_buffer.data())) {
+		cerr << "Could not create a directory in " << base << endl;
+		return 1;
+	}
+	string dir = dir_buffer.data();
+	for (int i = 0; i < NbFiles; ++i)
+		write_file(dir, i);
+
+	{
+		TestCallback cbk;
+		HwTmpfsBufferMgr mgr(dir.c_str(), FilePattern, cbk);
+		assert(!mgr.getBufferCallback());
+		mgr.setReadMode(HwTmpfsBufferMgr::MMap);
+		assert(mgr.getBufferCallback());
+
+		test_served_from_mapping(mgr, dir);
+		test_release_with_data(mgr);
+		test_release_all(mgr);
+	}
+
+	for (int i = 0; i < NbFiles; ++i)
+		unlink(file_path(dir, i).c_str());
+	rmdir(dir.c_str());
+	return 0;
+}
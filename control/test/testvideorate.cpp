@@ -0,0 +1,175 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+// Live video rate policy: the frames closer than 1/rate to the last shown
+// one are skipped, the last frame of the acquisition is always shown.
+// An image held by a client is not overwritten, the spare image is used.
+// The video images are checked against the Ramp pattern, cropped by the
+// video ROI.
+//
+// usage: testvideorate
+
+#include "lima/CtControl.h"
+#include "lima/CtAcquisition.h"
+#include "lima/CtVideo.h"
+#include "lima/HwSyntheticInterface.h"
+#include "lima/Timestamp.h"
+
+#include <cassert>
+#include <iostream>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace lima;
+using namespace std;
+
+const int NbFrames = 40;
+const double ExpoTime = 0.005;
+const double MaxImageRate = 20;
+const Roi VideoRoi(10, 20, 64, 32);
+
+class ImageCallback : public CtVideo::ImageCallback
+{
+public:
+	virtual void newImage(const CtVideo::Image& image)
+	{
+		AutoMutex lock(m_cond.mutex());
+		m_frames.push_back(image.frameNumber());
+		m_cond.broadcast();
+	}
+
+	vector<long long> frames() const
+	{
+		AutoMutex lock(m_cond.mutex());
+		return m_frames;
+	}
+
+	bool waitFrame(long long frame_nb, double timeout)
+	{
+		AutoMutex lock(m_cond.mutex());
+		Timestamp start = Timestamp::now();
+		while (m_frames.empty() || (m_frames.back() < frame_nb)) {
+			double elapsed = Timestamp::now() - start;
+			double left = timeout - elapsed;
+			if (left <= 0)
+				return false;
+			m_cond.wait(left);
+		}
+		return true;
+	}
+
+private:
+	mutable Cond m_cond;
+	vector<long long> m_frames;
+};
+
+// the image is the Ramp (x + y + frame_nb) cropped by VideoRoi
+void check_image(const CtVideo::Image& image)
+{
+	assert(image.mode() == Y16);
+	assert(image.width() == VideoRoi.getSize().getWidth());
+	assert(image.height() == VideoRoi.getSize().getHeight());
+	const Point& topl = VideoRoi.getTopLeft();
+	const unsigned short *p = (const unsigned short *) image.buffer();
+	for (int y = 0; y < image.height(); ++y)
+		for (int x = 0; x < image.width(); ++x, ++p)
+			assert(*p == (topl.x + x) + (topl.y + y) +
+				     image.frameNumber());
+}
+
+int main(int /*argc*/, char * /*argv*/ [])
+{
+	HwSyntheticInterface::Config config;
+	config.frame_size = Size(256, 256);
+	config.image_type = Bpp16;
+	config.pattern = HwSyntheticInterface::Ramp;
+	HwSyntheticInterface hw(config);
+
+	try {
+		CtControl ct(&hw);
+		ct.acquisition()->setAcqExpoTime(ExpoTime);
+		ct.acquisition()->setAcqNbFrames(NbFrames);
+
+		CtVideo *video = ct.video();
+		ImageCallback cb;
+		video->registerImageCallback(cb);
+		video->setRoi(VideoRoi);
+		video->setMaxImageRate(MaxImageRate);
+		video->setActive(true);
+
+		ct.prepareAcq();
+		Timestamp t0 = Timestamp::now();
+		ct.startAcq();
+
+		// hold the first image until the end of the acquisition
+		assert(cb.waitFrame(0, 5));
+		CtVideo::Image held;
+		video->getLastImage(held);
+		long long held_frame = held.frameNumber();
+		assert(held_frame >= 0);
+
+		bool done = false;
+		for (int i = 0; !done && (i < 2000); ++i) {
+			CtControl::Status status;
+			ct.getStatus(status);
+			assert(status.AcquisitionStatus != AcqFault);
+			done = (status.AcquisitionStatus == AcqReady);
+			usleep(5000);
+		}
+		assert(done);
+		double elapsed = Timestamp::now() - t0;
+
+		// the last frame is shown at the end of the acquisition
+		assert(cb.waitFrame(NbFrames - 1, 2));
+		vector<long long> frames = cb.frames();
+		int nb_skipped = NbFrames - int(frames.size());
+		cout << "elapsed " << elapsed << " s, " << frames.size()
+		     << " images shown, " << nb_skipped << " skipped" << endl;
+		for (size_t i = 1; i < frames.size(); ++i)
+			assert(frames[i] > frames[i - 1]);
+		assert(frames.back() == NbFrames - 1);
+		// one image per 1/rate, plus the first and the last frames
+		assert(frames.size() <= size_t(elapsed * MaxImageRate) + 2);
+		assert(nb_skipped > 0);
+
+		// the held image was not overwritten by the later ones
+		assert(held.frameNumber() == held_frame);
+		check_image(held);
+
+		CtVideo::Image last;
+		video->getLastImage(last);
+		assert(last.frameNumber() == NbFrames - 1);
+		check_image(last);
+
+		long long image_counter;
+		video->getLastImageCounter(image_counter);
+		assert(image_counter == (long long)(frames.size()) - 1);
+
+		video->unregisterImageCallback(cb);
+	} catch (Exception& e) {
+		cerr << "LIMA Exception: " << e.getErrMsg() << endl;
+		return 1;
+	}
+
+	cout << "OK" << endl;
+	return 0;
+}
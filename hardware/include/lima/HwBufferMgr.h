@@ -26,6 +26,7 @@
 #include "lima/HwFrameCallback.h"
 #include "lima/HwBufferCtrlObj.h"
 #include "lima/BufferHelper.h"
+#include "lima/HwShmFrameRing.h"
 
 #include <memory>
 #include <vector>
@@ -71,6 +72,11 @@ class LIMACORE_API BufferAllocMgr
 
 	virtual void clearBuffer(int buffer_nb);
 	virtual void clearAllBuffers();
+
+	/// notifications from StdBufferCbMgr, no-op by default
+	virtual void acqStarted();
+	virtual void frameReady(int buffer_nb, int concat_frame_nb,
+				const HwFrameInfoType& frame_info);
 };
 
 
@@ -78,7 +84,10 @@ class LIMACORE_API BufferAllocMgr
  * \class SoftBufferAllocMgr
  * \brief Simple full software implementation of BufferAllocMgr
  *
- * This classes uses new and delete to allocate the memory buffers
+ * This classes uses new and delete to allocate the memory buffers.
+ * With the slabAlloc parameter, the ring is a single allocation
+ * shared by all the buffers, split in per-node chunks with a
+ * multi-node NumaAllocator, and initialised by parallel threads.
  *******************************************************************/
 
 class LIMACORE_API SoftBufferAllocMgr : public BufferAllocMgr
@@ -102,6 +111,8 @@ class LIMACORE_API SoftBufferAllocMgr : public BufferAllocMgr
 
 	virtual void *getBufferPtr(int buffer_nb);
 
+	virtual void clearAllBuffers();
+
  protected:
 	typedef std::vector<std::shared_ptr<void>> BufferList;
 	typedef BufferList::const_reverse_iterator BufferListCRIt;
@@ -115,6 +126,22 @@ class LIMACORE_API SoftBufferAllocMgr : public BufferAllocMgr
 	BufferHelper m_buffer_helper;
 	BufferList m_buffer_list;
 	AutoPtr<DefAllocChangeCb> m_def_alloc_change_cb;
+
+ private:
+	struct SlabNode {
+		int first_buffer;
+		std::vector<int> cpus;	// the first-touch threads run there
+	};
+	typedef std::vector<SlabNode> SlabNodeList;
+
+	void allocSlab(int nb_buffers, int frame_size,
+		       const AllocParameters& params);
+	void clearSlab(int first_buffer, int end_buffer);
+
+	std::shared_ptr<MemBuffer> m_slab;
+	size_t m_slab_stride;
+	int m_slab_nb_buffers;
+	SlabNodeList m_slab_nodes;
 };
 
 
@@ -230,6 +257,8 @@ class LIMACORE_API StdBufferCbMgr : public BufferCbMgr
 	virtual void clearBuffer(int buffer_nb);
 	virtual void clearAllBuffers();
 
+	virtual void setStartTimestamp(Timestamp  start_ts);
+
 	void setKeepSidebandData(bool  keep_sideband_data);
 	void getKeepSidebandData(bool& keep_sideband_data);
 
@@ -475,6 +504,48 @@ class LIMACORE_API MmapFileBufferAllocMgr : public BufferAllocMgr
 };
 #endif // !defined(_WIN32)
 
+#ifdef __linux__
+/// Frame buffers in a POSIX shared-memory ring (see HwShmFrameRing.h),
+/// other processes can follow the acquisition with a ShmFrameRingReader.
+/// The frames are published when they are ready, single-frame buffers only.
+class LIMACORE_API ShmBufferAllocMgr : public BufferAllocMgr
+{
+  DEB_CLASS(DebModHardware, "ShmBufferAllocMgr");
+
+ public:
+  ShmBufferAllocMgr(const char* name);
+  virtual ~ShmBufferAllocMgr();
+
+  virtual void setAllocParameters(const AllocParameters& alloc_params) override;
+  virtual void getAllocParameters(AllocParameters& alloc_params) override;
+
+  virtual int getMaxNbBuffers(const FrameDim& frame_dim);
+  virtual void allocBuffers(int nb_buffers, 
+			    const FrameDim& frame_dim);
+  virtual const FrameDim& getFrameDim() {return m_frame_dim;}
+  virtual void getNbBuffers(int& nb_buffers) {nb_buffers = m_nb_buffers;}
+  virtual void releaseBuffers();
+
+  virtual void *getBufferPtr(int buffer_nb);
+
+  virtual void acqStarted() override;
+  virtual void frameReady(int buffer_nb, int concat_frame_nb,
+			  const HwFrameInfoType& frame_info) override;
+
+  const std::string& getName() const {return m_name;}
+
+ private:
+  void _createRing(int nb_buffers, const FrameDim& frame_dim);
+  void _destroyRing();
+
+  std::string		m_name;
+  ShmFrameRing::Header*	m_header;
+  FrameDim		m_frame_dim;
+  int			m_nb_buffers;
+  AllocParameters	m_alloc_params;
+};
+#endif // __linux__
+
 } // namespace lima
 
 #endif // HWBUFFERMGR_H
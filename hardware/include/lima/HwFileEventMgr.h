@@ -74,14 +74,38 @@ namespace lima
 				HwFrameInfoType&) = 0;
       virtual void getFrameDim(FrameDim& frame_dim) = 0;
       virtual HwBufferCtrlObj::Callback* getBufferCallback() {return NULL;}
+      /** @brief MMap read mode: the file is mapped at file_data,
+       *  set frame_info.frame_ptr to the frame inside the mapping.
+       *  The default expects the frame at the end of the file
+       *  (raw data after any header).
+       */
+      virtual bool getMappedFrameInfo(int image_number,const char* full_path,
+				      void* file_data,size_t file_size,
+				      HwFileEventCallbackHelper::CallFrom,
+				      HwFrameInfoType&);
     };
 
+    /** @brief how the frame files are read
+     *  - Copy: Callback::getFrameInfo reads the file into a buffer
+     *  - MMap: the file is mapped (private, copy-on-write) and the
+     *    mapping is the frame buffer, unmapped when the Data is released.
+     *    The HwBufferCtrlObj::Callback is then the manager's own, so the
+     *    mode must be set before the CtControl is created.
+     */
+    enum ReadMode {Copy, MMap};
+
     HwTmpfsBufferMgr(const char *tmpfs_path,const char* file_pattern,
 		     Callback &cbk);
     ~HwTmpfsBufferMgr();
     
     void setMemoryPercent(double);
     void setNextExpectedImageNumber(int);
+    void setReadMode(ReadMode);
+    ReadMode getReadMode() const {return m_read_mode;}
+    /** @brief number of files after the current one hinted for readahead
+     */
+    void setReadAhead(int nb_files);
+    int getReadAhead() const {return m_read_ahead;}
     void prepare();
     void start();
     void stop();
@@ -116,10 +140,16 @@ namespace lima
   private:
     class _CBK;
     friend class _CBK;
+    class _MapCBK;
     int _calcNbMaxImages();
     bool _getFrameInfo(int image_number,const char* full_path,
 		       HwFileEventCallbackHelper::CallFrom,
 		       HwFrameInfoType &frame_info);
+    bool _getMappedFrameInfo(int image_number,const char* full_path,
+			     HwFileEventCallbackHelper::CallFrom,
+			     HwFrameInfoType &frame_info);
+    void _readAhead(int image_number);
+    std::string _getFullPath(int image_number) const;
 
     std::string 		m_tmpfs_path;
     std::string 		m_file_pattern;
@@ -131,6 +161,9 @@ namespace lima
     DirectoryEvent 		m_directory_event;
     Callback&			m_cbk;
     Timestamp			m_start_time;
+    ReadMode			m_read_mode;
+    int				m_read_ahead;
+    _MapCBK*			m_map_cbk;
   };
 }
 #endif
@@ -0,0 +1,162 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef HWSHMFRAMERING_H
+#define HWSHMFRAMERING_H
+#ifdef __linux__
+
+#include "lima/LimaCompatibility.h"
+#include "lima/SizeUtils.h"
+#include "lima/Debug.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace lima
+{
+
+/** @brief layout of the shared-memory frame ring written by
+ *  ShmBufferAllocMgr, in the POSIX shm object /lima_ring_<name>:
+ *  - the Header, in the first page;
+ *  - the frame index, one Slot per buffer, at index_offset;
+ *  - the frame buffers, page aligned, at data_offset.
+ *
+ *  The index is lock-free: each Slot is written under a sequence
+ *  counter (odd while updated) and the readers wait on the wake_seq
+ *  futex, which the writer only signals if nb_waiters is not 0.
+ */
+namespace ShmFrameRing
+{
+  enum { Magic = 0x4c524e47, Version = 1 };
+
+  struct Slot
+  {
+    std::atomic<uint32_t>	seq;
+    std::atomic<int32_t>	valid_pixels;
+    std::atomic<int64_t>	frame_nb;	//!< -1 if empty
+    std::atomic<double>		timestamp;
+  };
+
+  struct Header
+  {
+    std::atomic<uint32_t>	magic;		//!< set when the ring is ready
+    uint32_t			version;
+    int32_t			width;
+    int32_t			height;
+    int32_t			image_type;
+    int32_t			nb_buffers;
+    uint64_t			frame_mem_size;	//!< buffer stride
+    uint64_t			index_offset;
+    uint64_t			data_offset;
+    uint64_t			total_size;
+
+    std::atomic<uint32_t>	stale;		//!< the writer replaced the ring
+    std::atomic<uint32_t>	wake_seq;
+    std::atomic<uint32_t>	nb_waiters;
+    std::atomic<uint64_t>	acq_id;		//!< frame numbers restarted
+    std::atomic<int64_t>	last_frame;	//!< highest published, or -1
+  };
+
+  LIMACORE_API std::string getShmName(const std::string& name);
+
+  /// fill the geometry of the ring, magic excepted
+  LIMACORE_API void initHeader(Header& header,const FrameDim& frame_dim,
+			       int nb_buffers);
+  /// the page-aligned frame buffer stride
+  LIMACORE_API size_t calcFrameMemSize(const FrameDim& frame_dim);
+
+  inline Slot *getSlots(void *base)
+  {
+    Header *header = static_cast<Header *>(base);
+    return reinterpret_cast<Slot *>(static_cast<char *>(base) +
+				    header->index_offset);
+  }
+
+  /// wake the readers waiting for a new frame
+  LIMACORE_API void wakeReaders(Header& header);
+  /// wait until wake_seq changes from wake_seq or the timeout expires
+  LIMACORE_API void waitWriter(Header& header, uint32_t wake_seq,
+			       double timeout);
+}
+
+/** @brief reader side of the ShmBufferAllocMgr frame ring.
+ *
+ *  Can be used from any process: the frames are mapped read-only, no
+ *  copy is done. As the writer does not wait for the readers, the data
+ *  of a frame must be checked with checkFrame() after being used.
+ */
+class LIMACORE_API ShmFrameRingReader
+{
+  DEB_CLASS_NAMESPC(DebModHardware,"ShmFrameRingReader","Hardware");
+ public:
+  enum Status
+    {
+      Ok,
+      Timeout,
+      Overwritten,	//!< the frame is no longer in the ring
+      Stale,		//!< the writer replaced the ring: call open() again
+    };
+
+  struct Frame
+  {
+    long	frame_nb{-1};
+    uint64_t	acq_id{0};
+    const void*	ptr{nullptr};
+    FrameDim	frame_dim;
+    double	timestamp{0};
+    int		valid_pixels{0};
+  };
+
+  ShmFrameRingReader(const std::string& name);
+  ~ShmFrameRingReader();
+
+  /// (re)map the ring, throws if it does not exist (yet)
+  void open();
+  void close();
+
+  const FrameDim& getFrameDim() const {return m_frame_dim;}
+  int getNbBuffers() const;
+  long getLastFrameNb() const;
+
+  /// wait for frame_nb, or for the first frame if frame_nb < 0;
+  /// timeout < 0 waits forever
+  Status waitFrame(long frame_nb,Frame& frame,double timeout = -1);
+  /// the frame data is still valid
+  Status checkFrame(const Frame& frame) const;
+
+ private:
+  bool _readSlot(long frame_nb,Frame& frame) const;
+
+  std::string		m_name;
+  ShmFrameRing::Header*	m_header;
+  void*			m_map_base;
+  size_t		m_map_size;
+  FrameDim		m_frame_dim;
+};
+
+LIMACORE_API std::ostream& operator <<(std::ostream& os,
+				       ShmFrameRingReader::Status status);
+
+} // namespace lima
+
+#endif // __linux__
+#endif // HWSHMFRAMERING_H
@@ -0,0 +1,181 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef HWSYNTHETICINTERFACE_H
+#define HWSYNTHETICINTERFACE_H
+
+#include "lima/HwInterface.h"
+#include "lima/HwDetInfoCtrlObj.h"
+#include "lima/HwSyncCtrlObj.h"
+#include "lima/HwBufferMgr.h"
+#include "lima/ThreadUtils.h"
+#include "lima/MemUtils.h"
+#include "lima/AutoObj.h"
+
+#include <vector>
+
+namespace lima
+{
+
+/// A detector without hardware: a dedicated thread writes generated
+/// frames into the StdBufferCbMgr buffers at the rate given by the
+/// exposure and latency times (as fast as possible if both are 0).
+/// It feeds the control layer like a real camera plugin, so it can be
+/// used to measure the throughput of the buffers, processing and saving.
+class LIMACORE_API HwSyntheticInterface : public HwInterface
+{
+	DEB_CLASS(DebModHardware, "HwSyntheticInterface");
+
+ public:
+	enum Pattern {
+		Zero,		//!< all pixels at 0
+		FrameNb,	//!< all pixels at the frame number
+		Ramp,		//!< x + y + frame number
+		Noise,		//!< pseudo-random values in [0, 255]
+	};
+
+	struct Config {
+		Size frame_size{2048, 2048};
+		ImageType image_type{Bpp16};
+		Pattern pattern{Ramp};
+		/// If not 0, this number of frames is rendered in prepareAcq
+		/// and copied in turn into the buffers: the frame cost is a
+		/// memcpy, whatever the pattern
+		int nb_prerendered{0};
+	};
+
+	/// Generation statistics of the last acquisition
+	struct Stats {
+		int nb_frames{0};
+		double elapsed{0};	//!< from startAcq to the last frame
+		int nb_late{0};		//!< frames generated after their deadline
+	};
+
+	class LIMACORE_API DetInfoCtrlObj : public HwDetInfoCtrlObj,
+					    public HwMaxImageSizeCallbackGen
+	{
+		DEB_CLASS(DebModHardware,
+			  "HwSyntheticInterface::DetInfoCtrlObj");
+	public:
+		DetInfoCtrlObj(HwSyntheticInterface& hw);
+
+		virtual void getMaxImageSize(Size& max_image_size);
+		virtual void getDetectorImageSize(Size& det_image_size);
+
+		virtual void getDefImageType(ImageType& def_image_type);
+		virtual void getCurrImageType(ImageType& curr_image_type);
+		virtual void setCurrImageType(ImageType  curr_image_type);
+
+		virtual void getPixelSize(double& x_size, double& y_size);
+		virtual void getDetectorType(std::string& det_type);
+		virtual void getDetectorModel(std::string& det_model);
+
+		virtual void registerMaxImageSizeCallback(
+					HwMaxImageSizeCallback& cb);
+		virtual void unregisterMaxImageSizeCallback(
+					HwMaxImageSizeCallback& cb);
+	private:
+		friend class HwSyntheticInterface;
+		HwSyntheticInterface& m_hw;
+	};
+
+	class LIMACORE_API SyncCtrlObj : public HwSyncCtrlObj
+	{
+		DEB_CLASS(DebModHardware, "HwSyntheticInterface::SyncCtrlObj");
+	public:
+		SyncCtrlObj();
+
+		virtual bool checkTrigMode(TrigMode trig_mode);
+		virtual void setTrigMode(TrigMode  trig_mode);
+		virtual void getTrigMode(TrigMode& trig_mode);
+
+		virtual void setExpTime(double  exp_time);
+		virtual void getExpTime(double& exp_time);
+
+		virtual void setLatTime(double  lat_time);
+		virtual void getLatTime(double& lat_time);
+
+		virtual void setNbHwFrames(int  nb_frames);
+		virtual void getNbHwFrames(int& nb_frames);
+
+		virtual void getValidRanges(ValidRangesType& valid_ranges);
+	private:
+		double m_exp_time;
+		double m_lat_time;
+		int m_nb_frames;
+	};
+
+	HwSyntheticInterface();
+	HwSyntheticInterface(const Config& config);
+	virtual ~HwSyntheticInterface();
+
+	/// The new config applies from the next prepareAcq
+	void setConfig(const Config& config);
+	void getConfig(Config& config) const;
+
+	void getStats(Stats& stats);
+
+	virtual void getCapList(CapList&) const;
+
+	virtual void reset(ResetLevel reset_level);
+	virtual void prepareAcq();
+	virtual void startAcq();
+	virtual void stopAcq();
+	virtual void getStatus(StatusType& status);
+	virtual int getNbHwAcquiredFrames();
+
+	/// Write the frame_nb frame of the pattern into ptr
+	static void renderFrame(void *ptr, const FrameDim& frame_dim,
+				Pattern pattern, int frame_nb);
+
+ private:
+	class _AcqThread;
+	friend class _AcqThread;
+
+	void _generateFrames();
+
+	Config			m_config;
+	CapList			m_cap_list;
+	DetInfoCtrlObj		m_det_info;
+	SyncCtrlObj		m_sync;
+	SoftBufferCtrlObj	m_buffer_ctrl_obj;
+	std::vector<MemBuffer>	m_prerendered;
+
+	mutable Cond		m_cond;
+	bool			m_acq_started;
+	bool			m_acq_running;
+	bool			m_stop_requested;
+	bool			m_quit;
+	FrameDim		m_frame_dim;
+	int			m_nb_frames;
+	double			m_frame_period;
+	Stats			m_stats;
+	AutoPtr<_AcqThread>	m_acq_thread;
+};
+
+LIMACORE_API std::ostream& operator <<(std::ostream& os,
+				       HwSyntheticInterface::Pattern pattern);
+LIMACORE_API std::istream& operator >>(std::istream& is,
+				       HwSyntheticInterface::Pattern& pattern);
+
+} // namespace lima
+
+#endif // HWSYNTHETICINTERFACE_H
@@ -21,7 +21,10 @@
 //###########################################################################
 #include "lima/HwBufferMgr.h"
 
+#include <algorithm>
+#include <cerrno>
 #include <cstring>
+#include <thread>
 #if !defined(_WIN32)
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -33,6 +36,11 @@
 #endif
 #include <sys/mman.h>
 #endif
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/statvfs.h>
+#endif
 
 using namespace lima;
 
@@ -87,6 +95,15 @@ void BufferAllocMgr::clearAllBuffers()
 		clearBuffer(i);
 }
 
+void BufferAllocMgr::acqStarted()
+{
+}
+
+void BufferAllocMgr::frameReady(int buffer_nb, int concat_frame_nb,
+				const HwFrameInfoType& frame_info)
+{
+}
+
 
 /*******************************************************************
  * SoftBufferAllocMgr
@@ -111,7 +128,8 @@ private:
 };
 
 SoftBufferAllocMgr::SoftBufferAllocMgr()
-	: m_def_alloc_change_cb(new DefAllocChangeCb(*this))
+	: m_def_alloc_change_cb(new DefAllocChangeCb(*this)),
+	  m_slab_stride(0), m_slab_nb_buffers(0)
 {
 	DEB_CONSTRUCTOR();
 	AllocParameters params;
@@ -144,7 +162,12 @@ void SoftBufferAllocMgr::getAllocParameters(AllocParameters& params)
 void SoftBufferAllocMgr::prepareAlloc(int nb_buffers, const FrameDim& frame_dim)
 {
 	DEB_MEMBER_FUNCT();
-	m_buffer_helper.prepareBuffers(nb_buffers, frame_dim.getMemSize());
+	AllocParameters params;
+	getAllocParameters(params);
+	// the slab replaces the BufferHelper pool
+	if (!params.slabAlloc)
+		m_buffer_helper.prepareBuffers(nb_buffers,
+					       frame_dim.getMemSize());
 }
 
 void SoftBufferAllocMgr::onDefaultAllocatorChange(Allocator::Ref prev_alloc,
@@ -191,7 +214,9 @@ void SoftBufferAllocMgr::allocBuffers(int nb_buffers,
 		THROW_HW_ERROR(InvalidValue) << "Invalid " 
 					     << DEB_VAR1(nb_buffers);
 
-	if (frame_dim != m_frame_dim)
+	AllocParameters params;
+	getAllocParameters(params);
+	if ((frame_dim != m_frame_dim) || (params.slabAlloc != bool(m_slab)))
 		releaseBuffers();
 
 	int curr_nb_buffers;
@@ -202,6 +227,19 @@ void SoftBufferAllocMgr::allocBuffers(int nb_buffers,
 		return;
 	}
 
+	if (params.slabAlloc) {
+		try {
+			allocSlab(nb_buffers, frame_size, params);
+		} catch (...) {
+			DEB_ERROR() << "Error alloc. slab of " << nb_buffers
+				    << " buffers";
+			releaseBuffers();
+			throw;
+		}
+		m_frame_dim = frame_dim;
+		return;
+	}
+
 	try {
 		BufferList& bl = m_buffer_list;
 		bl.resize(nb_buffers);
@@ -227,6 +265,10 @@ void SoftBufferAllocMgr::releaseBuffers()
 
 	BufferList& bl = m_buffer_list;
 	bl.clear();
+	m_slab.reset();
+	m_slab_stride = 0;
+	m_slab_nb_buffers = 0;
+	m_slab_nodes.clear();
 	m_frame_dim = FrameDim();
 }
 
@@ -252,6 +294,144 @@ void *SoftBufferAllocMgr::getBufferPtr(int buffer_nb)
 	return ptr;
 }
 
+void SoftBufferAllocMgr::clearAllBuffers()
+{
+	DEB_MEMBER_FUNCT();
+	if (!m_slab) {
+		BufferAllocMgr::clearAllBuffers();
+		return;
+	}
+	clearSlab(0, m_buffer_list.size());
+}
+
+void SoftBufferAllocMgr::allocSlab(int nb_buffers, int frame_size,
+				   const AllocParameters& params)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(nb_buffers, frame_size);
+
+	BufferList& bl = m_buffer_list;
+	// shrinking, or growing back, within the current slab
+	if (m_slab && (nb_buffers <= m_slab_nb_buffers)) {
+		int curr_nb_buffers = bl.size();
+		bl.resize(nb_buffers);
+		char *base = static_cast<char *>(m_slab->getPtr());
+		for (int i = curr_nb_buffers; i < nb_buffers; ++i)
+			bl[i] = std::shared_ptr<void>(m_slab,
+						      base + i * m_slab_stride);
+		return;
+	}
+
+	releaseBuffers();
+
+	int page_size;
+	GetPageSize(page_size);
+	size_t stride = (size_t(frame_size) + page_size - 1) / page_size;
+	stride *= page_size;
+
+	Allocator::Ref allocator = params.allocator;
+	if (!allocator)
+		allocator = AllocatorFactory::get().getDefaultAllocator();
+	DEB_TRACE() << "Allocating a slab of " << nb_buffers << " buffers, "
+		    << DEB_VAR2(stride, allocator->toString());
+	std::shared_ptr<MemBuffer> slab = std::make_shared<MemBuffer>(allocator);
+	slab->alloc(stride * nb_buffers, false);
+	char *base = static_cast<char *>(slab->getPtr());
+
+#ifdef LIMA_USE_NUMA
+	// one contiguous chunk of buffers per node of the allocator
+	NumaAllocator *numa_alloc = dynamic_cast<NumaAllocator *>(allocator.get());
+	std::vector<int> nodes;
+	CPUMask cpu_mask;
+	if (numa_alloc && numa_alloc->getCPUAffinityMask().m_mask.any()) {
+		cpu_mask = numa_alloc->getCPUAffinityMask();
+		NumaNodeMask node_mask = NumaNodeMask::fromCPUMask(cpu_mask);
+		const NumaNodeMask::ItemArray& a = node_mask.getArray();
+		for (int n = 0; n < NumaNodeMask::getMaxNodes(); ++n) {
+			int bit = n % NumaNodeMask::ItemBits;
+			if ((a[n / NumaNodeMask::ItemBits] >> bit) & 1)
+				nodes.push_back(n);
+		}
+	}
+	int nb_nodes = std::min<int>(nodes.size(), nb_buffers);
+	for (int k = 0; (nb_nodes > 1) && (k < nb_nodes); ++k) {
+		int first = long(nb_buffers) * k / nb_nodes;
+		int end = long(nb_buffers) * (k + 1) / nb_nodes;
+		NumaNodeMask chunk_mask;
+		NumaNodeMask::ItemArray& a = chunk_mask.getArray();
+		a[nodes[k] / NumaNodeMask::ItemBits] |=
+			1UL << (nodes[k] % NumaNodeMask::ItemBits);
+		chunk_mask.bind(base + first * stride, (end - first) * stride);
+
+		SlabNode slab_node;
+		slab_node.first_buffer = first;
+		CPUMask::BitMask cpus = chunk_mask.toCPUMask().m_mask;
+		cpus &= cpu_mask.m_mask;
+		for (int i = 0; i < CPUMask::MaxNbCPUs; ++i)
+			if (cpus.test(i))
+				slab_node.cpus.push_back(i);
+		m_slab_nodes.push_back(slab_node);
+		DEB_TRACE() << "Node " << nodes[k] << ": buffers "
+			    << first << "-" << end - 1;
+	}
+#endif
+
+	m_slab = slab;
+	m_slab_stride = stride;
+	m_slab_nb_buffers = nb_buffers;
+	bl.resize(nb_buffers);
+	for (int i = 0; i < nb_buffers; ++i)
+		bl[i] = std::shared_ptr<void>(m_slab, base + i * stride);
+
+	if (params.initMem)
+		clearSlab(0, nb_buffers);
+}
+
+void SoftBufferAllocMgr::clearSlab(int first_buffer, int end_buffer)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(first_buffer, end_buffer);
+
+	char *base = static_cast<char *>(m_slab->getPtr());
+	if (m_slab_nodes.empty()) {
+		ParallelClearBuffer(base + first_buffer * m_slab_stride,
+				    (end_buffer - first_buffer) * m_slab_stride);
+		return;
+	}
+
+#ifdef __linux__
+	// the pages are touched by threads running on their node
+	int nb_nodes = m_slab_nodes.size();
+	int nb_threads = std::min(int(std::thread::hardware_concurrency()), 16);
+	nb_threads = std::max(nb_threads / nb_nodes, 1);
+	std::vector<std::thread> node_threads;
+	for (int k = 0; k < nb_nodes; ++k) {
+		const SlabNode& node = m_slab_nodes[k];
+		int node_end = (k < nb_nodes - 1) ?
+			m_slab_nodes[k + 1].first_buffer : m_slab_nb_buffers;
+		int first = std::max(first_buffer, node.first_buffer);
+		int end = std::min(end_buffer, node_end);
+		if (first >= end)
+			continue;
+		char *ptr = base + first * m_slab_stride;
+		size_t size = (end - first) * m_slab_stride;
+		const std::vector<int>& cpus = node.cpus;
+		node_threads.emplace_back([=]() {
+			// inherited by the helper threads
+			cpu_set_t cpu_set;
+			CPU_ZERO(&cpu_set);
+			for (int cpu : cpus)
+				CPU_SET(cpu, &cpu_set);
+			pthread_setaffinity_np(pthread_self(), sizeof(cpu_set),
+					       &cpu_set);
+			ParallelClearBuffer(ptr, size, nb_threads);
+		});
+	}
+	for (auto& t : node_threads)
+		t.join();
+#endif
+}
+
 
 /*******************************************************************
  * NumaSoftBufferAllocMgr
@@ -517,6 +697,13 @@ void StdBufferCbMgr::setFrameCallbackActive(bool cb_active)
 	m_fcb_act = cb_active;
 }
 
+void StdBufferCbMgr::setStartTimestamp(Timestamp start_ts)
+{
+	DEB_MEMBER_FUNCT();
+	BufferCbMgr::setStartTimestamp(start_ts);
+	m_alloc_mgr->acqStarted();
+}
+
 bool StdBufferCbMgr::newFrameReady(HwFrameInfoType& frame_info)
 {
 	DEB_MEMBER_FUNCT();
@@ -552,6 +739,8 @@ bool StdBufferCbMgr::newFrameReady(HwFrameInfoType& frame_info)
 	if (!frame_info.sideband_data.empty() && !m_keep_sideband_data)
 		m_info_list[frame_nb].sideband_data.reset();
 
+	m_alloc_mgr->frameReady(buffer_nb, concat_frame_nb, frame_info);
+
 	if (!m_fcb_act) {
 		DEB_TRACE() << "No cb registered";
 		return false;
@@ -1232,3 +1421,211 @@ double MmapFileBufferAllocMgr::_calc_mem_size_percent()
   return mem_size_percent;
 }
 #endif // !defined(_WIN32)
+
+#ifdef __linux__
+/*****************************************************************************
+			ShmBufferAllocMgr
+****************************************************************************/
+ShmBufferAllocMgr::ShmBufferAllocMgr(const char* name):
+  m_name(name),
+  m_header(NULL),
+  m_nb_buffers(0)
+{
+  DEB_CONSTRUCTOR();
+  DEB_PARAM() << DEB_VAR1(name);
+}
+
+ShmBufferAllocMgr::~ShmBufferAllocMgr()
+{
+  DEB_DESTRUCTOR();
+  _destroyRing();
+}
+
+void ShmBufferAllocMgr::setAllocParameters(const AllocParameters& alloc_params)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(alloc_params);
+  m_alloc_params = alloc_params;
+}
+
+void ShmBufferAllocMgr::getAllocParameters(AllocParameters& alloc_params)
+{
+  DEB_MEMBER_FUNCT();
+  alloc_params = m_alloc_params;
+  DEB_RETURN() << DEB_VAR1(alloc_params);
+}
+
+int ShmBufferAllocMgr::getMaxNbBuffers(const FrameDim& frame_dim)
+{
+  DEB_MEMBER_FUNCT();
+  if (!frame_dim.isValid())
+    return 0;
+
+  size_t frame_mem_size = ShmFrameRing::calcFrameMemSize(frame_dim);
+  int max_nb_buffers = m_alloc_params.getDefMaxNbBuffers(frame_mem_size);
+
+  // the ring must also fit in /dev/shm, the current one will be replaced
+  struct statvfs fsstat;
+  if(!statvfs("/dev/shm",&fsstat))
+    {
+      unsigned long long shm_free = fsstat.f_bavail;
+      shm_free *= fsstat.f_frsize;
+      if(m_header)
+	shm_free += m_header->total_size;
+      // keep room for the header and the index
+      shm_free -= std::min<unsigned long long>(shm_free, 1 << 20);
+      max_nb_buffers = std::min<unsigned long long>(max_nb_buffers,
+						    shm_free / frame_mem_size);
+    }
+  DEB_RETURN() << DEB_VAR1(max_nb_buffers);
+  return max_nb_buffers;
+}
+
+void ShmBufferAllocMgr::allocBuffers(int nb_buffers,const FrameDim& frame_dim)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR2(nb_buffers, frame_dim);
+
+  if(frame_dim.getMemSize() <= 0)
+    THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(frame_dim);
+  int max_buffers = getMaxNbBuffers(frame_dim);
+  if((nb_buffers < 1) || (nb_buffers > max_buffers))
+    THROW_HW_ERROR(InvalidValue) << "Invalid " 
+				 << DEB_VAR2(nb_buffers, max_buffers);
+
+  if(m_header && (frame_dim == m_frame_dim) && (nb_buffers == m_nb_buffers))
+    {
+      DEB_TRACE() << "Nothing to do";
+      return;
+    }
+
+  // the readers see the old ring as stale and reopen the new one
+  _destroyRing();
+  _createRing(nb_buffers, frame_dim);
+}
+
+void ShmBufferAllocMgr::releaseBuffers()
+{
+  DEB_MEMBER_FUNCT();
+  _destroyRing();
+}
+
+void* ShmBufferAllocMgr::getBufferPtr(int buffer_nb)
+{
+  DEB_MEMBER_FUNCT();
+
+  if(!m_header)
+    THROW_HW_ERROR(Error) << "Allocation wasn't done";
+
+  char *base = reinterpret_cast<char *>(m_header);
+  return base + m_header->data_offset + m_header->frame_mem_size * buffer_nb;
+}
+
+void ShmBufferAllocMgr::acqStarted()
+{
+  DEB_MEMBER_FUNCT();
+  if(!m_header)
+    return;
+
+  // frame numbers restart: the frames kept from the previous
+  // acquisition are no longer valid
+  ShmFrameRing::Header& header = *m_header;
+  header.acq_id.fetch_add(1,std::memory_order_release);
+  ShmFrameRing::Slot *slots = ShmFrameRing::getSlots(m_header);
+  for(int i = 0;i < m_nb_buffers;++i)
+    {
+      ShmFrameRing::Slot& slot = slots[i];
+      uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+      slot.seq.store(seq + 1,std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      slot.frame_nb.store(-1,std::memory_order_relaxed);
+      slot.seq.store(seq + 2,std::memory_order_release);
+    }
+  header.last_frame.store(-1,std::memory_order_release);
+  ShmFrameRing::wakeReaders(header);
+}
+
+void ShmBufferAllocMgr::frameReady(int buffer_nb, int concat_frame_nb,
+				   const HwFrameInfoType& frame_info)
+{
+  // concatenated frames are not published
+  if(!m_header || (frame_info.frame_dim != m_frame_dim))
+    return;
+
+  ShmFrameRing::Header& header = *m_header;
+  ShmFrameRing::Slot& slot = ShmFrameRing::getSlots(m_header)[buffer_nb];
+  int64_t frame_nb = frame_info.acq_frame_nb;
+  uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+  slot.seq.store(seq + 1,std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.frame_nb.store(frame_nb,std::memory_order_relaxed);
+  slot.timestamp.store(double(frame_info.frame_timestamp),
+		       std::memory_order_relaxed);
+  slot.valid_pixels.store(frame_info.valid_pixels,std::memory_order_relaxed);
+  slot.seq.store(seq + 2,std::memory_order_release);
+
+  int64_t last_frame = header.last_frame.load(std::memory_order_relaxed);
+  while((frame_nb > last_frame) &&
+	!header.last_frame.compare_exchange_weak(last_frame,frame_nb,
+						 std::memory_order_release,
+						 std::memory_order_relaxed));
+  ShmFrameRing::wakeReaders(header);
+}
+
+void ShmBufferAllocMgr::_createRing(int nb_buffers,const FrameDim& frame_dim)
+{
+  DEB_MEMBER_FUNCT();
+
+  ShmFrameRing::Header layout;
+  ShmFrameRing::initHeader(layout,frame_dim,nb_buffers);
+
+  std::string shm_name = ShmFrameRing::getShmName(m_name);
+  // a writer which crashed may have left it
+  shm_unlink(shm_name.c_str());
+  int fd = shm_open(shm_name.c_str(),O_RDWR|O_CREAT|O_EXCL,0644);
+  if(fd < 0)
+    THROW_HW_ERROR(Error) << "Could not create " << DEB_VAR1(shm_name)
+			  << ": " << strerror(errno);
+
+  // reserve the pages now: a full /dev/shm would be a SIGBUS later
+  int ret = posix_fallocate(fd,0,layout.total_size);
+  void *base = MAP_FAILED;
+  if(!ret)
+    base = mmap(NULL,layout.total_size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+  close(fd);
+  if(base == MAP_FAILED)
+    {
+      shm_unlink(shm_name.c_str());
+      THROW_HW_ERROR(Error) << "Could not allocate " << DEB_VAR1(shm_name)
+			    << ": " << strerror(ret ? ret : errno);
+    }
+
+  ShmFrameRing::Header *header = static_cast<ShmFrameRing::Header *>(base);
+  ShmFrameRing::initHeader(*header,frame_dim,nb_buffers);
+  ShmFrameRing::Slot *slots = ShmFrameRing::getSlots(base);
+  for(int i = 0;i < nb_buffers;++i)
+    slots[i].frame_nb.store(-1,std::memory_order_relaxed);
+  header->magic.store(ShmFrameRing::Magic,std::memory_order_release);
+
+  m_header = header;
+  m_frame_dim = frame_dim;
+  m_nb_buffers = nb_buffers;
+  DEB_TRACE() << DEB_VAR3(shm_name,layout.total_size,nb_buffers);
+}
+
+void ShmBufferAllocMgr::_destroyRing()
+{
+  DEB_MEMBER_FUNCT();
+  if(!m_header)
+    return;
+
+  m_header->stale.store(1,std::memory_order_release);
+  ShmFrameRing::wakeReaders(*m_header);
+  munmap(m_header,m_header->total_size);
+  shm_unlink(ShmFrameRing::getShmName(m_name).c_str());
+
+  m_header = NULL;
+  m_frame_dim = FrameDim();
+  m_nb_buffers = 0;
+}
+#endif // __linux__
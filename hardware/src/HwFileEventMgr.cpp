@@ -20,7 +20,10 @@
 // along with this program; if not, see <http://www.gnu.org/licenses/>.
 //###########################################################################
 #include <dirent.h>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/statvfs.h>
 #include <sys/types.h>
 #ifdef __unix
@@ -28,7 +31,9 @@
 #else
 #include <processlib/win/unistd.h>
 #endif
+#include <map>
 #include "lima/HwFileEventMgr.h"
+#include "lima/ThreadUtils.h"
 using namespace lima;
 
 void HwFileEventCallbackHelper::prepare(const DirectoryEvent::Parameters& params)
@@ -160,6 +165,111 @@ public:
 private:
   HwTmpfsBufferMgr& m_cnt;
 };
+/** @brief buffer callback of the MMap read mode.
+ *
+ *  Keeps the file mappings, by frame pointer, until the Data built on
+ *  them is released.
+ */
+class HwTmpfsBufferMgr::_MapCBK : public HwBufferCtrlObj::Callback
+{
+  DEB_CLASS_NAMESPC(DebModHardware,"HwTmpfsBufferMgr::_MapCBK","Hardware");
+public:
+  struct Mapping
+  {
+    void*	frame_ptr;
+    void*	base;
+    size_t	size;
+    int		nb_refs;
+  };
+
+  virtual ~_MapCBK()
+  {
+    _unmapAll(true);
+  }
+
+  void add(void *frame_ptr,void *base,size_t size)
+  {
+    Mapping mapping = {frame_ptr,base,size,0};
+    AutoMutex lock(m_mutex);
+    m_mappings[frame_ptr] = mapping;
+  }
+
+  virtual void *map(void *address)
+  {
+    DEB_MEMBER_FUNCT();
+    AutoMutex lock(m_mutex);
+    MappingMap::iterator i = m_mappings.find(address);
+    if(i == m_mappings.end())
+      {
+	DEB_ERROR() << "Unknown frame " << DEB_VAR1(address);
+	return NULL;
+      }
+    ++i->second.nb_refs;
+    return &i->second;
+  }
+
+  virtual void release(void *address_ref)
+  {
+    if(!address_ref)
+      return;
+    Mapping *mapping = static_cast<Mapping*>(address_ref);
+    AutoMutex lock(m_mutex);
+    if(--mapping->nb_refs == 0)
+      {
+	munmap(mapping->base,mapping->size);
+	m_mappings.erase(mapping->frame_ptr);
+      }
+  }
+
+  // called by CtBuffer when all the Data are released: unmap the frames
+  // that never reached a Data (pending or dropped)
+  virtual void releaseAll()
+  {
+    _unmapAll(false);
+  }
+
+private:
+  typedef std::map<void*,Mapping> MappingMap;
+
+  void _unmapAll(bool force)
+  {
+    AutoMutex lock(m_mutex);
+    MappingMap::iterator i = m_mappings.begin();
+    while(i != m_mappings.end())
+      {
+	if(force || !i->second.nb_refs)
+	  {
+	    munmap(i->second.base,i->second.size);
+	    m_mappings.erase(i++);
+	  }
+	else
+	  ++i;
+      }
+  }
+
+  Mutex		m_mutex;
+  MappingMap	m_mappings;
+};
+
+bool HwTmpfsBufferMgr::Callback::getMappedFrameInfo(int image_number,
+						    const char*,
+						    void* file_data,
+						    size_t file_size,
+						    HwFileEventCallbackHelper::CallFrom,
+						    HwFrameInfoType& frame_info)
+{
+  FrameDim frame_dim;
+  getFrameDim(frame_dim);
+  size_t mem_size = frame_dim.getMemSize();
+  if(file_size < mem_size)
+    throw LIMA_HW_EXC(Error,"File smaller than the frame");
+
+  char *frame_ptr = (char*)file_data + (file_size - mem_size);
+  frame_info = HwFrameInfoType(image_number,frame_ptr,&frame_dim,
+			       Timestamp(),0,HwFrameInfoType::Managed);
+  return true;
+}
+
 /** @brief Buffer manager for tmp file system.
  *
  *  This manager can be used when you can't get (from API) image from the
@@ -176,7 +286,10 @@ HwTmpfsBufferMgr::HwTmpfsBufferMgr(const char* tmpfs_path,
   m_internal_cbk(new _CBK(*this)),
   m_directory_cbk(*m_internal_cbk),
   m_directory_event(true,m_directory_cbk),
-  m_cbk(cbk)
+  m_cbk(cbk),
+  m_read_mode(Copy),
+  m_read_ahead(1),
+  m_map_cbk(new _MapCBK())
 {
     
 }
@@ -185,6 +298,7 @@ HwTmpfsBufferMgr::~HwTmpfsBufferMgr()
 {
   m_directory_event.stop();
   delete m_internal_cbk;
+  delete m_map_cbk;
 }
 
 void HwTmpfsBufferMgr::setMemoryPercent(double percent)
@@ -196,6 +310,23 @@ void HwTmpfsBufferMgr::setMemoryPercent(double percent)
   else
     THROW_HW_ERROR(Error) << "percent should be between 0. and 1.";
 }
+void HwTmpfsBufferMgr::setReadMode(ReadMode read_mode)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(read_mode);
+  m_read_mode = read_mode;
+}
+
+void HwTmpfsBufferMgr::setReadAhead(int nb_files)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(nb_files);
+
+  if(nb_files < 0)
+    THROW_HW_ERROR(InvalidValue) << "nb_files should be positive";
+  m_read_ahead = nb_files;
+}
+
 /** @brief next image number should we expected
  *  This parameters will be take into account after prepare
  */
@@ -289,14 +420,10 @@ void HwTmpfsBufferMgr::getFrameInfo(int acq_frame_nb, HwFrameInfoType& info)
 {
   DEB_MEMBER_FUNCT();
 
-  char filename[1024];
-  snprintf(filename,sizeof(filename),
-	   m_file_pattern.c_str(),acq_frame_nb);
-  std::string fullPath = m_tmpfs_path + "/";
-  fullPath += filename;
-  m_cbk.getFrameInfo(acq_frame_nb,fullPath.c_str(),
-		     HwFileEventCallbackHelper::OnDemand,
-		     info);
+  std::string fullPath = _getFullPath(acq_frame_nb);
+  _getFrameInfo(acq_frame_nb,fullPath.c_str(),
+		HwFileEventCallbackHelper::OnDemand,
+		info);
 }
 
 void HwTmpfsBufferMgr::registerFrameCallback(HwFrameCallback& frame_cb)
@@ -311,6 +438,8 @@ void HwTmpfsBufferMgr::unregisterFrameCallback(HwFrameCallback& frame_cb)
 
 HwBufferCtrlObj::Callback* HwTmpfsBufferMgr::getBufferCallback()
 {
+  if(m_read_mode == MMap)
+    return m_map_cbk;
   return m_cbk.getBufferCallback();
 }
 
@@ -335,5 +464,102 @@ bool HwTmpfsBufferMgr::_getFrameInfo(int image_number,const char* full_path,
 				     HwFileEventCallbackHelper::CallFrom mode,
 				     HwFrameInfoType &frame_info)
 {
+  if(m_read_mode == MMap)
+    return _getMappedFrameInfo(image_number,full_path,mode,frame_info);
   return m_cbk.getFrameInfo(image_number,full_path,mode,frame_info);
 }
+
+/** @brief map the file: no copy, the pages of a tmpfs file are
+ *  the frame buffer.
+ *
+ *  The mapping is private: a processing done in place only copies the
+ *  pages it writes, the file is never modified.
+ */
+bool HwTmpfsBufferMgr::_getMappedFrameInfo(int image_number,
+					   const char* full_path,
+					   HwFileEventCallbackHelper::CallFrom mode,
+					   HwFrameInfoType &frame_info)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR2(image_number,full_path);
+
+  int fd = open(full_path,O_RDONLY | O_CLOEXEC);
+  if(fd < 0)
+    THROW_HW_ERROR(Error) << "Can't open file: " << full_path;
+
+  struct stat file_stat;
+  void *base = MAP_FAILED;
+  size_t file_size = 0;
+  if(!fstat(fd,&file_stat) && file_stat.st_size > 0)
+    {
+      file_size = file_stat.st_size;
+      base = mmap(NULL,file_size,PROT_READ | PROT_WRITE,MAP_PRIVATE,fd,0);
+    }
+  close(fd);
+  if(base == MAP_FAILED)
+    THROW_HW_ERROR(Error) << "Can't map file: " << full_path;
+  // MAP_POPULATE would break the copy-on-write of a writable mapping:
+  // prefault for reading only
+#ifdef MADV_POPULATE_READ
+  if(madvise(base,file_size,MADV_POPULATE_READ))
+#endif
+    madvise(base,file_size,MADV_WILLNEED);
+
+  bool continueFlag;
+  try
+    {
+      continueFlag = m_cbk.getMappedFrameInfo(image_number,full_path,
+					      base,file_size,mode,
+					      frame_info);
+      char *frame_ptr = (char*)frame_info.frame_ptr;
+      char *file_end = (char*)base + file_size;
+      if(!frame_ptr || frame_ptr < (char*)base ||
+	 frame_ptr + frame_info.frame_dim.getMemSize() > file_end)
+	THROW_HW_ERROR(Error) << "Frame outside of the file mapping: "
+			      << DEB_VAR2(frame_info,file_size);
+    }
+  catch(...)
+    {
+      munmap(base,file_size);
+      throw;
+    }
+
+  frame_info.buffer_owner_ship = HwFrameInfoType::Managed;
+  if(!frame_info.frame_timestamp.isSet() && m_start_time.isSet())
+    frame_info.frame_timestamp = Timestamp::now() - m_start_time;
+  if(!frame_info.valid_pixels)
+    frame_info.valid_pixels = Point(frame_info.frame_dim.getSize()).getArea();
+  m_map_cbk->add(frame_info.frame_ptr,base,file_size);
+
+  if(mode == HwFileEventCallbackHelper::Acquisition)
+    _readAhead(image_number);
+
+  return continueFlag;
+}
+
+/** @brief hint the kernel about the next files, if already written.
+ *  A no-op on tmpfs, but it starts the reading on a disk or network
+ *  file system.
+ */
+void HwTmpfsBufferMgr::_readAhead(int image_number)
+{
+  for(int i = 1;i <= m_read_ahead;++i)
+    {
+      std::string fullPath = _getFullPath(image_number + i);
+      int fd = open(fullPath.c_str(),O_RDONLY | O_CLOEXEC);
+      if(fd < 0)
+	break;
+      posix_fadvise(fd,0,0,POSIX_FADV_WILLNEED);
+      close(fd);
+    }
+}
+
+std::string HwTmpfsBufferMgr::_getFullPath(int image_number) const
+{
+  char filename[1024];
+  snprintf(filename,sizeof(filename),
+	   m_file_pattern.c_str(),image_number);
+  std::string fullPath = m_tmpfs_path + "/";
+  fullPath += filename;
+  return fullPath;
+}
@@ -0,0 +1,316 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include "lima/HwShmFrameRing.h"
+#include "lima/Exceptions.h"
+#include "lima/Timestamp.h"
+
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace lima;
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+	      "ShmFrameRing needs lock-free atomics");
+
+static const size_t PageSize = 4096;
+
+static inline size_t page_align(size_t size)
+{
+  return (size + PageSize - 1) & ~(PageSize - 1);
+}
+
+/*******************************************************************
+ * ShmFrameRing
+ *******************************************************************/
+
+std::string ShmFrameRing::getShmName(const std::string& name)
+{
+  return "/lima_ring_" + name;
+}
+
+size_t ShmFrameRing::calcFrameMemSize(const FrameDim& frame_dim)
+{
+  return page_align(frame_dim.getMemSize());
+}
+
+void ShmFrameRing::initHeader(Header& header,const FrameDim& frame_dim,
+			      int nb_buffers)
+{
+  static_assert(sizeof(Header) <= PageSize,"Header too large");
+
+  header.version = Version;
+  header.width = frame_dim.getSize().getWidth();
+  header.height = frame_dim.getSize().getHeight();
+  header.image_type = frame_dim.getImageType();
+  header.nb_buffers = nb_buffers;
+  header.frame_mem_size = calcFrameMemSize(frame_dim);
+  header.index_offset = PageSize;
+  header.data_offset = page_align(header.index_offset +
+				  nb_buffers * sizeof(Slot));
+  header.total_size = header.data_offset +
+		      header.frame_mem_size * nb_buffers;
+
+  header.stale = 0;
+  header.wake_seq = 0;
+  header.nb_waiters = 0;
+  header.acq_id = 0;
+  header.last_frame = -1;
+}
+
+void ShmFrameRing::wakeReaders(Header& header)
+{
+  // seq_cst pairs with the nb_waiters increment in waitWriter:
+  // either the reader sees the new wake_seq, or we see the waiter
+  header.wake_seq.fetch_add(1,std::memory_order_seq_cst);
+  if(header.nb_waiters.load(std::memory_order_seq_cst) == 0)
+    return;
+  syscall(SYS_futex,&header.wake_seq,FUTEX_WAKE,INT_MAX,NULL,NULL,0);
+}
+
+void ShmFrameRing::waitWriter(Header& header,uint32_t wake_seq,
+			      double timeout)
+{
+  struct timespec ts, *pts = NULL;
+  if(timeout >= 0)
+    {
+      ts.tv_sec = time_t(timeout);
+      ts.tv_nsec = long((timeout - ts.tv_sec) * 1e9);
+      pts = &ts;
+    }
+
+  header.nb_waiters.fetch_add(1,std::memory_order_seq_cst);
+  if(header.wake_seq.load(std::memory_order_seq_cst) == wake_seq)
+    syscall(SYS_futex,&header.wake_seq,FUTEX_WAIT,wake_seq,pts,NULL,0);
+  header.nb_waiters.fetch_sub(1,std::memory_order_seq_cst);
+}
+
+/*******************************************************************
+ * ShmFrameRingReader
+ *******************************************************************/
+
+ShmFrameRingReader::ShmFrameRingReader(const std::string& name) :
+  m_name(name),
+  m_header(NULL),
+  m_map_base(NULL),
+  m_map_size(0)
+{
+  DEB_CONSTRUCTOR();
+  DEB_PARAM() << DEB_VAR1(name);
+}
+
+ShmFrameRingReader::~ShmFrameRingReader()
+{
+  DEB_DESTRUCTOR();
+  close();
+}
+
+void ShmFrameRingReader::open()
+{
+  DEB_MEMBER_FUNCT();
+  using namespace ShmFrameRing;
+
+  close();
+
+  std::string shm_name = getShmName(m_name);
+  int fd = shm_open(shm_name.c_str(),O_RDWR,0);
+  if(fd < 0)
+    THROW_HW_ERROR(Error) << "Could not open " << DEB_VAR1(shm_name)
+			  << ": " << strerror(errno);
+
+  struct stat st;
+  if(fstat(fd,&st) < 0 || size_t(st.st_size) < PageSize)
+    {
+      ::close(fd);
+      THROW_HW_ERROR(Error) << "Invalid ring " << DEB_VAR1(shm_name);
+    }
+
+  // only the header page is writable: the readers register in it
+  void *header = mmap(NULL,PageSize,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+  if(header == MAP_FAILED)
+    {
+      ::close(fd);
+      THROW_HW_ERROR(Error) << "Could not map " << DEB_VAR1(shm_name);
+    }
+  m_header = static_cast<Header *>(header);
+
+  if(m_header->magic.load(std::memory_order_acquire) != Magic ||
+     m_header->version != Version ||
+     m_header->total_size > uint64_t(st.st_size))
+    {
+      ::close(fd);
+      close();
+      THROW_HW_ERROR(Error) << "Ring " << DEB_VAR1(shm_name) << " not ready";
+    }
+
+  m_map_size = m_header->total_size;
+  m_map_base = mmap(NULL,m_map_size,PROT_READ,MAP_SHARED,fd,0);
+  ::close(fd);
+  if(m_map_base == MAP_FAILED)
+    {
+      m_map_base = NULL;
+      close();
+      THROW_HW_ERROR(Error) << "Could not map " << DEB_VAR1(shm_name);
+    }
+
+  Size size(m_header->width,m_header->height);
+  m_frame_dim = FrameDim(size,ImageType(m_header->image_type));
+  DEB_TRACE() << DEB_VAR3(shm_name,m_frame_dim,getNbBuffers());
+}
+
+void ShmFrameRingReader::close()
+{
+  if(m_map_base)
+    munmap(m_map_base,m_map_size);
+  if(m_header)
+    munmap(m_header,PageSize);
+  m_map_base = NULL;
+  m_map_size = 0;
+  m_header = NULL;
+  m_frame_dim = FrameDim();
+}
+
+int ShmFrameRingReader::getNbBuffers() const
+{
+  return m_header ? m_header->nb_buffers : 0;
+}
+
+long ShmFrameRingReader::getLastFrameNb() const
+{
+  return m_header ? m_header->last_frame.load(std::memory_order_acquire) : -1;
+}
+
+bool ShmFrameRingReader::_readSlot(long frame_nb,Frame& frame) const
+{
+  using namespace ShmFrameRing;
+
+  Slot& slot = getSlots(m_map_base)[frame_nb % m_header->nb_buffers];
+  uint32_t seq = slot.seq.load(std::memory_order_acquire);
+  if(seq & 1)
+    return false;
+  int64_t slot_frame_nb = slot.frame_nb.load(std::memory_order_relaxed);
+  double timestamp = slot.timestamp.load(std::memory_order_relaxed);
+  int valid_pixels = slot.valid_pixels.load(std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if(slot.seq.load(std::memory_order_relaxed) != seq ||
+     slot_frame_nb != frame_nb)
+    return false;
+
+  frame.frame_nb = frame_nb;
+  frame.ptr = static_cast<char *>(m_map_base) + m_header->data_offset +
+	      m_header->frame_mem_size * (frame_nb % m_header->nb_buffers);
+  frame.frame_dim = m_frame_dim;
+  frame.timestamp = timestamp;
+  frame.valid_pixels = valid_pixels;
+  return true;
+}
+
+ShmFrameRingReader::Status
+ShmFrameRingReader::waitFrame(long frame_nb,Frame& frame,double timeout)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR2(frame_nb,timeout);
+
+  if(!m_header)
+    THROW_HW_ERROR(Error) << "Ring not open";
+
+  ShmFrameRing::Header& header = *m_header;
+  Timestamp t0 = Timestamp::now();
+  while(true)
+    {
+      if(header.stale.load(std::memory_order_acquire))
+	return Stale;
+
+      uint32_t wake_seq = header.wake_seq.load(std::memory_order_seq_cst);
+      uint64_t acq_id = header.acq_id.load(std::memory_order_acquire);
+      long last_frame = header.last_frame.load(std::memory_order_acquire);
+      long req_frame = (frame_nb < 0) ? last_frame : frame_nb;
+      if((req_frame >= 0) && (last_frame >= req_frame))
+	{
+	  if(last_frame + 1 >= req_frame + header.nb_buffers)
+	    return Overwritten;
+	  frame.acq_id = acq_id;
+	  if(_readSlot(req_frame,frame) &&
+	     (header.acq_id.load(std::memory_order_acquire) == acq_id))
+	    return Ok;
+	  // published out of order, or being rewritten: retry
+	  sched_yield();
+	  continue;
+	}
+
+      double remaining = -1;
+      if(timeout >= 0)
+	{
+	  double elapsed = Timestamp::now() - t0;
+	  remaining = timeout - elapsed;
+	  if(remaining <= 0)
+	    return Timeout;
+	}
+      ShmFrameRing::waitWriter(header,wake_seq,remaining);
+    }
+}
+
+ShmFrameRingReader::Status
+ShmFrameRingReader::checkFrame(const Frame& frame) const
+{
+  if(!m_header)
+    return Stale;
+
+  ShmFrameRing::Header& header = *m_header;
+  // the data reads must be done before the checks
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if(header.stale.load(std::memory_order_acquire))
+    return Stale;
+  if(header.acq_id.load(std::memory_order_acquire) != frame.acq_id)
+    return Overwritten;
+  // the next frame going into the same buffer may be being written
+  long last_frame = header.last_frame.load(std::memory_order_acquire);
+  if(last_frame + 1 >= frame.frame_nb + header.nb_buffers)
+    return Overwritten;
+  Frame check;
+  if(!_readSlot(frame.frame_nb,check))
+    return Overwritten;
+  return Ok;
+}
+
+std::ostream& lima::operator <<(std::ostream& os,
+				ShmFrameRingReader::Status status)
+{
+  const char *name = "Unknown";
+  switch(status)
+    {
+    case ShmFrameRingReader::Ok:		name = "Ok";		break;
+    case ShmFrameRingReader::Timeout:		name = "Timeout";	break;
+    case ShmFrameRingReader::Overwritten:	name = "Overwritten";	break;
+    case ShmFrameRingReader::Stale:		name = "Stale";		break;
+    }
+  return os << name;
+}
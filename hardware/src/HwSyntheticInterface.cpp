@@ -0,0 +1,583 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+#include "lima/HwSyntheticInterface.h"
+
+#include <cstring>
+#include <cstdint>
+
+using namespace lima;
+using namespace std;
+
+/*******************************************************************
+ * \brief Frame generation
+ *******************************************************************/
+
+namespace
+{
+
+template <class T>
+void renderPixels(T *p, const Size& size, HwSyntheticInterface::Pattern pattern,
+		  int frame_nb, uint64_t mask)
+{
+	typedef HwSyntheticInterface S;
+	int width = size.getWidth(), height = size.getHeight();
+	long nb_pixels = long(width) * height;
+	switch (pattern) {
+	case S::Zero:
+		memset(p, 0, nb_pixels * sizeof(T));
+		break;
+	case S::FrameNb:
+		fill(p, p + nb_pixels, T(uint64_t(frame_nb) & mask));
+		break;
+	case S::Ramp:
+		for (int y = 0; y < height; ++y)
+			for (int x = 0; x < width; ++x)
+				*p++ = T(uint64_t(x + y + frame_nb) & mask);
+		break;
+	case S::Noise: {
+		// xorshift32: reproducible, distinct for each frame
+		uint32_t r = uint32_t(frame_nb) * 2654435761U + 1;
+		for (long i = 0; i < nb_pixels; ++i) {
+			r ^= r << 13;
+			r ^= r >> 17;
+			r ^= r << 5;
+			*p++ = T(r & 0xff & mask);
+		}
+		break;
+	}
+	}
+}
+
+} // namespace
+
+void HwSyntheticInterface::renderFrame(void *ptr, const FrameDim& frame_dim,
+				       Pattern pattern, int frame_nb)
+{
+	DEB_STATIC_FUNCT();
+	ImageType image_type = frame_dim.getImageType();
+	int bpp = FrameDim::getImageTypeBpp(image_type);
+	if (FrameDim::isImageTypeSigned(image_type))
+		--bpp;
+	uint64_t mask = (bpp < 64) ? ((uint64_t(1) << bpp) - 1) : ~uint64_t(0);
+
+	const Size& size = frame_dim.getSize();
+	switch (frame_dim.getDepth()) {
+	case 1:
+		renderPixels((uint8_t *) ptr, size, pattern, frame_nb, mask);
+		break;
+	case 2:
+		renderPixels((uint16_t *) ptr, size, pattern, frame_nb, mask);
+		break;
+	case 4:
+		if (image_type == Bpp32F)
+			renderPixels((float *) ptr, size, pattern, frame_nb,
+				     mask);
+		else
+			renderPixels((uint32_t *) ptr, size, pattern, frame_nb,
+				     mask);
+		break;
+	case 8:
+		renderPixels((uint64_t *) ptr, size, pattern, frame_nb, mask);
+		break;
+	default:
+		THROW_HW_ERROR(NotSupported) << "Invalid " 
+					     << DEB_VAR1(image_type);
+	}
+}
+
+/*******************************************************************
+ * \brief HwSyntheticInterface::_AcqThread
+ *******************************************************************/
+
+class HwSyntheticInterface::_AcqThread : public Thread
+{
+	DEB_CLASS(DebModHardware, "HwSyntheticInterface::_AcqThread");
+public:
+	_AcqThread(HwSyntheticInterface& hw)
+		: m_hw(hw)
+	{
+		start();
+	}
+
+	virtual ~_AcqThread()
+	{
+		{
+			AutoMutex lock(m_hw.m_cond.mutex());
+			m_hw.m_quit = true;
+			m_hw.m_cond.broadcast();
+		}
+		join();
+	}
+
+	bool isCurrent()
+	{
+		return pthread_equal(pthread_self(), m_thread);
+	}
+
+protected:
+	virtual void threadFunction()
+	{
+		DEB_MEMBER_FUNCT();
+		Cond& cond = m_hw.m_cond;
+		AutoMutex lock(cond.mutex());
+		while (!m_hw.m_quit) {
+			if (!m_hw.m_acq_started) {
+				cond.wait();
+				continue;
+			}
+			m_hw.m_acq_started = false;
+			try {
+				AutoMutexUnlock u(lock);
+				m_hw._generateFrames();
+			} catch (Exception& e) {
+				DEB_ERROR() << "Frame generation failed: " << e;
+			}
+			m_hw.m_acq_running = false;
+			cond.broadcast();
+		}
+	}
+
+private:
+	HwSyntheticInterface& m_hw;
+};
+
+/*******************************************************************
+ * \brief HwSyntheticInterface::DetInfoCtrlObj
+ *******************************************************************/
+
+HwSyntheticInterface::DetInfoCtrlObj::DetInfoCtrlObj(HwSyntheticInterface& hw)
+	: m_hw(hw)
+{
+	DEB_CONSTRUCTOR();
+}
+
+void HwSyntheticInterface::DetInfoCtrlObj::getMaxImageSize(Size& max_image_size)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex lock(m_hw.m_cond.mutex());
+	max_image_size = m_hw.m_config.frame_size;
+	DEB_RETURN() << DEB_VAR1(max_image_size);
+}
+
+void HwSyntheticInterface::DetInfoCtrlObj::getDetectorImageSize(Size& det_image_size)
+{
+	DEB_MEMBER_FUNCT();
+	getMaxImageSize(det_image_size);
+}
+
+void HwSyntheticInterface::DetInfoCtrlObj::getDefImageType(ImageType& def_image_type)
+{
+	DEB_MEMBER_FUNCT();
+	def_image_type = Bpp16;
+	DEB_RETURN() << DEB_VAR1(def_image_type);
+}
+
+void HwSyntheticInterface::DetInfoCtrlObj::getCurrImageType(ImageType& curr_image_type)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex lock(m_hw.m_cond.mutex());
+	curr_image_type = m_hw.m_config.image_type;
+	DEB_RETURN() << DEB_VAR1(curr_image_type);
+}
+
+void HwSyntheticInterface::DetInfoCtrlObj::setCurrImageType(ImageType curr_image_type)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(curr_image_type);
+	Config config;
+	m_hw.getConfig(config);
+	config.image_type = curr_image_type;
+	m_hw.setConfig(config);
+}
+
+void HwSyntheticInterface::DetInfoCtrlObj::getPixelSize(double& x_size, double& y_size)
+{
+	DEB_MEMBER_FUNCT();
+	x_size = y_size = 75e-6;
+	DEB_RETURN() << DEB_VAR2(x_size, y_size);
+}
+
+void HwSyntheticInterface::DetInfoCtrlObj::getDetectorType(string& det_type)
+{
+	DEB_MEMBER_FUNCT();
+	det_type = "Synthetic";
+	DEB_RETURN() << DEB_VAR1(det_type);
+}
+
+void HwSyntheticInterface::DetInfoCtrlObj::getDetectorModel(string& det_model)
+{
+	DEB_MEMBER_FUNCT();
+	ostringstream os;
+	os << m_hw.m_config.pattern;
+	det_model = os.str();
+	DEB_RETURN() << DEB_VAR1(det_model);
+}
+
+void HwSyntheticInterface::DetInfoCtrlObj::registerMaxImageSizeCallback(
+						HwMaxImageSizeCallback& cb)
+{
+	DEB_MEMBER_FUNCT();
+	HwMaxImageSizeCallbackGen::registerMaxImageSizeCallback(cb);
+}
+
+void HwSyntheticInterface::DetInfoCtrlObj::unregisterMaxImageSizeCallback(
+						HwMaxImageSizeCallback& cb)
+{
+	DEB_MEMBER_FUNCT();
+	HwMaxImageSizeCallbackGen::unregisterMaxImageSizeCallback(cb);
+}
+
+/*******************************************************************
+ * \brief HwSyntheticInterface::SyncCtrlObj
+ *******************************************************************/
+
+HwSyntheticInterface::SyncCtrlObj::SyncCtrlObj()
+	: m_exp_time(1e-3), m_lat_time(0), m_nb_frames(1)
+{
+	DEB_CONSTRUCTOR();
+}
+
+bool HwSyntheticInterface::SyncCtrlObj::checkTrigMode(TrigMode trig_mode)
+{
+	DEB_MEMBER_FUNCT();
+	bool valid_mode = (trig_mode == IntTrig);
+	DEB_RETURN() << DEB_VAR1(valid_mode);
+	return valid_mode;
+}
+
+void HwSyntheticInterface::SyncCtrlObj::setTrigMode(TrigMode trig_mode)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(trig_mode);
+	if (!checkTrigMode(trig_mode))
+		THROW_HW_ERROR(NotSupported) << DEB_VAR1(trig_mode);
+}
+
+void HwSyntheticInterface::SyncCtrlObj::getTrigMode(TrigMode& trig_mode)
+{
+	DEB_MEMBER_FUNCT();
+	trig_mode = IntTrig;
+	DEB_RETURN() << DEB_VAR1(trig_mode);
+}
+
+void HwSyntheticInterface::SyncCtrlObj::setExpTime(double exp_time)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(exp_time);
+	m_exp_time = exp_time;
+}
+
+void HwSyntheticInterface::SyncCtrlObj::getExpTime(double& exp_time)
+{
+	DEB_MEMBER_FUNCT();
+	exp_time = m_exp_time;
+	DEB_RETURN() << DEB_VAR1(exp_time);
+}
+
+void HwSyntheticInterface::SyncCtrlObj::setLatTime(double lat_time)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(lat_time);
+	m_lat_time = lat_time;
+}
+
+void HwSyntheticInterface::SyncCtrlObj::getLatTime(double& lat_time)
+{
+	DEB_MEMBER_FUNCT();
+	lat_time = m_lat_time;
+	DEB_RETURN() << DEB_VAR1(lat_time);
+}
+
+void HwSyntheticInterface::SyncCtrlObj::setNbHwFrames(int nb_frames)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(nb_frames);
+	m_nb_frames = nb_frames;
+}
+
+void HwSyntheticInterface::SyncCtrlObj::getNbHwFrames(int& nb_frames)
+{
+	DEB_MEMBER_FUNCT();
+	nb_frames = m_nb_frames;
+	DEB_RETURN() << DEB_VAR1(nb_frames);
+}
+
+void HwSyntheticInterface::SyncCtrlObj::getValidRanges(ValidRangesType& valid_ranges)
+{
+	DEB_MEMBER_FUNCT();
+	valid_ranges = ValidRangesType(0, 1e6, 0, 1e6);
+	DEB_RETURN() << DEB_VAR1(valid_ranges);
+}
+
+/*******************************************************************
+ * \brief HwSyntheticInterface
+ *******************************************************************/
+
+HwSyntheticInterface::HwSyntheticInterface()
+	: HwSyntheticInterface(Config())
+{
+}
+
+HwSyntheticInterface::HwSyntheticInterface(const Config& config)
+	: m_config(config), m_det_info(*this),
+	  m_acq_started(false), m_acq_running(false),
+	  m_stop_requested(false), m_quit(false),
+	  m_nb_frames(0), m_frame_period(0)
+{
+	DEB_CONSTRUCTOR();
+
+	m_cap_list.push_back(HwCap(static_cast<HwDetInfoCtrlObj *>(&m_det_info)));
+	m_cap_list.push_back(HwCap(&m_sync));
+	m_cap_list.push_back(HwCap(&m_buffer_ctrl_obj));
+
+	m_acq_thread = new _AcqThread(*this);
+}
+
+HwSyntheticInterface::~HwSyntheticInterface()
+{
+	DEB_DESTRUCTOR();
+	stopAcq();
+	m_acq_thread = NULL;
+}
+
+void HwSyntheticInterface::setConfig(const Config& config)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR4(config.frame_size, config.image_type,
+				config.pattern, config.nb_prerendered);
+
+	if (config.nb_prerendered < 0)
+		THROW_HW_ERROR(InvalidValue) << "Invalid " 
+					     << DEB_VAR1(config.nb_prerendered);
+
+	bool changed;
+	{
+		AutoMutex lock(m_cond.mutex());
+		if (m_acq_running)
+			THROW_HW_ERROR(Error) << "Acquisition is running";
+		changed = ((config.frame_size != m_config.frame_size) ||
+			   (config.image_type != m_config.image_type));
+		m_config = config;
+	}
+
+	if (changed)
+		m_det_info.maxImageSizeChanged(config.frame_size,
+					       config.image_type);
+}
+
+void HwSyntheticInterface::getConfig(Config& config) const
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex lock(m_cond.mutex());
+	config = m_config;
+}
+
+void HwSyntheticInterface::getStats(Stats& stats)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex lock(m_cond.mutex());
+	stats = m_stats;
+	DEB_RETURN() << DEB_VAR3(stats.nb_frames, stats.elapsed,
+				 stats.nb_late);
+}
+
+void HwSyntheticInterface::getCapList(CapList& cap_list) const
+{
+	DEB_MEMBER_FUNCT();
+	cap_list = m_cap_list;
+}
+
+void HwSyntheticInterface::reset(ResetLevel reset_level)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(reset_level);
+	stopAcq();
+}
+
+void HwSyntheticInterface::prepareAcq()
+{
+	DEB_MEMBER_FUNCT();
+
+	AutoMutex lock(m_cond.mutex());
+	if (m_acq_running)
+		THROW_HW_ERROR(Error) << "Acquisition is running";
+
+	m_buffer_ctrl_obj.getFrameDim(m_frame_dim);
+	m_sync.getNbHwFrames(m_nb_frames);
+	double exp_time, lat_time;
+	m_sync.getExpTime(exp_time);
+	m_sync.getLatTime(lat_time);
+	m_frame_period = exp_time + lat_time;
+	m_stats = Stats();
+
+	int nb_prerendered = m_config.nb_prerendered;
+	if (m_nb_frames > 0)
+		nb_prerendered = min(nb_prerendered, m_nb_frames);
+	int mem_size = m_frame_dim.getMemSize();
+	m_prerendered.clear();
+	for (int i = 0; i < nb_prerendered; ++i) {
+		m_prerendered.emplace_back(mem_size);
+		renderFrame(m_prerendered.back().getPtr(), m_frame_dim,
+			    m_config.pattern, i);
+	}
+	DEB_TRACE() << DEB_VAR4(m_frame_dim, m_nb_frames, m_frame_period,
+				nb_prerendered);
+}
+
+void HwSyntheticInterface::startAcq()
+{
+	DEB_MEMBER_FUNCT();
+
+	AutoMutex lock(m_cond.mutex());
+	if (m_acq_running)
+		THROW_HW_ERROR(Error) << "Acquisition is running";
+
+	m_buffer_ctrl_obj.getBuffer().setStartTimestamp(Timestamp::now());
+	m_stop_requested = false;
+	m_acq_running = true;
+	m_acq_started = true;
+	m_cond.broadcast();
+}
+
+void HwSyntheticInterface::stopAcq()
+{
+	DEB_MEMBER_FUNCT();
+
+	AutoMutex lock(m_cond.mutex());
+	if (!m_acq_running)
+		return;
+	m_stop_requested = true;
+	m_cond.broadcast();
+	// the frame callback may stop the acquisition from the acq thread
+	if (m_acq_thread->isCurrent())
+		return;
+	while (m_acq_running)
+		m_cond.wait();
+}
+
+void HwSyntheticInterface::getStatus(StatusType& status)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex lock(m_cond.mutex());
+	status.set(m_acq_running ? StatusType::Exposure : StatusType::Ready);
+	DEB_RETURN() << DEB_VAR1(status);
+}
+
+int HwSyntheticInterface::getNbHwAcquiredFrames()
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex lock(m_cond.mutex());
+	int nb_hw_acq_frames = m_stats.nb_frames;
+	DEB_RETURN() << DEB_VAR1(nb_hw_acq_frames);
+	return nb_hw_acq_frames;
+}
+
+// called without the lock: the config and the acq parameters are frozen
+// while m_acq_running is set
+void HwSyntheticInterface::_generateFrames()
+{
+	DEB_MEMBER_FUNCT();
+
+	StdBufferCbMgr& buffer_mgr = m_buffer_ctrl_obj.getBuffer();
+	Timestamp t0;
+	buffer_mgr.getStartTimestamp(t0);
+	int mem_size = m_frame_dim.getMemSize();
+	int nb_prerendered = m_prerendered.size();
+	double exp_time;
+	m_sync.getExpTime(exp_time);
+
+	for (int frame_nb = 0; (m_nb_frames == 0) || (frame_nb < m_nb_frames);
+	     ++frame_nb) {
+		{
+			AutoMutex lock(m_cond.mutex());
+			if (m_stop_requested || m_quit)
+				break;
+		}
+
+		// the frame is read out at the end of its exposure
+		double deadline = frame_nb * m_frame_period + exp_time;
+		if (m_frame_period > 0) {
+			double now = Timestamp::now() - t0;
+			double wait = deadline - now;
+			if (wait > 0)
+				Sleep(wait);
+		}
+
+		void *ptr = buffer_mgr.getFrameBufferPtr(frame_nb);
+		if (nb_prerendered > 0) {
+			MemBuffer& frame = m_prerendered[frame_nb % nb_prerendered];
+			memcpy(ptr, frame.getPtr(), mem_size);
+		} else {
+			renderFrame(ptr, m_frame_dim, m_config.pattern,
+				    frame_nb);
+		}
+
+		HwFrameInfoType frame_info(frame_nb, ptr, &m_frame_dim,
+					   Timestamp(), 0,
+					   HwFrameInfoType::Managed);
+		bool cont = buffer_mgr.newFrameReady(frame_info);
+
+		double elapsed = Timestamp::now() - t0;
+		{
+			AutoMutex lock(m_cond.mutex());
+			m_stats.nb_frames = frame_nb + 1;
+			m_stats.elapsed = elapsed;
+			if ((m_frame_period > 0) &&
+			    (elapsed - deadline > m_frame_period))
+				++m_stats.nb_late;
+		}
+		if (!cont)
+			break;
+	}
+
+	DEB_TRACE() << DEB_VAR2(m_stats.nb_frames, m_stats.elapsed);
+}
+
+ostream& lima::operator <<(ostream& os, HwSyntheticInterface::Pattern pattern)
+{
+	const char *name = "Unknown";
+	switch (pattern) {
+	case HwSyntheticInterface::Zero:	name = "Zero";		break;
+	case HwSyntheticInterface::FrameNb:	name = "FrameNb";	break;
+	case HwSyntheticInterface::Ramp:	name = "Ramp";		break;
+	case HwSyntheticInterface::Noise:	name = "Noise";		break;
+	}
+	return os << name;
+}
+
+istream& lima::operator >>(istream& is, HwSyntheticInterface::Pattern& pattern)
+{
+	string s;
+	is >> s;
+	if (s == "Zero")
+		pattern = HwSyntheticInterface::Zero;
+	else if (s == "FrameNb")
+		pattern = HwSyntheticInterface::FrameNb;
+	else if (s == "Ramp")
+		pattern = HwSyntheticInterface::Ramp;
+	else if (s == "Noise")
+		pattern = HwSyntheticInterface::Noise;
+	else
+		throw LIMA_HW_EXC(InvalidValue, "Invalid pattern: ") << s;
+	return is;
+}
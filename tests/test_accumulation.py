@@ -95,7 +95,7 @@ def wait_acq_finished(ct: core.CtControl, timeout=5.0):
     assert status.LastImageReady + 1 == ACQ_NB_FRAMES
 
 
-def prepare(tmp_path, ct: core.CtControl, output_type=None, threshold=None, operation=None):
+def prepare(tmp_path, ct: core.CtControl, output_type=None, threshold=None, operation=None, nb_tiles=None):
     acq = ct.acquisition()
     acq.setAcqMode(core.AcqMode.Accumulation)
     acq.setAcqExpoTime(ACQ_EXPO_TIME)
@@ -107,6 +107,10 @@ def prepare(tmp_path, ct: core.CtControl, output_type=None, threshold=None, oper
     if output_type:
         acc.setOutputType(output_type)
 
+    if nb_tiles:
+        acc.setNbTiles(nb_tiles)
+        assert acc.getNbTiles() == nb_tiles
+
     if threshold:
         acc.setFilter(core.CtAccumulation.Filter.FILTER_THRESHOLD_MIN)
         acc.setThresholdBefore(threshold)
@@ -326,3 +330,66 @@ def test_accumulation_mean(tmp_path, simu, output_type, expectation):
             # Check all pixels
             # comparison = frm.buffer == np.full(frm.buffer.shape, expected)
             # assert comparison.all()
+
+
+@pytest.mark.parametrize(
+    ("simu, operation"),
+    [
+        (core.ImageType.Bpp8, core.CtAccumulation.Operation.ACC_SUM),
+        (core.ImageType.Bpp16, core.CtAccumulation.Operation.ACC_SUM),
+        (core.ImageType.Bpp16S, core.CtAccumulation.Operation.ACC_SUM),
+        (core.ImageType.Bpp32, core.CtAccumulation.Operation.ACC_SUM),
+        (core.ImageType.Bpp16, core.CtAccumulation.Operation.ACC_MEAN),
+    ],
+    indirect=["simu"]
+)
+def test_accumulation_tiled(tmp_path, simu, operation):
+    prepare(tmp_path, simu, operation=operation, nb_tiles=4)
+    start(simu)
+    wait_acq_finished(simu, timeout=ACQ_EXPO_TIME * 1.5 * (ACQ_NB_FRAMES + 1))
+
+    for i in range(0, ACQ_NB_FRAMES):
+        frm = simu.ReadImage(i)
+        assert frm.buffer.dtype == np.int32
+
+        begin = i * ACC_NB_FRAMES
+        r = np.arange(begin, begin + ACC_NB_FRAMES, dtype=frm.buffer.dtype)
+        expected = r.sum()
+        if operation == core.CtAccumulation.Operation.ACC_MEAN:
+            expected = int(expected / ACC_NB_FRAMES)
+
+        # Check all pixels
+        comparison = frm.buffer == np.full(frm.buffer.shape, expected)
+        assert comparison.all()
+
+
+@pytest.mark.parametrize(
+    ("simu, nb_tiles"),
+    [
+        (core.ImageType.Bpp8, None),
+        (core.ImageType.Bpp16, None),
+        (core.ImageType.Bpp16S, None),
+        (core.ImageType.Bpp32, None),
+        (core.ImageType.Bpp16, 4),
+        (core.ImageType.Bpp32S, 4),
+    ],
+    indirect=["simu"]
+)
+def test_accumulation_median(tmp_path, simu, nb_tiles):
+    prepare(tmp_path, simu, operation=core.CtAccumulation.Operation.ACC_MEDIAN,
+            nb_tiles=nb_tiles)
+    start(simu)
+    wait_acq_finished(simu, timeout=ACQ_EXPO_TIME * 1.5 * (ACQ_NB_FRAMES + 1))
+
+    for i in range(0, ACQ_NB_FRAMES):
+        frm = simu.ReadImage(i)
+        assert frm.buffer.dtype == np.int32
+
+        # even number of frames: mean of the two middle values, truncated
+        begin = i * ACC_NB_FRAMES
+        r = np.arange(begin, begin + ACC_NB_FRAMES)
+        expected = int(np.median(r))
+
+        # Check all pixels
+        comparison = frm.buffer == np.full(frm.buffer.shape, expected)
+        assert comparison.all()
@@ -1,5 +1,6 @@
 from __future__ import annotations
 
+import json
 import pytest
 import numpy
 from lima import core
@@ -136,3 +137,33 @@ def test_acquisition_mean_bin_with_binroi_capability(lima_helper: LimaHelper):
     assert array.shape == (2, 8)
     expected_1st_row = [0, 1, 1, 1, 1, 1, 1, 0]
     numpy.testing.assert_allclose(array[0], expected_1st_row)
+
+
+def test_frame_trace(lima_helper: LimaHelper):
+    cam = MockedCamera()
+    ct_control = lima_helper.control(cam)
+    ct_acq = ct_control.acquisition()
+    ct_acq.setAcqNbFrames(3)
+    ct_image = lima_helper.image(cam)
+    ct_image.setBin(core.Bin(2, 2))
+
+    trace = ct_control.frameTrace()
+    assert not trace.getActive()
+    trace.setActive(True)
+    lima_helper.process_acquisition(ct_control)
+    trace.setActive(False)
+
+    hw = trace.getHistogram(core.CtFrameTrace.HwFrameReady)
+    assert hw.Count == 3
+    assert hw.Max == 0
+    base = trace.getHistogram(core.CtFrameTrace.BaseImageReady)
+    assert base.Count == 3
+    assert 0 < base.Min <= base.getPercentile(50) <= base.Max
+    assert trace.getHistogram(core.CtFrameTrace.Overrun).Count == 0
+
+    events = json.loads(trace.getChromeTrace())["traceEvents"]
+    frames = {e["args"]["frame"] for e in events if e["ph"] != "M"}
+    assert frames == {0, 1, 2}
+
+    trace.reset()
+    assert trace.getHistogram(core.CtFrameTrace.BaseImageReady).Count == 0
@@ -2,6 +2,7 @@ from __future__ import annotations
 
 import os.path
 import logging
+import numpy
 from lima import core
 from .mocked_camera import MockedCamera
 from .lima_helper import LimaHelper
@@ -40,3 +41,78 @@ def test_h5(lima_helper: LimaHelper, tmp_path):
         assert measurement_group["data"].shape == (1, 8, 16)
         instrument_group = h5["/entry_0000/instrument/Mock"]
         assert instrument_group["image_operation/bin_mode"].asstr()[()] == "Bin_Sum"
+
+
+def test_h5_chunk_frames(lima_helper: LimaHelper, tmp_path):
+    """Stack 4 frames per chunk, the last chunk is partial"""
+    cam = MockedCamera(fill_frame_number=True, pin_corners=False)
+    ct_control = lima_helper.control(cam)
+    ct_control.acquisition().setAcqNbFrames(10)
+
+    saving = ct_control.saving()
+    saving.setDirectory(str(tmp_path))
+    saving.setPrefix("test")
+    saving.setSuffix(".h5")
+    saving.setFormat(core.CtSaving.FileFormat.HDF5)
+    saving.setSavingMode(core.CtSaving.SavingMode.AutoFrame)
+    saving.setFramesPerFile(10)
+    saving.setOptions("CHUNK_FRAMES=4")
+
+    lima_helper.process_acquisition(ct_control)
+
+    filename = str(tmp_path / "test0000.h5")
+    assert os.path.exists(filename)
+
+    if h5py is None:
+        _logger.warning("h5py not installed. Some checks are skipped.")
+        return
+
+    with h5py.File(filename) as h5:
+        data = h5["/entry_0000/measurement/data"]
+        assert data.shape == (10, 8, 16)
+        assert data.chunks == (4, 8, 16)
+        for i in range(10):
+            assert (data[i] == i).all(), f"frame {i}"
+        time_of_frame = h5["/entry_0000/instrument/Mock/time_of_frame"][()]
+        assert time_of_frame.shape == (10,)
+        # every entry written, including the ones of the last chunk
+        assert (time_of_frame[1:] > 0).all()
+        assert (numpy.diff(time_of_frame) >= 0).all()
+
+
+def test_spill_tier(lima_helper: LimaHelper, tmp_path):
+    cam = MockedCamera()
+    ct_control = lima_helper.control(cam)
+    ct_control.acquisition().setAcqNbFrames(10)
+
+    saving = ct_control.saving()
+    saving.setDirectory(str(tmp_path))
+    saving.setPrefix("test")
+    saving.setSuffix(".edf")
+    saving.setFormat(core.CtSaving.FileFormat.EDF)
+    saving.setSavingMode(core.CtSaving.SavingMode.AutoFrame)
+
+    spill_dir = tmp_path / "spill"
+    spill_dir.mkdir()
+    tier = ct_control.spillTier()
+    assert not tier.isEnabled()
+    tier.setDirectory(str(spill_dir))
+    tier.setMaxSize(1)
+    # spill as soon as a frame is waiting
+    tier.setHighWaterMark(1)
+    assert tier.isEnabled()
+
+    lima_helper.process_acquisition(ct_control)
+
+    for i in range(10):
+        assert os.path.exists(str(tmp_path / f"test{i:04d}.edf"))
+    # the scratch file is unlinked at creation
+    assert list(spill_dir.iterdir()) == []
+
+    stats = ct_control.getSpillStats()
+    assert stats.Enabled
+    assert stats.NbSlots > 0
+    assert stats.NbRefused == 0
+    assert stats.Occupancy <= stats.PeakOccupancy <= stats.NbSlots
+    assert stats.NbSpilled >= stats.PeakOccupancy
+    assert stats.PeakRingUsage >= 0
@@ -1,4 +1,8 @@
+import numpy
+import pytest
 from lima import core
+from lima import processlib as Processlib
+from .mocked_camera import MockedCamera
 
 
 def test_write_read():
@@ -13,3 +17,68 @@ def test_write_read():
     roi_check = roictmgr.getRois()
     assert roi_check[0][0] == "myroi"
     assert roi_check[0][1] == myroi
+
+
+def test_fused_engine():
+    """Check the fused engine switch, ROIs are kept"""
+    myroi = core.Roi(0, 0, 100, 100)
+    my_opt_ext = core.SoftOpExternalMgr()
+
+    roictmgr = my_opt_ext.addOp(core.SoftOpId.ROICOUNTERS, "titi", 0)
+    assert not roictmgr.getFusedEngine()
+
+    roictmgr.updateRois([("myroi", myroi)])
+    roictmgr.setFusedEngine(True)
+    assert roictmgr.getFusedEngine()
+    assert roictmgr.getNames() == ["myroi"]
+
+
+class RampCamera(MockedCamera):
+    """Mocked camera with a different value on each pixel"""
+
+    def _create_frame(self, frame_id: int) -> numpy.ndarray:
+        y, x = numpy.mgrid[0:self.height, 0:self.width]
+        array = (x * 7 + y * 13 + frame_id * 3) % 251
+        return array.astype(self.BPP_2_NUMPY[self.bpp])
+
+
+def _read_counters(lima_helper, ct, roictmgr):
+    acq = ct.acquisition()
+    acq.setAcqExpoTime(0.01)
+    acq.setAcqNbFrames(3)
+    lima_helper.process_acquisition(ct)
+    assert ct.getStatus().AcquisitionStatus == core.AcqStatus.AcqReady
+    return {name: [(r.frameNumber, r.sum, r.average, r.std, r.minValue, r.maxValue)
+                   for r in results]
+            for name, results in roictmgr.readCounters(-1)}
+
+
+def test_fused_engine_counters(lima_helper):
+    """Check the fused engine gives the counters of the per-ROI tasks"""
+    cam = RampCamera()
+    cam.width = 64
+    cam.height = 48
+    ct = lima_helper.control(cam)
+
+    roictmgr = ct.externalOperation().addOp(core.SoftOpId.ROICOUNTERS, "roi", 0)
+    roictmgr.updateRois([("rect", core.Roi(2, 3, 30, 20)),
+                         ("overlap", core.Roi(20, 10, 40, 30))])
+    roictmgr.updateArcRois([("arc", core.ArcRoi(32, 24, 5, 20, 30, 250))])
+    lut = Processlib.Data()
+    lut.buffer = (numpy.arange(16 * 8, dtype=numpy.float32) % 5 * 0.25).reshape(8, 16)
+    roictmgr.setLut("lut", core.Point(10, 30), lut)
+    lut_mask = Processlib.Data()
+    lut_mask.buffer = (numpy.arange(16 * 8, dtype=numpy.uint8) % 3 == 0).astype(numpy.uint8).reshape(8, 16)
+    roictmgr.setLutMask("lut_mask", core.Point(40, 5), lut_mask)
+
+    roictmgr.setFusedEngine(False)
+    tasks = _read_counters(lima_helper, ct, roictmgr)
+    roictmgr.setFusedEngine(True)
+    fused = _read_counters(lima_helper, ct, roictmgr)
+
+    assert sorted(tasks) == ["arc", "lut", "lut_mask", "overlap", "rect"]
+    assert sorted(fused) == sorted(tasks)
+    for name, results in tasks.items():
+        assert len(results) == 3
+        for expected, result in zip(results, fused[name]):
+            assert result == pytest.approx(expected), name